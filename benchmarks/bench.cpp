@@ -0,0 +1,520 @@
+/* Benchmarks every adt container against its std counterpart.
+
+   containers_bench [--sizes 1e3,1e4,1e5,1e6] [--keys int,uint64,string]
+                    [--ops insert,hit,miss,iterate,copy,destroy,erase]
+                    [--containers vector,list,pqueue,set,...,hash] [--reps 3]
+                    [--csv file] [--json file]
+
+   Operations are timed in batches of up to 1024, ns/op is the total time over all
+   repetitions divided by the number of operations, the percentiles are taken over batches.
+   iterate, copy and destroy are timed as a whole and reported per element.
+   peak_rss_kb is how far the peak resident set grew above the resident set
+   measured right before the (container, key, size) run.  */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <list>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "../include/containers/list.h"
+#include "../include/containers/vector.h"
+#include "../include/containers/pqueue.h"
+#include "../include/containers/set.h"
+#include "../include/containers/multiset.h"
+#include "../include/containers/map.h"
+#include "../include/containers/multimap.h"
+#include "../include/containers/btree_set.h"
+#include "../include/containers/btree_multiset.h"
+#include "../include/containers/btree_map.h"
+#include "../include/containers/btree_multimap.h"
+#include "../include/containers/unordered_set.h"
+#include "../include/containers/unordered_multiset.h"
+#include "../include/containers/unordered_map.h"
+#include "../include/containers/unordered_multimap.h"
+#include "../include/containers/pool_allocator.h"
+
+using bench_clock = std::chrono::steady_clock;
+
+static const size_t batch_size = 1024;
+
+struct options {
+    std::vector<size_t> sizes{1000, 10000, 100000, 1000000};
+    std::vector<std::string> keys{"int", "uint64", "string"};
+    std::vector<std::string> ops{"insert", "hit", "miss", "iterate", "copy", "destroy", "erase"};
+    std::vector<std::string> containers;
+    size_t reps = 3;
+    std::string csv;
+    std::string json;
+
+    bool has_op(const std::string &op) const { return std::find(ops.begin(), ops.end(), op) != ops.end(); }
+    bool has_container(const std::string &name) const {
+        return containers.empty() || std::find(containers.begin(), containers.end(), name) != containers.end();
+    }
+};
+
+struct result {
+    std::string container_name;
+    std::string impl;
+    std::string key;
+    std::string op;
+    size_t n;
+    double ns_per_op;
+    double p50;
+    double p90;
+    double p99;
+    long peak_rss_kb;
+};
+
+/* Keeps the optimizer from dropping the work being measured.  */
+static volatile uint64_t sink;
+
+/* Peak RSS tracking, Linux lets us reset the high water mark through clear_refs.  */
+static long read_status_kb(const char *field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    size_t len = std::strlen(field);
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, len, field) == 0) return std::atol(line.c_str() + len + 1);
+    }
+
+    return -1;
+}
+
+static long reset_peak_rss() {
+#ifdef __GLIBC__
+    /* Hand the previous run's free heap back first, or it would be reused without touching the RSS.  */
+    malloc_trim(0);
+#endif
+    std::ofstream clear_refs("/proc/self/clear_refs");
+
+    if (clear_refs) clear_refs << "5";
+
+    return read_status_kb("VmRSS");
+}
+
+static long peak_rss(long baseline) {
+    struct rusage usage;
+    long peak = read_status_kb("VmHWM");
+
+    /* Without /proc, fall back to the (never reset) process peak.  */
+    if (peak < 0) {
+        getrusage(RUSAGE_SELF, &usage);
+        peak = usage.ru_maxrss;
+    }
+
+    return baseline >= 0 ? std::max(0L, peak - baseline) : peak;
+}
+
+/* Key generation, 2n distinct keys: the first n are inserted, the rest are used for misses.  */
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+template<typename Key>
+struct key_maker;
+
+template<>
+struct key_maker<int> {
+    /* i -> i * odd constant is a bijection on 32 bits, so the keys are distinct.  */
+    static int make(uint64_t i) { return (int) (uint32_t) (i * 0x9E3779B1U); }
+};
+
+template<>
+struct key_maker<uint64_t> {
+    /* splitmix64 is a bijection on 64 bits.  */
+    static uint64_t make(uint64_t i) { return splitmix64(i); }
+};
+
+template<>
+struct key_maker<std::string> {
+    static std::string make(uint64_t i) { return "key-" + std::to_string(splitmix64(i)); }
+};
+
+template<typename Key>
+std::vector<Key> make_keys(size_t n) {
+    std::vector<Key> keys;
+
+    keys.reserve(2 * n);
+    for (size_t i = 0 ; i < 2 * n ; i++) keys.push_back(key_maker<Key>::make(i));
+
+    return keys;
+}
+
+static uint64_t weight(int key) { return (uint64_t) key; }
+static uint64_t weight(uint64_t key) { return key; }
+static uint64_t weight(const std::string &key) { return key.size(); }
+template<typename K, typename V>
+static uint64_t weight(const std::pair<K, V> &val) { return weight(val.first); }
+
+/* Container policies, they map the benchmarked operations onto each container's API.  */
+template<class C>
+struct sequence_policy {
+    static const bool lookup = false;
+    static const bool iterate = true;
+
+    template<typename Key>
+    static void insert(C &c, const Key &key) { c.push_back(key); }
+    template<typename Key>
+    static bool contains(C &, const Key &) { return false; }
+    /* Lists are drained from the front, vectors from the back.  */
+    template<typename Key>
+    static void erase(C &c, const Key &) { pop(c, 0); }
+
+    template<class T>
+    static auto pop(T &c, int) -> decltype(c.pop_front()) { c.pop_front(); }
+    template<class T>
+    static void pop(T &c, long) { c.pop_back(); }
+};
+
+template<class C>
+struct queue_policy {
+    static const bool lookup = false;
+    static const bool iterate = false;
+
+    template<typename Key>
+    static void insert(C &c, const Key &key) { c.push(key); }
+    template<typename Key>
+    static bool contains(C &, const Key &) { return false; }
+    template<typename Key>
+    static void erase(C &c, const Key &) { c.pop(); }
+};
+
+template<class C>
+struct set_policy {
+    static const bool lookup = true;
+    static const bool iterate = true;
+
+    template<typename Key>
+    static void insert(C &c, const Key &key) { c.insert(key); }
+    template<typename Key>
+    static bool contains(C &c, const Key &key) { return c.find(key) != c.end(); }
+    template<typename Key>
+    static void erase(C &c, const Key &key) {
+        auto it = c.find(key);
+        if (it != c.end()) c.erase(it);
+    }
+};
+
+template<class C>
+struct map_policy : set_policy<C> {
+    template<typename Key>
+    static void insert(C &c, const Key &key) { c.insert(std::make_pair(key, (uint64_t) 0)); }
+};
+
+template<class C>
+uint64_t iterate(C &c, std::true_type) {
+    uint64_t sum = 0;
+
+    for (auto it = c.begin() ; it != c.end() ; ++it) sum += weight(*it);
+
+    return sum;
+}
+
+template<class C>
+uint64_t iterate(C &, std::false_type) {
+    return 0;
+}
+
+/* Timing helpers.  */
+static double elapsed_ns(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+struct samples {
+    std::vector<double> batches;
+    double total_ns = 0;
+    size_t total_ops = 0;
+
+    void add(double ns, size_t ops) {
+        batches.push_back(ns / ops);
+        total_ns += ns;
+        total_ops += ops;
+    }
+
+    double percentile(double p) {
+        size_t idx;
+
+        if (batches.empty()) return 0;
+        std::sort(batches.begin(), batches.end());
+        idx = (size_t) (p * (batches.size() - 1) + 0.5);
+
+        return batches[idx];
+    }
+};
+
+/* Runs f(key) over keys[first, last) in batches.  */
+template<typename Key, typename F>
+void timed_batches(samples &s, const std::vector<Key> &keys, size_t first, size_t last, F f) {
+    for (size_t i = first ; i < last ; i += batch_size) {
+        size_t end = std::min(last, i + batch_size);
+        auto start = bench_clock::now();
+
+        for (size_t j = i ; j < end ; j++) f(keys[j]);
+
+        s.add(elapsed_ns(start), end - i);
+    }
+}
+
+template<class Policy, class C, typename Key>
+void run(const char *container_name, const char *impl, const char *key_name, const options &opt,
+         const std::vector<Key> &keys, const std::vector<Key> &shuffled, std::vector<result> &out) {
+    const char *names[] = {"insert", "hit", "miss", "iterate", "copy", "destroy", "erase"};
+    const size_t n_ops = sizeof(names) / sizeof(names[0]);
+    size_t n = keys.size() / 2;
+    samples s[n_ops];
+    long baseline;
+
+    baseline = reset_peak_rss();
+    for (size_t rep = 0 ; rep < opt.reps ; rep++) {
+        C *c = new C();
+        uint64_t found = 0;
+
+        timed_batches(s[0], keys, 0, n, [&](const Key &key) { Policy::insert(*c, key); });
+
+        if (Policy::lookup) {
+            timed_batches(s[1], shuffled, 0, n, [&](const Key &key) { found += Policy::contains(*c, key); });
+            timed_batches(s[2], keys, n, 2 * n, [&](const Key &key) { found += Policy::contains(*c, key); });
+        }
+
+        if (Policy::iterate) {
+            auto start = bench_clock::now();
+            found += iterate(*c, std::integral_constant<bool, Policy::iterate>());
+            s[3].add(elapsed_ns(start), n);
+        }
+
+        auto start = bench_clock::now();
+        C *copy = new C(*c);
+        s[4].add(elapsed_ns(start), n);
+
+        start = bench_clock::now();
+        delete copy;
+        s[5].add(elapsed_ns(start), n);
+
+        timed_batches(s[6], shuffled, 0, n, [&](const Key &key) { Policy::erase(*c, key); });
+
+        delete c;
+        sink = sink + found;
+    }
+
+    long rss = peak_rss(baseline);
+    for (size_t op = 0 ; op < n_ops ; op++) {
+        if (s[op].total_ops == 0 || !opt.has_op(names[op])) continue;
+
+        out.push_back({container_name, impl, key_name, names[op], n, s[op].total_ns / s[op].total_ops,
+                       s[op].percentile(0.5), s[op].percentile(0.9), s[op].percentile(0.99), rss});
+        std::printf("%-20s %-9s %-7s %-8s %11zu %12.2f %10.2f %10.2f %10.2f %10ld\n",
+                    container_name, impl, key_name, names[op], n, out.back().ns_per_op,
+                    out.back().p50, out.back().p90, out.back().p99, rss);
+        std::fflush(stdout);
+    }
+}
+
+/* Hashing microbenchmark: the raw hasher against the mixed hash the tables probe with.  */
+template<typename Key>
+void run_hash(const char *key_name, const options &opt, const std::vector<Key> &keys, std::vector<result> &out) {
+    std::hash<Key> hasher;
+    uint64_t seed = hash_internal::next_seed();
+    samples raw, mixed;
+    size_t n = keys.size() / 2;
+
+    for (size_t rep = 0 ; rep < opt.reps ; rep++) {
+        uint64_t acc = 0;
+
+        timed_batches(raw, keys, 0, n, [&](const Key &key) { acc += hasher(key); });
+        timed_batches(mixed, keys, 0, n, [&](const Key &key) { acc += hash_internal::mix(hasher(key), seed); });
+        sink = sink + acc;
+    }
+
+    for (auto *p : {&raw, &mixed}) {
+        const char *impl = p == &raw ? "std_hash" : "mix";
+        out.push_back({"hash", impl, key_name, "hash", n, p->total_ns / p->total_ops,
+                       p->percentile(0.5), p->percentile(0.9), p->percentile(0.99), 0});
+        std::printf("%-20s %-9s %-7s %-8s %11zu %12.2f %10.2f %10.2f %10.2f %10d\n",
+                    "hash", impl, key_name, "hash", n, out.back().ns_per_op,
+                    out.back().p50, out.back().p90, out.back().p99, 0);
+    }
+}
+
+template<typename Key>
+void run_key(const char *key_name, size_t n, const options &opt, std::vector<result> &out) {
+    using mapped = uint64_t;
+    using pair_alloc = adt::pool_allocator<std::pair<const Key, mapped>>;
+    std::vector<Key> keys = make_keys<Key>(n);
+    std::vector<Key> shuffled(keys.begin(), keys.begin() + n);
+
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937_64(n));
+
+#define BENCH(name, impl, policy, ...)                                                  \
+    if (opt.has_container(name))                                                        \
+        run<policy<__VA_ARGS__>, __VA_ARGS__, Key>(name, impl, key_name, opt, keys, shuffled, out)
+
+    BENCH("vector", "adt", sequence_policy, adt::vector<Key>);
+    BENCH("vector", "std", sequence_policy, std::vector<Key>);
+    BENCH("list", "adt", sequence_policy, adt::list<Key>);
+    BENCH("list", "std", sequence_policy, std::list<Key>);
+    BENCH("pqueue", "adt", queue_policy, adt::pqueue<Key>);
+    BENCH("pqueue", "std", queue_policy, std::priority_queue<Key>);
+    BENCH("set", "adt", set_policy, adt::set<Key>);
+    BENCH("set", "adt_pool", set_policy, adt::set<Key, std::less<Key>, adt::pool_allocator<Key>>);
+    BENCH("set", "adt_btree", set_policy, adt::btree_set<Key>);
+    BENCH("set", "std", set_policy, std::set<Key>);
+    BENCH("multiset", "adt", set_policy, adt::multiset<Key>);
+    BENCH("multiset", "adt_btree", set_policy, adt::btree_multiset<Key>);
+    BENCH("multiset", "std", set_policy, std::multiset<Key>);
+    BENCH("map", "adt", map_policy, adt::map<Key, mapped>);
+    BENCH("map", "adt_pool", map_policy, adt::map<Key, mapped, std::less<Key>, pair_alloc>);
+    BENCH("map", "adt_btree", map_policy, adt::btree_map<Key, mapped>);
+    BENCH("map", "std", map_policy, std::map<Key, mapped>);
+    BENCH("multimap", "adt", map_policy, adt::multimap<Key, mapped>);
+    BENCH("multimap", "adt_btree", map_policy, adt::btree_multimap<Key, mapped>);
+    BENCH("multimap", "std", map_policy, std::multimap<Key, mapped>);
+    BENCH("unordered_set", "adt", set_policy, adt::unordered_set<Key>);
+    BENCH("unordered_set", "adt_flat", set_policy, adt::flat_unordered_set<Key>);
+    BENCH("unordered_set", "std", set_policy, std::unordered_set<Key>);
+    BENCH("unordered_multiset", "adt", set_policy, adt::unordered_multiset<Key>);
+    BENCH("unordered_multiset", "std", set_policy, std::unordered_multiset<Key>);
+    BENCH("unordered_map", "adt", map_policy, adt::unordered_map<Key, mapped>);
+    BENCH("unordered_map", "adt_flat", map_policy, adt::flat_unordered_map<Key, mapped>);
+    BENCH("unordered_map", "std", map_policy, std::unordered_map<Key, mapped>);
+    BENCH("unordered_multimap", "adt", map_policy, adt::unordered_multimap<Key, mapped>);
+    BENCH("unordered_multimap", "std", map_policy, std::unordered_multimap<Key, mapped>);
+
+#undef BENCH
+
+    if (opt.has_container("hash")) run_hash(key_name, opt, keys, out);
+}
+
+/* Output.  */
+static std::string json_escape(const std::string &s) {
+    std::string escaped;
+
+    for (char c : s) {
+        if (c == '"' || c == '\\') escaped += '\\';
+        escaped += c;
+    }
+
+    return escaped;
+}
+
+static void write_csv(const std::string &path, const std::vector<result> &results) {
+    std::ofstream f(path);
+
+    f << "container,impl,key,op,n,ns_per_op,p50,p90,p99,peak_rss_kb\n";
+    for (const auto &r : results) {
+        f << r.container_name << ',' << r.impl << ',' << r.key << ',' << r.op << ',' << r.n << ','
+          << r.ns_per_op << ',' << r.p50 << ',' << r.p90 << ',' << r.p99 << ',' << r.peak_rss_kb << '\n';
+    }
+}
+
+static void write_json(const std::string &path, const std::vector<result> &results) {
+    std::ofstream f(path);
+
+    f << "[\n";
+    for (size_t i = 0 ; i < results.size() ; i++) {
+        const auto &r = results[i];
+        f << "  {\"container\": \"" << json_escape(r.container_name) << "\", \"impl\": \"" << json_escape(r.impl)
+          << "\", \"key\": \"" << json_escape(r.key) << "\", \"op\": \"" << json_escape(r.op)
+          << "\", \"n\": " << r.n << ", \"ns_per_op\": " << r.ns_per_op << ", \"p50\": " << r.p50
+          << ", \"p90\": " << r.p90 << ", \"p99\": " << r.p99 << ", \"peak_rss_kb\": " << r.peak_rss_kb
+          << (i + 1 < results.size() ? "},\n" : "}\n");
+    }
+    f << "]\n";
+}
+
+/* Command line.  */
+static std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> parts;
+    size_t start = 0, end;
+
+    while ((end = s.find(',', start)) != std::string::npos) {
+        parts.push_back(s.substr(start, end - start));
+        start = end + 1;
+    }
+    parts.push_back(s.substr(start));
+
+    return parts;
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr, "usage: %s [--sizes 1e3,1e4,...] [--keys int,uint64,string] "
+                         "[--ops insert,hit,miss,iterate,copy,destroy,erase] [--containers set,map,...,hash] "
+                         "[--reps N] [--csv file] [--json file]\n", prog);
+    std::exit(1);
+}
+
+static options parse_options(int argc, char **argv) {
+    options opt;
+
+    for (int i = 1 ; i < argc ; i++) {
+        std::string arg = argv[i];
+
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string val = argv[++i];
+
+        if (arg == "--sizes") {
+            opt.sizes.clear();
+            /* strtod accepts 1e6 as well as 1000000.  */
+            for (const auto &s : split(val)) opt.sizes.push_back((size_t) std::strtod(s.c_str(), nullptr));
+        } else if (arg == "--keys") {
+            opt.keys = split(val);
+        } else if (arg == "--ops") {
+            opt.ops = split(val);
+        } else if (arg == "--containers") {
+            opt.containers = split(val);
+        } else if (arg == "--reps") {
+            opt.reps = std::max(1L, std::atol(val.c_str()));
+        } else if (arg == "--csv") {
+            opt.csv = val;
+        } else if (arg == "--json") {
+            opt.json = val;
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    return opt;
+}
+
+int main(int argc, char **argv) {
+    options opt = parse_options(argc, argv);
+    std::vector<result> results;
+
+    std::printf("%-20s %-9s %-7s %-8s %11s %12s %10s %10s %10s %10s\n",
+                "container", "impl", "key", "op", "n", "ns/op", "p50", "p90", "p99", "rss_kb");
+
+    for (size_t n : opt.sizes) {
+        for (const auto &key : opt.keys) {
+            if (key == "int") run_key<int>("int", n, opt, results);
+            else if (key == "uint64") run_key<uint64_t>("uint64", n, opt, results);
+            else if (key == "string") run_key<std::string>("string", n, opt, results);
+            else usage(argv[0]);
+        }
+    }
+
+    if (!opt.csv.empty()) write_csv(opt.csv, results);
+    if (!opt.json.empty()) write_json(opt.json, results);
+
+    return 0;
+}
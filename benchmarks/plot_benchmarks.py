@@ -0,0 +1,137 @@
+#!/usr/bin/env python3
+"""Draws the benchmark charts from the CSV written by containers_bench --csv.
+
+    plot_benchmarks.py results.csv [output_dir]
+
+One SVG per container, with a panel per operation: ns/op against the number of
+elements, both on log scales, a line per (implementation, key type).
+Only the standard library is used so the charts can be regenerated anywhere.
+"""
+
+import csv
+import math
+import os
+import sys
+from collections import defaultdict
+
+PANEL_W, PANEL_H = 360, 240
+MARGIN_L, MARGIN_R, MARGIN_T, MARGIN_B = 60, 20, 30, 40
+COLUMNS = 3
+LEGEND_H = 24
+COLORS = ["#1f77b4", "#ff7f0e", "#2ca02c", "#d62728", "#9467bd", "#8c564b", "#e377c2", "#7f7f7f", "#bcbd22"]
+DASHES = {"int": "", "uint64": "6,3", "string": "2,2"}
+
+
+def log_ticks(lo, hi):
+    return [10 ** e for e in range(math.floor(math.log10(lo)), math.ceil(math.log10(hi)) + 1)]
+
+
+def fmt(v):
+    return "1e%d" % round(math.log10(v))
+
+
+def panel(op, series, styles, x0, y0):
+    xs = [n for points in series.values() for n, _ in points]
+    ys = [v for points in series.values() for _, v in points if v > 0]
+    if not xs or not ys:
+        return []
+
+    xlo, xhi = min(xs), max(xs)
+    ylo, yhi = min(ys), max(ys)
+    if xlo == xhi:
+        xlo, xhi = xlo / 10, xhi * 10
+    if ylo == yhi:
+        ylo, yhi = ylo / 2, yhi * 2
+    xlo, xhi = math.log10(xlo), math.log10(xhi)
+    ylo, yhi = math.log10(ylo) - 0.1, math.log10(yhi) + 0.1
+
+    w, h = PANEL_W - MARGIN_L - MARGIN_R, PANEL_H - MARGIN_T - MARGIN_B
+    left, top = x0 + MARGIN_L, y0 + MARGIN_T
+
+    def px(n):
+        return left + (math.log10(n) - xlo) / (xhi - xlo) * w
+
+    def py(v):
+        return top + h - (math.log10(v) - ylo) / (yhi - ylo) * h
+
+    out = ['<text x="%d" y="%d" font-weight="bold">%s</text>' % (left, y0 + 18, op),
+           '<rect x="%d" y="%d" width="%d" height="%d" fill="none" stroke="#888"/>' % (left, top, w, h)]
+
+    for t in log_ticks(10 ** xlo, 10 ** xhi):
+        if xlo <= math.log10(t) <= xhi:
+            out.append('<text x="%.1f" y="%d" text-anchor="middle">%s</text>' % (px(t), top + h + 16, fmt(t)))
+    for t in log_ticks(10 ** ylo, 10 ** yhi):
+        if ylo <= math.log10(t) <= yhi:
+            out.append('<line x1="%d" x2="%d" y1="%.1f" y2="%.1f" stroke="#ddd"/>' % (left, left + w, py(t), py(t)))
+            out.append('<text x="%d" y="%.1f" text-anchor="end">%g</text>' % (left - 4, py(t) + 4, t))
+    out.append('<text x="%d" y="%d" text-anchor="middle">elements</text>' % (left + w / 2, top + h + 32))
+    out.append('<text transform="translate(%d,%d) rotate(-90)" text-anchor="middle">ns/op</text>' % (x0 + 14, top + h / 2))
+
+    for name, points in sorted(series.items()):
+        points = sorted(p for p in points if p[1] > 0)
+        color, dash = styles[name]
+        path = " ".join("%.1f,%.1f" % (px(n), py(v)) for n, v in points)
+        out.append('<polyline points="%s" fill="none" stroke="%s" stroke-width="2" stroke-dasharray="%s"/>'
+                   % (path, color, dash))
+
+    return out
+
+
+def chart(container, rows):
+    ops = []
+    series = defaultdict(lambda: defaultdict(list))
+    impls = []
+    for r in rows:
+        if r["op"] not in ops:
+            ops.append(r["op"])
+        if r["impl"] not in impls:
+            impls.append(r["impl"])
+        series[r["op"]][(r["impl"], r["key"])].append((int(r["n"]), float(r["ns_per_op"])))
+
+    names = sorted({name for s in series.values() for name in s})
+    styles = {name: (COLORS[impls.index(name[0]) % len(COLORS)], DASHES.get(name[1], "8,2,2,2")) for name in names}
+
+    rows_n = (len(ops) + COLUMNS - 1) // COLUMNS
+    width = COLUMNS * PANEL_W
+    height = rows_n * PANEL_H + LEGEND_H * (len(names) + 1)
+
+    out = ['<svg xmlns="http://www.w3.org/2000/svg" width="%d" height="%d" font-family="sans-serif" font-size="11">'
+           % (width, height),
+           '<rect width="100%" height="100%" fill="white"/>']
+    for i, op in enumerate(ops):
+        out += panel(op, series[op], styles, (i % COLUMNS) * PANEL_W, (i // COLUMNS) * PANEL_H)
+
+    y = rows_n * PANEL_H + LEGEND_H
+    out.append('<text x="%d" y="%d" font-weight="bold">%s</text>' % (MARGIN_L, y, container))
+    for name in names:
+        y += LEGEND_H
+        color, dash = styles[name]
+        out.append('<line x1="%d" x2="%d" y1="%d" y2="%d" stroke="%s" stroke-width="2" stroke-dasharray="%s"/>'
+                   % (MARGIN_L, MARGIN_L + 40, y - 4, y - 4, color, dash))
+        out.append('<text x="%d" y="%d">%s %s</text>' % (MARGIN_L + 48, y, name[0], name[1]))
+
+    out.append("</svg>")
+    return "\n".join(out) + "\n"
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit(__doc__)
+
+    out_dir = sys.argv[2] if len(sys.argv) > 2 else "."
+    os.makedirs(out_dir, exist_ok=True)
+
+    by_container = defaultdict(list)
+    with open(sys.argv[1], newline="") as f:
+        for row in csv.DictReader(f):
+            by_container[row["container"]].append(row)
+
+    for container, rows in by_container.items():
+        path = os.path.join(out_dir, "%s_benchmarks.svg" % container)
+        with open(path, "w") as f:
+            f.write(chart(container, rows))
+        print(path)
+
+
+if __name__ == "__main__":
+    main()
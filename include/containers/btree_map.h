@@ -0,0 +1,759 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+#include "../internal/btree_internal.h"
+#include "../internal/container_tags.h"
+
+#define btree_map_t typename btree_map<K, V, Less, Alloc, TargetNodeSize>
+
+using namespace btree_internal;
+
+namespace adt {
+
+    /* Map kept in a B-tree, with the same interface as adt::map, see adt::btree_set.
+       Elements move between nodes when they split and merge, so value_type is std::pair<K, V>
+       rather than std::pair<const K, V>: modifying the key through an iterator breaks the map.
+       Every modification invalidates iterators.  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<K, V>>, std::size_t TargetNodeSize = 256>
+    class btree_map {
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<K, V>;
+        using key_compare = Less;
+        using value_compare = Less;
+        using reference = value_type&;
+        using const_reference = const value_type&;
+        using pointer = value_type*;
+        using const_pointer = const value_type*;
+        using difference_type = std::ptrdiff_t;
+        using size_type = std::size_t;
+        using allocator_type = Alloc;
+        class iterator;
+        class const_iterator;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    private:
+        using node_type = btree_node<value_type, btree_slots<value_type, TargetNodeSize>::value>;
+        using inner_node_type = btree_inner_node<value_type, node_type::slots>;
+        using internal_ptr = node_type*;
+        using position_type = btree_pos<node_type>;
+        using leaf_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node_type>;
+        using inner_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<inner_node_type>;
+
+        internal_ptr _root;
+        size_type _size;
+        key_compare _less;
+        leaf_allocator _leaf_alloc;
+        inner_allocator _inner_alloc;
+
+        struct enabler {};
+
+    public:
+        class iterator {
+            friend class btree_map;
+            friend class const_iterator;
+            using internal_ptr = btree_map::internal_ptr;
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = btree_map::value_type;
+            using reference = btree_map::reference;
+            using pointer = btree_map::pointer;
+            using difference_type = btree_map::difference_type;
+
+            iterator() : _node(nullptr), _pos(0) {}
+            iterator(const iterator &other) = default;
+            iterator(iterator &&other) = default;
+
+            iterator &operator=(const iterator &rhs) = default;
+
+            bool operator==(const iterator &rhs) const { return this->_node == rhs._node && this->_pos == rhs._pos; }
+            bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+
+            iterator &operator++() {
+                _btree_increment(_node, _pos);
+                return *this;
+            }
+            iterator operator++(int) {
+                auto temp(*this);
+                ++(*this);
+                return temp;
+            }
+            iterator &operator--() {
+                _btree_decrement(_node, _pos);
+                return *this;
+            }
+            iterator operator--(int) {
+                auto temp(*this);
+                --(*this);
+                return temp;
+            }
+
+            reference operator*() const { return _node->slot(_pos); }
+            pointer operator->() const { return &_node->slot(_pos); }
+
+        private:
+            internal_ptr _node;
+            size_type _pos;
+
+            explicit iterator(position_type where) : _node(where.node), _pos(where.pos) {}
+        };
+
+        class const_iterator {
+            friend class btree_map;
+            using internal_ptr = btree_map::internal_ptr;
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = btree_map::value_type;
+            using reference = btree_map::const_reference;
+            using pointer = btree_map::const_pointer;
+            using difference_type = btree_map::difference_type;
+
+            const_iterator() : _node(nullptr), _pos(0) {}
+            const_iterator(const const_iterator &other) = default;
+            const_iterator(const_iterator &&other) = default;
+            /* Implicit conversion from iterator.  */
+            const_iterator(const iterator &it) : _node(it._node), _pos(it._pos) {}
+
+            const_iterator &operator=(const const_iterator &rhs) = default;
+
+            bool operator==(const const_iterator &rhs) const { return this->_node == rhs._node && this->_pos == rhs._pos; }
+            bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+
+            const_iterator &operator++() {
+                _btree_increment(_node, _pos);
+                return *this;
+            }
+            const_iterator operator++(int) {
+                auto temp(*this);
+                ++(*this);
+                return temp;
+            }
+            const_iterator &operator--() {
+                _btree_decrement(_node, _pos);
+                return *this;
+            }
+            const_iterator operator--(int) {
+                auto temp(*this);
+                --(*this);
+                return temp;
+            }
+
+            reference operator*() const { return _node->slot(_pos); }
+            pointer operator->() const { return &_node->slot(_pos); }
+
+        private:
+            internal_ptr _node;
+            size_type _pos;
+
+            explicit const_iterator(position_type where) : _node(where.node), _pos(where.pos) {}
+        };
+
+        /* Constructors/Destructors.  */
+        btree_map(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
+        template<class InputIt, btree_internal::enable_if_iterator<InputIt> = 0>
+        btree_map(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        template<class InputIt>
+        btree_map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        btree_map(const btree_map &other);
+        btree_map(btree_map &&other) noexcept;
+        ~btree_map();
+        btree_map &operator=(btree_map rhs);
+
+        /* Iterators.  */
+        iterator begin() noexcept;
+        const_iterator begin() const noexcept;
+        iterator end() noexcept;
+        const_iterator end() const noexcept;
+        reverse_iterator rbegin() noexcept;
+        const_reverse_iterator rbegin() const noexcept;
+        reverse_iterator rend() noexcept;
+        const_reverse_iterator rend() const noexcept;
+        const_iterator cbegin() const noexcept;
+        const_iterator cend() const noexcept;
+        const_reverse_iterator crbegin() const noexcept;
+        const_reverse_iterator crend() const noexcept;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+
+        /* Observers.  */
+        key_compare key_comp() const;
+        value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
+
+        /* Element access.  */
+        mapped_type &operator[](const key_type &key);
+        mapped_type &operator[](key_type &&key);
+        mapped_type &at(const key_type &key) noexcept(false);
+        const mapped_type &at(const key_type &key) const noexcept(false);
+
+        /* Modifiers.  */
+        std::pair<iterator, bool> insert(const value_type &val);
+        template<class P>
+        std::pair<iterator, bool> insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type = enabler());
+        template<class InputIt, btree_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class InputIt>
+        void insert(sorted_unique_t, InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        template<class P>
+        iterator insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type = enabler());
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args&&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj);
+        iterator erase(const_iterator pos);
+        size_type erase(const key_type &key);
+        iterator erase(const_iterator first, const_iterator last);
+        void clear() noexcept;
+        void swap(btree_map &other);
+
+        /* Operations.  */
+        iterator find(const key_type &key);
+        const_iterator find(const key_type &key) const;
+        size_type count(const key_type &key) const;
+        iterator lower_bound(const key_type &key);
+        const_iterator lower_bound(const key_type &key) const;
+        iterator upper_bound(const key_type &key);
+        const_iterator upper_bound(const key_type &key) const;
+        std::pair<iterator, iterator> equal_range(const key_type &key);
+        std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator lower_bound(const Key &key);
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator lower_bound(const Key &key) const;
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator upper_bound(const Key &key);
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator upper_bound(const Key &key) const;
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, btree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+
+        friend void swap(btree_map &lhs, btree_map &rhs) {
+            lhs.swap(rhs);
+        }
+
+        template<class Container, typename Key>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const Key &key, bool upper, btree_simd_search);
+
+        template<class Container, typename Key>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const Key &key, bool upper, btree_binary_search);
+
+        template<class Container, typename Key>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const Key &key, bool upper);
+
+        template<class Container, typename Key>
+        friend btree_pos<container::node_type> btree_internal::_btree_bound(Container *cnt, const Key &key, bool upper);
+
+        template<class Container, typename Key>
+        friend btree_pos<container::node_type> btree_internal::_btree_find(Container *cnt, const Key &key);
+
+        template<class Container>
+        friend container::node_type *btree_internal::_btree_new_node(Container *cnt, bool leaf);
+
+        template<class Container>
+        friend void btree_internal::_btree_delete_node(Container *cnt, container::node_type *node);
+
+        template<class Container>
+        friend void btree_internal::_btree_destroy(Container *cnt, container::node_type *node);
+
+        template<class Container>
+        friend container::node_type *btree_internal::_btree_copy(Container *cnt, const container::node_type *other);
+
+        template<class Container>
+        friend void btree_internal::_btree_split(Container *cnt, container::node_type *&node, std::size_t &pos);
+
+        template<class Container>
+        friend void btree_internal::_btree_insert_slot(Container *cnt, container::node_type *&node, std::size_t &pos, container::value_type &&val, container::node_type *right);
+
+        template<class Container, typename Key>
+        friend btree_pos<container::node_type> btree_internal::_btree_insert_position(Container *cnt, const Key &key, bool unique, bool &found);
+
+        template<class Container, typename Key>
+        friend btree_pos<container::node_type> btree_internal::_btree_hint_position(Container *cnt, btree_pos<container::node_type> hint, const Key &key, bool unique, bool &found);
+
+        template<class Container>
+        friend btree_pos<container::node_type> btree_internal::_btree_insert_at(Container *cnt, btree_pos<container::node_type> where, container::value_type &&val);
+
+        template<class Container>
+        friend void btree_internal::_btree_merge(Container *cnt, container::node_type *parent, std::size_t i, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_borrow_right(Container *cnt, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_borrow_left(Container *cnt, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_rebalance(Container *cnt, container::node_type *node, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend btree_pos<container::node_type> btree_internal::_btree_erase(Container *cnt, btree_pos<container::node_type> where);
+
+    private:
+        static const key_type &_get_key(const value_type &val);
+        std::pair<iterator, bool> _insert(const_iterator hint, value_type &&val);
+        template<typename Key, class... Args>
+        std::pair<iterator, bool> _try_emplace(Key &&key, Args&&... args);
+        template<typename Key, class M>
+        std::pair<iterator, bool> _insert_or_assign(Key &&key, M &&obj);
+        static position_type _position(const_iterator it);
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::btree_map(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _leaf_alloc(alloc), _inner_alloc(alloc) {}
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt, btree_internal::enable_if_iterator<InputIt>>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::btree_map(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc)
+        : btree_map(keq, alloc) {
+        insert(first, last);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::btree_map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc)
+        : btree_map(keq, alloc) {
+        insert(sorted_unique, first, last);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::btree_map(const btree_map &other)
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _leaf_alloc(std::allocator_traits<leaf_allocator>::select_on_container_copy_construction(other._leaf_alloc)),
+          _inner_alloc(std::allocator_traits<inner_allocator>::select_on_container_copy_construction(other._inner_alloc)) {
+        if (other._root) _root = _btree_copy(this, other._root);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::btree_map(btree_map &&other) noexcept : btree_map() {
+        swap(other);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map<K, V, Less, Alloc, TargetNodeSize>::~btree_map() {
+        clear();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map<K, V, Less, Alloc, TargetNodeSize> &btree_map<K, V, Less, Alloc, TargetNodeSize>::operator=(btree_map rhs) {
+        swap(rhs);
+
+        return *this;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::begin() noexcept {
+        return _root ? iterator(position_type{_btree_leftmost(_root), 0}) : end();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::begin() const noexcept {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->begin();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::end() noexcept {
+        return iterator(_btree_end(_root));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::end() const noexcept {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->end();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::rbegin() noexcept {
+        return reverse_iterator(end());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::rbegin() const noexcept {
+        return const_reverse_iterator(end());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::rend() noexcept {
+        return reverse_iterator(begin());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::rend() const noexcept {
+        return const_reverse_iterator(begin());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::cbegin() const noexcept {
+        return begin();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::cend() const noexcept {
+        return end();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::crbegin() const noexcept {
+        return rbegin();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_reverse_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::crend() const noexcept {
+        return rend();
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    bool btree_map<K, V, Less, Alloc, TargetNodeSize>::empty() const noexcept {
+        return _size == 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::size_type btree_map<K, V, Less, Alloc, TargetNodeSize>::size() const noexcept {
+        return _size;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::key_compare btree_map<K, V, Less, Alloc, TargetNodeSize>::key_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::value_compare btree_map<K, V, Less, Alloc, TargetNodeSize>::value_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::allocator_type btree_map<K, V, Less, Alloc, TargetNodeSize>::get_allocator() const noexcept {
+        return allocator_type(_leaf_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::mapped_type &btree_map<K, V, Less, Alloc, TargetNodeSize>::operator[](const key_type &key) {
+        return _try_emplace(key).first->second;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::mapped_type &btree_map<K, V, Less, Alloc, TargetNodeSize>::operator[](key_type &&key) {
+        return _try_emplace(std::move(key)).first->second;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::mapped_type &btree_map<K, V, Less, Alloc, TargetNodeSize>::at(const key_type &key) noexcept(false) {
+        iterator it = find(key);
+
+        /* If we found it, return the mapped value.  */
+        if (it != end()) return it->second;
+
+        throw std::out_of_range("Key is not present on the map.");
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    const btree_map_t::mapped_type &btree_map<K, V, Less, Alloc, TargetNodeSize>::at(const key_type &key) const noexcept(false) {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->at(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(const value_type &val) {
+        return _insert(end(), value_type(val));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class P>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type) {
+        return _insert(end(), value_type(std::forward<P>(val)));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt, btree_internal::enable_if_iterator<InputIt>>
+    void btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(InputIt first, InputIt last) {
+        /* Hinting at end() makes sorted input an append to the rightmost leaf.  */
+        for (; first != last ; ++first) emplace_hint(end(), *first);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt>
+    void btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(sorted_unique_t, InputIt first, InputIt last) {
+        insert(first, last);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(const_iterator hint, const value_type &val) {
+        return _insert(hint, value_type(val)).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class P>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type) {
+        return _insert(hint, value_type(std::forward<P>(val))).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::emplace(Args &&... args) {
+        return _insert(end(), value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::emplace_hint(const_iterator hint, Args &&... args) {
+        return _insert(hint, value_type(std::forward<Args>(args)...)).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::try_emplace(const key_type &key, Args &&... args) {
+        return _try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::try_emplace(key_type &&key, Args &&... args) {
+        return _try_emplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class M>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::insert_or_assign(const key_type &key, M &&obj) {
+        return _insert_or_assign(key, std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class M>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::insert_or_assign(key_type &&key, M &&obj) {
+        return _insert_or_assign(std::move(key), std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::erase(const_iterator pos) {
+        return iterator(_btree_erase(this, _position(pos)));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::size_type btree_map<K, V, Less, Alloc, TargetNodeSize>::erase(const key_type &key) {
+        iterator it = find(key);
+
+        if (it == end()) return 0;
+
+        erase(it);
+
+        return 1;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::erase(const_iterator first, const_iterator last) {
+        iterator it = iterator(_position(first));
+        size_type n = 0;
+
+        /* Erasing moves elements around, count the range first and erase through the returned iterator.  */
+        for (; first != last ; ++first) n++;
+        while (n-- > 0) it = erase(it);
+
+        return it;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    void btree_map<K, V, Less, Alloc, TargetNodeSize>::clear() noexcept {
+        if (_root) _btree_destroy(this, _root);
+        _root = nullptr;
+        _size = 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    void btree_map<K, V, Less, Alloc, TargetNodeSize>::swap(btree_map &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_size, other._size);
+        swap(_less, other._less);
+        swap(_leaf_alloc, other._leaf_alloc);
+        swap(_inner_alloc, other._inner_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::find(const Key &key) {
+        return iterator(_btree_find(this, key));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::find(const key_type &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::find(const Key &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::size_type btree_map<K, V, Less, Alloc, TargetNodeSize>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::size_type btree_map<K, V, Less, Alloc, TargetNodeSize>::count(const Key &key) const {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::lower_bound(const Key &key) {
+        return iterator(_btree_bound(this, key, false));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::lower_bound(const key_type &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->lower_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::lower_bound(const Key &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->lower_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::upper_bound(const Key &key) {
+        return iterator(_btree_bound(this, key, true));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::upper_bound(const key_type &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    btree_map_t::const_iterator btree_map<K, V, Less, Alloc, TargetNodeSize>::upper_bound(const Key &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_map_t::iterator, btree_map_t::iterator> btree_map<K, V, Less, Alloc, TargetNodeSize>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    std::pair<btree_map_t::iterator, btree_map_t::iterator> btree_map<K, V, Less, Alloc, TargetNodeSize>::equal_range(const Key &key) {
+        iterator it = lower_bound(key), next = it;
+
+        /* Keys are unique, the range holds at most one element.  */
+        if (it == end() || _less(key, it->first)) return std::make_pair(it, it);
+
+        return std::make_pair(it, ++next);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_map_t::const_iterator, btree_map_t::const_iterator> btree_map<K, V, Less, Alloc, TargetNodeSize>::equal_range(const key_type &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class Key, btree_internal::enable_lookup<Less, K, Key>>
+    std::pair<btree_map_t::const_iterator, btree_map_t::const_iterator> btree_map<K, V, Less, Alloc, TargetNodeSize>::equal_range(const Key &key) const {
+        return const_cast<btree_map<K, V, Less, Alloc, TargetNodeSize>*>(this)->equal_range(key);
+    }
+
+    /* Private member functions.  */
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    const btree_map_t::key_type &btree_map<K, V, Less, Alloc, TargetNodeSize>::_get_key(const value_type &val) {
+        return val.first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::_insert(const_iterator hint, value_type &&val) {
+        position_type where;
+        bool found;
+
+        if (_root == nullptr) _root = _btree_new_node(this, true);
+
+        where = _btree_hint_position(this, _position(hint), val.first, true, found);
+        if (found) return std::make_pair(iterator(where), false);
+
+        return std::make_pair(iterator(_btree_insert_at(this, where, std::move(val))), true);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<typename Key, class... Args>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::_try_emplace(Key &&key, Args &&... args) {
+        position_type where;
+        bool found;
+
+        if (_root == nullptr) _root = _btree_new_node(this, true);
+
+        /* Unlike emplace, nothing is constructed when the key is already there.  */
+        where = _btree_insert_position(this, key, true, found);
+        if (found) return std::make_pair(iterator(where), false);
+
+        return std::make_pair(iterator(_btree_insert_at(this, where, value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)),
+                                                                                 std::forward_as_tuple(std::forward<Args>(args)...)))), true);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<typename Key, class M>
+    std::pair<btree_map_t::iterator, bool> btree_map<K, V, Less, Alloc, TargetNodeSize>::_insert_or_assign(Key &&key, M &&obj) {
+        std::pair<iterator, bool> ret = _try_emplace(std::forward<Key>(key), std::forward<M>(obj));
+
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_map_t::position_type btree_map<K, V, Less, Alloc, TargetNodeSize>::_position(const_iterator it) {
+        return position_type{it._node, it._pos};
+    }
+}
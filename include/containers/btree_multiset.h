@@ -0,0 +1,589 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+#include "../internal/btree_internal.h"
+
+#define btree_multiset_t typename btree_multiset<Key, Less, Alloc, TargetNodeSize>
+
+using namespace btree_internal;
+
+namespace adt {
+
+    /* Multiset kept in a B-tree, with the same interface as adt::multiset, see adt::btree_set.
+       Equivalent elements are stored side by side in insertion order.  */
+    template<typename Key, class Less = std::less<Key>, class Alloc = std::allocator<Key>, std::size_t TargetNodeSize = 256>
+    class btree_multiset {
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using key_compare = Less;
+        using value_compare = Less;
+        using reference = value_type&;
+        using const_reference = const value_type&;
+        using pointer = value_type*;
+        using const_pointer = const value_type*;
+        using difference_type = std::ptrdiff_t;
+        using size_type = std::size_t;
+        using allocator_type = Alloc;
+        class iterator;
+        using const_iterator = iterator;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = reverse_iterator;
+
+    private:
+        using node_type = btree_node<value_type, btree_slots<value_type, TargetNodeSize>::value>;
+        using inner_node_type = btree_inner_node<value_type, node_type::slots>;
+        using internal_ptr = node_type*;
+        using position_type = btree_pos<node_type>;
+        using leaf_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node_type>;
+        using inner_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<inner_node_type>;
+
+        internal_ptr _root;
+        size_type _size;
+        key_compare _less;
+        leaf_allocator _leaf_alloc;
+        inner_allocator _inner_alloc;
+
+    public:
+        class iterator {
+            friend class btree_multiset;
+            using internal_ptr = btree_multiset::internal_ptr;
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = btree_multiset::value_type;
+            using reference = btree_multiset::const_reference;
+            using pointer = btree_multiset::const_pointer;
+            using difference_type = btree_multiset::difference_type;
+
+            iterator() : _node(nullptr), _pos(0) {}
+            iterator(const iterator &other) = default;
+            iterator(iterator &&other) = default;
+
+            iterator &operator=(const iterator &rhs) = default;
+
+            bool operator==(const iterator &rhs) const { return this->_node == rhs._node && this->_pos == rhs._pos; }
+            bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+
+            iterator &operator++() {
+                _btree_increment(_node, _pos);
+                return *this;
+            }
+            iterator operator++(int) {
+                auto temp(*this);
+                ++(*this);
+                return temp;
+            }
+            iterator &operator--() {
+                _btree_decrement(_node, _pos);
+                return *this;
+            }
+            iterator operator--(int) {
+                auto temp(*this);
+                --(*this);
+                return temp;
+            }
+
+            reference operator*() const { return _node->slot(_pos); }
+            pointer operator->() const { return &_node->slot(_pos); }
+
+        private:
+            internal_ptr _node;
+            size_type _pos;
+
+            explicit iterator(position_type where) : _node(where.node), _pos(where.pos) {}
+        };
+
+        /* Constructors/Destructors.  */
+        btree_multiset(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
+        template<class InputIt, btree_internal::enable_if_iterator<InputIt> = 0>
+        btree_multiset(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        btree_multiset(const btree_multiset &other);
+        btree_multiset(btree_multiset &&other) noexcept;
+        ~btree_multiset();
+        btree_multiset &operator=(btree_multiset rhs);
+
+        /* Iterators.  */
+        iterator begin() noexcept;
+        const_iterator begin() const noexcept;
+        iterator end() noexcept;
+        const_iterator end() const noexcept;
+        reverse_iterator rbegin() noexcept;
+        const_reverse_iterator rbegin() const noexcept;
+        reverse_iterator rend() noexcept;
+        const_reverse_iterator rend() const noexcept;
+        const_iterator cbegin() const noexcept;
+        const_iterator cend() const noexcept;
+        const_reverse_iterator crbegin() const noexcept;
+        const_reverse_iterator crend() const noexcept;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+
+        /* Observers.  */
+        key_compare key_comp() const;
+        value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
+
+        /* Modifiers.  */
+        iterator insert(const value_type &val);
+        iterator insert(value_type &&val);
+        template<class InputIt, btree_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        iterator insert(const_iterator hint, value_type &&val);
+        template <class... Args>
+        iterator emplace(Args &&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        iterator erase(const_iterator pos);
+        size_type erase(const value_type &val);
+        iterator erase(const_iterator first, const_iterator last);
+        void clear() noexcept;
+        void swap(btree_multiset &other);
+
+        /* Operations.  */
+        iterator find(const key_type &key);
+        const_iterator find(const key_type &key) const;
+        size_type count(const key_type &key) const;
+        iterator lower_bound(const key_type &key);
+        const_iterator lower_bound(const key_type &key) const;
+        iterator upper_bound(const key_type &key);
+        const_iterator upper_bound(const key_type &key) const;
+        std::pair<iterator, iterator> equal_range(const key_type &key);
+        std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator lower_bound(const K &key);
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator lower_bound(const K &key) const;
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator upper_bound(const K &key);
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator upper_bound(const K &key) const;
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, btree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const K &key) const;
+
+        friend void swap(btree_multiset &lhs, btree_multiset &rhs) {
+            lhs.swap(rhs);
+        }
+
+        template<class Container, typename K>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const K &key, bool upper, btree_simd_search);
+
+        template<class Container, typename K>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const K &key, bool upper, btree_binary_search);
+
+        template<class Container, typename K>
+        friend std::size_t btree_internal::_btree_search_node(Container *cnt, container::node_type *node, const K &key, bool upper);
+
+        template<class Container, typename K>
+        friend btree_pos<container::node_type> btree_internal::_btree_bound(Container *cnt, const K &key, bool upper);
+
+        template<class Container>
+        friend container::node_type *btree_internal::_btree_new_node(Container *cnt, bool leaf);
+
+        template<class Container>
+        friend void btree_internal::_btree_delete_node(Container *cnt, container::node_type *node);
+
+        template<class Container>
+        friend void btree_internal::_btree_destroy(Container *cnt, container::node_type *node);
+
+        template<class Container>
+        friend container::node_type *btree_internal::_btree_copy(Container *cnt, const container::node_type *other);
+
+        template<class Container>
+        friend void btree_internal::_btree_split(Container *cnt, container::node_type *&node, std::size_t &pos);
+
+        template<class Container>
+        friend void btree_internal::_btree_insert_slot(Container *cnt, container::node_type *&node, std::size_t &pos, container::value_type &&val, container::node_type *right);
+
+        template<class Container, typename K>
+        friend btree_pos<container::node_type> btree_internal::_btree_insert_position(Container *cnt, const K &key, bool unique, bool &found);
+
+        template<class Container, typename K>
+        friend btree_pos<container::node_type> btree_internal::_btree_hint_position(Container *cnt, btree_pos<container::node_type> hint, const K &key, bool unique, bool &found);
+
+        template<class Container>
+        friend btree_pos<container::node_type> btree_internal::_btree_insert_at(Container *cnt, btree_pos<container::node_type> where, container::value_type &&val);
+
+        template<class Container>
+        friend void btree_internal::_btree_merge(Container *cnt, container::node_type *parent, std::size_t i, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_borrow_right(Container *cnt, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_borrow_left(Container *cnt, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend void btree_internal::_btree_rebalance(Container *cnt, container::node_type *node, btree_pos<container::node_type> &tracked);
+
+        template<class Container>
+        friend btree_pos<container::node_type> btree_internal::_btree_erase(Container *cnt, btree_pos<container::node_type> where);
+
+    private:
+        static const key_type &_get_key(const value_type &val);
+        template<typename V>
+        iterator _insert(const_iterator hint, V &&val);
+        static position_type _position(const_iterator it);
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize>::btree_multiset(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _leaf_alloc(alloc), _inner_alloc(alloc) {}
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt, btree_internal::enable_if_iterator<InputIt>>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize>::btree_multiset(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc)
+        : btree_multiset(keq, alloc) {
+        insert(first, last);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize>::btree_multiset(const btree_multiset &other)
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _leaf_alloc(std::allocator_traits<leaf_allocator>::select_on_container_copy_construction(other._leaf_alloc)),
+          _inner_alloc(std::allocator_traits<inner_allocator>::select_on_container_copy_construction(other._inner_alloc)) {
+        if (other._root) _root = _btree_copy(this, other._root);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize>::btree_multiset(btree_multiset &&other) noexcept : btree_multiset() {
+        swap(other);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize>::~btree_multiset() {
+        clear();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset<Key, Less, Alloc, TargetNodeSize> &btree_multiset<Key, Less, Alloc, TargetNodeSize>::operator=(btree_multiset rhs) {
+        swap(rhs);
+
+        return *this;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::begin() noexcept {
+        return _root ? iterator(position_type{_btree_leftmost(_root), 0}) : end();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::begin() const noexcept {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->begin();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::end() noexcept {
+        return iterator(_btree_end(_root));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::end() const noexcept {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->end();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::rbegin() noexcept {
+        return reverse_iterator(end());
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::rbegin() const noexcept {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->rbegin();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::rend() noexcept {
+        return reverse_iterator(begin());
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::rend() const noexcept {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->rend();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::cbegin() const noexcept {
+        return begin();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::cend() const noexcept {
+        return end();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::crbegin() const noexcept {
+        return rbegin();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_reverse_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::crend() const noexcept {
+        return rend();
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    bool btree_multiset<Key, Less, Alloc, TargetNodeSize>::empty() const noexcept {
+        return _size == 0;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::size_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::size() const noexcept {
+        return _size;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::key_compare btree_multiset<Key, Less, Alloc, TargetNodeSize>::key_comp() const {
+        return _less;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::value_compare btree_multiset<Key, Less, Alloc, TargetNodeSize>::value_comp() const {
+        return _less;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::allocator_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::get_allocator() const noexcept {
+        return allocator_type(_leaf_alloc);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::insert(const value_type &val) {
+        return _insert(end(), val);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::insert(value_type &&val) {
+        return _insert(end(), std::move(val));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class InputIt, btree_internal::enable_if_iterator<InputIt>>
+    void btree_multiset<Key, Less, Alloc, TargetNodeSize>::insert(InputIt first, InputIt last) {
+        /* Hinting at end() makes sorted input an append to the rightmost leaf.  */
+        for (; first != last ; ++first) emplace_hint(end(), *first);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::insert(const_iterator hint, const value_type &val) {
+        return _insert(hint, val);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::insert(const_iterator hint, value_type &&val) {
+        return _insert(hint, std::move(val));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::emplace(Args &&... args) {
+        return _insert(end(), value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class... Args>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::emplace_hint(const_iterator hint, Args &&... args) {
+        return _insert(hint, value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::erase(const_iterator pos) {
+        return iterator(_btree_erase(this, _position(pos)));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::size_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::erase(const value_type &val) {
+        std::pair<iterator, iterator> range = equal_range(val);
+        size_type n = 0;
+
+        for (iterator it = range.first ; it != range.second ; ++it) n++;
+        erase(range.first, range.second);
+
+        return n;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::erase(const_iterator first, const_iterator last) {
+        size_type n = 0;
+
+        /* Erasing moves elements around, count the range first and erase through the returned iterator.  */
+        for (const_iterator it = first ; it != last ; ++it) n++;
+        while (n-- > 0) first = erase(first);
+
+        return first;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    void btree_multiset<Key, Less, Alloc, TargetNodeSize>::clear() noexcept {
+        if (_root) _btree_destroy(this, _root);
+        _root = nullptr;
+        _size = 0;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    void btree_multiset<Key, Less, Alloc, TargetNodeSize>::swap(btree_multiset &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_size, other._size);
+        swap(_less, other._less);
+        swap(_leaf_alloc, other._leaf_alloc);
+        swap(_inner_alloc, other._inner_alloc);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::find(const K &key) {
+        iterator it = lower_bound(key);
+
+        /* The first of the equivalent elements.  */
+        if (it == end() || _less(key, *it)) return end();
+
+        return it;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::find(const key_type &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->find(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::find(const K &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->find(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::size_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::size_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::count(const K &key) const {
+        std::pair<const_iterator, const_iterator> range = equal_range(key);
+        size_type n = 0;
+
+        for (const_iterator it = range.first ; it != range.second ; ++it) n++;
+
+        return n;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::lower_bound(const K &key) {
+        return iterator(_btree_bound(this, key, false));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::lower_bound(const key_type &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->lower_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::lower_bound(const K &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->lower_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::upper_bound(const K &key) {
+        return iterator(_btree_bound(this, key, true));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::upper_bound(const key_type &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    btree_multiset_t::const_iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::upper_bound(const K &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_multiset_t::iterator, btree_multiset_t::iterator> btree_multiset<Key, Less, Alloc, TargetNodeSize>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    std::pair<btree_multiset_t::iterator, btree_multiset_t::iterator> btree_multiset<Key, Less, Alloc, TargetNodeSize>::equal_range(const K &key) {
+        return std::make_pair(lower_bound(key), upper_bound(key));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    std::pair<btree_multiset_t::const_iterator, btree_multiset_t::const_iterator> btree_multiset<Key, Less, Alloc, TargetNodeSize>::equal_range(const key_type &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<class K, btree_internal::enable_lookup<Less, Key, K>>
+    std::pair<btree_multiset_t::const_iterator, btree_multiset_t::const_iterator> btree_multiset<Key, Less, Alloc, TargetNodeSize>::equal_range(const K &key) const {
+        return const_cast<btree_multiset<Key, Less, Alloc, TargetNodeSize>*>(this)->equal_range(key);
+    }
+
+    /* Private member functions.  */
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    const btree_multiset_t::key_type &btree_multiset<Key, Less, Alloc, TargetNodeSize>::_get_key(const value_type &val) {
+        return val;
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    template<typename V>
+    btree_multiset_t::iterator btree_multiset<Key, Less, Alloc, TargetNodeSize>::_insert(const_iterator hint, V &&val) {
+        value_type value(std::forward<V>(val));
+        position_type where;
+        bool found;
+
+        if (_root == nullptr) _root = _btree_new_node(this, true);
+
+        /* After the equivalent elements already there.  */
+        where = _btree_hint_position(this, _position(hint), value, false, found);
+
+        return iterator(_btree_insert_at(this, where, std::move(value)));
+    }
+
+    template<typename Key, class Less, class Alloc, std::size_t TargetNodeSize>
+    btree_multiset_t::position_type btree_multiset<Key, Less, Alloc, TargetNodeSize>::_position(const_iterator it) {
+        return position_type{it._node, it._pos};
+    }
+}
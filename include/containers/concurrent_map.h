@@ -0,0 +1,312 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "persistent_map.h"
+#include "../internal/epoch_internal.h"
+
+#define concurrent_map_t typename concurrent_map<K, V, Less, Alloc>
+
+using namespace epoch_internal;
+
+namespace adt {
+
+    /* Ordered map for many readers and few writers. Writers are serialized by a mutex, change a private
+       persistent_map (copying only the path to what they change) and publish it as a new version with one
+       atomic store. Readers never lock or wait: read() announces an epoch in a record of the calling thread
+       and returns a guard to the latest version, which stays alive and unchanged until the guard is destroyed.
+       Replaced versions are freed by later writers once no reader entered before they were replaced
+       (epoch based reclamation).  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>>
+    class concurrent_map {
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<const K, V>;
+        using key_compare = Less;
+        using size_type = std::size_t;
+        using allocator_type = Alloc;
+        using map_type = persistent_map<K, V, Less, Alloc>;
+        class reader;
+
+    private:
+        /* A published map, and once replaced the epoch it was replaced at.  */
+        struct version {
+            map_type map;
+            std::uint64_t retired;
+            version *next;
+
+            explicit version(const map_type &latest) : map(latest), retired(0), next(nullptr) {}
+        };
+
+        using version_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<version>;
+
+        /* Read by every reader, kept apart from what writers change.  */
+        alignas(64) std::atomic<version*> _published;
+        mutable epoch_domain _epochs;
+
+        std::mutex _write_lock;
+        map_type _latest;
+        version *_retired_head;
+        version *_retired_tail;
+        version_allocator _version_alloc;
+
+    public:
+        /* A read guard: the version it points to is not freed while it lives.
+           Readers that stay for long hold back the reclamation of every later replaced version.
+           It may be moved but must be destroyed by the thread that called read().  */
+        class reader {
+            friend class concurrent_map;
+
+        public:
+            reader(reader &&other) noexcept : _record(other._record), _map(other._map) {
+                other._record = nullptr;
+            }
+            reader(const reader &other) = delete;
+            ~reader() {
+                if (_record) _epoch_leave(_record);
+            }
+
+            reader &operator=(const reader &rhs) = delete;
+
+            const map_type &operator*() const { return *_map; }
+            const map_type *operator->() const { return _map; }
+
+        private:
+            epoch_record *_record;
+            const map_type *_map;
+
+            reader(epoch_record *record, const map_type *map) : _record(record), _map(map) {}
+        };
+
+        /* Constructors/Destructors.  */
+        concurrent_map(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        concurrent_map(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        concurrent_map(const concurrent_map &other) = delete;
+        ~concurrent_map();
+        concurrent_map &operator=(const concurrent_map &rhs) = delete;
+
+        /* Readers, never blocked by writers.  */
+        reader read() const;
+        map_type snapshot() const;
+        bool empty() const;
+        size_type size() const;
+        size_type count(const key_type &key) const;
+        mapped_type at(const key_type &key) const noexcept(false);
+
+        /* Modifiers, serialized. Each one that changes the map publishes a new version.  */
+        bool insert(const value_type &val);
+        template<class... Args>
+        bool emplace(Args&&... args);
+        template<class... Args>
+        bool try_emplace(const key_type &key, Args&&... args);
+        template<class M>
+        bool insert_or_assign(const key_type &key, M &&obj);
+        size_type erase(const key_type &key);
+        void clear();
+        template<class Function>
+        void update(Function fn);
+
+    private:
+        template<class Function>
+        auto _write(Function fn) -> decltype(fn(std::declval<map_type&>()));
+        void _publish(version *next);
+        void _reclaim();
+        void _delete_version(version *old);
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map<K, V, Less, Alloc>::concurrent_map(const key_compare &keq, const allocator_type &alloc)
+        : _published(nullptr), _latest(keq, alloc), _retired_head(nullptr), _retired_tail(nullptr), _version_alloc(alloc) {
+        version *first = std::allocator_traits<version_allocator>::allocate(_version_alloc, 1);
+
+        _published.store(::new (first) version(_latest));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    concurrent_map<K, V, Less, Alloc>::concurrent_map(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc)
+        : concurrent_map(keq, alloc) {
+        update([&](map_type &latest) { latest.insert(first, last); });
+    }
+
+    /* No reader may be left, every version goes.  */
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map<K, V, Less, Alloc>::~concurrent_map() {
+        version *next;
+
+        for (version *old = _retired_head ; old != nullptr ; old = next) {
+            next = old->next;
+            _delete_version(old);
+        }
+        _delete_version(_published.load());
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::reader concurrent_map<K, V, Less, Alloc>::read() const {
+        epoch_record *record = _epoch_enter(&_epochs);
+
+        /* Ordered after the announcement: a writer that missed it published before this load.  */
+        return reader(record, &_published.load()->map);
+    }
+
+    /* Unlike a reader, the snapshot holds its nodes by reference count and can outlive the map.  */
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::map_type concurrent_map<K, V, Less, Alloc>::snapshot() const {
+        return map_type(*read());
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    bool concurrent_map<K, V, Less, Alloc>::empty() const {
+        return read()->empty();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::size_type concurrent_map<K, V, Less, Alloc>::size() const {
+        return read()->size();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::size_type concurrent_map<K, V, Less, Alloc>::count(const key_type &key) const {
+        return read()->count(key);
+    }
+
+    /* The mapped value is returned by copy, a reference would outlive the guard.  */
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::mapped_type concurrent_map<K, V, Less, Alloc>::at(const key_type &key) const noexcept(false) {
+        return read()->at(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    bool concurrent_map<K, V, Less, Alloc>::insert(const value_type &val) {
+        return _write([&](map_type &latest) { return latest.insert(val).second; });
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    bool concurrent_map<K, V, Less, Alloc>::emplace(Args &&... args) {
+        return _write([&](map_type &latest) { return latest.emplace(std::forward<Args>(args)...).second; });
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    bool concurrent_map<K, V, Less, Alloc>::try_emplace(const key_type &key, Args &&... args) {
+        return _write([&](map_type &latest) { return latest.try_emplace(key, std::forward<Args>(args)...).second; });
+    }
+
+    /* Returns true if the key was inserted, false if it was assigned.  */
+    template<typename K, typename V, class Less, class Alloc>
+    template<class M>
+    bool concurrent_map<K, V, Less, Alloc>::insert_or_assign(const key_type &key, M &&obj) {
+        bool inserted = false;
+
+        _write([&](map_type &latest) {
+            inserted = latest.insert_or_assign(key, std::forward<M>(obj)).second;
+            return true;
+        });
+
+        return inserted;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    concurrent_map_t::size_type concurrent_map<K, V, Less, Alloc>::erase(const key_type &key) {
+        return _write([&](map_type &latest) { return latest.erase(key); });
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    void concurrent_map<K, V, Less, Alloc>::clear() {
+        _write([](map_type &latest) {
+            bool changed = !latest.empty();
+
+            latest.clear();
+            return changed;
+        });
+    }
+
+    /* Applies several changes to the map and publishes them together, readers see all of them or none.  */
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Function>
+    void concurrent_map<K, V, Less, Alloc>::update(Function fn) {
+        _write([&](map_type &latest) {
+            fn(latest);
+            return true;
+        });
+    }
+
+    /* Private member functions.  */
+
+    /* Runs fn on the writer's map under the write lock and publishes the result when fn returns non zero.
+       The version is allocated first, so a change is never left unpublished.  */
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Function>
+    auto concurrent_map<K, V, Less, Alloc>::_write(Function fn) -> decltype(fn(std::declval<map_type&>())) {
+        std::lock_guard<std::mutex> lock(_write_lock);
+        version *next = std::allocator_traits<version_allocator>::allocate(_version_alloc, 1);
+        decltype(fn(std::declval<map_type&>())) ret;
+
+        try {
+            ret = fn(_latest);
+        }
+        catch (...) {
+            std::allocator_traits<version_allocator>::deallocate(_version_alloc, next, 1);
+            throw;
+        }
+
+        if (ret) {
+            _publish(next);
+        }
+        else {
+            std::allocator_traits<version_allocator>::deallocate(_version_alloc, next, 1);
+        }
+
+        return ret;
+    }
+
+    /* The new version shares every node with the writer's map, the next change copies what it touches.  */
+    template<typename K, typename V, class Less, class Alloc>
+    void concurrent_map<K, V, Less, Alloc>::_publish(version *next) {
+        version *old = _published.exchange(::new (next) version(_latest));
+
+        old->retired = _epoch_advance(&_epochs);
+        if (_retired_tail) {
+            _retired_tail->next = old;
+        }
+        else {
+            _retired_head = old;
+        }
+        _retired_tail = old;
+
+        _reclaim();
+    }
+
+    /* Versions are retired in epoch order, free them from the oldest while no reader can hold them.  */
+    template<typename K, typename V, class Less, class Alloc>
+    void concurrent_map<K, V, Less, Alloc>::_reclaim() {
+        std::uint64_t oldest = _epoch_oldest(&_epochs);
+        version *old;
+
+        while (_retired_head && _retired_head->retired <= oldest) {
+            old = _retired_head;
+            _retired_head = old->next;
+            _delete_version(old);
+        }
+        if (_retired_head == nullptr) _retired_tail = nullptr;
+    }
+
+    /* Drops the version's references, only the nodes no other version or snapshot holds are freed.  */
+    template<typename K, typename V, class Less, class Alloc>
+    void concurrent_map<K, V, Less, Alloc>::_delete_version(version *old) {
+        old->~version();
+        std::allocator_traits<version_allocator>::deallocate(_version_alloc, old, 1);
+    }
+}
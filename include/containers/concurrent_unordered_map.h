@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "unordered_map.h"
+
+#define cumap_t typename concurrent_unordered_map<K, V, Hash, Eq, Storage>
+
+using namespace hash_internal;
+
+namespace adt {
+
+    /* Hash map for many threads that read and write. The keys are split between independently locked shards
+       by the high bits of their hash, each shard is an unordered_map, so threads working on different shards
+       never wait for each other. Elements are only reached through visitors that run under the shard lock,
+       no iterator or reference outlives it.  */
+    template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>, typename Storage = node_slots>
+    class concurrent_unordered_map {
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<const K, V>;
+        using hasher = Hash;
+        using key_equal = Eq;
+        using size_type = std::size_t;
+        using map_type = unordered_map<K, V, Hash, Eq, Storage>;
+
+    private:
+        /* A cache line each, locking one shard never invalidates the line of another.  */
+        struct alignas(64) shard {
+            std::mutex lock;
+            map_type map;
+        };
+
+        std::unique_ptr<shard[]> _shards;
+        size_type _n_shards;
+        hasher _hasher;
+        uint64_t _seed;
+
+    public:
+        /* Constructors/Destructors.  */
+        explicit concurrent_unordered_map(size_type n_shards = 0, const hasher &hash = hasher(), const key_equal &keq = key_equal());
+        concurrent_unordered_map(const concurrent_unordered_map &other) = delete;
+        concurrent_unordered_map &operator=(const concurrent_unordered_map &rhs) = delete;
+
+        /* Capacity, every shard is locked in turn, the result may be stale when other threads write.  */
+        bool empty() const;
+        size_type size() const;
+        size_type shard_count() const noexcept;
+
+        /* Visitors, fn runs under the lock of the element's shard and must not call back into the map.  */
+        template<class Function>
+        bool visit(const key_type &key, Function fn);
+        template<class Function>
+        bool visit(const key_type &key, Function fn) const;
+        template<class Function>
+        bool insert_or_visit(const value_type &val, Function fn);
+        template<class Function>
+        bool insert_or_visit(value_type &&val, Function fn);
+        template<class Function>
+        void for_each(Function fn);
+        template<class Function>
+        void for_each(Function fn) const;
+        template<class Function>
+        void parallel_for_each(Function fn, size_type n_threads = 0);
+
+        /* Modifiers.  */
+        bool insert(const value_type &val);
+        bool insert(value_type &&val);
+        template <class... Args>
+        bool emplace(Args&&... args);
+        template<class... Args>
+        bool try_emplace(const key_type &key, Args&&... args);
+        template<class M>
+        bool insert_or_assign(const key_type &key, M &&obj);
+        size_type erase(const key_type &key);
+        template<class Predicate>
+        size_type erase_if(Predicate pred);
+        void clear();
+
+        /* Operations.  */
+        size_type count(const key_type &key) const;
+        bool contains(const key_type &key) const;
+
+    private:
+        shard &_shard_of(const key_type &key) const;
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+
+    /* Without a shard count every hardware thread gets four shards, few threads then meet on the same lock.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    concurrent_unordered_map<K, V, Hash, Eq, Storage>::concurrent_unordered_map(size_type n_shards, const hasher &hash,
+                                                                              const key_equal &keq)
+        : _n_shards(n_shards), _hasher(hash), _seed(next_seed()) {
+        if (_n_shards == 0) _n_shards = 4 * std::max(1u, std::thread::hardware_concurrency());
+
+        _shards.reset(new shard[_n_shards]);
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            _shards[i].map = map_type(16, hash, keq);
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::empty() const {
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+            if (!_shards[i].map.empty()) return false;
+        }
+
+        return true;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    cumap_t::size_type concurrent_unordered_map<K, V, Hash, Eq, Storage>::size() const {
+        size_type size = 0;
+
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+            size += _shards[i].map.size();
+        }
+
+        return size;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    cumap_t::size_type concurrent_unordered_map<K, V, Hash, Eq, Storage>::shard_count() const noexcept {
+        return _n_shards;
+    }
+
+    /* Calls fn(value_type &) on the element with key, returns false if there is none.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::visit(const key_type &key, Function fn) {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto it = s.map.find(key);
+
+        if (it == s.map.end()) return false;
+        fn(*it);
+
+        return true;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::visit(const key_type &key, Function fn) const {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto it = s.map.find(key);
+
+        if (it == s.map.end()) return false;
+        fn(static_cast<const value_type &>(*it));
+
+        return true;
+    }
+
+    /* Inserts val, or calls fn(value_type &) on the element that has its key. Returns true if val was inserted.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::insert_or_visit(const value_type &val, Function fn) {
+        shard &s = _shard_of(val.first);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto ret = s.map.insert(val);
+
+        if (!ret.second) fn(*ret.first);
+
+        return ret.second;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::insert_or_visit(value_type &&val, Function fn) {
+        shard &s = _shard_of(val.first);
+        std::lock_guard<std::mutex> lock(s.lock);
+        auto ret = s.map.insert(std::move(val));
+
+        if (!ret.second) fn(*ret.first);
+
+        return ret.second;
+    }
+
+    /* Shard by shard, each one locked while its elements are visited. Elements inserted or erased
+       by other threads meanwhile may or may not be visited.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    void concurrent_unordered_map<K, V, Hash, Eq, Storage>::for_each(Function fn) {
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+            for (auto &val : _shards[i].map) fn(val);
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    void concurrent_unordered_map<K, V, Hash, Eq, Storage>::for_each(Function fn) const {
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+            for (const auto &val : _shards[i].map) fn(val);
+        }
+    }
+
+    /* Like for_each, but n_threads threads (the calling one included) take the shards from a shared counter.
+       fn is called concurrently for elements of different shards. The first exception fn throws is
+       rethrown once every thread is done, the shards not taken yet are skipped.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Function>
+    void concurrent_unordered_map<K, V, Hash, Eq, Storage>::parallel_for_each(Function fn, size_type n_threads) {
+        std::atomic<size_type> next(0);
+        std::exception_ptr error;
+        std::mutex error_lock;
+        std::vector<std::thread> workers;
+
+        if (n_threads == 0) n_threads = std::max(1u, std::thread::hardware_concurrency());
+        n_threads = std::min(n_threads, _n_shards);
+
+        auto work = [&]() {
+            size_type i;
+
+            while ((i = next.fetch_add(1, std::memory_order_relaxed)) < _n_shards) {
+                std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+                try {
+                    for (auto &val : _shards[i].map) fn(val);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> guard(error_lock);
+
+                    if (!error) error = std::current_exception();
+                    next.store(_n_shards, std::memory_order_relaxed);
+                }
+            }
+        };
+
+        workers.reserve(n_threads - 1);
+        for (size_type i = 1 ; i < n_threads ; i++) workers.emplace_back(work);
+        work();
+        for (auto &worker : workers) worker.join();
+
+        if (error) std::rethrow_exception(error);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::insert(const value_type &val) {
+        shard &s = _shard_of(val.first);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.insert(val).second;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::insert(value_type &&val) {
+        shard &s = _shard_of(val.first);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.insert(std::move(val)).second;
+    }
+
+    /* The element is built before the lock is taken, its key picks the shard.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::emplace(Args &&... args) {
+        return insert(value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::try_emplace(const key_type &key, Args &&... args) {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.try_emplace(key, std::forward<Args>(args)...).second;
+    }
+
+    /* Returns true if the key was inserted, false if it was assigned.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class M>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::insert_or_assign(const key_type &key, M &&obj) {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.insert_or_assign(key, std::forward<M>(obj)).second;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    cumap_t::size_type concurrent_unordered_map<K, V, Hash, Eq, Storage>::erase(const key_type &key) {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.erase(key);
+    }
+
+    /* Erases every element for which pred(const value_type &) is true, returns how many were erased.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Predicate>
+    cumap_t::size_type concurrent_unordered_map<K, V, Hash, Eq, Storage>::erase_if(Predicate pred) {
+        size_type erased = 0;
+
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+            map_type &map = _shards[i].map;
+
+            for (auto it = map.begin() ; it != map.end() ; ) {
+                if (pred(static_cast<const value_type &>(*it))) {
+                    it = map.erase(it);
+                    erased++;
+                }
+                else {
+                    ++it;
+                }
+            }
+        }
+
+        return erased;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void concurrent_unordered_map<K, V, Hash, Eq, Storage>::clear() {
+        for (size_type i = 0 ; i < _n_shards ; i++) {
+            std::lock_guard<std::mutex> lock(_shards[i].lock);
+
+            _shards[i].map.clear();
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    cumap_t::size_type concurrent_unordered_map<K, V, Hash, Eq, Storage>::count(const key_type &key) const {
+        shard &s = _shard_of(key);
+        std::lock_guard<std::mutex> lock(s.lock);
+
+        return s.map.count(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool concurrent_unordered_map<K, V, Hash, Eq, Storage>::contains(const key_type &key) const {
+        return count(key) != 0;
+    }
+
+    /* Private member functions.  */
+
+    /* The high 32 bits of the mixed hash scaled to the shard count. The shards mix the user hash with their
+       own seeds, so the keys of one shard still spread over its whole table.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    cumap_t::shard &concurrent_unordered_map<K, V, Hash, Eq, Storage>::_shard_of(const key_type &key) const {
+        uint64_t hash = mix(_hasher(key), _seed);
+
+        return _shards[((hash >> 32) * _n_shards) >> 32];
+    }
+}
@@ -0,0 +1,817 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <cstddef>
+#include <iterator>
+
+#include "vector.h"
+#include "../internal/flat_internal.h"
+#include "../internal/container_tags.h"
+
+#define flat_map_t typename flat_map<K, V, Less, Layout>
+
+using namespace flat_internal;
+
+namespace adt {
+
+    /* Map kept as a sorted adt::vector of pairs, with the same interface as adt::map.
+       Elements are shifted around by insertions and erasures, so value_type is std::pair<K, V>
+       rather than std::pair<const K, V>: modifying the key through an iterator breaks the map.
+       Every modification invalidates iterators.
+       Layout selects how lookups search the array, see flat_internal::sorted_layout and flat_internal::eytzinger_layout.  */
+    template<typename K, typename V, class Less = std::less<K>, class Layout = sorted_layout>
+    class flat_map {
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<K, V>;
+        using key_compare = Less;
+        using value_compare = Less;
+        using reference = value_type&;
+        using const_reference = const value_type&;
+        using pointer = value_type*;
+        using const_pointer = const value_type*;
+        using difference_type = std::ptrdiff_t;
+        using size_type = std::size_t;
+        class iterator;
+        class const_iterator;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    private:
+        using internal_ptr = value_type*;
+        using layout_type = Layout;
+        using index_type = typename Layout::template index<K>;
+
+        adt::vector<value_type> _data;
+        key_compare _less;
+        index_type _index;
+
+        struct enabler {};
+
+    public:
+        class iterator {
+            friend class flat_map;
+            friend class const_iterator;
+            using internal_ptr = flat_map::internal_ptr;
+
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = flat_map::value_type;
+            using reference = flat_map::reference;
+            using pointer = flat_map::pointer;
+            using difference_type = flat_map::difference_type;
+
+            iterator() : _ptr(nullptr) {}
+            iterator(const iterator &other) = default;
+            iterator(iterator &&other) = default;
+
+            iterator &operator=(const iterator &rhs) = default;
+
+            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
+            bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+            bool operator<(const iterator &rhs) const { return this->_ptr < rhs._ptr; }
+            bool operator<=(const iterator &rhs) const { return this->_ptr <= rhs._ptr; }
+            bool operator>(const iterator &rhs) const { return this->_ptr > rhs._ptr; }
+            bool operator>=(const iterator &rhs) const { return this->_ptr >= rhs._ptr; }
+
+            iterator &operator+=(difference_type val) {
+                _ptr += val;
+                return *this;
+            }
+            iterator &operator-=(difference_type val) {
+                _ptr -= val;
+                return *this;
+            }
+            iterator &operator++() {
+                ++_ptr;
+                return *this;
+            }
+            iterator operator++(int) {
+                auto temp(*this);
+                ++_ptr;
+                return temp;
+            }
+            iterator &operator--() {
+                --_ptr;
+                return *this;
+            }
+            iterator operator--(int) {
+                auto temp(*this);
+                --_ptr;
+                return temp;
+            }
+            iterator operator+(difference_type val) const { return iterator(_ptr + val); }
+            iterator operator-(difference_type val) const { return iterator(_ptr - val); }
+            difference_type operator-(const iterator &other) const { return _ptr - other._ptr; }
+
+            reference operator[](difference_type n) const { return _ptr[n]; }
+            reference operator*() const { return *_ptr; }
+            pointer operator->() const { return _ptr; }
+
+        private:
+            internal_ptr _ptr;
+
+            explicit iterator(internal_ptr ptr) : _ptr(ptr) {}
+        };
+
+        class const_iterator {
+            friend class flat_map;
+            using internal_ptr = flat_map::const_pointer;
+
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = flat_map::value_type;
+            using reference = flat_map::const_reference;
+            using pointer = flat_map::const_pointer;
+            using difference_type = flat_map::difference_type;
+
+            const_iterator() : _ptr(nullptr) {}
+            const_iterator(const const_iterator &other) = default;
+            const_iterator(const_iterator &&other) = default;
+            /* Implicit conversion from iterator.  */
+            const_iterator(const iterator &it) : _ptr(it._ptr) {}
+
+            const_iterator &operator=(const const_iterator &rhs) = default;
+
+            bool operator==(const const_iterator &rhs) const { return this->_ptr == rhs._ptr; }
+            bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+            bool operator<(const const_iterator &rhs) const { return this->_ptr < rhs._ptr; }
+            bool operator<=(const const_iterator &rhs) const { return this->_ptr <= rhs._ptr; }
+            bool operator>(const const_iterator &rhs) const { return this->_ptr > rhs._ptr; }
+            bool operator>=(const const_iterator &rhs) const { return this->_ptr >= rhs._ptr; }
+
+            const_iterator &operator+=(difference_type val) {
+                _ptr += val;
+                return *this;
+            }
+            const_iterator &operator-=(difference_type val) {
+                _ptr -= val;
+                return *this;
+            }
+            const_iterator &operator++() {
+                ++_ptr;
+                return *this;
+            }
+            const_iterator operator++(int) {
+                auto temp(*this);
+                ++_ptr;
+                return temp;
+            }
+            const_iterator &operator--() {
+                --_ptr;
+                return *this;
+            }
+            const_iterator operator--(int) {
+                auto temp(*this);
+                --_ptr;
+                return temp;
+            }
+            const_iterator operator+(difference_type val) const { return const_iterator(_ptr + val); }
+            const_iterator operator-(difference_type val) const { return const_iterator(_ptr - val); }
+            difference_type operator-(const const_iterator &other) const { return _ptr - other._ptr; }
+
+            reference operator[](difference_type n) const { return _ptr[n]; }
+            reference operator*() const { return *_ptr; }
+            pointer operator->() const { return _ptr; }
+
+        private:
+            internal_ptr _ptr;
+
+            explicit const_iterator(internal_ptr ptr) : _ptr(ptr) {}
+        };
+
+        /* Constructors/Destructors.  */
+        flat_map(const key_compare &keq = key_compare()) noexcept;
+        template<class InputIt, flat_internal::enable_if_iterator<InputIt> = 0>
+        flat_map(InputIt first, InputIt last, const key_compare &keq = key_compare());
+        template<class InputIt>
+        flat_map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq = key_compare());
+        flat_map(const flat_map &other);
+        flat_map(flat_map &&other) noexcept;
+        ~flat_map();
+        flat_map &operator=(flat_map rhs);
+
+        /* Iterators.  */
+        iterator begin() noexcept;
+        const_iterator begin() const noexcept;
+        iterator end() noexcept;
+        const_iterator end() const noexcept;
+        reverse_iterator rbegin() noexcept;
+        const_reverse_iterator rbegin() const noexcept;
+        reverse_iterator rend() noexcept;
+        const_reverse_iterator rend() const noexcept;
+        const_iterator cbegin() const noexcept;
+        const_iterator cend() const noexcept;
+        const_reverse_iterator crbegin() const noexcept;
+        const_reverse_iterator crend() const noexcept;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+        size_type capacity() const noexcept;
+        void reserve(size_type n);
+
+        /* Observers.  */
+        key_compare key_comp() const;
+        value_compare value_comp() const;
+
+        /* Element access.  */
+        mapped_type &operator[](const key_type &key);
+        mapped_type &operator[](key_type &&key);
+        mapped_type &at(const key_type &key) noexcept(false);
+        const mapped_type &at(const key_type &key) const noexcept(false);
+
+        /* Modifiers.  */
+        std::pair<iterator, bool> insert(const value_type &val);
+        template<class P>
+        std::pair<iterator, bool> insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type = enabler());
+        template<class InputIt, flat_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class InputIt>
+        void insert(sorted_unique_t, InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        template<class P>
+        iterator insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type = enabler());
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args&&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj);
+        iterator erase(const_iterator pos);
+        size_type erase(const key_type &key);
+        iterator erase(const_iterator first, const_iterator last);
+        void clear() noexcept;
+        void swap(flat_map &x);
+
+        /* Operations.  */
+        iterator find(const key_type &key);
+        const_iterator find(const key_type &key) const;
+        size_type count(const key_type &key) const;
+        iterator lower_bound(const key_type &key);
+        const_iterator lower_bound(const key_type &key) const;
+        iterator upper_bound(const key_type &key);
+        const_iterator upper_bound(const key_type &key) const;
+        std::pair<iterator, iterator> equal_range(const key_type &key);
+        std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+
+        /* Order statistics, O(1) except rank().  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        iterator lower_bound(const Key &key);
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator lower_bound(const Key &key) const;
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        iterator upper_bound(const Key &key);
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator upper_bound(const Key &key) const;
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, flat_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+
+        friend void swap(flat_map &lhs, flat_map &rhs) {
+            lhs.swap(rhs);
+        }
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_partition_point(Container *cnt, Pred go_right, sorted_layout);
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_partition_point(Container *cnt, Pred go_right, eytzinger_layout);
+
+        template<class Container, typename Key>
+        friend std::size_t flat_internal::_flat_lower_bound(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend std::size_t flat_internal::_flat_upper_bound(Container *cnt, const Key &key);
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_eytzinger_search(Container *cnt, Pred go_right);
+
+        template<class Container, typename Key>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const Key &key, sorted_layout);
+
+        template<class Container, typename Key>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const Key &key, eytzinger_layout);
+
+        template<class Container, typename Key>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const Key &key);
+
+        template<class Container>
+        friend std::size_t flat_internal::_flat_eytzinger_fill(Container *cnt, std::size_t i, std::size_t k);
+
+        template<class Container>
+        friend void flat_internal::_flat_reindex(Container *cnt, eytzinger_layout);
+
+        template<class Container>
+        friend void flat_internal::_flat_reindex(Container *cnt);
+
+        template<class Container>
+        friend void flat_internal::_flat_rotate_back(Container *cnt, std::size_t pos);
+
+        template<class Container>
+        friend void flat_internal::_flat_erase(Container *cnt, std::size_t first, std::size_t last);
+
+        template<class Container>
+        friend void flat_internal::_flat_merge_back(Container *cnt, std::size_t old_size, bool sorted_unique);
+
+    private:
+        static const key_type &_get_key(const value_type &val);
+        size_type _insert_position(const_iterator hint, const key_type &key, bool &found);
+        std::pair<iterator, bool> _insert(const_iterator hint, value_type &&val);
+        template<typename Key, class... Args>
+        std::pair<iterator, bool> _try_emplace(Key &&key, Args&&... args);
+        template<typename Key, class M>
+        std::pair<iterator, bool> _insert_or_assign(Key &&key, M &&obj);
+        iterator _make_iterator(size_type pos);
+    };
+
+    /* flat_map searched through an Eytzinger copy of its keys, for maps that are built once and read many times.  */
+    template<typename K, typename V, class Less = std::less<K>>
+    using eytzinger_map = flat_map<K, V, Less, eytzinger_layout>;
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename K, typename V, class Less, class Layout>
+    flat_map<K, V, Less, Layout>::flat_map(const key_compare &keq) noexcept : _data(), _less(keq), _index() {}
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class InputIt, flat_internal::enable_if_iterator<InputIt>>
+    flat_map<K, V, Less, Layout>::flat_map(InputIt first, InputIt last, const key_compare &keq) : flat_map(keq) {
+        insert(first, last);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class InputIt>
+    flat_map<K, V, Less, Layout>::flat_map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq) : flat_map(keq) {
+        insert(sorted_unique, first, last);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map<K, V, Less, Layout>::flat_map(const flat_map &other) : _data(other._data), _less(other._less), _index(other._index) {}
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map<K, V, Less, Layout>::flat_map(flat_map &&other) noexcept : flat_map() {
+        swap(other);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map<K, V, Less, Layout>::~flat_map() {}
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map<K, V, Less, Layout> &flat_map<K, V, Less, Layout>::operator=(flat_map rhs) {
+        swap(rhs);
+
+        return *this;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::begin() noexcept {
+        return iterator(_data.data());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::begin() const noexcept {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->begin();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::end() noexcept {
+        return iterator(_data.data() + _data.size());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::end() const noexcept {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->end();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::reverse_iterator flat_map<K, V, Less, Layout>::rbegin() noexcept {
+        return reverse_iterator(end());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_reverse_iterator flat_map<K, V, Less, Layout>::rbegin() const noexcept {
+        return const_reverse_iterator(end());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::reverse_iterator flat_map<K, V, Less, Layout>::rend() noexcept {
+        return reverse_iterator(begin());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_reverse_iterator flat_map<K, V, Less, Layout>::rend() const noexcept {
+        return const_reverse_iterator(begin());
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::cbegin() const noexcept {
+        return begin();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::cend() const noexcept {
+        return end();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_reverse_iterator flat_map<K, V, Less, Layout>::crbegin() const noexcept {
+        return rbegin();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_reverse_iterator flat_map<K, V, Less, Layout>::crend() const noexcept {
+        return rend();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    bool flat_map<K, V, Less, Layout>::empty() const noexcept {
+        return _data.empty();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::size() const noexcept {
+        return _data.size();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::capacity() const noexcept {
+        return _data.capacity();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    void flat_map<K, V, Less, Layout>::reserve(size_type n) {
+        _data.reserve(n);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::key_compare flat_map<K, V, Less, Layout>::key_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::value_compare flat_map<K, V, Less, Layout>::value_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::mapped_type &flat_map<K, V, Less, Layout>::operator[](const key_type &key) {
+        return _try_emplace(key).first->second;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::mapped_type &flat_map<K, V, Less, Layout>::operator[](key_type &&key) {
+        return _try_emplace(std::move(key)).first->second;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::mapped_type &flat_map<K, V, Less, Layout>::at(const key_type &key) noexcept(false) {
+        size_type idx = _flat_find(this, key);
+
+        /* If we found it, return the mapped value.  */
+        if (idx != _data.size()) return _data[idx].second;
+
+        throw std::out_of_range("Key is not present on the map.");
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    const flat_map_t::mapped_type &flat_map<K, V, Less, Layout>::at(const key_type &key) const noexcept(false) {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->at(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::insert(const value_type &val) {
+        return _insert(end(), value_type(val));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class P>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type) {
+        return _insert(end(), value_type(std::forward<P>(val)));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class InputIt, flat_internal::enable_if_iterator<InputIt>>
+    void flat_map<K, V, Less, Layout>::insert(InputIt first, InputIt last) {
+        size_type old_size = _data.size();
+
+        /* Append the whole batch, then sort and merge it in once.  */
+        for (; first != last ; ++first) _data.emplace_back(*first);
+        _flat_merge_back(this, old_size, false);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class InputIt>
+    void flat_map<K, V, Less, Layout>::insert(sorted_unique_t, InputIt first, InputIt last) {
+        size_type old_size = _data.size();
+
+        for (; first != last ; ++first) _data.emplace_back(*first);
+        _flat_merge_back(this, old_size, true);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::insert(const_iterator hint, const value_type &val) {
+        return _insert(hint, value_type(val)).first;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class P>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type) {
+        return _insert(hint, value_type(std::forward<P>(val))).first;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class... Args>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::emplace(Args &&... args) {
+        return _insert(end(), value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class... Args>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::emplace_hint(const_iterator hint, Args &&... args) {
+        return _insert(hint, value_type(std::forward<Args>(args)...)).first;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class... Args>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::try_emplace(const key_type &key, Args &&... args) {
+        return _try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class... Args>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::try_emplace(key_type &&key, Args &&... args) {
+        return _try_emplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class M>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::insert_or_assign(const key_type &key, M &&obj) {
+        return _insert_or_assign(key, std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class M>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::insert_or_assign(key_type &&key, M &&obj) {
+        return _insert_or_assign(std::move(key), std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::erase(const_iterator pos) {
+        size_type idx = pos - cbegin();
+
+        _flat_erase(this, idx, idx + 1);
+
+        return _make_iterator(idx);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::erase(const key_type &key) {
+        size_type idx = _flat_find(this, key);
+
+        if (idx == _data.size()) return 0;
+
+        _flat_erase(this, idx, idx + 1);
+
+        return 1;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::erase(const_iterator first, const_iterator last) {
+        size_type idx = first - cbegin();
+
+        _flat_erase(this, idx, last - cbegin());
+
+        return _make_iterator(idx);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    void flat_map<K, V, Less, Layout>::clear() noexcept {
+        _data.clear();
+        _flat_reindex(this);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    void flat_map<K, V, Less, Layout>::swap(flat_map &x) {
+        using std::swap;
+
+        swap(_data, x._data);
+        swap(_less, x._less);
+        swap(_index, x._index);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::find(const Key &key) {
+        return _make_iterator(_flat_find(this, key));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::find(const key_type &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::find(const Key &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::count(const Key &key) const {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::lower_bound(const Key &key) {
+        return _make_iterator(_flat_lower_bound(this, key));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::lower_bound(const key_type &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->lower_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::lower_bound(const Key &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->lower_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::upper_bound(const Key &key) {
+        return _make_iterator(_flat_upper_bound(this, key));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::upper_bound(const key_type &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::upper_bound(const Key &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    std::pair<flat_map_t::iterator, flat_map_t::iterator> flat_map<K, V, Less, Layout>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    std::pair<flat_map_t::iterator, flat_map_t::iterator> flat_map<K, V, Less, Layout>::equal_range(const Key &key) {
+        size_type idx = _flat_lower_bound(this, key);
+
+        /* Keys are unique, the range holds at most one element.  */
+        if (idx == _data.size() || _less(key, _data[idx].first)) return std::make_pair(_make_iterator(idx), _make_iterator(idx));
+
+        return std::make_pair(_make_iterator(idx), _make_iterator(idx + 1));
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    std::pair<flat_map_t::const_iterator, flat_map_t::const_iterator> flat_map<K, V, Less, Layout>::equal_range(const key_type &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<class Key, flat_internal::enable_lookup<Less, K, Key>>
+    std::pair<flat_map_t::const_iterator, flat_map_t::const_iterator> flat_map<K, V, Less, Layout>::equal_range(const Key &key) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::nth(size_type k) {
+        return k < _data.size() ? _make_iterator(k) : end();
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::const_iterator flat_map<K, V, Less, Layout>::nth(size_type k) const {
+        return const_cast<flat_map<K, V, Less, Layout>*>(this)->nth(k);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::rank(const key_type &key) const {
+        return _flat_lower_bound(const_cast<flat_map<K, V, Less, Layout>*>(this), key);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::difference_type flat_map<K, V, Less, Layout>::distance(const_iterator first, const_iterator last) const {
+        return last - first;
+    }
+
+    /* Private member functions.  */
+    template<typename K, typename V, class Less, class Layout>
+    const flat_map_t::key_type &flat_map<K, V, Less, Layout>::_get_key(const value_type &val) {
+        return val.first;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::size_type flat_map<K, V, Less, Layout>::_insert_position(const_iterator hint, const key_type &key, bool &found) {
+        size_type idx = hint - cbegin();
+
+        /* A good hint is the element right after key, the search is skipped then.  */
+        if ((idx == _data.size() || _less(key, _data[idx].first)) && (idx == 0 || _less(_data[idx - 1].first, key))) {
+            found = false;
+            return idx;
+        }
+
+        idx = _flat_lower_bound(this, key);
+        found = idx != _data.size() && !_less(key, _data[idx].first);
+
+        return idx;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::_insert(const_iterator hint, value_type &&val) {
+        bool found;
+        size_type idx = _insert_position(hint, val.first, found);
+
+        if (found) return std::make_pair(_make_iterator(idx), false);
+
+        _data.push_back(std::move(val));
+        _flat_rotate_back(this, idx);
+        _flat_reindex(this);
+
+        return std::make_pair(_make_iterator(idx), true);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<typename Key, class... Args>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::_try_emplace(Key &&key, Args &&... args) {
+        bool found;
+        size_type idx = _insert_position(cend(), key, found);
+
+        /* Unlike emplace, nothing is constructed when the key is already there.  */
+        if (found) return std::make_pair(_make_iterator(idx), false);
+
+        _data.emplace_back(std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        _flat_rotate_back(this, idx);
+        _flat_reindex(this);
+
+        return std::make_pair(_make_iterator(idx), true);
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    template<typename Key, class M>
+    std::pair<flat_map_t::iterator, bool> flat_map<K, V, Less, Layout>::_insert_or_assign(Key &&key, M &&obj) {
+        std::pair<iterator, bool> ret = _try_emplace(std::forward<Key>(key), std::forward<M>(obj));
+
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
+    }
+
+    template<typename K, typename V, class Less, class Layout>
+    flat_map_t::iterator flat_map<K, V, Less, Layout>::_make_iterator(size_type pos) {
+        return iterator(_data.data() + pos);
+    }
+}
@@ -0,0 +1,650 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+#include <cstddef>
+#include <iterator>
+
+#include "vector.h"
+#include "../internal/flat_internal.h"
+#include "../internal/container_tags.h"
+
+#define flat_set_t typename flat_set<Key, Less, Layout>
+
+using namespace flat_internal;
+
+namespace adt {
+
+    /* Set kept as a sorted adt::vector, with the same interface as adt::set.
+       Lookups are binary searches over contiguous memory and iteration is a linear scan,
+       single insertions and erasures shift the tail of the array (O(n)), batches are merged in one pass.
+       Every modification invalidates iterators.
+       Layout selects how lookups search the array, see flat_internal::sorted_layout and flat_internal::eytzinger_layout.  */
+    template<typename Key, class Less = std::less<Key>, class Layout = sorted_layout>
+    class flat_set {
+    public:
+        using key_type = Key;
+        using value_type = Key;
+        using key_compare = Less;
+        using value_compare = Less;
+        using reference = value_type&;
+        using const_reference = const value_type&;
+        using pointer = value_type*;
+        using const_pointer = const value_type*;
+        using difference_type = std::ptrdiff_t;
+        using size_type = std::size_t;
+        class iterator;
+        using const_iterator = iterator;
+        using reverse_iterator = std::reverse_iterator<iterator>;
+        using const_reverse_iterator = reverse_iterator;
+
+    private:
+        using internal_ptr = const value_type*;
+        using layout_type = Layout;
+        using index_type = typename Layout::template index<Key>;
+
+        adt::vector<value_type> _data;
+        key_compare _less;
+        index_type _index;
+
+    public:
+        class iterator {
+            friend class flat_set;
+            using internal_ptr = flat_set::internal_ptr;
+
+        public:
+            using iterator_category = std::random_access_iterator_tag;
+            using value_type = flat_set::value_type;
+            using reference = flat_set::const_reference;
+            using pointer = flat_set::const_pointer;
+            using difference_type = flat_set::difference_type;
+
+            iterator() : _ptr(nullptr) {}
+            iterator(const iterator &other) = default;
+            iterator(iterator &&other) = default;
+
+            iterator &operator=(const iterator &rhs) = default;
+
+            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
+            bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
+            bool operator<(const iterator &rhs) const { return this->_ptr < rhs._ptr; }
+            bool operator<=(const iterator &rhs) const { return this->_ptr <= rhs._ptr; }
+            bool operator>(const iterator &rhs) const { return this->_ptr > rhs._ptr; }
+            bool operator>=(const iterator &rhs) const { return this->_ptr >= rhs._ptr; }
+
+            iterator &operator+=(difference_type val) {
+                _ptr += val;
+                return *this;
+            }
+            iterator &operator-=(difference_type val) {
+                _ptr -= val;
+                return *this;
+            }
+            iterator &operator++() {
+                ++_ptr;
+                return *this;
+            }
+            iterator operator++(int) {
+                auto temp(*this);
+                ++_ptr;
+                return temp;
+            }
+            iterator &operator--() {
+                --_ptr;
+                return *this;
+            }
+            iterator operator--(int) {
+                auto temp(*this);
+                --_ptr;
+                return temp;
+            }
+            iterator operator+(difference_type val) const { return iterator(_ptr + val); }
+            iterator operator-(difference_type val) const { return iterator(_ptr - val); }
+            difference_type operator-(const iterator &other) const { return _ptr - other._ptr; }
+
+            reference operator[](difference_type n) const { return _ptr[n]; }
+            reference operator*() const { return *_ptr; }
+            pointer operator->() const { return _ptr; }
+
+        private:
+            internal_ptr _ptr;
+
+            explicit iterator(internal_ptr ptr) : _ptr(ptr) {}
+        };
+
+        /* Constructors/Destructors.  */
+        flat_set(const key_compare &keq = key_compare()) noexcept;
+        template<class InputIt, flat_internal::enable_if_iterator<InputIt> = 0>
+        flat_set(InputIt first, InputIt last, const key_compare &keq = key_compare());
+        template<class InputIt>
+        flat_set(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq = key_compare());
+        flat_set(const flat_set &other);
+        flat_set(flat_set &&other) noexcept;
+        ~flat_set();
+        flat_set &operator=(flat_set rhs);
+
+        /* Iterators.  */
+        iterator begin() noexcept;
+        const_iterator begin() const noexcept;
+        iterator end() noexcept;
+        const_iterator end() const noexcept;
+        reverse_iterator rbegin() noexcept;
+        const_reverse_iterator rbegin() const noexcept;
+        reverse_iterator rend() noexcept;
+        const_reverse_iterator rend() const noexcept;
+        const_iterator cbegin() const noexcept;
+        const_iterator cend() const noexcept;
+        const_reverse_iterator crbegin() const noexcept;
+        const_reverse_iterator crend() const noexcept;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+        size_type capacity() const noexcept;
+        void reserve(size_type n);
+
+        /* Observers.  */
+        key_compare key_comp() const;
+        value_compare value_comp() const;
+
+        /* Modifiers.  */
+        std::pair<iterator, bool> insert(const value_type &val);
+        std::pair<iterator, bool> insert(value_type &&val);
+        template<class InputIt, flat_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class InputIt>
+        void insert(sorted_unique_t, InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        iterator insert(const_iterator hint, value_type &&val);
+        template <class... Args>
+        std::pair<iterator, bool> emplace(Args &&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        iterator erase(const_iterator pos);
+        size_type erase(const value_type &val);
+        iterator erase(const_iterator first, const_iterator last);
+        void clear() noexcept;
+        void swap(flat_set &other);
+
+        /* Operations.  */
+        iterator find(const key_type &key);
+        const_iterator find(const key_type &key) const;
+        size_type count(const key_type &key) const;
+        iterator lower_bound(const key_type &key);
+        const_iterator lower_bound(const key_type &key) const;
+        iterator upper_bound(const key_type &key);
+        const_iterator upper_bound(const key_type &key) const;
+        std::pair<iterator, iterator> equal_range(const key_type &key);
+        std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+
+        /* Order statistics, O(1) except rank().  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        iterator lower_bound(const K &key);
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator lower_bound(const K &key) const;
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        iterator upper_bound(const K &key);
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator upper_bound(const K &key) const;
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, flat_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const K &key) const;
+
+        friend void swap(flat_set &lhs, flat_set &rhs) {
+            lhs.swap(rhs);
+        }
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_partition_point(Container *cnt, Pred go_right, sorted_layout);
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_partition_point(Container *cnt, Pred go_right, eytzinger_layout);
+
+        template<class Container, typename K>
+        friend std::size_t flat_internal::_flat_lower_bound(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend std::size_t flat_internal::_flat_upper_bound(Container *cnt, const K &key);
+
+        template<class Container, class Pred>
+        friend std::size_t flat_internal::_flat_eytzinger_search(Container *cnt, Pred go_right);
+
+        template<class Container, typename K>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const K &key, sorted_layout);
+
+        template<class Container, typename K>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const K &key, eytzinger_layout);
+
+        template<class Container, typename K>
+        friend std::size_t flat_internal::_flat_find(Container *cnt, const K &key);
+
+        template<class Container>
+        friend std::size_t flat_internal::_flat_eytzinger_fill(Container *cnt, std::size_t i, std::size_t k);
+
+        template<class Container>
+        friend void flat_internal::_flat_reindex(Container *cnt, eytzinger_layout);
+
+        template<class Container>
+        friend void flat_internal::_flat_reindex(Container *cnt);
+
+        template<class Container>
+        friend void flat_internal::_flat_rotate_back(Container *cnt, std::size_t pos);
+
+        template<class Container>
+        friend void flat_internal::_flat_erase(Container *cnt, std::size_t first, std::size_t last);
+
+        template<class Container>
+        friend void flat_internal::_flat_merge_back(Container *cnt, std::size_t old_size, bool sorted_unique);
+
+    private:
+        static const key_type &_get_key(const value_type &val);
+        size_type _insert_position(const_iterator hint, const key_type &key, bool &found);
+        template<typename V>
+        std::pair<iterator, bool> _insert(const_iterator hint, V &&val);
+        iterator _make_iterator(size_type pos) const;
+    };
+
+    /* flat_set searched through an Eytzinger copy of its keys, for sets that are built once and read many times.  */
+    template<typename Key, class Less = std::less<Key>>
+    using eytzinger_set = flat_set<Key, Less, eytzinger_layout>;
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename Key, class Less, class Layout>
+    flat_set<Key, Less, Layout>::flat_set(const key_compare &keq) noexcept : _data(), _less(keq), _index() {}
+
+    template<typename Key, class Less, class Layout>
+    template<class InputIt, flat_internal::enable_if_iterator<InputIt>>
+    flat_set<Key, Less, Layout>::flat_set(InputIt first, InputIt last, const key_compare &keq) : flat_set(keq) {
+        insert(first, last);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class InputIt>
+    flat_set<Key, Less, Layout>::flat_set(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq) : flat_set(keq) {
+        insert(sorted_unique, first, last);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set<Key, Less, Layout>::flat_set(const flat_set &other) : _data(other._data), _less(other._less), _index(other._index) {}
+
+    template<typename Key, class Less, class Layout>
+    flat_set<Key, Less, Layout>::flat_set(flat_set &&other) noexcept : flat_set() {
+        swap(other);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set<Key, Less, Layout>::~flat_set() {}
+
+    template<typename Key, class Less, class Layout>
+    flat_set<Key, Less, Layout> &flat_set<Key, Less, Layout>::operator=(flat_set rhs) {
+        swap(rhs);
+
+        return *this;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::begin() noexcept {
+        return iterator(_data.data());
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::begin() const noexcept {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->begin();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::end() noexcept {
+        return iterator(_data.data() + _data.size());
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::end() const noexcept {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->end();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::reverse_iterator flat_set<Key, Less, Layout>::rbegin() noexcept {
+        return reverse_iterator(end());
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_reverse_iterator flat_set<Key, Less, Layout>::rbegin() const noexcept {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->rbegin();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::reverse_iterator flat_set<Key, Less, Layout>::rend() noexcept {
+        return reverse_iterator(begin());
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_reverse_iterator flat_set<Key, Less, Layout>::rend() const noexcept {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->rend();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::cbegin() const noexcept {
+        return begin();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::cend() const noexcept {
+        return end();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_reverse_iterator flat_set<Key, Less, Layout>::crbegin() const noexcept {
+        return rbegin();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_reverse_iterator flat_set<Key, Less, Layout>::crend() const noexcept {
+        return rend();
+    }
+
+    template<typename Key, class Less, class Layout>
+    bool flat_set<Key, Less, Layout>::empty() const noexcept {
+        return _data.empty();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::size() const noexcept {
+        return _data.size();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::capacity() const noexcept {
+        return _data.capacity();
+    }
+
+    template<typename Key, class Less, class Layout>
+    void flat_set<Key, Less, Layout>::reserve(size_type n) {
+        _data.reserve(n);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::key_compare flat_set<Key, Less, Layout>::key_comp() const {
+        return _less;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::value_compare flat_set<Key, Less, Layout>::value_comp() const {
+        return _less;
+    }
+
+    template<typename Key, class Less, class Layout>
+    std::pair<flat_set_t::iterator, bool> flat_set<Key, Less, Layout>::insert(const value_type &val) {
+        return _insert(end(), val);
+    }
+
+    template<typename Key, class Less, class Layout>
+    std::pair<flat_set_t::iterator, bool> flat_set<Key, Less, Layout>::insert(value_type &&val) {
+        return _insert(end(), std::move(val));
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class InputIt, flat_internal::enable_if_iterator<InputIt>>
+    void flat_set<Key, Less, Layout>::insert(InputIt first, InputIt last) {
+        size_type old_size = _data.size();
+
+        /* Append the whole batch, then sort and merge it in once.  */
+        for (; first != last ; ++first) _data.emplace_back(*first);
+        _flat_merge_back(this, old_size, false);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class InputIt>
+    void flat_set<Key, Less, Layout>::insert(sorted_unique_t, InputIt first, InputIt last) {
+        size_type old_size = _data.size();
+
+        for (; first != last ; ++first) _data.emplace_back(*first);
+        _flat_merge_back(this, old_size, true);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::insert(const_iterator hint, const value_type &val) {
+        return _insert(hint, val).first;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::insert(const_iterator hint, value_type &&val) {
+        return _insert(hint, std::move(val)).first;
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class... Args>
+    std::pair<flat_set_t::iterator, bool> flat_set<Key, Less, Layout>::emplace(Args &&... args) {
+        return _insert(end(), value_type(std::forward<Args>(args)...));
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class... Args>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::emplace_hint(const_iterator hint, Args &&... args) {
+        return _insert(hint, value_type(std::forward<Args>(args)...)).first;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::erase(const_iterator pos) {
+        size_type idx = pos - begin();
+
+        _flat_erase(this, idx, idx + 1);
+
+        return _make_iterator(idx);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::erase(const value_type &val) {
+        size_type idx = _flat_find(this, val);
+
+        if (idx == _data.size()) return 0;
+
+        _flat_erase(this, idx, idx + 1);
+
+        return 1;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::erase(const_iterator first, const_iterator last) {
+        size_type idx = first - begin();
+
+        _flat_erase(this, idx, last - begin());
+
+        return _make_iterator(idx);
+    }
+
+    template<typename Key, class Less, class Layout>
+    void flat_set<Key, Less, Layout>::clear() noexcept {
+        _data.clear();
+        _flat_reindex(this);
+    }
+
+    template<typename Key, class Less, class Layout>
+    void flat_set<Key, Less, Layout>::swap(flat_set &other) {
+        using std::swap;
+
+        swap(_data, other._data);
+        swap(_less, other._less);
+        swap(_index, other._index);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::find(const K &key) {
+        return _make_iterator(_flat_find(this, key));
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::find(const key_type &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->find(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::find(const K &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->find(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::count(const K &key) const {
+        return find(key) != end() ? 1 : 0;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::lower_bound(const K &key) {
+        return _make_iterator(_flat_lower_bound(this, key));
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::lower_bound(const key_type &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->lower_bound(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::lower_bound(const K &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->lower_bound(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::upper_bound(const K &key) {
+        return _make_iterator(_flat_upper_bound(this, key));
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::upper_bound(const key_type &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::upper_bound(const K &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    std::pair<flat_set_t::iterator, flat_set_t::iterator> flat_set<Key, Less, Layout>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    std::pair<flat_set_t::iterator, flat_set_t::iterator> flat_set<Key, Less, Layout>::equal_range(const K &key) {
+        size_type idx = _flat_lower_bound(this, key);
+
+        /* Keys are unique, the range holds at most one element.  */
+        if (idx == _data.size() || _less(key, _data[idx])) return std::make_pair(_make_iterator(idx), _make_iterator(idx));
+
+        return std::make_pair(_make_iterator(idx), _make_iterator(idx + 1));
+    }
+
+    template<typename Key, class Less, class Layout>
+    std::pair<flat_set_t::const_iterator, flat_set_t::const_iterator> flat_set<Key, Less, Layout>::equal_range(const key_type &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<class K, flat_internal::enable_lookup<Less, Key, K>>
+    std::pair<flat_set_t::const_iterator, flat_set_t::const_iterator> flat_set<Key, Less, Layout>::equal_range(const K &key) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::nth(size_type k) {
+        return k < _data.size() ? _make_iterator(k) : end();
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::const_iterator flat_set<Key, Less, Layout>::nth(size_type k) const {
+        return const_cast<flat_set<Key, Less, Layout>*>(this)->nth(k);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::rank(const key_type &key) const {
+        return _flat_lower_bound(const_cast<flat_set<Key, Less, Layout>*>(this), key);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::difference_type flat_set<Key, Less, Layout>::distance(const_iterator first, const_iterator last) const {
+        return last - first;
+    }
+
+    /* Private member functions.  */
+    template<typename Key, class Less, class Layout>
+    const flat_set_t::key_type &flat_set<Key, Less, Layout>::_get_key(const value_type &val) {
+        return val;
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::size_type flat_set<Key, Less, Layout>::_insert_position(const_iterator hint, const key_type &key, bool &found) {
+        size_type idx = hint - begin();
+
+        /* A good hint is the element right after key, the search is skipped then.  */
+        if ((idx == _data.size() || _less(key, _data[idx])) && (idx == 0 || _less(_data[idx - 1], key))) {
+            found = false;
+            return idx;
+        }
+
+        idx = _flat_lower_bound(this, key);
+        found = idx != _data.size() && !_less(key, _data[idx]);
+
+        return idx;
+    }
+
+    template<typename Key, class Less, class Layout>
+    template<typename V>
+    std::pair<flat_set_t::iterator, bool> flat_set<Key, Less, Layout>::_insert(const_iterator hint, V &&val) {
+        bool found;
+        size_type idx = _insert_position(hint, val, found);
+
+        if (found) return std::make_pair(_make_iterator(idx), false);
+
+        _data.push_back(std::forward<V>(val));
+        _flat_rotate_back(this, idx);
+        _flat_reindex(this);
+
+        return std::make_pair(_make_iterator(idx), true);
+    }
+
+    template<typename Key, class Less, class Layout>
+    flat_set_t::iterator flat_set<Key, Less, Layout>::_make_iterator(size_type pos) const {
+        return iterator(_data.data() + pos);
+    }
+}
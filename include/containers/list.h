@@ -371,13 +371,13 @@ namespace adt {
     }
 
     template<typename T>
-    list<T>::list(const list<T> &other) : _head(nullptr), _sentinel(nullptr), _size(0) {
-        if (!other.empty()) _copy_from_container(other);
+    list<T>::list(const list<T> &other) : list() {
+        _copy_from_container(other);
     }
 
     template<typename T>
-    list<T>::list(std::initializer_list<T> &il) : _head(nullptr), _sentinel(nullptr), _size(0) {
-        if (il.size() != 0) _copy_from_container(il);
+    list<T>::list(std::initializer_list<T> &il) : list() {
+        _copy_from_container(il);
     }
 
     template<typename T>
@@ -698,23 +698,9 @@ namespace adt {
     template<typename T>
     template<typename Container>
     void list<T>::_copy_from_container(const Container &other) {
-
-        _head = *(other.begin());
-        _sentinel = new list_node();
-        _sentinel->previous = _head;
-        _head->previous = _sentinel;
-
-        iterator it = ++(other.begin());
-        iterator end = other.end();
-
-        for (; it != end ; it++) {
-            list_node *new_node(new list_node(*it));
-            _sentinel->previous->next = new_node;
-            new_node->previous = _sentinel->previous;
-            _sentinel->previous = new_node;
-            new_node->next = _sentinel;
+        for (auto it = other.begin() ; it != other.end() ; ++it) {
+            _push_back(new list_node(*it));
         }
-        _size = other._size;
     }
 
     template<typename T>
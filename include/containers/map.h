@@ -1,14 +1,18 @@
 #pragma once
 
+#include <tuple>
+
 #include "../internal/rbtree_internal.h"
+#include "../internal/container_tags.h"
 
-#define map_t typename map<K, V, Less>
+#define map_t typename map<K, V, Less, Alloc, Stats>
 
 using namespace rbtree_internal;
 
 namespace adt {
 
-    template<typename K, typename V, class Less = std::less<K>>
+    /* Stats selects the node layout, see rbtree_internal::no_order_statistics and rbtree_internal::order_statistics.  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>, class Stats = no_order_statistics>
     class map {
     public:
         using key_type = K;
@@ -22,6 +26,7 @@ namespace adt {
         using const_pointer = const value_type*;
         using difference_type = std::ptrdiff_t;
         using size_type = std::size_t;
+        using allocator_type = Alloc;
         class iterator;
         class const_iterator;
         class reverse_iterator;
@@ -30,11 +35,15 @@ namespace adt {
     private:
         using node_type = std::pair<K, V>;
         using internal_ptr = rb_node<node_type>*;
+        using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<typename Stats::template node<node_type>>;
+        using sentinel_type = rb_sentinel<typename Stats::template node<node_type>, node_type>;
+        using stats_type = Stats;
 
         internal_ptr _root;
         internal_ptr _sentinel;
         size_type _size;
         key_compare _less;
+        node_allocator _node_alloc;
 
         template<typename U>
         struct handle_return_overload {
@@ -51,6 +60,13 @@ namespace adt {
         typedef handle_return_overload<tag_ignore> to_ignore;
         typedef handle_return_overload<tag_delete> to_delete;
 
+        /* Arguments of try_emplace, the node is built from them only if the key is absent.  */
+        template<typename KeyArgs, typename MappedArgs>
+        struct piecewise_args {
+            KeyArgs key;
+            MappedArgs mapped;
+        };
+
         struct enabler {};
 
     public:
@@ -99,10 +115,10 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
+                    current = _ptr->parent();
                     while (current != nullptr && _ptr == current->right) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
@@ -129,10 +145,10 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
-                    while (current->parent != nullptr && _ptr == current->left) {
+                    current = _ptr->parent();
+                    while (current->parent() != nullptr && _ptr == current->left) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
@@ -152,8 +168,8 @@ namespace adt {
 
             void swap(iterator &lhs, iterator& rhs) { std::swap(lhs, rhs); }
 
-            template<class Container>
-            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename Key>
+            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const Key &key);
 
         private:
             internal_ptr _sentinel;
@@ -307,7 +323,11 @@ namespace adt {
         };
 
         /* Constructors/Destructors.  */
-        map(const key_compare &keq = key_compare()) noexcept;
+        map(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        map(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        template<class InputIt>
+        map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
         explicit map(const map &other) noexcept;
         map(map &&other) noexcept;
         ~map();
@@ -334,6 +354,7 @@ namespace adt {
         /* Observers.  */
         key_compare key_comp() const;
         value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
 
         /* Element access.  */
         mapped_type &operator[](const key_type &key);
@@ -345,13 +366,32 @@ namespace adt {
         std::pair<iterator, bool> insert(const value_type &val);
         template<class P>
         std::pair<iterator, bool> insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class InputIt>
+        void insert(sorted_unique_t, InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        template<class P>
+        iterator insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         template<class... Args>
         std::pair<iterator, bool> emplace(Args&&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj);
         iterator erase(const_iterator pos);
         size_type erase(const key_type &key);
         iterator erase(const_iterator first, const_iterator last);
         void clear() noexcept;
         void swap(map &x);
+        map split(const key_type &key);
+        void join(map &other);
 
         /* Operations.  */
         iterator find(const key_type &key);
@@ -363,18 +403,40 @@ namespace adt {
         const_iterator upper_bound(const key_type &key) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
-
-        friend void swap(map& lhs, map& rhs) {
-            using std::swap;
-
-            swap(lhs._root, rhs._root);
-            swap(lhs._sentinel, rhs._sentinel);
-            swap(lhs._less, rhs._less);
-            swap(lhs._size, rhs._size);
+        size_type count_range(const key_type &lo, const key_type &hi) const;
+
+        /* Order statistics, Stats must be order_statistics.  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator lower_bound(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator lower_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator upper_bound(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator upper_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+
+        friend void swap(map &lhs, map &rhs) {
+            lhs.swap(rhs);
         }
 
         template<class Container>
-        friend void rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
+        friend std::size_t rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
 
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_left_of(rb_node<container::node_type> *tnode);
@@ -412,17 +474,106 @@ namespace adt {
         template<class Container, typename R, typename Key, typename Value, typename... Args>
         friend R rbtree_internal::_rbtree_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
+        template<class Container, typename R>
+        friend R rbtree_internal::_rbtree_insert_fixup(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container, typename Key>
+        friend neighbor_t rbtree_internal::_rbtree_hint_position(Container *cnt, rb_node<container::node_type> *hint, const Key &key, rb_node<container::node_type> **parent);
+
+        template<class Container, typename R, typename Key, typename Value, typename... Args>
+        friend R rbtree_internal::_rbtree_insert_hint(Container *cnt, rb_node<container::node_type> *hint, const Key &key, Value val, Args &&... args);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_build_balanced(rb_node<container::node_type> **head, std::size_t n, std::size_t depth, std::size_t red_depth);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_link_sorted(Container *cnt, rb_node<container::node_type> *head, std::size_t n);
+
+        template<class Container, class InputIt>
+        friend void rbtree_internal::_rbtree_insert_range(Container *cnt, InputIt first, InputIt last, bool assume_sorted);
+
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_prepare_erase(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
 
+        template<class Container, typename Key>
+        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_bound(Container *cnt, const Key &key, bool upper);
+
+        template<class Container, typename Key>
+        friend std::pair<rb_node<container::node_type>*, rb_node<container::node_type>*> rbtree_internal::_rbtree_equal_range(Container *cnt, const Key &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_count(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_set_count(rb_node<container::node_type> *tnode, std::size_t count);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_weight(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_add_count(rb_node<container::node_type> *tnode, rb_node<container::node_type> *sentinel, std::size_t delta);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_rotate_count(rb_node<container::node_type> *top, rb_node<container::node_type> *new_top, rb_node<container::node_type> *moved);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_count(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_select(Container *cnt, std::size_t &k);
+
+        template<class Container, typename Key>
+        friend std::size_t rbtree_internal::_rbtree_rank(Container *cnt, const Key &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_index(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_minimum(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_maximum(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_black_height(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_join(rb_node<container::node_type> *left, std::size_t left_height, rb_node<container::node_type> *pivot,
+                                                                            rb_node<container::node_type> *right, std::size_t right_height, std::size_t &height);
+
+        template<class Container, typename Key>
+        friend void rbtree_internal::_rbtree_split(Container *cnt, rb_node<container::node_type> *tnode, std::size_t height, const Key &key,
+                                                   rb_node<container::node_type> **left, std::size_t &left_height, rb_node<container::node_type> **right, std::size_t &right_height);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_split_size(rb_node<container::node_type> *left, rb_node<container::node_type> *right, std::size_t total);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_attach(Container *cnt, rb_node<container::node_type> *root, std::size_t size);
+
+        template<class Container, typename Key>
+        friend void rbtree_internal::_rbtree_split_tree(Container *cnt, Container *other, const Key &key);
+
+        template<class Container>
+        friend bool rbtree_internal::_rbtree_join_appends(Container *cnt, Container *other);
+
         template<class Container>
-        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_join_trees(Container *cnt, Container *other);
 
         template<class Container>
-        friend bool rbtree_internal::_rbtree_is_equal_key(Container *cnt, const container::key_type &lhs_key, const container::key_type &rhs_key);
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_concat(Container *cnt, rb_node<container::node_type> *left, rb_node<container::node_type> *right);
 
         template<class Container>
-        friend rb_node<container::node_type> *rbtree_internal::_rbtree_find_bound(Container *cnt, rb_node<container::node_type> *tnode, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_erase_range(Container *cnt, rb_node<container::node_type> *first, rb_node<container::node_type> *last);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_append_copy(Container *cnt, rb_node<container::node_type> **head, rb_node<container::node_type> **tail, std::size_t &n, rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_set_operation(Container *cnt, Container *lhs, Container *rhs, set_operation_t operation);
 
     private:
         internal_ptr _copy_tree(internal_ptr other_root);
@@ -432,169 +583,180 @@ namespace adt {
         internal_ptr _construct_new_element(internal_ptr val);
         internal_ptr _construct_new_element(const key_type &key);
         internal_ptr _construct_new_element(key_type &&key);
+        template<typename KeyArgs, typename MappedArgs>
+        internal_ptr _construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args);
         std::pair<iterator, bool> _handle_elem_found(internal_ptr ptr, to_ignore obj);
         std::pair<iterator, bool> _handle_elem_found(internal_ptr ptr, to_delete obj);
         std::pair<iterator, bool> _handle_elem_not_found(internal_ptr ptr);
         const key_type &_get_key(rb_node<node_type> *tnode);
-        void _clear_node(internal_ptr tnode);
+        size_type _clear_node(internal_ptr tnode);
         std::pair<rb_node<node_type> *, size_type> _erase(const_iterator pos);
     };
 
+    /* map that keeps subtree sizes, for nth(), rank() and distance() in O(log n).  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>>
+    using ranked_map = map<K, V, Less, Alloc, order_statistics>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename K, typename V, class Less>
-    map<K, V, Less>::map(const key_compare &keq) noexcept : _root(nullptr), _size(0), _less(keq) {
-        _sentinel = new rb_node<node_type>();
-    }
-
-    template<typename K, typename V, class Less>
-    map<K, V, Less>::map(const map &other) noexcept {
-        if (this != &other) {
-            /* Create an exact copy of this map, O(n).  */
-            _root = _copy_tree(other._root);
-            _sentinel = new rb_node<node_type>();
-            _sentinel->left = _root;
-            _root->parent = _sentinel;
-            _less = other._less;
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats>::map(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _node_alloc(alloc) {
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
     }
 
-    template<typename K, typename V, class Less>
-    map<K, V, Less>::map(map &&other) noexcept : map() {
-        swap(*this, other);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats>::map(const map &other) noexcept
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _node_alloc(std::allocator_traits<node_allocator>::select_on_container_copy_construction(other._node_alloc)) {
+        /* Create an exact copy of this map, O(n).  */
+        _root = _copy_tree(other._root);
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
+        _sentinel->left = _root;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+        if (_root) _root->set_parent(_sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    map<K, V, Less>::~map() {
-        if (_root != nullptr) {
-            clear();
-            delete _sentinel;
-        } else {
-            if (_sentinel) delete _sentinel;
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats>::map(map &&other) noexcept : map() {
+        swap(other);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    map<K, V, Less, Alloc, Stats>::map(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc) : map(keq, alloc) {
+        insert(first, last);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class InputIt>
+    map<K, V, Less, Alloc, Stats>::map(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc) : map(keq, alloc) {
+        insert(sorted_unique, first, last);
     }
 
-    template<typename K, typename V, class Less>
-    map<K, V, Less> &map<K, V, Less>::operator=(map rhs) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats>::~map() {
+        /* The allocator gives its blocks back on its own, no need to walk the tree.  */
+        if (_rbtree_can_drop_nodes<node_allocator, node_type>(_node_alloc)) return;
+
+        clear();
+        _rbtree_delete_sentinel<sentinel_type>(_node_alloc, _sentinel);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats> &map<K, V, Less, Alloc, Stats>::operator=(map rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
 
         return *this;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::begin() noexcept {
-        internal_ptr current = _root;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::begin() noexcept {
+        internal_ptr current = _rbtree_first<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->left != nullptr) {
-                current = current->left;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return iterator(_sentinel, current);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::begin() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->begin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::begin() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::end() noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::end() noexcept {
         return iterator(_sentinel, _sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::end() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->end();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::end() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::reverse_iterator map<K, V, Less>::rbegin() noexcept {
-        internal_ptr current = _root;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::reverse_iterator map<K, V, Less, Alloc, Stats>::rbegin() noexcept {
+        internal_ptr current = _rbtree_last<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->right != nullptr) {
-                current = current->right;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return reverse_iterator(_sentinel, current);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_reverse_iterator map<K, V, Less>::rbegin() const {
-        return const_cast<map<K, V, Less>*>(this)->rbegin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_reverse_iterator map<K, V, Less, Alloc, Stats>::rbegin() const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::reverse_iterator map<K, V, Less>::rend() noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::reverse_iterator map<K, V, Less, Alloc, Stats>::rend() noexcept {
         return reverse_iterator(_sentinel, _sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_reverse_iterator map<K, V, Less>::rend() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->rend();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_reverse_iterator map<K, V, Less, Alloc, Stats>::rend() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::cbegin() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->begin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::cbegin() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::cend() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->end();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::cend() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_reverse_iterator map<K, V, Less>::crbegin() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->rbegin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_reverse_iterator map<K, V, Less, Alloc, Stats>::crbegin() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_reverse_iterator map<K, V, Less>::crend() const noexcept {
-        return const_cast<map<K, V, Less>*>(this)->rend();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_reverse_iterator map<K, V, Less, Alloc, Stats>::crend() const noexcept {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename K, typename V, class Less>
-    bool map<K, V, Less>::empty() const noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    bool map<K, V, Less, Alloc, Stats>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::size_type map<K, V, Less>::size() const noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::size() const noexcept {
         return _size;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::key_compare map<K, V, Less>::key_comp() const {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::key_compare map<K, V, Less, Alloc, Stats>::key_comp() const {
         return _less;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::value_compare map<K, V, Less>::value_comp() const {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::value_compare map<K, V, Less, Alloc, Stats>::value_comp() const {
         return _less;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::mapped_type &map<K, V, Less>::operator[](const key_type &key) {
-        return (*((insert(std::make_pair(key,mapped_type()))).first)).second;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::allocator_type map<K, V, Less, Alloc, Stats>::get_allocator() const noexcept {
+        return allocator_type(_node_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::mapped_type &map<K, V, Less, Alloc, Stats>::operator[](const key_type &key) {
+        return try_emplace(key).first->second;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::mapped_type &map<K, V, Less>::operator[](key_type &&key) {
-        return (*((insert(std::make_pair(key,mapped_type()))).first)).second;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::mapped_type &map<K, V, Less, Alloc, Stats>::operator[](key_type &&key) {
+        return try_emplace(std::move(key)).first->second;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::mapped_type &map<K, V, Less>::at(const key_type &key) noexcept(false) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::mapped_type &map<K, V, Less, Alloc, Stats>::at(const key_type &key) noexcept(false) {
         iterator it = find(key);
 
         /* If we found it, return the mapped value.  */
@@ -603,215 +765,470 @@ namespace adt {
         throw std::out_of_range("Key is not present on the map.");
     }
 
-    template<typename K, typename V, class Less>
-    const map_t::mapped_type &map<K, V, Less>::at(const key_type &key) const noexcept(false) {
-        return const_cast<map<K, V, Less>*>(this)->at(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    const map_t::mapped_type &map<K, V, Less, Alloc, Stats>::at(const key_type &key) const noexcept(false) {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->at(key);
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::insert(const value_type &val) {
-        return _rbtree_insert<map<K, V, Less>, std::pair<iterator, bool>, key_type, const value_type&>(this, val.first, val, to_ignore());
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::insert(const value_type &val) {
+        return _rbtree_insert<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, const value_type&>(this, val.first, val, to_ignore());
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<class P>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return _rbtree_insert<map<K, V, Less>, std::pair<iterator, bool>, key_type, P&&>(this, val.first, std::forward<P>(val), to_ignore());
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_insert<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, P&&>(this, val.first, std::forward<P>(val), to_ignore());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    void map<K, V, Less, Alloc, Stats>::insert(InputIt first, InputIt last) {
+        /* Sorted input into an empty map is linked into a balanced tree in O(n).  */
+        _rbtree_insert_range<map<K, V, Less, Alloc, Stats>>(this, first, last, false);
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class InputIt>
+    void map<K, V, Less, Alloc, Stats>::insert(sorted_unique_t, InputIt first, InputIt last) {
+        _rbtree_insert_range<map<K, V, Less, Alloc, Stats>>(this, first, last, true);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::insert(const_iterator hint, const value_type &val) {
+        return _rbtree_insert_hint<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, const value_type&>(this, hint._it._ptr, val.first, val, to_ignore()).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class P>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_insert_hint<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, P&&>(this, hint._it._ptr, val.first, std::forward<P>(val), to_ignore()).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<class... Args>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::emplace(Args &&... args) {
-        internal_ptr val = new rb_node<node_type>(std::forward<Args>(args)...);
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::emplace(Args &&... args) {
+        internal_ptr val = _rbtree_new_node(_node_alloc, std::forward<Args>(args)...);
 
-        return _rbtree_insert<map<K, V, Less>, std::pair<iterator, bool>, key_type, internal_ptr>(this, val->data.first, val, to_delete(val));
+        return _rbtree_insert<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, internal_ptr>(this, val->data.first, val, to_delete(val));
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::erase(const_iterator pos) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::emplace_hint(const_iterator hint, Args &&... args) {
+        internal_ptr val = _rbtree_new_node(_node_alloc, std::forward<Args>(args)...);
+
+        return _rbtree_insert_hint<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, internal_ptr>(this, hint._it._ptr, val->data.first, val, to_delete(val)).first;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::try_emplace(const key_type &key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<const key_type&>, std::tuple<Args&&...>>;
+
+        return _rbtree_insert<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::try_emplace(key_type &&key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<key_type&&>, std::tuple<Args&&...>>;
+
+        /* The key is only moved from once the search is over and a node has to be built.  */
+        return _rbtree_insert<map<K, V, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class M>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::insert_or_assign(const key_type &key, M &&obj) {
+        auto ret = try_emplace(key, std::forward<M>(obj));
+
+        /* obj was left untouched if the key was already there.  */
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class M>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::insert_or_assign(key_type &&key, M &&obj) {
+        auto ret = try_emplace(std::move(key), std::forward<M>(obj));
+
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::erase(const_iterator pos) {
         return {_sentinel, _erase(pos).first};
     }
 
-    template<typename K, typename V, class Less>
-    map_t::size_type map<K, V, Less>::erase(const key_type &key) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::erase(const key_type &key) {
         return _erase(find(key)).second;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::erase(const_iterator first, const_iterator last) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::erase(const_iterator first, const_iterator last) {
         auto it = first._it;
+        size_type n = 0;
+
+        /* A short range is erased one element at a time, counted beforehand since erase() may move
+           the data of the next element and invalidate last.  */
+        for (; it != last._it && n < _rbtree_short_range ; ++it) n++;
+        if (it == last._it) {
+            for (it = first._it ; n > 0 ; n--) it = erase(it);
+            return it;
+        }
 
-        while (it != last._it) it = erase(it);
+        _rbtree_erase_range<map<K, V, Less, Alloc, Stats>>(this, first._it._ptr, last._it._ptr);
 
-        return it;
+        return {_sentinel, last._it._ptr};
     }
 
-    template<typename K, typename V, class Less>
-    void map<K, V, Less>::clear() noexcept {
-        _rbtree_destruct<map<K, V, Less>>(this, _root);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void map<K, V, Less, Alloc, Stats>::clear() noexcept {
+        _rbtree_destruct<map<K, V, Less, Alloc, Stats>>(this, _root);
         _sentinel->left = nullptr;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
         _root = nullptr;
         _size = 0;
     }
 
-    template<typename K, typename V, class Less>
-    void map<K, V, Less>::swap(map &x) {
-        swap(*this, x);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void map<K, V, Less, Alloc, Stats>::swap(map &x) {
+        using std::swap;
+
+        swap(_root, x._root);
+        swap(_sentinel, x._sentinel);
+        swap(_less, x._less);
+        swap(_size, x._size);
+        swap(_node_alloc, x._node_alloc);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::find(const key_type &key) {
-        return _rbtree_find<map<K, V, Less>>(this, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats> map<K, V, Less, Alloc, Stats>::split(const key_type &key) {
+        map other(_less, get_allocator());
+
+        /* Nodes can only change hands between allocators that compare equal.  */
+        if (!(_node_alloc == other._node_alloc)) {
+            auto first = lower_bound(key);
+
+            other.insert(sorted_unique, first, end());
+            erase(first, end());
+            return other;
+        }
+
+        _rbtree_split_tree<map<K, V, Less, Alloc, Stats>>(this, &other, key);
+        return other;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void map<K, V, Less, Alloc, Stats>::join(map &other) {
+        if (this == &other || other.empty()) return;
+
+        if (!(_node_alloc == other._node_alloc)) {
+            /* Only checks that the keys do not overlap.  */
+            _rbtree_join_appends<map<K, V, Less, Alloc, Stats>>(this, &other);
+            insert(other.begin(), other.end());
+            other.clear();
+            return;
+        }
+
+        _rbtree_join_trees<map<K, V, Less, Alloc, Stats>>(this, &other);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::find(const key_type &key) const {
-        return const_cast<map<K, V, Less>*>(this)->find(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::find(const key_type &key) {
+        return find<key_type>(key);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::size_type map<K, V, Less>::count(const key_type &key) const {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::find(const Key &key) {
+        return _rbtree_find<map<K, V, Less, Alloc, Stats>>(this, key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::find(const key_type &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::find(const Key &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->find(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::count(const key_type &key) const {
         return find(key)._it._ptr != _sentinel ? 1 : 0;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::lower_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<map<K, V, Less>>(this, _root, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::count(const Key &key) const {
+        auto range = _rbtree_equal_range<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), key);
+        internal_ptr last = range.second ? range.second : _sentinel;
+        size_type count = 0;
+
+        /* Keys of another type may be equivalent to several elements.  */
+        for (internal_ptr current = range.first ; current && current != last ; current = _rbtree_successor<map<K, V, Less, Alloc, Stats>>(current)) {
+            count++;
+        }
+
+        return count;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::lower_bound(const Key &key) {
+        internal_ptr bound = _rbtree_bound<map<K, V, Less, Alloc, Stats>>(this, key, false);
 
         return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::lower_bound(const key_type &key) const {
-        return const_cast<map<K, V, Less>*>(this)->lower_bound(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::lower_bound(const key_type &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->lower_bound(key);
     }
 
-    template<typename K, typename V, class Less>
-    map_t::iterator map<K, V, Less>::upper_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<map<K, V, Less>>(this, _root, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::lower_bound(const Key &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->lower_bound(key);
+    }
 
-        if (bound == nullptr) {
-            return end();
-        } else {
-            if (_rbtree_is_equal_key<map<K, V, Less>>(this, bound->data.first, key)) {
-                return iterator(_sentinel, _rbtree_successor<map<K, V, Less>>(bound));
-            } else {
-                return iterator(_sentinel, bound);
-            }
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::upper_bound(const Key &key) {
+        internal_ptr bound = _rbtree_bound<map<K, V, Less, Alloc, Stats>>(this, key, true);
+
+        return bound == nullptr ? end() : iterator(_sentinel, bound);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::upper_bound(const key_type &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::upper_bound(const Key &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::iterator, map_t::iterator> map<K, V, Less, Alloc, Stats>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    std::pair<map_t::iterator, map_t::iterator> map<K, V, Less, Alloc, Stats>::equal_range(const Key &key) {
+        auto range = _rbtree_equal_range<map<K, V, Less, Alloc, Stats>>(this, key);
+
+        return {{_sentinel, range.first ? range.first : _sentinel}, {_sentinel, range.second ? range.second : _sentinel}};
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::const_iterator, map_t::const_iterator> map<K, V, Less, Alloc, Stats>::equal_range(const key_type &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    std::pair<map_t::const_iterator, map_t::const_iterator> map<K, V, Less, Alloc, Stats>::equal_range(const Key &key) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::count_range(const key_type &lo, const key_type &hi) const {
+        size_type count = 0;
+
+        if (!_less(lo, hi)) return 0;
+        if (Stats::value) return _rbtree_rank<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), hi) - _rbtree_rank<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), lo);
+
+        /* Without subtree sizes the elements in between are walked.  */
+        for (auto it = lower_bound(lo), last = lower_bound(hi) ; it != last ; ++it) count++;
+
+        return count;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::const_iterator map<K, V, Less>::upper_bound(const key_type &key) const {
-        return const_cast<map<K, V, Less>*>(this)->upper_bound(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::iterator map<K, V, Less, Alloc, Stats>::nth(size_type k) {
+        static_assert(Stats::value, "nth() needs order_statistics");
+
+        if (k >= _size) return end();
+
+        return iterator(_sentinel, _rbtree_select<map<K, V, Less, Alloc, Stats>>(this, k));
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::iterator, map_t::iterator> map<K, V, Less>::equal_range(const key_type &key) {
-        auto first = find(key);
-        auto second(first);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::const_iterator map<K, V, Less, Alloc, Stats>::nth(size_type k) const {
+        return const_cast<map<K, V, Less, Alloc, Stats>*>(this)->nth(k);
+    }
 
-        return {first, ++second};
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::rank(const key_type &key) const {
+        static_assert(Stats::value, "rank() needs order_statistics");
+
+        return _rbtree_rank<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), key);
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::const_iterator, map_t::const_iterator> map<K, V, Less>::equal_range(const key_type &key) const {
-        return const_cast<map<K, V, Less>*>(this)->equal_range(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::difference_type map<K, V, Less, Alloc, Stats>::distance(const_iterator first, const_iterator last) const {
+        static_assert(Stats::value, "distance() needs order_statistics");
+
+        return (difference_type) _rbtree_index<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), last._it._ptr) - (difference_type) _rbtree_index<map<K, V, Less, Alloc, Stats>>(const_cast<map<K, V, Less, Alloc, Stats>*>(this), first._it._ptr);
     }
 
     /* Private member functions.  */
-    template<typename K, typename V, class Less>
-    map_t::internal_ptr map<K, V, Less>::_copy_tree(internal_ptr other_root) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_copy_tree(internal_ptr other_root) {
         internal_ptr new_node;
 
         if (other_root == nullptr) return nullptr;
 
-        new_node = new rb_node<node_type>(other_root->data);
+        new_node = _rbtree_new_node(_node_alloc, other_root->data);
+        if (Stats::value) _rbtree_set_count<map<K, V, Less, Alloc, Stats>>(new_node, _rbtree_count<map<K, V, Less, Alloc, Stats>>(other_root));
+        new_node->set_color(other_root->color());
 
         new_node->left = _copy_tree(other_root->left);
-        if (new_node->left) new_node->left->parent = new_node;
+        if (new_node->left) new_node->left->set_parent(new_node);
 
         new_node->right = _copy_tree(other_root->right);
-        if (new_node->right) new_node->right->parent = new_node;
+        if (new_node->right) new_node->right->set_parent(new_node);
 
         return new_node;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::internal_ptr map<K, V, Less>::_construct_new_element(const value_type &val) {
-        return new rb_node<node_type>(val);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(const value_type &val) {
+        return _rbtree_new_node(_node_alloc, val);
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<class P>
-    map_t::internal_ptr map<K, V, Less>::_construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return new rb_node<node_type>(std::forward<node_type>(val));
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_new_node(_node_alloc, std::forward<node_type>(val));
     }
 
-    template<typename K, typename V, class Less>
-    map_t::internal_ptr map<K, V, Less>::_construct_new_element(internal_ptr val) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(internal_ptr val) {
         return val;
     }
 
-    template<typename K, typename V, class Less>
-    map_t::internal_ptr map<K, V, Less>::_construct_new_element(const key_type &key) {
-        return new rb_node<node_type>(key, mapped_type());
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(const key_type &key) {
+        return _rbtree_new_node(_node_alloc, key, mapped_type());
     }
 
-    template<typename K, typename V, class Less>
-    map_t::internal_ptr map<K, V, Less>::_construct_new_element(key_type &&key) {
-        return new rb_node<node_type>(std::forward<key_type>(key), mapped_type());
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(key_type &&key) {
+        return _rbtree_new_node(_node_alloc, std::forward<key_type>(key), mapped_type());
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::_handle_elem_found(internal_ptr ptr, to_ignore obj) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<typename KeyArgs, typename MappedArgs>
+    map_t::internal_ptr map<K, V, Less, Alloc, Stats>::_construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args) {
+        return _rbtree_new_node(_node_alloc, std::piecewise_construct, std::move(args.key), std::move(args.mapped));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, to_ignore obj) {
         return {{_sentinel, ptr}, false};
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::_handle_elem_found(internal_ptr ptr, to_delete obj) {
-        delete obj.ptr;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, to_delete obj) {
+        _rbtree_delete_node(_node_alloc, obj.ptr);
         return {{_sentinel, ptr}, false};
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<map_t::iterator, bool> map<K, V, Less>::_handle_elem_not_found(internal_ptr ptr) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<map_t::iterator, bool> map<K, V, Less, Alloc, Stats>::_handle_elem_not_found(internal_ptr ptr) {
         return {{_sentinel, ptr}, true};
     }
 
-    template<typename K, typename V, class Less>
-    const map_t::key_type &map<K, V, Less>::_get_key(internal_ptr tnode) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    const map_t::key_type &map<K, V, Less, Alloc, Stats>::_get_key(internal_ptr tnode) {
         return tnode->data.first;
     }
 
-    template<typename K, typename V, class Less>
-    void map<K, V, Less>::_clear_node(internal_ptr tnode) {
-        delete tnode;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map_t::size_type map<K, V, Less, Alloc, Stats>::_clear_node(internal_ptr tnode) {
+        _rbtree_delete_node(_node_alloc, tnode);
+
+        return 1;
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<rb_node<map_t::node_type> *, map_t::size_type> map<K, V, Less>::_erase(const_iterator pos) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<rb_node<map_t::node_type> *, map_t::size_type> map<K, V, Less, Alloc, Stats>::_erase(const_iterator pos) {
         internal_ptr to_return, successor, erase_ptr;
         iterator &it = pos._it;
 
         to_return = _sentinel;
         if (it._ptr != _sentinel) {
-            _root->parent = nullptr;
+            _root->set_parent(nullptr);
 
-            successor = _rbtree_successor<map<K, V, Less>>(it._ptr);
-            erase_ptr = _rbtree_prepare_erase<map<K, V, Less>>(this, it._ptr, successor);
+            successor = _rbtree_successor<map<K, V, Less, Alloc, Stats>>(it._ptr);
+            erase_ptr = _rbtree_prepare_erase<map<K, V, Less, Alloc, Stats>>(this, it._ptr, successor);
             to_return = erase_ptr == successor ? it._ptr : successor;
 
-            delete erase_ptr;
+            _rbtree_delete_node(_node_alloc, erase_ptr);
 
             --_size;
             if (_size == 0) {
                 _root = nullptr;
                 _sentinel->left = nullptr;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
                 to_return = _sentinel;
+            } else {
+                /* The root may have changed, hook it back under the sentinel so iteration still reaches end().  */
+                _root->set_parent(_sentinel);
+                _sentinel->left = _root;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+                if (to_return == nullptr) to_return = _sentinel;
             }
         }
 
         return {to_return, 1};
     }
+
+    /* Set algebra, returns a new map with copies of the elements, the values come from lhs when both hold the key.  */
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats> set_union(const map<K, V, Less, Alloc, Stats> &lhs, const map<K, V, Less, Alloc, Stats> &rhs) {
+        map<K, V, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<map<K, V, Less, Alloc, Stats>>(&result, const_cast<map<K, V, Less, Alloc, Stats>*>(&lhs), const_cast<map<K, V, Less, Alloc, Stats>*>(&rhs), SET_UNION);
+        return result;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats> set_intersection(const map<K, V, Less, Alloc, Stats> &lhs, const map<K, V, Less, Alloc, Stats> &rhs) {
+        map<K, V, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<map<K, V, Less, Alloc, Stats>>(&result, const_cast<map<K, V, Less, Alloc, Stats>*>(&lhs), const_cast<map<K, V, Less, Alloc, Stats>*>(&rhs), SET_INTERSECTION);
+        return result;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    map<K, V, Less, Alloc, Stats> set_difference(const map<K, V, Less, Alloc, Stats> &lhs, const map<K, V, Less, Alloc, Stats> &rhs) {
+        map<K, V, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<map<K, V, Less, Alloc, Stats>>(&result, const_cast<map<K, V, Less, Alloc, Stats>*>(&lhs), const_cast<map<K, V, Less, Alloc, Stats>*>(&rhs), SET_DIFFERENCE);
+        return result;
+    }
 }
@@ -1,14 +1,17 @@
 #pragma once
 
+#include <tuple>
+
 #include "../internal/rbtree_internal.h"
 
-#define multimap_t typename multimap<K, V, Less>
+#define multimap_t typename multimap<K, V, Less, Alloc, Stats>
 
 using namespace rbtree_internal;
 
 namespace adt {
 
-    template<typename K, typename V, class Less = std::less<K>>
+    /* Stats selects the node layout, see rbtree_internal::no_order_statistics and rbtree_internal::order_statistics.  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>, class Stats = no_order_statistics>
     class multimap {
     public:
         using key_type = K;
@@ -22,6 +25,7 @@ namespace adt {
         using const_pointer = const value_type*;
         using difference_type = std::ptrdiff_t;
         using size_type = std::size_t;
+        using allocator_type = Alloc;
         class iterator;
         class const_iterator;
         class reverse_iterator;
@@ -44,13 +48,38 @@ namespace adt {
 
         struct enabler {};
 
-        using node_type = multimap_node*;
+        /* Arguments of try_emplace, the node is built from them only if the key is absent.  */
+        template<typename KeyArgs, typename MappedArgs>
+        struct piecewise_args {
+            KeyArgs key;
+            MappedArgs mapped;
+        };
+
+        /* Passed to _handle_elem_found when an existing key must be left alone.  */
+        struct to_ignore {};
+
+        /* The equivalent elements held by a tree node, listed from head, and their number.  */
+        struct multimap_chain {
+            multimap_node *head;
+            std::size_t length;
+
+            multimap_chain() : head(nullptr), length(0) {}
+            multimap_chain(multimap_node *_head) : head(_head), length(1) {}
+        };
+
+        using node_type = multimap_chain;
         using internal_ptr = rb_node<node_type>*;
+        using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<typename Stats::template node<node_type>>;
+        using sentinel_type = rb_sentinel<typename Stats::template node<node_type>, node_type>;
+        using stats_type = Stats;
+        using list_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<multimap_node>;
 
         internal_ptr _root;
         internal_ptr _sentinel;
         size_type _size;
         key_compare _less;
+        node_allocator _node_alloc;
+        list_allocator _list_alloc;
 
     public:
         class iterator {
@@ -74,13 +103,13 @@ namespace adt {
 
             iterator &operator=(const iterator &rhs) {
                 this->_ptr = rhs._ptr;
-                this->_inner_ptr = rhs._ptr ? rhs._ptr->data : nullptr;
+                this->_inner_ptr = rhs._inner_ptr;
                 this->_sentinel = rhs._sentinel;
 
                 return *this;
             }
 
-            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
+            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr && this->_inner_ptr == rhs._inner_ptr; }
             bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
 
             /* Inorder successor algorithm. */
@@ -104,15 +133,15 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
+                    current = _ptr->parent();
                     while (current != nullptr && _ptr == current->right) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
                 _ptr = current;
-                _inner_ptr = _ptr ? _ptr->data : nullptr;
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
                 return *this;
             }
             iterator operator++(int) {
@@ -128,7 +157,7 @@ namespace adt {
                     return *this;
                 }
 
-                if (_inner_ptr->previous != nullptr) {
+                if (_inner_ptr != nullptr && _inner_ptr->previous != nullptr) {
                     _inner_ptr = _inner_ptr->previous;
                     return *this;
                 }
@@ -140,20 +169,22 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
-                    while (current->parent != nullptr && _ptr == current->left) {
+                    current = _ptr->parent();
+                    while (current->parent() != nullptr && _ptr == current->left) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
                 _ptr = current;
-                _inner_ptr = _ptr ? _ptr->data : nullptr;
+                /* Equivalent elements are visited backwards from the tail of the list.  */
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
+                while (_inner_ptr != nullptr && _inner_ptr->next != nullptr) _inner_ptr = _inner_ptr->next;
                 return *this;
             }
             iterator operator--(int) {
                 auto temp(*this);
-                ++(*this);
+                --(*this);
                 return temp;
             }
 
@@ -166,16 +197,16 @@ namespace adt {
                 std::swap(lhs, rhs);
             }
 
-            template<class Container>
-            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename Key>
+            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const Key &key);
 
         private:
             internal_ptr _sentinel;
             internal_ptr _ptr;
-            node_type _inner_ptr;
+            multimap_node *_inner_ptr;
 
             iterator(internal_ptr sentinel = nullptr, internal_ptr ptr = nullptr) : _sentinel(sentinel), _ptr(ptr) {
-                _inner_ptr = _ptr ? _ptr->data : nullptr;
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
             }
         };
 
@@ -322,7 +353,7 @@ namespace adt {
         };
 
         /* Constructors/Destructors.  */
-        multimap(const key_compare &keq = key_compare()) noexcept;
+        multimap(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
         multimap(const multimap &other) noexcept;
         multimap(multimap &&other) noexcept;
         ~multimap();
@@ -349,13 +380,23 @@ namespace adt {
         /* Observers.  */
         key_compare key_comp() const;
         value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
 
         /* Modifiers.  */
         iterator insert(const value_type &val);
         template<class P>
         iterator insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
+        iterator insert(const_iterator hint, const value_type &val);
+        template<class P>
+        iterator insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         template <class... Args>
         iterator emplace(Args &&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
         iterator erase(const_iterator pos);
         size_type erase(const value_type &val);
         iterator erase(const_iterator first, const_iterator last);
@@ -372,18 +413,40 @@ namespace adt {
         const_iterator upper_bound(const key_type &key) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+        size_type count_range(const key_type &lo, const key_type &hi) const;
+
+        /* Order statistics, Stats must be order_statistics.  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator lower_bound(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator lower_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        iterator upper_bound(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator upper_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
 
         friend void swap(multimap &lhs, multimap &rhs) {
-            using std::swap;
-
-            swap(lhs._root, rhs._root);
-            swap(lhs._sentinel, rhs._sentinel);
-            swap(lhs._less, rhs._less);
-            swap(lhs._size, rhs._size);
+            lhs.swap(rhs);
         }
 
         template<class Container>
-        friend void rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
+        friend std::size_t rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
 
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_left_of(rb_node<container::node_type> *tnode);
@@ -421,434 +484,690 @@ namespace adt {
         template<class Container, typename R, typename Key, typename Value, typename... Args>
         friend R rbtree_internal::_rbtree_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
+        template<class Container, typename R>
+        friend R rbtree_internal::_rbtree_insert_fixup(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container, typename Key>
+        friend neighbor_t rbtree_internal::_rbtree_hint_position(Container *cnt, rb_node<container::node_type> *hint, const Key &key, rb_node<container::node_type> **parent);
+
+        template<class Container, typename R, typename Key, typename Value, typename... Args>
+        friend R rbtree_internal::_rbtree_insert_hint(Container *cnt, rb_node<container::node_type> *hint, const Key &key, Value val, Args &&... args);
+
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_prepare_erase(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
 
+        template<class Container, typename Key>
+        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_bound(Container *cnt, const Key &key, bool upper);
+
+        template<class Container, typename Key>
+        friend std::pair<rb_node<container::node_type>*, rb_node<container::node_type>*> rbtree_internal::_rbtree_equal_range(Container *cnt, const Key &key);
+
         template<class Container>
-        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_minimum(rb_node<container::node_type> *tnode);
 
         template<class Container>
-        friend bool rbtree_internal::_rbtree_is_equal_key(Container *cnt, const container::key_type &lhs_key, const container::key_type &rhs_key);
+        friend std::size_t rbtree_internal::_rbtree_count(rb_node<container::node_type> *tnode);
 
         template<class Container>
-        friend rb_node<container::node_type> *rbtree_internal::_rbtree_find_bound(Container *cnt, rb_node<container::node_type> *tnode, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_set_count(rb_node<container::node_type> *tnode, std::size_t count);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_weight(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_add_count(rb_node<container::node_type> *tnode, rb_node<container::node_type> *sentinel, std::size_t delta);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_rotate_count(rb_node<container::node_type> *top, rb_node<container::node_type> *new_top, rb_node<container::node_type> *moved);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_count(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_select(Container *cnt, std::size_t &k);
+
+        template<class Container, typename Key>
+        friend std::size_t rbtree_internal::_rbtree_rank(Container *cnt, const Key &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_index(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_black_height(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_join(rb_node<container::node_type> *left, std::size_t left_height, rb_node<container::node_type> *pivot,
+                                                                            rb_node<container::node_type> *right, std::size_t right_height, std::size_t &height);
+
+        template<class Container, typename Key>
+        friend void rbtree_internal::_rbtree_split(Container *cnt, rb_node<container::node_type> *tnode, std::size_t height, const Key &key,
+                                                   rb_node<container::node_type> **left, std::size_t &left_height, rb_node<container::node_type> **right, std::size_t &right_height);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_attach(Container *cnt, rb_node<container::node_type> *root, std::size_t size);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_concat(Container *cnt, rb_node<container::node_type> *left, rb_node<container::node_type> *right);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_range(Container *cnt, rb_node<container::node_type> *first, rb_node<container::node_type> *last);
 
     private:
         internal_ptr _copy_tree(internal_ptr other_root);
+        size_type _index(const_iterator pos) const;
+        multimap_node *_copy_list(multimap_node *head);
         iterator _add_to_list(internal_ptr ptr, multimap_node *new_node);
         internal_ptr _construct_new_element(const value_type &val);
         template<typename P>
         internal_ptr _construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         internal_ptr _construct_new_element(multimap_node *val);
+        template<typename KeyArgs, typename MappedArgs>
+        internal_ptr _construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args);
         iterator _handle_elem_found(internal_ptr ptr, const value_type &val);
         template<typename P>
         iterator _handle_elem_found(internal_ptr ptr, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         iterator _handle_elem_found(internal_ptr ptr, multimap_node *val);
+        iterator _handle_elem_found(internal_ptr ptr, to_ignore obj);
         iterator _handle_elem_not_found(internal_ptr ptr);
         const key_type &_get_key(internal_ptr tnode);
-        void _clear_node(internal_ptr tnode);
+        size_type _clear_node(internal_ptr tnode);
         size_type _erase_list(internal_ptr erase_ptr);
-        void _erase_from_node(internal_ptr erase_ptr);
-        std::pair<internal_ptr, size_type> _erase(const_iterator pos, bool erase_all);
+        void _erase_from_node(internal_ptr erase_ptr, multimap_node *element);
+        std::pair<iterator, size_type> _erase(const_iterator pos, bool erase_all);
     };
 
+    /* multimap that keeps subtree sizes, for nth(), rank() and distance() in O(log n).  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>>
+    using ranked_multimap = multimap<K, V, Less, Alloc, order_statistics>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename K, typename V, class Less>
-    multimap<K, V, Less>::multimap(const key_compare &keq) noexcept : _root(nullptr), _size(0), _less(keq) {
-        _sentinel = new rb_node<node_type>();
-    }
-
-    template<typename K, typename V, class Less>
-    multimap<K, V, Less>::multimap(const multimap &other) noexcept {
-        if (this != &other) {
-            /* Create an exact copy of this set, O(n).  */
-            _root = _copy_tree(other._root);
-            _sentinel = new rb_node<node_type>();
-            _sentinel->left = _root;
-            _root->parent = _sentinel;
-            _less = other._less;
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap<K, V, Less, Alloc, Stats>::multimap(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _node_alloc(alloc), _list_alloc(alloc) {
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
     }
 
-    template<typename K, typename V, class Less>
-    multimap<K, V, Less>::multimap(multimap &&other) noexcept {
-        swap(*this, other);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap<K, V, Less, Alloc, Stats>::multimap(const multimap &other) noexcept
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _node_alloc(std::allocator_traits<node_allocator>::select_on_container_copy_construction(other._node_alloc)),
+          _list_alloc(_node_alloc) {
+        /* Create an exact copy of this map, O(n).  */
+        _root = _copy_tree(other._root);
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
+        _sentinel->left = _root;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+        if (_root) _root->set_parent(_sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    multimap<K, V, Less>::~multimap() {
-        if (_root != nullptr) {
-            clear();
-            delete _sentinel;
-        } else {
-            if (_sentinel) delete _sentinel;
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap<K, V, Less, Alloc, Stats>::multimap(multimap &&other) noexcept : multimap() {
+        swap(other);
     }
 
-    template<typename K, typename V, class Less>
-    multimap<K, V, Less> &multimap<K, V, Less>::operator=(multimap rhs) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap<K, V, Less, Alloc, Stats>::~multimap() {
+        /* The allocator gives its blocks back on its own, no need to walk the tree.  */
+        if (_rbtree_can_drop_nodes<node_allocator, node_type>(_node_alloc, 2) && _rbtree_can_drop_nodes<list_allocator, value_type>(_list_alloc, 2)) return;
+
+        clear();
+        _rbtree_delete_sentinel<sentinel_type>(_node_alloc, _sentinel);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap<K, V, Less, Alloc, Stats> &multimap<K, V, Less, Alloc, Stats>::operator=(multimap rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
 
         return *this;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::begin() noexcept {
-        internal_ptr current = _root;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::begin() noexcept {
+        internal_ptr current = _rbtree_first<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->left != nullptr) {
-                current = current->left;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return iterator(_sentinel, current);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::begin() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->begin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::begin() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::end() noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::end() noexcept {
         return iterator(_sentinel, _sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::end() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->end();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::end() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::reverse_iterator multimap<K, V, Less>::rbegin() noexcept {
-        internal_ptr current = _root;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::reverse_iterator multimap<K, V, Less, Alloc, Stats>::rbegin() noexcept {
+        internal_ptr current = _rbtree_last<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->right != nullptr) {
-                current = current->right;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
+
+        reverse_iterator rit(_sentinel, current);
 
-        return reverse_iterator(_sentinel, current);
+        /* The last element is the tail of the list of the rightmost node.  */
+        while (rit._it._inner_ptr != nullptr && rit._it._inner_ptr->next != nullptr) rit._it._inner_ptr = rit._it._inner_ptr->next;
+
+        return rit;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_reverse_iterator multimap<K, V, Less>::rbegin() const {
-        return const_cast<multimap<K, V, Less>*>(this)->rbegin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_reverse_iterator multimap<K, V, Less, Alloc, Stats>::rbegin() const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::reverse_iterator multimap<K, V, Less>::rend() noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::reverse_iterator multimap<K, V, Less, Alloc, Stats>::rend() noexcept {
         return reverse_iterator(_sentinel, _sentinel);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_reverse_iterator multimap<K, V, Less>::rend() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->rend();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_reverse_iterator multimap<K, V, Less, Alloc, Stats>::rend() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::cbegin() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->begin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::cbegin() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::cend() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->end();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::cend() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_reverse_iterator multimap<K, V, Less>::crbegin() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->rbegin();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_reverse_iterator multimap<K, V, Less, Alloc, Stats>::crbegin() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_reverse_iterator multimap<K, V, Less>::crend() const noexcept {
-        return const_cast<multimap<K, V, Less>*>(this)->rend();
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_reverse_iterator multimap<K, V, Less, Alloc, Stats>::crend() const noexcept {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename K, typename V, class Less>
-    bool multimap<K, V, Less>::empty() const noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    bool multimap<K, V, Less, Alloc, Stats>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::size_type multimap<K, V, Less>::size() const noexcept {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::size() const noexcept {
         return _size;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::key_compare multimap<K, V, Less>::key_comp() const {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::key_compare multimap<K, V, Less, Alloc, Stats>::key_comp() const {
         return _less;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::value_compare multimap<K, V, Less>::value_comp() const {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::value_compare multimap<K, V, Less, Alloc, Stats>::value_comp() const {
         return _less;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::insert(const value_type &val) {
-        return _rbtree_insert<multimap<K, V, Less>, iterator, key_type, const value_type&>(this, val.first, val, val);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::allocator_type multimap<K, V, Less, Alloc, Stats>::get_allocator() const noexcept {
+        return allocator_type(_node_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::insert(const value_type &val) {
+        return _rbtree_insert<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, const value_type&>(this, val.first, val, val);
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<class P>
-    multimap_t::iterator multimap<K, V, Less>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return _rbtree_insert<multimap<K, V, Less>, iterator, key_type, P&&>(this, val.first, std::forward<P>(val), std::forward<P>(val));
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_insert<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, P&&>(this, val.first, std::forward<P>(val), std::forward<P>(val));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::insert(const_iterator hint, const value_type &val) {
+        return _rbtree_insert_hint<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, const value_type&>(this, hint._it._ptr, val.first, val, val);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class P>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::insert(const_iterator hint, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_insert_hint<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, P&&>(this, hint._it._ptr, val.first, std::forward<P>(val), std::forward<P>(val));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::emplace(Args &&... args) {
+        multimap_node *val = _rbtree_new_node(_list_alloc, std::forward<Args>(args)...);
+
+        return _rbtree_insert<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, multimap_node*>(this, val->data.first, val, val);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::emplace_hint(const_iterator hint, Args &&... args) {
+        multimap_node *val = _rbtree_new_node(_list_alloc, std::forward<Args>(args)...);
+
+        return _rbtree_insert_hint<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, multimap_node*>(this, hint._it._ptr, val->data.first, val, val);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class... Args>
+    std::pair<multimap_t::iterator, bool> multimap<K, V, Less, Alloc, Stats>::try_emplace(const key_type &key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<const key_type&>, std::tuple<Args&&...>>;
+        size_type old_size = _size;
+        iterator it = _rbtree_insert<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+
+        return {it, _size != old_size};
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<class... Args>
-    multimap_t::iterator multimap<K, V, Less>::emplace(Args &&... args) {
-        multimap_node *val = new multimap_node(std::forward<Args>(args)...);
+    std::pair<multimap_t::iterator, bool> multimap<K, V, Less, Alloc, Stats>::try_emplace(key_type &&key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<key_type&&>, std::tuple<Args&&...>>;
+        size_type old_size = _size;
+        iterator it = _rbtree_insert<multimap<K, V, Less, Alloc, Stats>, iterator, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
 
-        return _rbtree_insert<multimap<K, V, Less>, iterator, key_type, multimap_node*>(this, val->data.first, val, val);
+        return {it, _size != old_size};
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::erase(const_iterator pos) {
-        return {_sentinel, _erase(pos, false).first};
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::erase(const_iterator pos) {
+        return _erase(pos, false).first;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::size_type multimap<K, V, Less>::erase(const value_type &val) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::erase(const value_type &val) {
         return _erase(find(val), true).second;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::erase(const_iterator first, const_iterator last) {
-        auto it = first._it;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::erase(const_iterator first, const_iterator last) {
+        iterator it = first._it, end = last._it;
+        size_type n = 0;
+
+        /* A short range is erased one element at a time, counted beforehand since erase() may move
+           the list of the next node and invalidate last.  */
+        for (; it != end && n < _rbtree_short_range ; ++it) n++;
+        if (it == end) {
+            for (it = first._it ; n > 0 ; n--) it = erase(it);
+            return it;
+        }
 
-        while (it != last._it) it = erase(it);
+        /* The elements of the nodes at both ends that fall in the range are erased one at a time,
+           these nodes keep other elements and stay in the tree.  */
+        for (it = first._it ; it != end && it._inner_ptr != it._ptr->data.head ; ) it = erase(it);
+        if (it == end) return it;
+        while (end._ptr != _sentinel && end._inner_ptr != end._ptr->data.head) erase(iterator(_sentinel, end._ptr));
 
-        return it;
+        if (it._ptr != end._ptr) _rbtree_erase_range<multimap<K, V, Less, Alloc, Stats>>(this, it._ptr, end._ptr);
+
+        return end;
     }
 
-    template<typename K, typename V, class Less>
-    void multimap<K, V, Less>::clear() noexcept {
-        _rbtree_destruct<multimap<K, V, Less>>(this, _root);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void multimap<K, V, Less, Alloc, Stats>::clear() noexcept {
+        _rbtree_destruct<multimap<K, V, Less, Alloc, Stats>>(this, _root);
         _sentinel->left = nullptr;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
         _root = nullptr;
         _size = 0;
     }
 
-    template<typename K, typename V, class Less>
-    void multimap<K, V, Less>::swap(multimap &other) {
-        swap(*this, other);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void multimap<K, V, Less, Alloc, Stats>::swap(multimap &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_sentinel, other._sentinel);
+        swap(_less, other._less);
+        swap(_size, other._size);
+        swap(_node_alloc, other._node_alloc);
+        swap(_list_alloc, other._list_alloc);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::find(const key_type &key) {
-        return _rbtree_find<multimap<K, V, Less>>(this, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::find(const key_type &key) {
+        return find<key_type>(key);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::find(const key_type &key) const {
-        return const_cast<multimap<K, V, Less>*>(this)->find(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::find(const Key &key) {
+        return _rbtree_find<multimap<K, V, Less, Alloc, Stats>>(this, key);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::size_type multimap<K, V, Less>::count(const key_type &key) const {
-        internal_ptr found_ptr = const_cast<multimap<K, V, Less>*>(this)->find(key)._ptr;
-        multimap_node *current;
-        size_t count = 0;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::find(const key_type &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->find(key);
+    }
 
-        if (found_ptr == _sentinel) return count;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::find(const Key &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->find(key);
+    }
 
-        current = found_ptr->data;
-        while (current != nullptr) {
-            count++;
-            current = current->next;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::count(const Key &key) const {
+        auto range = _rbtree_equal_range<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), key);
+        internal_ptr last = range.second ? range.second : _sentinel;
+        size_type count = 0;
+
+        /* Equivalent elements share a node, which keeps their number, only keys of another type can match several.  */
+        for (internal_ptr current = range.first ; current && current != last ; current = _rbtree_successor<multimap<K, V, Less, Alloc, Stats>>(current)) {
+            count += current->data.length;
         }
 
         return count;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::lower_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<multimap<K, V, Less>>(this, _root, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::lower_bound(const Key &key) {
+        internal_ptr bound = _rbtree_bound<multimap<K, V, Less, Alloc, Stats>>(this, key, false);
 
         return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::lower_bound(const key_type &key) const {
-        return const_cast<multimap<K, V, Less>*>(this)->lower_bound(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::lower_bound(const key_type &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->lower_bound(key);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::upper_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<multimap<K, V, Less>>(this, _root, key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::lower_bound(const Key &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->lower_bound(key);
+    }
 
-        if (bound == nullptr) {
-            return end();
-        } else {
-            if (_rbtree_is_equal_key<multimap<K, V, Less>>(this, bound->data->data.first, key)) {
-                return iterator(_sentinel, _rbtree_successor<multimap<K, V, Less>>(bound));
-            } else {
-                return iterator(_sentinel, bound);
-            }
-        }
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::const_iterator multimap<K, V, Less>::upper_bound(const key_type &key) const {
-        return const_cast<multimap<K, V, Less>*>(this)->upper_bound(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::upper_bound(const Key &key) {
+        internal_ptr bound = _rbtree_bound<multimap<K, V, Less, Alloc, Stats>>(this, key, true);
+
+        return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<multimap_t::iterator, multimap_t::iterator> multimap<K, V, Less>::equal_range(const key_type &key) {
-        auto first = find(key)._ptr;
-        auto second = _rbtree_successor<multimap<K, V, Less>>(first);
-        second = second != nullptr ? second : _sentinel;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::upper_bound(const key_type &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::upper_bound(const Key &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
 
-        return {{_sentinel, first}, {_sentinel, second}};
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<multimap_t::iterator, multimap_t::iterator> multimap<K, V, Less, Alloc, Stats>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<multimap_t::const_iterator, multimap_t::const_iterator> multimap<K, V, Less>::equal_range(const key_type &key) const {
-        return const_cast<multimap<K, V, Less>*>(this)->equal_range(key);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    std::pair<multimap_t::iterator, multimap_t::iterator> multimap<K, V, Less, Alloc, Stats>::equal_range(const Key &key) {
+        auto range = _rbtree_equal_range<multimap<K, V, Less, Alloc, Stats>>(this, key);
+
+        return {{_sentinel, range.first ? range.first : _sentinel}, {_sentinel, range.second ? range.second : _sentinel}};
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<multimap_t::const_iterator, multimap_t::const_iterator> multimap<K, V, Less, Alloc, Stats>::equal_range(const key_type &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    std::pair<multimap_t::const_iterator, multimap_t::const_iterator> multimap<K, V, Less, Alloc, Stats>::equal_range(const Key &key) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::count_range(const key_type &lo, const key_type &hi) const {
+        internal_ptr current, last;
+        size_type count = 0;
+
+        if (!_less(lo, hi)) return 0;
+        if (Stats::value) return _rbtree_rank<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), hi) - _rbtree_rank<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), lo);
+
+        /* Without subtree sizes the nodes in between are walked, each knows how many elements it holds.  */
+        current = _rbtree_bound<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), lo, false);
+        last = _rbtree_bound<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), hi, false);
+        if (last == nullptr) last = _sentinel;
+        for (; current && current != last ; current = _rbtree_successor<multimap<K, V, Less, Alloc, Stats>>(current)) count += current->data.length;
+
+        return count;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::nth(size_type k) {
+        static_assert(Stats::value, "nth() needs order_statistics");
+
+        if (k >= _size) return end();
+
+        iterator it(_sentinel, _rbtree_select<multimap<K, V, Less, Alloc, Stats>>(this, k));
+        /* k is left at the position inside the node's list.  */
+        for (; k > 0 ; k--) it._inner_ptr = it._inner_ptr->next;
+
+        return it;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::const_iterator multimap<K, V, Less, Alloc, Stats>::nth(size_type k) const {
+        return const_cast<multimap<K, V, Less, Alloc, Stats>*>(this)->nth(k);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::rank(const key_type &key) const {
+        static_assert(Stats::value, "rank() needs order_statistics");
+
+        return _rbtree_rank<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::difference_type multimap<K, V, Less, Alloc, Stats>::distance(const_iterator first, const_iterator last) const {
+        static_assert(Stats::value, "distance() needs order_statistics");
+
+        return (difference_type) _index(last) - (difference_type) _index(first);
     }
 
     /* Private member functions.  */
-    template<typename K, typename V, class Less>
-    multimap_t::internal_ptr multimap<K, V, Less>::_copy_tree(internal_ptr other_root) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::internal_ptr multimap<K, V, Less, Alloc, Stats>::_copy_tree(internal_ptr other_root) {
         internal_ptr new_node;
 
         if (other_root == nullptr) return nullptr;
 
-        new_node = new rb_node<node_type>(other_root->data);
+        new_node = _rbtree_new_node(_node_alloc, _copy_list(other_root->data.head));
+        new_node->data.length = other_root->data.length;
+        if (Stats::value) _rbtree_set_count<multimap<K, V, Less, Alloc, Stats>>(new_node, _rbtree_count<multimap<K, V, Less, Alloc, Stats>>(other_root));
+        new_node->set_color(other_root->color());
 
         new_node->left = _copy_tree(other_root->left);
-        if (new_node->left) new_node->left->parent = new_node;
+        if (new_node->left) new_node->left->set_parent(new_node);
 
         new_node->right = _copy_tree(other_root->right);
-        if (new_node->right) new_node->right->parent = new_node;
+        if (new_node->right) new_node->right->set_parent(new_node);
 
         return new_node;
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::_add_to_list(internal_ptr ptr, multimap_node *new_node) {
-        new_node->next = ptr->data;
-        ptr->data = new_node;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    typename multimap<K, V, Less, Alloc, Stats>::multimap_node *multimap<K, V, Less, Alloc, Stats>::_copy_list(multimap_node *head) {
+        multimap_node *new_head, *tail;
+
+        /* Every node of the tree owns its list, copy it in order.  */
+        new_head = tail = _rbtree_new_node(_list_alloc, head->data);
+        for (head = head->next ; head != nullptr ; head = head->next) {
+            tail->next = _rbtree_new_node(_list_alloc, head->data);
+            tail->next->previous = tail;
+            tail = tail->next;
+        }
+
+        return new_head;
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_add_to_list(internal_ptr ptr, multimap_node *new_node) {
+        new_node->next = ptr->data.head;
+        ptr->data.head = new_node;
+        ptr->data.length++;
         new_node->next->previous = new_node;
         _size++;
+        _rbtree_add_count<multimap<K, V, Less, Alloc, Stats>>(ptr, _sentinel, 1);
 
         return {_sentinel, ptr};
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::internal_ptr multimap<K, V, Less>::_construct_new_element(const value_type &val) {
-        return new rb_node<node_type>(new multimap_node(val));
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::internal_ptr multimap<K, V, Less, Alloc, Stats>::_construct_new_element(const value_type &val) {
+        return _rbtree_new_node(_node_alloc, _rbtree_new_node(_list_alloc, val));
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<typename P>
-    multimap_t::internal_ptr multimap<K, V, Less>::_construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return new rb_node<node_type>(new multimap_node(std::forward<P>(val)));
+    multimap_t::internal_ptr multimap<K, V, Less, Alloc, Stats>::_construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _rbtree_new_node(_node_alloc, _rbtree_new_node(_list_alloc, std::forward<P>(val)));
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::internal_ptr multimap<K, V, Less>::_construct_new_element(multimap_node *val) {
-        return new rb_node<node_type>(val);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::internal_ptr multimap<K, V, Less, Alloc, Stats>::_construct_new_element(multimap_node *val) {
+        return _rbtree_new_node(_node_alloc, val);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::_handle_elem_found(internal_ptr ptr, const value_type &val) {
-        return _add_to_list(ptr, new multimap_node(val));
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    template<typename KeyArgs, typename MappedArgs>
+    multimap_t::internal_ptr multimap<K, V, Less, Alloc, Stats>::_construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args) {
+        return _rbtree_new_node(_node_alloc, _rbtree_new_node(_list_alloc, std::piecewise_construct, std::move(args.key), std::move(args.mapped)));
     }
 
-    template<typename K, typename V, class Less>
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, const value_type &val) {
+        return _add_to_list(ptr, _rbtree_new_node(_list_alloc, val));
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
     template<typename P>
-    multimap_t::iterator multimap<K, V, Less>::_handle_elem_found(internal_ptr ptr, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return _add_to_list(ptr, new multimap_node(std::forward<P>(val)));
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _add_to_list(ptr, _rbtree_new_node(_list_alloc, std::forward<P>(val)));
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::_handle_elem_found(internal_ptr ptr, multimap_node *val) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, multimap_node *val) {
         return _add_to_list(ptr, val);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::iterator multimap<K, V, Less>::_handle_elem_not_found(internal_ptr ptr) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, to_ignore obj) {
+        return {_sentinel, ptr};
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::iterator multimap<K, V, Less, Alloc, Stats>::_handle_elem_not_found(internal_ptr ptr) {
         return {_sentinel, ptr};
     }
 
-    template<typename K, typename V, class Less>
-    const multimap_t::key_type &multimap<K, V, Less>::_get_key(internal_ptr tnode) {
-        return tnode->data->data.first;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    const multimap_t::key_type &multimap<K, V, Less, Alloc, Stats>::_get_key(internal_ptr tnode) {
+        return tnode->data.head->data.first;
     }
 
-    template<typename K, typename V, class Less>
-    void multimap<K, V, Less>::_clear_node(internal_ptr tnode) {
-        _erase_list(tnode);
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::_clear_node(internal_ptr tnode) {
+        return _erase_list(tnode);
     }
 
-    template<typename K, typename V, class Less>
-    multimap_t::size_type multimap<K, V, Less>::_erase_list(internal_ptr erase_ptr) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::_erase_list(internal_ptr erase_ptr) {
         multimap_node *current, *to_delete;
         size_t count = 0;
 
-        current = erase_ptr->data;
+        current = erase_ptr->data.head;
         while (current->next != nullptr) {
             to_delete = current->next;
             current->next = to_delete->next;
 
-            delete to_delete;
+            _rbtree_delete_node(_list_alloc, to_delete);
             count++;
         }
 
-        delete erase_ptr->data;
-        delete erase_ptr;
+        _rbtree_delete_node(_list_alloc, erase_ptr->data.head);
+        _rbtree_delete_node(_node_alloc, erase_ptr);
         count++;
 
         return count;
     }
 
-    template<typename K, typename V, class Less>
-    void multimap<K, V, Less>::_erase_from_node(internal_ptr erase_ptr) {
-        multimap_node *head = erase_ptr->data;
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    void multimap<K, V, Less, Alloc, Stats>::_erase_from_node(internal_ptr erase_ptr, multimap_node *element) {
+        if (element->previous) element->previous->next = element->next;
+        else erase_ptr->data.head = element->next;
+        if (element->next) element->next->previous = element->previous;
 
-        erase_ptr->data = head->next;
-        delete head;
+        erase_ptr->data.length--;
+        _rbtree_delete_node(_list_alloc, element);
     }
 
-    template<typename K, typename V, class Less>
-    std::pair<multimap_t::internal_ptr, multimap_t::size_type> multimap<K, V, Less>::_erase(const_iterator pos, bool erase_all) {
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    std::pair<multimap_t::iterator, multimap_t::size_type> multimap<K, V, Less, Alloc, Stats>::_erase(const_iterator pos, bool erase_all) {
         internal_ptr to_return, successor, erase_ptr;
+        multimap_node *next = nullptr;
         size_t count = 0;
         iterator &it = pos._it;
 
         to_return = _sentinel;
         if (it._ptr != _sentinel) {
-            _root->parent = nullptr;
+            _root->set_parent(nullptr);
 
             if (erase_all) {
-                successor = _rbtree_successor<multimap<K, V, Less>>(it._ptr);
-                erase_ptr = _rbtree_prepare_erase<multimap<K, V, Less>>(this, it._ptr, successor);
+                successor = _rbtree_successor<multimap<K, V, Less, Alloc, Stats>>(it._ptr);
+                erase_ptr = _rbtree_prepare_erase<multimap<K, V, Less, Alloc, Stats>>(this, it._ptr, successor);
                 to_return = erase_ptr == successor ? it._ptr : successor;
 
                 count = _erase_list(erase_ptr);
             } else {
-                _erase_from_node(it._ptr);
-                if (it._ptr->data != nullptr) {
-                    to_return = it._ptr;
+                next = it._inner_ptr->next;
+                _erase_from_node(it._ptr, it._inner_ptr);
+                if (it._ptr->data.head != nullptr) {
+                    /* The element after pos is the next in the list, or the first of the next node.  */
+                    to_return = next ? it._ptr : _rbtree_successor<multimap<K, V, Less, Alloc, Stats>>(it._ptr);
+                    _rbtree_add_count<multimap<K, V, Less, Alloc, Stats>>(it._ptr, _sentinel, (size_type) 0 - 1);
                 } else {
-                    successor = _rbtree_successor<multimap<K, V, Less>>(it._ptr);
-                    erase_ptr = _rbtree_prepare_erase<multimap<K, V, Less>>(this, it._ptr, successor);
+                    successor = _rbtree_successor<multimap<K, V, Less, Alloc, Stats>>(it._ptr);
+                    erase_ptr = _rbtree_prepare_erase<multimap<K, V, Less, Alloc, Stats>>(this, it._ptr, successor);
                     to_return = erase_ptr == successor ? it._ptr : successor;
 
-                    delete erase_ptr;
+                    _rbtree_delete_node(_node_alloc, erase_ptr);
                 }
                 count = 1;
             }
@@ -857,10 +1176,33 @@ namespace adt {
             if (_size == 0) {
                 _root = nullptr;
                 _sentinel->left = nullptr;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
                 to_return = _sentinel;
+            } else {
+                /* The root may have changed, hook it back under the sentinel so iteration still reaches end().  */
+                _root->set_parent(_sentinel);
+                _sentinel->left = _root;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+                if (to_return == nullptr) to_return = _sentinel;
             }
         }
 
-        return {to_return, count};
+        iterator ret(_sentinel, to_return);
+        if (next) ret._inner_ptr = next;
+
+        return {ret, count};
+    }
+
+    template<typename K, typename V, class Less, class Alloc, class Stats>
+    multimap_t::size_type multimap<K, V, Less, Alloc, Stats>::_index(const_iterator pos) const {
+        size_type index = _rbtree_index<multimap<K, V, Less, Alloc, Stats>>(const_cast<multimap<K, V, Less, Alloc, Stats>*>(this), pos._it._ptr);
+        multimap_node *current;
+
+        if (pos._it._ptr == _sentinel) return index;
+
+        /* Equivalent elements are listed in the node, count the ones before pos.  */
+        for (current = pos._it._ptr->data.head ; current != pos._it._inner_ptr ; current = current->next) index++;
+
+        return index;
     }
 }
@@ -2,13 +2,14 @@
 
 #include "../internal/rbtree_internal.h"
 
-#define multiset_t typename multiset<Key, Less>
+#define multiset_t typename multiset<Key, Less, Alloc, Stats>
 
 using namespace rbtree_internal;
 
 namespace adt {
     
-    template<typename Key, class Less = std::less<Key>>
+    /* Stats selects the node layout, see rbtree_internal::no_order_statistics and rbtree_internal::order_statistics.  */
+    template<typename Key, class Less = std::less<Key>, class Alloc = std::allocator<Key>, class Stats = no_order_statistics>
     class multiset {
     public:
         using key_type = Key;
@@ -21,6 +22,7 @@ namespace adt {
         using const_pointer = const value_type*;
         using difference_type = std::ptrdiff_t;
         using size_type = std::size_t;
+        using allocator_type = Alloc;
         class iterator;
         using const_iterator = iterator;
         class reverse_iterator;
@@ -41,13 +43,28 @@ namespace adt {
             multiset_node(multiset_node &&other) = default;
         };
 
-        using node_type = multiset_node*;
+        /* The equivalent elements held by a tree node, listed from head, and their number.  */
+        struct multiset_chain {
+            multiset_node *head;
+            std::size_t length;
+
+            multiset_chain() : head(nullptr), length(0) {}
+            multiset_chain(multiset_node *_head) : head(_head), length(1) {}
+        };
+
+        using node_type = multiset_chain;
         using internal_ptr = rb_node<node_type>*;
+        using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<typename Stats::template node<node_type>>;
+        using sentinel_type = rb_sentinel<typename Stats::template node<node_type>, node_type>;
+        using stats_type = Stats;
+        using list_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<multiset_node>;
 
         internal_ptr _root;
         internal_ptr _sentinel;
         size_type _size;
         key_compare _less;
+        node_allocator _node_alloc;
+        list_allocator _list_alloc;
 
     public:
         class iterator {
@@ -67,11 +84,11 @@ namespace adt {
             iterator &operator=(const iterator &rhs) = default;
             iterator &operator=(internal_ptr ptr) {
                 this->_ptr = ptr;
-                this->inner_ptr = ptr ? ptr->data : nullptr;
+                this->_inner_ptr = ptr ? ptr->data.head : nullptr;
                 return *this;
             }
 
-            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
+            bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr && this->_inner_ptr == rhs._inner_ptr; }
             bool operator==(internal_ptr ptr) const { return this->_ptr == ptr; }
             bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
             bool operator!=(internal_ptr ptr) const { return !(*this == ptr); }
@@ -98,15 +115,15 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
+                    current = _ptr->parent();
                     while (current != nullptr && _ptr == current->right) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
                 _ptr = current;
-                _inner_ptr = _ptr ? _ptr->data : nullptr;
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
                 return *this;
             }
             iterator operator++(int) {
@@ -122,7 +139,7 @@ namespace adt {
                     return *this;
                 }
 
-                if (_inner_ptr->previous != nullptr) {
+                if (_inner_ptr != nullptr && _inner_ptr->previous != nullptr) {
                     _inner_ptr = _inner_ptr->previous;
                     return *this;
                 }
@@ -134,20 +151,22 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
-                    while (current->parent != nullptr && _ptr == current->left) {
+                    current = _ptr->parent();
+                    while (current->parent() != nullptr && _ptr == current->left) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
                 _ptr = current;
-                _inner_ptr = _ptr->data;
+                /* Equivalent elements are visited backwards from the tail of the list.  */
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
+                while (_inner_ptr != nullptr && _inner_ptr->next != nullptr) _inner_ptr = _inner_ptr->next;
                 return *this;
             }
             iterator operator--(int) {
                 auto temp(*this);
-                ++(*this);
+                --(*this);
                 return temp;
             }
 
@@ -158,16 +177,16 @@ namespace adt {
                 std::swap(lhs, rhs);
             }
 
-            template<class Container>
-            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename K>
+            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const K &key);
 
         private:
             internal_ptr _sentinel;
             internal_ptr _ptr;
-            node_type _inner_ptr;
+            multiset_node *_inner_ptr;
 
             iterator(internal_ptr sentinel, internal_ptr ptr) : _sentinel(sentinel), _ptr(ptr) {
-                _inner_ptr = _ptr ? _ptr->data : nullptr;
+                _inner_ptr = _ptr ? _ptr->data.head : nullptr;
             }
         };
 
@@ -229,7 +248,7 @@ namespace adt {
         };
 
         /* Constructors/Destructors.  */
-        multiset(const key_compare &keq = key_compare()) noexcept;
+        multiset(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
         explicit multiset(const multiset &other) noexcept;
         multiset(multiset &&other) noexcept;
         ~multiset();
@@ -256,12 +275,17 @@ namespace adt {
         /* Observers.  */
         key_compare key_comp() const;
         value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
 
         /* Modifiers.  */
         iterator insert(const value_type &val);
         iterator insert(value_type &&val);
+        iterator insert(const_iterator hint, const value_type &val);
+        iterator insert(const_iterator hint, value_type &&val);
         template <class... Args>
         iterator emplace(Args &&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
         iterator erase(const_iterator pos);
         size_type erase(const value_type &val);
         iterator erase(const_iterator first, const_iterator last);
@@ -278,18 +302,40 @@ namespace adt {
         const_iterator upper_bound(const key_type &key) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+        size_type count_range(const key_type &lo, const key_type &hi) const;
+
+        /* Order statistics, Stats must be order_statistics.  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator lower_bound(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator lower_bound(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator upper_bound(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator upper_bound(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const K &key) const;
 
         friend void swap(multiset &lhs, multiset &rhs) {
-            using std::swap;
-
-            swap(lhs._root, rhs._root);
-            swap(lhs._sentinel, rhs._sentinel);
-            swap(lhs._less, rhs._less);
-            swap(lhs._size, rhs._size);
+            lhs.swap(rhs);
         }
 
         template<class Container>
-        friend void rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
+        friend std::size_t rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
 
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_left_of(rb_node<container::node_type> *tnode);
@@ -327,20 +373,81 @@ namespace adt {
         template<class Container, typename R, typename K, typename V, typename... Args>
         friend R rbtree_internal::_rbtree_insert(Container *cnt, const K &key, V val, Args &&... args);
 
+        template<class Container, typename R>
+        friend R rbtree_internal::_rbtree_insert_fixup(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container, typename K>
+        friend neighbor_t rbtree_internal::_rbtree_hint_position(Container *cnt, rb_node<container::node_type> *hint, const K &key, rb_node<container::node_type> **parent);
+
+        template<class Container, typename R, typename K, typename V, typename... Args>
+        friend R rbtree_internal::_rbtree_insert_hint(Container *cnt, rb_node<container::node_type> *hint, const K &key, V val, Args &&... args);
+
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_prepare_erase(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
 
+        template<class Container, typename K>
+        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_bound(Container *cnt, const K &key, bool upper);
+
+        template<class Container, typename K>
+        friend std::pair<rb_node<container::node_type>*, rb_node<container::node_type>*> rbtree_internal::_rbtree_equal_range(Container *cnt, const K &key);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_minimum(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_count(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_set_count(rb_node<container::node_type> *tnode, std::size_t count);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_weight(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_add_count(rb_node<container::node_type> *tnode, rb_node<container::node_type> *sentinel, std::size_t delta);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_rotate_count(rb_node<container::node_type> *top, rb_node<container::node_type> *new_top, rb_node<container::node_type> *moved);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_count(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_select(Container *cnt, std::size_t &k);
+
+        template<class Container, typename K>
+        friend std::size_t rbtree_internal::_rbtree_rank(Container *cnt, const K &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_index(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_black_height(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_join(rb_node<container::node_type> *left, std::size_t left_height, rb_node<container::node_type> *pivot,
+                                                                            rb_node<container::node_type> *right, std::size_t right_height, std::size_t &height);
+
+        template<class Container, typename K>
+        friend void rbtree_internal::_rbtree_split(Container *cnt, rb_node<container::node_type> *tnode, std::size_t height, const K &key,
+                                                   rb_node<container::node_type> **left, std::size_t &left_height, rb_node<container::node_type> **right, std::size_t &right_height);
+
         template<class Container>
-        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_attach(Container *cnt, rb_node<container::node_type> *root, std::size_t size);
 
         template<class Container>
-        friend bool rbtree_internal::_rbtree_is_equal_key(Container *cnt, const container::key_type &lhs_key, const container::key_type &rhs_key);
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_concat(Container *cnt, rb_node<container::node_type> *left, rb_node<container::node_type> *right);
 
         template<class Container>
-        friend rb_node<container::node_type> *rbtree_internal::_rbtree_find_bound(Container *cnt, rb_node<container::node_type> *tnode, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_erase_range(Container *cnt, rb_node<container::node_type> *first, rb_node<container::node_type> *last);
 
     private:
         internal_ptr _copy_tree(internal_ptr other_root);
+        size_type _index(const_iterator pos) const;
+        multiset_node *_copy_list(multiset_node *head);
         iterator _add_to_list(internal_ptr ptr, multiset_node *new_node);
         internal_ptr _construct_new_element(const value_type &val);
         internal_ptr _construct_new_element(value_type &&val);
@@ -350,405 +457,565 @@ namespace adt {
         iterator _handle_elem_found(internal_ptr ptr, multiset_node *val);
         iterator _handle_elem_not_found(internal_ptr ptr);
         const key_type &_get_key(internal_ptr ptr);
-        void _clear_node(internal_ptr tnode);
+        size_type _clear_node(internal_ptr tnode);
         size_type _erase_list(internal_ptr erase_ptr);
-        void _erase_from_node(internal_ptr erase_ptr);
-        std::pair<internal_ptr, size_type> _erase(const_iterator pos, bool erase_all);
+        void _erase_from_node(internal_ptr erase_ptr, multiset_node *element);
+        std::pair<iterator, size_type> _erase(const_iterator pos, bool erase_all);
     };
 
+    /* multiset that keeps subtree sizes, for nth(), rank() and distance() in O(log n).  */
+    template<typename Key, class Less = std::less<Key>, class Alloc = std::allocator<Key>>
+    using ranked_multiset = multiset<Key, Less, Alloc, order_statistics>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename Key, class Less>
-    multiset<Key, Less>::multiset(const key_compare &keq) noexcept : _root(nullptr), _size(0), _less(keq) {
-        _sentinel = new rb_node<node_type>();
-    }
-
-    template<typename Key, class Less>
-    multiset<Key, Less>::multiset(const multiset &other) noexcept {
-        if (this != &other) {
-            /* Create an exact copy of this set, O(n).  */
-            _root = _copy_tree(other._root);
-            _sentinel = new rb_node<node_type>();
-            _sentinel->left = _root;
-            _root->parent = _sentinel;
-            _less = other._less;
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset<Key, Less, Alloc, Stats>::multiset(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _node_alloc(alloc), _list_alloc(alloc) {
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
     }
 
-    template<typename Key, class Less>
-    multiset<Key, Less>::multiset(multiset &&other) noexcept : multiset() {
-        swap(*this, other);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset<Key, Less, Alloc, Stats>::multiset(const multiset &other) noexcept
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _node_alloc(std::allocator_traits<node_allocator>::select_on_container_copy_construction(other._node_alloc)),
+          _list_alloc(_node_alloc) {
+        /* Create an exact copy of this set, O(n).  */
+        _root = _copy_tree(other._root);
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
+        _sentinel->left = _root;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+        if (_root) _root->set_parent(_sentinel);
     }
 
-    template<typename Key, class Less>
-    multiset<Key, Less>::~multiset() {
-        if (_root != nullptr) {
-            clear();
-            delete _sentinel;
-        } else {
-            if (_sentinel) delete _sentinel;
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset<Key, Less, Alloc, Stats>::multiset(multiset &&other) noexcept : multiset() {
+        swap(other);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset<Key, Less, Alloc, Stats>::~multiset() {
+        /* The allocator gives its blocks back on its own, no need to walk the tree.  */
+        if (_rbtree_can_drop_nodes<node_allocator, node_type>(_node_alloc, 2) && _rbtree_can_drop_nodes<list_allocator, value_type>(_list_alloc, 2)) return;
+
+        clear();
+        _rbtree_delete_sentinel<sentinel_type>(_node_alloc, _sentinel);
     }
 
-    template<typename Key, class Less>
-    multiset<Key, Less> &multiset<Key, Less>::operator=(multiset rhs) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset<Key, Less, Alloc, Stats> &multiset<Key, Less, Alloc, Stats>::operator=(multiset rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
 
         return *this;
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::begin() noexcept {
-        internal_ptr current = _root;
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::begin() noexcept {
+        internal_ptr current = _rbtree_first<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->left != nullptr) {
-                current = current->left;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return iterator(_sentinel, current);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::begin() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->begin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::begin() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::end() noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::end() noexcept {
         return iterator(_sentinel, _sentinel);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::end() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->end();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::end() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename Key, class Less>
-    multiset_t::reverse_iterator multiset<Key, Less>::rbegin() noexcept {
-        rb_node<node_type> *current = _root;
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::reverse_iterator multiset<Key, Less, Alloc, Stats>::rbegin() noexcept {
+        rb_node<node_type> *current = _rbtree_last<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->right != nullptr) {
-                current = current->right;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
+
+        reverse_iterator rit(_sentinel, current);
 
-        return reverse_iterator(_sentinel, current);
+        /* The last element is the tail of the list of the rightmost node.  */
+        while (rit._it._inner_ptr != nullptr && rit._it._inner_ptr->next != nullptr) rit._it._inner_ptr = rit._it._inner_ptr->next;
+
+        return rit;
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_reverse_iterator multiset<Key, Less>::rbegin() const {
-        return const_cast<multiset<Key, Less>*>(this)->rbegin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_reverse_iterator multiset<Key, Less, Alloc, Stats>::rbegin() const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename Key, class Less>
-    multiset_t::reverse_iterator multiset<Key, Less>::rend() noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::reverse_iterator multiset<Key, Less, Alloc, Stats>::rend() noexcept {
         return reverse_iterator(_sentinel, _sentinel);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_reverse_iterator multiset<Key, Less>::rend() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->rend();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_reverse_iterator multiset<Key, Less, Alloc, Stats>::rend() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::cbegin() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->begin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::cbegin() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::cend() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->end();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::cend() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_reverse_iterator multiset<Key, Less>::crbegin() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->rbegin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_reverse_iterator multiset<Key, Less, Alloc, Stats>::crbegin() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_reverse_iterator multiset<Key, Less>::crend() const noexcept {
-        return const_cast<multiset<Key, Less>*>(this)->rend();
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_reverse_iterator multiset<Key, Less, Alloc, Stats>::crend() const noexcept {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename Key, class Less>
-    bool multiset<Key, Less>::empty() const noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    bool multiset<Key, Less, Alloc, Stats>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename Key, class Less>
-    multiset_t::size_type multiset<Key, Less>::size() const noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::size() const noexcept {
         return _size;
     }
 
-    template<typename Key, class Less>
-    multiset_t::key_compare multiset<Key, Less>::key_comp() const {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::key_compare multiset<Key, Less, Alloc, Stats>::key_comp() const {
         return _less;
     }
 
-    template<typename Key, class Less>
-    multiset_t::value_compare multiset<Key, Less>::value_comp() const {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::value_compare multiset<Key, Less, Alloc, Stats>::value_comp() const {
         return _less;
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::insert(const value_type &val) {
-        return _rbtree_insert<multiset<Key, Less>, iterator, key_type, const value_type&>(this, val, val, val);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::allocator_type multiset<Key, Less, Alloc, Stats>::get_allocator() const noexcept {
+        return allocator_type(_node_alloc);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::insert(const value_type &val) {
+        return _rbtree_insert<multiset<Key, Less, Alloc, Stats>, iterator, key_type, const value_type&>(this, val, val, val);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::insert(value_type &&val) {
+        return _rbtree_insert<multiset<Key, Less, Alloc, Stats>, iterator, key_type, value_type&&>(this, val, std::forward<value_type>(val), std::forward<value_type>(val));
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::insert(value_type &&val) {
-        return _rbtree_insert<multiset<Key, Less>, iterator, key_type, value_type&&>(this, val, std::forward<value_type>(val), std::forward<value_type>(val));
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::insert(const_iterator hint, const value_type &val) {
+        return _rbtree_insert_hint<multiset<Key, Less, Alloc, Stats>, iterator, key_type, const value_type&>(this, hint._ptr, val, val, val);
     }
 
-    template<typename Key, class Less>
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::insert(const_iterator hint, value_type &&val) {
+        return _rbtree_insert_hint<multiset<Key, Less, Alloc, Stats>, iterator, key_type, value_type&&>(this, hint._ptr, val, std::forward<value_type>(val), std::forward<value_type>(val));
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
     template<class... Args>
-    multiset_t::iterator multiset<Key, Less>::emplace(Args &&... args) {
-        multiset_node *val = new multiset_node(std::forward<Args>(args)...);
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::emplace(Args &&... args) {
+        multiset_node *val = _rbtree_new_node(_list_alloc, std::forward<Args>(args)...);
 
-        return _rbtree_insert<multiset<Key, Less>, iterator, key_type, multiset_node*>(this, val->data, val, val);
+        return _rbtree_insert<multiset<Key, Less, Alloc, Stats>, iterator, key_type, multiset_node*>(this, val->data, val, val);
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::erase(const_iterator pos) {
-        return {_sentinel, _erase(pos, false).first};
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class... Args>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::emplace_hint(const_iterator hint, Args &&... args) {
+        multiset_node *val = _rbtree_new_node(_list_alloc, std::forward<Args>(args)...);
+
+        return _rbtree_insert_hint<multiset<Key, Less, Alloc, Stats>, iterator, key_type, multiset_node*>(this, hint._ptr, val->data, val, val);
     }
 
-    template<typename Key, class Less>
-    multiset_t::size_type multiset<Key, Less>::erase(const value_type &val) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::erase(const_iterator pos) {
+        return _erase(pos, false).first;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::erase(const value_type &val) {
         return _erase(find(val), true).second;
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::erase(multiset::const_iterator first, multiset::const_iterator last) {
-        auto it = first;
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::erase(multiset::const_iterator first, multiset::const_iterator last) {
+        iterator it = first, end = last;
+        size_type n = 0;
+
+        /* A short range is erased one element at a time, counted beforehand since erase() may move
+           the list of the next node and invalidate last.  */
+        for (; it != end && n < _rbtree_short_range ; ++it) n++;
+        if (it == end) {
+            for (it = first ; n > 0 ; n--) it = erase(it);
+            return it;
+        }
 
-        while (it != last) it = erase(it);
+        /* The elements of the nodes at both ends that fall in the range are erased one at a time,
+           these nodes keep other elements and stay in the tree.  */
+        for (it = first ; it != end && it._inner_ptr != it._ptr->data.head ; ) it = erase(it);
+        if (it == end) return it;
+        while (end._ptr != _sentinel && end._inner_ptr != end._ptr->data.head) erase(iterator(_sentinel, end._ptr));
 
-        return it;
+        if (it._ptr != end._ptr) _rbtree_erase_range<multiset<Key, Less, Alloc, Stats>>(this, it._ptr, end._ptr);
+
+        return end;
     }
 
-    template<typename Key, class Less>
-    void multiset<Key, Less>::clear() noexcept {
-        _rbtree_destruct<multiset<Key, Less>>(this, _root);
+    template<typename Key, class Less, class Alloc, class Stats>
+    void multiset<Key, Less, Alloc, Stats>::clear() noexcept {
+        _rbtree_destruct<multiset<Key, Less, Alloc, Stats>>(this, _root);
         _sentinel->left = nullptr;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
         _root = nullptr;
         _size = 0;
     }
 
-    template<typename Key, class Less>
-    void multiset<Key, Less>::swap(multiset &other) {
-        swap(*this, other);
+    template<typename Key, class Less, class Alloc, class Stats>
+    void multiset<Key, Less, Alloc, Stats>::swap(multiset &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_sentinel, other._sentinel);
+        swap(_less, other._less);
+        swap(_size, other._size);
+        swap(_node_alloc, other._node_alloc);
+        swap(_list_alloc, other._list_alloc);
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::find(const key_type &key) {
-        return _rbtree_find<multiset<Key, Less>>(this, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::find(const key_type &key) {
+        return find<key_type>(key);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::find(const key_type &key) const {
-        return const_cast<multiset<Key, Less>*>(this)->find(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::find(const K &key) {
+        return _rbtree_find<multiset<Key, Less, Alloc, Stats>>(this, key);
     }
 
-    template<typename Key, class Less>
-    multiset_t::size_type multiset<Key, Less>::count(const key_type &key) const {
-        internal_ptr found_ptr = const_cast<multiset<Key, Less>*>(this)->find(key)._ptr;
-        multiset_node *current;
-        size_t count = 0;
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::find(const key_type &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->find(key);
+    }
 
-        if (found_ptr == _sentinel) return count;
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::find(const K &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->find(key);
+    }
 
-        current = found_ptr->data;
-        while (current != nullptr) {
-            count++;
-            current = current->next;
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::count(const K &key) const {
+        auto range = _rbtree_equal_range<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), key);
+        internal_ptr last = range.second ? range.second : _sentinel;
+        size_type count = 0;
+
+        /* Equivalent elements share a node, which keeps their number, only keys of another type can match several.  */
+        for (internal_ptr current = range.first ; current && current != last ; current = _rbtree_successor<multiset<Key, Less, Alloc, Stats>>(current)) {
+            count += current->data.length;
         }
 
         return count;
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::lower_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<multiset<Key, Less>>(this, _root, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::lower_bound(const K &key) {
+        internal_ptr bound = _rbtree_bound<multiset<Key, Less, Alloc, Stats>>(this, key, false);
 
         return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::lower_bound(const key_type &key) const {
-        return const_cast<multiset<Key, Less>*>(this)->lower_bound(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::lower_bound(const key_type &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->lower_bound(key);
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::upper_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<multiset<Key, Less>>(this, _root, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::lower_bound(const K &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->lower_bound(key);
+    }
 
-        if (bound == nullptr) {
-            return end();
-        } else {
-            if (_rbtree_is_equal_key<multiset<Key, Less>>(this, bound->data->data, key)) {
-                return iterator(_sentinel, _rbtree_successor<multiset<Key, Less>>(bound));
-            } else {
-                return iterator(_sentinel, bound);
-            }
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::upper_bound(const K &key) {
+        internal_ptr bound = _rbtree_bound<multiset<Key, Less, Alloc, Stats>>(this, key, true);
+
+        return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename Key, class Less>
-    multiset_t::const_iterator multiset<Key, Less>::upper_bound(const key_type &key) const {
-        return const_cast<multiset<Key, Less>*>(this)->upper_bound(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::upper_bound(const key_type &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->upper_bound(key);
     }
 
-    template<typename Key, class Less>
-    std::pair<multiset_t::iterator, multiset_t::iterator> multiset<Key, Less>::equal_range(const key_type &key) {
-        auto first = find(key)._ptr;
-        auto second = _rbtree_successor<multiset<Key, Less>>(first);
-        second = second != nullptr ? second : _sentinel;
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::upper_bound(const K &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
 
-        return {{_sentinel, first}, {_sentinel, second}};
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<multiset_t::iterator, multiset_t::iterator> multiset<Key, Less, Alloc, Stats>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
     }
 
-    template<typename Key, class Less>
-    std::pair<multiset_t::const_iterator, multiset_t::const_iterator> multiset<Key, Less>::equal_range(const key_type &key) const {
-        return const_cast<multiset<Key, Less>*>(this)->equal_range(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    std::pair<multiset_t::iterator, multiset_t::iterator> multiset<Key, Less, Alloc, Stats>::equal_range(const K &key) {
+        auto range = _rbtree_equal_range<multiset<Key, Less, Alloc, Stats>>(this, key);
+
+        return {{_sentinel, range.first ? range.first : _sentinel}, {_sentinel, range.second ? range.second : _sentinel}};
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<multiset_t::const_iterator, multiset_t::const_iterator> multiset<Key, Less, Alloc, Stats>::equal_range(const key_type &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    std::pair<multiset_t::const_iterator, multiset_t::const_iterator> multiset<Key, Less, Alloc, Stats>::equal_range(const K &key) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::count_range(const key_type &lo, const key_type &hi) const {
+        internal_ptr current, last;
+        size_type count = 0;
+
+        if (!_less(lo, hi)) return 0;
+        if (Stats::value) return _rbtree_rank<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), hi) - _rbtree_rank<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), lo);
+
+        /* Without subtree sizes the nodes in between are walked, each knows how many elements it holds.  */
+        current = _rbtree_bound<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), lo, false);
+        last = _rbtree_bound<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), hi, false);
+        if (last == nullptr) last = _sentinel;
+        for (; current && current != last ; current = _rbtree_successor<multiset<Key, Less, Alloc, Stats>>(current)) count += current->data.length;
+
+        return count;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::nth(size_type k) {
+        static_assert(Stats::value, "nth() needs order_statistics");
+
+        if (k >= _size) return end();
+
+        iterator it(_sentinel, _rbtree_select<multiset<Key, Less, Alloc, Stats>>(this, k));
+        /* k is left at the position inside the node's list.  */
+        for (; k > 0 ; k--) it._inner_ptr = it._inner_ptr->next;
+
+        return it;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::const_iterator multiset<Key, Less, Alloc, Stats>::nth(size_type k) const {
+        return const_cast<multiset<Key, Less, Alloc, Stats>*>(this)->nth(k);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::rank(const key_type &key) const {
+        static_assert(Stats::value, "rank() needs order_statistics");
+
+        return _rbtree_rank<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::difference_type multiset<Key, Less, Alloc, Stats>::distance(const_iterator first, const_iterator last) const {
+        static_assert(Stats::value, "distance() needs order_statistics");
+
+        return (difference_type) _index(last) - (difference_type) _index(first);
     }
 
     /* Private member functions.  */
-    template<typename Key, class Less>
-    multiset_t::internal_ptr multiset<Key, Less>::_copy_tree(internal_ptr other_root) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::internal_ptr multiset<Key, Less, Alloc, Stats>::_copy_tree(internal_ptr other_root) {
         internal_ptr new_node;
 
         if (other_root == nullptr) return nullptr;
 
-        new_node = new rb_node<node_type>(other_root->data);
+        new_node = _rbtree_new_node(_node_alloc, _copy_list(other_root->data.head));
+        new_node->data.length = other_root->data.length;
+        if (Stats::value) _rbtree_set_count<multiset<Key, Less, Alloc, Stats>>(new_node, _rbtree_count<multiset<Key, Less, Alloc, Stats>>(other_root));
+        new_node->set_color(other_root->color());
 
         new_node->left = _copy_tree(other_root->left);
-        if (new_node->left) new_node->left->parent = new_node;
+        if (new_node->left) new_node->left->set_parent(new_node);
 
         new_node->right = _copy_tree(other_root->right);
-        if (new_node->right) new_node->right->parent = new_node;
+        if (new_node->right) new_node->right->set_parent(new_node);
 
         return new_node;
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::_add_to_list(internal_ptr ptr, multiset_node *new_node) {
-        new_node->next = ptr->data;
-        ptr->data = new_node;
+    template<typename Key, class Less, class Alloc, class Stats>
+    typename multiset<Key, Less, Alloc, Stats>::multiset_node *multiset<Key, Less, Alloc, Stats>::_copy_list(multiset_node *head) {
+        multiset_node *new_head, *tail;
+
+        /* Every node of the tree owns its list, copy it in order.  */
+        new_head = tail = _rbtree_new_node(_list_alloc, head->data);
+        for (head = head->next ; head != nullptr ; head = head->next) {
+            tail->next = _rbtree_new_node(_list_alloc, head->data);
+            tail->next->previous = tail;
+            tail = tail->next;
+        }
+
+        return new_head;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::_add_to_list(internal_ptr ptr, multiset_node *new_node) {
+        new_node->next = ptr->data.head;
+        ptr->data.head = new_node;
+        ptr->data.length++;
         new_node->next->previous = new_node;
         _size++;
+        _rbtree_add_count<multiset<Key, Less, Alloc, Stats>>(ptr, _sentinel, 1);
 
         return {_sentinel, ptr};
     }
 
-    template<typename Key, class Less>
-    multiset_t::internal_ptr multiset<Key, Less>::_construct_new_element(const value_type &val) {
-        return new rb_node<node_type>(new multiset_node(val));
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::internal_ptr multiset<Key, Less, Alloc, Stats>::_construct_new_element(const value_type &val) {
+        return _rbtree_new_node(_node_alloc, _rbtree_new_node(_list_alloc, val));
     }
 
-    template<typename Key, class Less>
-    multiset_t::internal_ptr multiset<Key, Less>::_construct_new_element(value_type &&val) {
-        return new rb_node<node_type>(new multiset_node(std::forward<value_type>(val)));
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::internal_ptr multiset<Key, Less, Alloc, Stats>::_construct_new_element(value_type &&val) {
+        return _rbtree_new_node(_node_alloc, _rbtree_new_node(_list_alloc, std::forward<value_type>(val)));
     }
 
-    template<typename Key, class Less>
-    multiset_t::internal_ptr multiset<Key, Less>::_construct_new_element(multiset_node *val) {
-        return new rb_node<node_type>(val);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::internal_ptr multiset<Key, Less, Alloc, Stats>::_construct_new_element(multiset_node *val) {
+        return _rbtree_new_node(_node_alloc, val);
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::_handle_elem_found(internal_ptr ptr, const value_type &val) {
-        return _add_to_list(ptr, new multiset_node(val));
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, const value_type &val) {
+        return _add_to_list(ptr, _rbtree_new_node(_list_alloc, val));
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::_handle_elem_found(internal_ptr ptr, value_type &&val) {
-        return _add_to_list(ptr, new multiset_node(std::forward<value_type>(val)));
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, value_type &&val) {
+        return _add_to_list(ptr, _rbtree_new_node(_list_alloc, std::forward<value_type>(val)));
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::_handle_elem_found(internal_ptr ptr, multiset_node *val) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, multiset_node *val) {
         return _add_to_list(ptr, val);
     }
 
-    template<typename Key, class Less>
-    multiset_t::iterator multiset<Key, Less>::_handle_elem_not_found(internal_ptr ptr) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::iterator multiset<Key, Less, Alloc, Stats>::_handle_elem_not_found(internal_ptr ptr) {
         return {_sentinel, ptr};
     }
 
-    template<typename Key, class Less>
-    const multiset_t::key_type &multiset<Key, Less>::_get_key(internal_ptr ptr) {
-        return ptr->data->data;
+    template<typename Key, class Less, class Alloc, class Stats>
+    const multiset_t::key_type &multiset<Key, Less, Alloc, Stats>::_get_key(internal_ptr ptr) {
+        return ptr->data.head->data;
     }
 
-    template<typename Key, class Less>
-    void multiset<Key, Less>::_clear_node(internal_ptr tnode) {
-        _erase_list(tnode);
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::_clear_node(internal_ptr tnode) {
+        return _erase_list(tnode);
     }
 
-    template<typename Key, class Less>
-    multiset_t::size_type multiset<Key, Less>::_erase_list(internal_ptr erase_ptr) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::_erase_list(internal_ptr erase_ptr) {
         multiset_node *current, *to_delete;
         size_t count = 0;
 
-        current = erase_ptr->data;
+        current = erase_ptr->data.head;
         while (current->next != nullptr) {
             to_delete = current->next;
             current->next = to_delete->next;
 
-            delete to_delete;
+            _rbtree_delete_node(_list_alloc, to_delete);
             count++;
         }
 
-        delete erase_ptr->data;
-        delete erase_ptr;
+        _rbtree_delete_node(_list_alloc, erase_ptr->data.head);
+        _rbtree_delete_node(_node_alloc, erase_ptr);
         count++;
 
         return count;
     }
 
-    template<typename Key, class Less>
-    void multiset<Key, Less>::_erase_from_node(internal_ptr erase_ptr) {
-        multiset_node *head = erase_ptr->data;
+    template<typename Key, class Less, class Alloc, class Stats>
+    void multiset<Key, Less, Alloc, Stats>::_erase_from_node(internal_ptr erase_ptr, multiset_node *element) {
+        if (element->previous) element->previous->next = element->next;
+        else erase_ptr->data.head = element->next;
+        if (element->next) element->next->previous = element->previous;
 
-        erase_ptr->data = head->next;
-        delete head;
+        erase_ptr->data.length--;
+        _rbtree_delete_node(_list_alloc, element);
     }
 
-    template<typename Key, class Less>
-    std::pair<multiset_t::internal_ptr, multiset_t::size_type> multiset<Key, Less>::_erase(const_iterator pos, bool erase_all) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<multiset_t::iterator, multiset_t::size_type> multiset<Key, Less, Alloc, Stats>::_erase(const_iterator pos, bool erase_all) {
         internal_ptr to_return, successor, erase_ptr;
+        multiset_node *next = nullptr;
         size_t count = 0;
 
         to_return = _sentinel;
         if (pos._ptr != _sentinel) {
-            _root->parent = nullptr;
+            _root->set_parent(nullptr);
 
             if (erase_all) {
-                successor = _rbtree_successor<multiset<Key, Less>>(pos._ptr);
-                erase_ptr = _rbtree_prepare_erase<multiset<Key, Less>>(this, pos._ptr, successor);
+                successor = _rbtree_successor<multiset<Key, Less, Alloc, Stats>>(pos._ptr);
+                erase_ptr = _rbtree_prepare_erase<multiset<Key, Less, Alloc, Stats>>(this, pos._ptr, successor);
                 to_return = erase_ptr == successor ? pos._ptr : successor;
 
                 count = _erase_list(erase_ptr);
             } else {
-                _erase_from_node(pos._ptr);
-                if (pos._ptr->data != nullptr) {
-                    to_return = pos._ptr;
+                next = pos._inner_ptr->next;
+                _erase_from_node(pos._ptr, pos._inner_ptr);
+                if (pos._ptr->data.head != nullptr) {
+                    /* The element after pos is the next in the list, or the first of the next node.  */
+                    to_return = next ? pos._ptr : _rbtree_successor<multiset<Key, Less, Alloc, Stats>>(pos._ptr);
+                    _rbtree_add_count<multiset<Key, Less, Alloc, Stats>>(pos._ptr, _sentinel, (size_type) 0 - 1);
                 } else {
-                    successor = _rbtree_successor<multiset<Key, Less>>(pos._ptr);
-                    erase_ptr = _rbtree_prepare_erase<multiset<Key, Less>>(this, pos._ptr, successor);
+                    successor = _rbtree_successor<multiset<Key, Less, Alloc, Stats>>(pos._ptr);
+                    erase_ptr = _rbtree_prepare_erase<multiset<Key, Less, Alloc, Stats>>(this, pos._ptr, successor);
                     to_return = erase_ptr == successor ? pos._ptr : successor;
 
-                    delete erase_ptr;
+                    _rbtree_delete_node(_node_alloc, erase_ptr);
                 }
                 count = 1;
             }
@@ -757,10 +1024,33 @@ namespace adt {
             if (_size == 0) {
                 _root = nullptr;
                 _sentinel->left = nullptr;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
                 to_return = _sentinel;
+            } else {
+                /* The root may have changed, hook it back under the sentinel so iteration still reaches end().  */
+                _root->set_parent(_sentinel);
+                _sentinel->left = _root;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+                if (to_return == nullptr) to_return = _sentinel;
             }
         }
 
-        return {to_return, count};
+        iterator ret(_sentinel, to_return);
+        if (next) ret._inner_ptr = next;
+
+        return {ret, count};
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    multiset_t::size_type multiset<Key, Less, Alloc, Stats>::_index(const_iterator pos) const {
+        size_type index = _rbtree_index<multiset<Key, Less, Alloc, Stats>>(const_cast<multiset<Key, Less, Alloc, Stats>*>(this), pos._ptr);
+        multiset_node *current;
+
+        if (pos._ptr == _sentinel) return index;
+
+        /* Equivalent elements are listed in the node, count the ones before pos.  */
+        for (current = pos._ptr->data.head ; current != pos._inner_ptr ; current = current->next) index++;
+
+        return index;
     }
 }
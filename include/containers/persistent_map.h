@@ -0,0 +1,573 @@
+#pragma once
+
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+
+#include "../internal/persistent_internal.h"
+
+#define persistent_map_t typename persistent_map<K, V, Less, Alloc>
+
+using namespace persistent_internal;
+
+namespace adt {
+
+    /* Map whose copies are snapshots: a copy (or snapshot()) shares the whole tree in O(1), and a modification
+       copies only the shared nodes on its way down (path copying), so snapshots keep seeing the map as it was.
+       Elements can only be changed through the map (insert_or_assign), iterators are constant.
+       The allocator must be able to free nodes allocated by its copies, every snapshot frees the nodes it drops.  */
+    template<typename K, typename V, class Less = std::less<K>, class Alloc = std::allocator<std::pair<const K, V>>>
+    class persistent_map {
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<const K, V>;
+        using key_compare = Less;
+        using value_compare = Less;
+        using reference = const value_type&;
+        using const_reference = const value_type&;
+        using pointer = const value_type*;
+        using const_pointer = const value_type*;
+        using difference_type = std::ptrdiff_t;
+        using size_type = std::size_t;
+        using allocator_type = Alloc;
+        class const_iterator;
+        using iterator = const_iterator;
+        using reverse_iterator = std::reverse_iterator<const_iterator>;
+        using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    private:
+        using node_type = persistent_node<value_type>;
+        using internal_ptr = node_type*;
+        using path_type = persistent_path<node_type>;
+        using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<node_type>;
+
+        static_assert(std::allocator_traits<node_allocator>::is_always_equal::value,
+                      "Snapshots free each other's nodes, the allocator must be stateless.");
+
+        internal_ptr _root;
+        size_type _size;
+        key_compare _less;
+        node_allocator _node_alloc;
+
+        struct enabler {};
+
+    public:
+        class const_iterator {
+            friend class persistent_map;
+            using internal_ptr = persistent_map::internal_ptr;
+            using path_type = persistent_map::path_type;
+
+        public:
+            using iterator_category = std::bidirectional_iterator_tag;
+            using value_type = persistent_map::value_type;
+            using reference = persistent_map::const_reference;
+            using pointer = persistent_map::const_pointer;
+            using difference_type = persistent_map::difference_type;
+
+            const_iterator() : _root(nullptr) {}
+            const_iterator(const const_iterator &other) = default;
+
+            const_iterator &operator=(const const_iterator &rhs) = default;
+
+            bool operator==(const const_iterator &rhs) const { return this->_path.top() == rhs._path.top(); }
+            bool operator!=(const const_iterator &rhs) const { return !(*this == rhs); }
+
+            const_iterator &operator++() {
+                _persistent_increment(_path);
+                return *this;
+            }
+            const_iterator operator++(int) {
+                auto temp(*this);
+                ++(*this);
+                return temp;
+            }
+            const_iterator &operator--() {
+                _persistent_decrement(_root, _path);
+                return *this;
+            }
+            const_iterator operator--(int) {
+                auto temp(*this);
+                --(*this);
+                return temp;
+            }
+
+            reference operator*() const { return _path.top()->data; }
+            pointer operator->() const { return &_path.top()->data; }
+
+        private:
+            internal_ptr _root;
+            path_type _path;
+
+            const_iterator(internal_ptr root, const path_type &path) : _root(root), _path(path) {}
+        };
+
+        /* Constructors/Destructors.  */
+        persistent_map(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        persistent_map(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        persistent_map(const persistent_map &other) noexcept;
+        persistent_map(persistent_map &&other) noexcept;
+        ~persistent_map();
+        persistent_map &operator=(persistent_map rhs);
+
+        /* Snapshots.  */
+        persistent_map snapshot() const noexcept;
+
+        /* Iterators.  */
+        const_iterator begin() const noexcept;
+        const_iterator end() const noexcept;
+        const_reverse_iterator rbegin() const noexcept;
+        const_reverse_iterator rend() const noexcept;
+        const_iterator cbegin() const noexcept;
+        const_iterator cend() const noexcept;
+        const_reverse_iterator crbegin() const noexcept;
+        const_reverse_iterator crend() const noexcept;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+
+        /* Observers.  */
+        key_compare key_comp() const;
+        value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
+
+        /* Element access.  */
+        const mapped_type &at(const key_type &key) const noexcept(false);
+
+        /* Modifiers.  */
+        std::pair<iterator, bool> insert(const value_type &val);
+        template<class P>
+        std::pair<iterator, bool> insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type = enabler());
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class... Args>
+        std::pair<iterator, bool> emplace(Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj);
+        iterator erase(const_iterator pos);
+        size_type erase(const key_type &key);
+        void clear() noexcept;
+        void swap(persistent_map &other);
+
+        /* Operations.  */
+        const_iterator find(const key_type &key) const;
+        size_type count(const key_type &key) const;
+        const_iterator lower_bound(const key_type &key) const;
+        const_iterator upper_bound(const key_type &key) const;
+        std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator lower_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        const_iterator upper_bound(const Key &key) const;
+        template<class Key, rbtree_internal::enable_lookup<Less, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+
+        friend void swap(persistent_map &lhs, persistent_map &rhs) {
+            lhs.swap(rhs);
+        }
+
+        template<class Container>
+        friend container::internal_ptr &persistent_internal::_persistent_link(Container *cnt, persistent_path<container::node_type> &path, std::size_t i);
+
+        template<class Container, typename... Args>
+        friend container::internal_ptr persistent_internal::_persistent_new_node(Container *cnt, Args&&... args);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_release(Container *cnt, container::internal_ptr node);
+
+        template<class Container>
+        friend container::internal_ptr persistent_internal::_persistent_unshare(Container *cnt, container::internal_ptr &link);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_unshare_path(Container *cnt, persistent_path<container::node_type> &path);
+
+        template<class Container, typename Key>
+        friend bool persistent_internal::_persistent_search(Container *cnt, const Key &key, persistent_path<container::node_type> &path);
+
+        template<class Container, typename Key>
+        friend persistent_path<container::node_type> persistent_internal::_persistent_bound(const Container *cnt, const Key &key, bool upper);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_insert(Container *cnt, persistent_path<container::node_type> &path, container::internal_ptr node);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_prepare_fixup(Container *cnt, persistent_path<container::node_type> path, bool left);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_erase_fixup(Container *cnt, persistent_path<container::node_type> &path, bool left);
+
+        template<class Container>
+        friend void persistent_internal::_persistent_erase(Container *cnt, persistent_path<container::node_type> &path);
+
+    private:
+        static const key_type &_get_key(internal_ptr node);
+        template<class... Args>
+        const_iterator _insert_at(path_type &path, Args&&... args);
+        template<typename Key, class... Args>
+        std::pair<iterator, bool> _try_emplace(Key &&key, Args&&... args);
+        template<typename Key, class M>
+        std::pair<iterator, bool> _insert_or_assign(Key &&key, M &&obj);
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc>::persistent_map(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _node_alloc(alloc) {}
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    persistent_map<K, V, Less, Alloc>::persistent_map(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc)
+        : persistent_map(keq, alloc) {
+        insert(first, last);
+    }
+
+    /* A copy is a snapshot, both maps share the tree until either of them changes.  */
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc>::persistent_map(const persistent_map &other) noexcept
+        : _root(nullptr), _size(other._size), _less(other._less), _node_alloc(other._node_alloc) {
+        _root = _persistent_share(other._root);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc>::persistent_map(persistent_map &&other) noexcept : persistent_map() {
+        swap(other);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc>::~persistent_map() {
+        clear();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc> &persistent_map<K, V, Less, Alloc>::operator=(persistent_map rhs) {
+        swap(rhs);
+
+        return *this;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map<K, V, Less, Alloc> persistent_map<K, V, Less, Alloc>::snapshot() const noexcept {
+        return persistent_map(*this);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::begin() const noexcept {
+        path_type path;
+
+        _persistent_leftmost(_root, path);
+
+        return const_iterator(_root, path);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::end() const noexcept {
+        return const_iterator(_root, path_type());
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_reverse_iterator persistent_map<K, V, Less, Alloc>::rbegin() const noexcept {
+        return const_reverse_iterator(end());
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_reverse_iterator persistent_map<K, V, Less, Alloc>::rend() const noexcept {
+        return const_reverse_iterator(begin());
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::cbegin() const noexcept {
+        return begin();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::cend() const noexcept {
+        return end();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_reverse_iterator persistent_map<K, V, Less, Alloc>::crbegin() const noexcept {
+        return rbegin();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_reverse_iterator persistent_map<K, V, Less, Alloc>::crend() const noexcept {
+        return rend();
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    bool persistent_map<K, V, Less, Alloc>::empty() const noexcept {
+        return _size == 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::size_type persistent_map<K, V, Less, Alloc>::size() const noexcept {
+        return _size;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::key_compare persistent_map<K, V, Less, Alloc>::key_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::value_compare persistent_map<K, V, Less, Alloc>::value_comp() const {
+        return _less;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::allocator_type persistent_map<K, V, Less, Alloc>::get_allocator() const noexcept {
+        return allocator_type(_node_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    const persistent_map_t::mapped_type &persistent_map<K, V, Less, Alloc>::at(const key_type &key) const noexcept(false) {
+        const_iterator it = find(key);
+
+        /* If we found it, return the mapped value.  */
+        if (it != end()) return it->second;
+
+        throw std::out_of_range("Key is not present on the map.");
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::insert(const value_type &val) {
+        return _try_emplace(val.first, val.second);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class P>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::insert(P &&val, typename std::enable_if<std::is_constructible<value_type, P&&>::value, enabler>::type) {
+        return emplace(std::forward<P>(val));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    void persistent_map<K, V, Less, Alloc>::insert(InputIt first, InputIt last) {
+        for (; first != last ; ++first) emplace(*first);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::emplace(Args &&... args) {
+        internal_ptr node = _persistent_new_node(this, std::forward<Args>(args)...);
+        path_type path;
+
+        /* The element is built first to get its key, and dropped if the key is already there.  */
+        if (_persistent_search(this, _get_key(node), path)) {
+            _persistent_release(this, node);
+            return std::make_pair(const_iterator(_root, path), false);
+        }
+
+        try {
+            _persistent_unshare_path(this, path);
+        }
+        catch (...) {
+            _persistent_release(this, node);
+            throw;
+        }
+
+        _persistent_insert(this, path, node);
+        _size++;
+
+        return std::make_pair(const_iterator(_root, path), true);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::try_emplace(const key_type &key, Args &&... args) {
+        return _try_emplace(key, std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::try_emplace(key_type &&key, Args &&... args) {
+        return _try_emplace(std::move(key), std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class M>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::insert_or_assign(const key_type &key, M &&obj) {
+        return _insert_or_assign(key, std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class M>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::insert_or_assign(key_type &&key, M &&obj) {
+        return _insert_or_assign(std::move(key), std::forward<M>(obj));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::iterator persistent_map<K, V, Less, Alloc>::erase(const_iterator pos) {
+        /* Erasing may copy or relink the nodes around pos, the next element is found again by key.  */
+        key_type key = pos->first;
+
+        erase(key);
+
+        return upper_bound(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::size_type persistent_map<K, V, Less, Alloc>::erase(const key_type &key) {
+        path_type path;
+
+        if (!_persistent_search(this, key, path)) return 0;
+
+        _persistent_erase(this, path);
+        _size--;
+
+        return 1;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    void persistent_map<K, V, Less, Alloc>::clear() noexcept {
+        /* Only the nodes no snapshot holds are freed.  */
+        _persistent_release(this, _root);
+        _root = nullptr;
+        _size = 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    void persistent_map<K, V, Less, Alloc>::swap(persistent_map &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_size, other._size);
+        swap(_less, other._less);
+        swap(_node_alloc, other._node_alloc);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::find(const key_type &key) const {
+        return find<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::find(const Key &key) const {
+        path_type path;
+
+        if (!_persistent_search(const_cast<persistent_map<K, V, Less, Alloc>*>(this), key, path)) return end();
+
+        return const_iterator(_root, path);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::size_type persistent_map<K, V, Less, Alloc>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    persistent_map_t::size_type persistent_map<K, V, Less, Alloc>::count(const Key &key) const {
+        path_type path;
+
+        return _persistent_search(const_cast<persistent_map<K, V, Less, Alloc>*>(this), key, path) ? 1 : 0;
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::lower_bound(const key_type &key) const {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::lower_bound(const Key &key) const {
+        return const_iterator(_root, _persistent_bound(this, key, false));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::upper_bound(const key_type &key) const {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::upper_bound(const Key &key) const {
+        return const_iterator(_root, _persistent_bound(this, key, true));
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    std::pair<persistent_map_t::const_iterator, persistent_map_t::const_iterator> persistent_map<K, V, Less, Alloc>::equal_range(const key_type &key) const {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<class Key, rbtree_internal::enable_lookup<Less, K, Key>>
+    std::pair<persistent_map_t::const_iterator, persistent_map_t::const_iterator> persistent_map<K, V, Less, Alloc>::equal_range(const Key &key) const {
+        const_iterator it = lower_bound(key), next = it;
+
+        /* Keys are unique, the range holds at most one element.  */
+        if (it == end() || _less(key, it->first)) return std::make_pair(it, it);
+
+        return std::make_pair(it, ++next);
+    }
+
+    /* Private member functions.  */
+    template<typename K, typename V, class Less, class Alloc>
+    const persistent_map_t::key_type &persistent_map<K, V, Less, Alloc>::_get_key(internal_ptr node) {
+        return node->data.first;
+    }
+
+    /* Links a new element under the end of a search path that did not find its key.  */
+    template<typename K, typename V, class Less, class Alloc>
+    template<class... Args>
+    persistent_map_t::const_iterator persistent_map<K, V, Less, Alloc>::_insert_at(path_type &path, Args &&... args) {
+        internal_ptr node;
+
+        _persistent_unshare_path(this, path);
+        node = _persistent_new_node(this, std::forward<Args>(args)...);
+
+        _persistent_insert(this, path, node);
+        _size++;
+
+        return const_iterator(_root, path);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<typename Key, class... Args>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::_try_emplace(Key &&key, Args &&... args) {
+        path_type path;
+
+        /* Unlike emplace, nothing is constructed (or copied) when the key is already there.  */
+        if (_persistent_search(this, key, path)) return std::make_pair(const_iterator(_root, path), false);
+
+        return std::make_pair(_insert_at(path, std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)),
+                                         std::forward_as_tuple(std::forward<Args>(args)...)), true);
+    }
+
+    template<typename K, typename V, class Less, class Alloc>
+    template<typename Key, class M>
+    std::pair<persistent_map_t::iterator, bool> persistent_map<K, V, Less, Alloc>::_insert_or_assign(Key &&key, M &&obj) {
+        path_type path;
+
+        /* The element is assigned in a private copy, snapshots keep the old value.  */
+        if (_persistent_search(this, key, path)) {
+            _persistent_unshare_path(this, path);
+            path.top()->data.second = std::forward<M>(obj);
+            return std::make_pair(const_iterator(_root, path), false);
+        }
+
+        return std::make_pair(_insert_at(path, std::piecewise_construct, std::forward_as_tuple(std::forward<Key>(key)),
+                                         std::forward_as_tuple(std::forward<M>(obj))), true);
+    }
+}
@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace adt {
+
+    namespace pool_internal {
+
+        /* Nodes of one size: blocks that grow geometrically up to a maximum and a free list.  */
+        struct pool_arena {
+            std::size_t slot_size;
+            void *blocks;
+            void *free_list;
+            unsigned char *next;
+            unsigned char *end;
+            std::size_t block_nodes;
+            pool_arena *next_arena;
+        };
+
+        /* Shared by the copies and rebinds of an allocator, one arena per node size. The last owner releases it.  */
+        struct pool_shared {
+            std::size_t owners;
+            pool_arena *arenas;
+        };
+
+        constexpr std::size_t pool_min_block_nodes = 16;
+
+        /* Blocks start with the pointer to the next one, the nodes follow at the strictest alignment.  */
+        constexpr std::size_t pool_block_offset = (sizeof(void*) + alignof(std::max_align_t) - 1) / alignof(std::max_align_t) * alignof(std::max_align_t);
+
+        inline pool_arena *_pool_arena_for(pool_shared *shared, std::size_t slot_size) {
+            pool_arena *arena;
+
+            for (arena = shared->arenas ; arena != nullptr ; arena = arena->next_arena) {
+                if (arena->slot_size == slot_size) return arena;
+            }
+
+            arena = new pool_arena{slot_size, nullptr, nullptr, nullptr, nullptr, 0, shared->arenas};
+            shared->arenas = arena;
+
+            return arena;
+        }
+
+        inline void _pool_add_block(pool_arena *arena, std::size_t max_block_nodes) {
+            void *block;
+
+            /* Double the block size each time, so small trees stay small.  */
+            arena->block_nodes = arena->block_nodes == 0 ? pool_min_block_nodes : arena->block_nodes * 2;
+            if (arena->block_nodes > max_block_nodes) arena->block_nodes = max_block_nodes;
+
+            block = ::operator new(pool_block_offset + arena->block_nodes * arena->slot_size);
+            ::new (block) void*(arena->blocks);
+            arena->blocks = block;
+
+            arena->next = static_cast<unsigned char*>(block) + pool_block_offset;
+            arena->end = arena->next + arena->block_nodes * arena->slot_size;
+        }
+
+        inline void *_pool_allocate(pool_arena *arena, std::size_t max_block_nodes) {
+            void *node;
+
+            if (arena->free_list) {
+                node = arena->free_list;
+                arena->free_list = *static_cast<void**>(node);
+                return node;
+            }
+
+            if (arena->next == arena->end) _pool_add_block(arena, max_block_nodes);
+            node = arena->next;
+            arena->next += arena->slot_size;
+
+            return node;
+        }
+
+        inline void _pool_deallocate(pool_arena *arena, void *node) noexcept {
+            ::new (node) void*(arena->free_list);
+            arena->free_list = node;
+        }
+
+        inline void _pool_release(pool_shared *shared) noexcept {
+            pool_arena *arena;
+            void *block;
+
+            while (shared->arenas) {
+                arena = shared->arenas;
+                shared->arenas = arena->next_arena;
+
+                while (arena->blocks) {
+                    block = arena->blocks;
+                    arena->blocks = *static_cast<void**>(block);
+                    ::operator delete(block);
+                }
+                delete arena;
+            }
+
+            delete shared;
+        }
+    }
+
+    /* Node allocator for the tree containers.
+       Nodes are carved out of blocks that grow geometrically up to MaxBlockNodes nodes,
+       freed nodes go to a free list and every block is released with the pool.
+       Copies and rebinds share the pool and compare equal, the last of them releases it.
+       A copied container still starts with a pool of its own (select_on_container_copy_construction).  */
+    template<typename T, std::size_t MaxBlockNodes = 1024>
+    class pool_allocator {
+        template<typename U, std::size_t OtherMaxBlockNodes>
+        friend class pool_allocator;
+
+    public:
+        using value_type = T;
+        using pointer = T*;
+        using size_type = std::size_t;
+        using difference_type = std::ptrdiff_t;
+        using propagate_on_container_copy_assignment = std::false_type;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        using is_always_equal = std::false_type;
+        /* Containers may skip freeing their nodes one by one when they hold the last owners,
+           see rbtree_internal::releases_on_destruction.  */
+        using releases_on_destruction = std::true_type;
+
+        template<typename U>
+        struct rebind {
+            using other = pool_allocator<U, MaxBlockNodes>;
+        };
+
+        pool_allocator() : _shared(new pool_internal::pool_shared{1, nullptr}), _arena(nullptr) {}
+        pool_allocator(const pool_allocator &other) noexcept : _shared(other._shared), _arena(other._arena) {
+            _shared->owners++;
+        }
+        template<typename U>
+        pool_allocator(const pool_allocator<U, MaxBlockNodes> &other) noexcept : _shared(other._shared), _arena(nullptr) {
+            _shared->owners++;
+        }
+        ~pool_allocator();
+
+        pool_allocator &operator=(const pool_allocator &rhs) noexcept;
+
+        T *allocate(size_type n);
+        void deallocate(T *ptr, size_type n) noexcept;
+
+        pool_allocator select_on_container_copy_construction() const { return pool_allocator(); }
+
+        /* Allocators sharing the pool, this one included.  */
+        size_type use_count() const noexcept { return _shared->owners; }
+
+        template<typename U>
+        bool operator==(const pool_allocator<U, MaxBlockNodes> &rhs) const noexcept { return _shared == rhs._shared; }
+        template<typename U>
+        bool operator!=(const pool_allocator<U, MaxBlockNodes> &rhs) const noexcept { return !(*this == rhs); }
+
+    private:
+        union slot {
+            void *next;
+            alignas(T) unsigned char storage[sizeof(T)];
+        };
+
+        static_assert(alignof(slot) <= alignof(std::max_align_t), "pool_allocator does not support over-aligned types");
+
+        pool_internal::pool_shared *_shared;
+        /* Arena of our node size, looked up on first use.  */
+        pool_internal::pool_arena *_arena;
+
+        pool_internal::pool_arena *_get_arena();
+    };
+
+    /* Implementation.  */
+    template<typename T, std::size_t MaxBlockNodes>
+    pool_allocator<T, MaxBlockNodes>::~pool_allocator() {
+        if (--_shared->owners == 0) pool_internal::_pool_release(_shared);
+    }
+
+    template<typename T, std::size_t MaxBlockNodes>
+    pool_allocator<T, MaxBlockNodes> &pool_allocator<T, MaxBlockNodes>::operator=(const pool_allocator &rhs) noexcept {
+        if (_shared != rhs._shared) {
+            rhs._shared->owners++;
+            if (--_shared->owners == 0) pool_internal::_pool_release(_shared);
+            _shared = rhs._shared;
+            _arena = rhs._arena;
+        }
+
+        return *this;
+    }
+
+    template<typename T, std::size_t MaxBlockNodes>
+    T *pool_allocator<T, MaxBlockNodes>::allocate(size_type n) {
+        /* Only single nodes are pooled.  */
+        if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+
+        return static_cast<T*>(pool_internal::_pool_allocate(_get_arena(), MaxBlockNodes));
+    }
+
+    template<typename T, std::size_t MaxBlockNodes>
+    void pool_allocator<T, MaxBlockNodes>::deallocate(T *ptr, size_type n) noexcept {
+        if (n != 1) {
+            ::operator delete(ptr);
+            return;
+        }
+
+        /* The node came from an allocator sharing the pool, the arena of its size exists already.  */
+        pool_internal::_pool_deallocate(_get_arena(), ptr);
+    }
+
+    template<typename T, std::size_t MaxBlockNodes>
+    pool_internal::pool_arena *pool_allocator<T, MaxBlockNodes>::_get_arena() {
+        if (_arena == nullptr) _arena = pool_internal::_pool_arena_for(_shared, sizeof(slot));
+
+        return _arena;
+    }
+}
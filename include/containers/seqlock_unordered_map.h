@@ -0,0 +1,551 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "../internal/hash_internal.h"
+#include "../internal/epoch_internal.h"
+#include "../internal/seqlock_internal.h"
+
+#define seqmap_t typename seqlock_unordered_map<K, V, Hash, Eq>
+
+using namespace hash_internal;
+using namespace epoch_internal;
+using namespace seqlock_internal;
+
+namespace adt {
+
+    /* Hash map with lock free readers for read mostly workloads. Each group of the Swiss table keeps a version
+       next to its control bytes: readers copy what they need and retry if the version changed meanwhile, they
+       never store to the table. Writers lock the key's stripe, then only the group they change.
+       When the table grows, the new table is filled a few groups per change by the writers, and lookups look
+       in both tables until the last group is copied. Keys and values are copied by readers while writers may
+       change them, so both have to be trivially copyable.  */
+    template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+    class seqlock_unordered_map {
+        static_assert(std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value,
+                      "seqlock_unordered_map copies keys and values while they are written, they must be trivially copyable");
+        static_assert(std::is_default_constructible<K>::value && std::is_default_constructible<V>::value,
+                      "seqlock_unordered_map copies keys and values into default constructed ones");
+
+    public:
+        using key_type = K;
+        using mapped_type = V;
+        using value_type = std::pair<const K, V>;
+        using hasher = Hash;
+        using key_equal = Eq;
+        using size_type = std::size_t;
+
+    private:
+        using entry_type = seq_entry<K, V>;
+        using table_type = seq_table<entry_type>;
+        using group_type = seq_group<entry_type>;
+
+        /* A group locked by a writer, with the slot that holds the key or the free slot it goes into.
+           No group is locked if table has no room for the key.  */
+        struct locate_info {
+            table_type *table;
+            group_type *group;
+            size_type slot;
+            uint64_t version;
+            bool found;
+        };
+
+        /* Read by every reader, kept apart from what writers change. Every access is seq_cst.  */
+        alignas(64) std::atomic<table_type*> _table;
+        hasher _hasher;
+        key_equal _keq;
+        uint64_t _seed;
+        mutable epoch_domain _epochs;
+
+        alignas(64) std::atomic<size_type> _size;
+        std::atomic<bool> _reclaim_pending;
+        seq_stripe _stripes[seqlock_writer_stripes];
+        std::mutex _resize_lock;
+        table_type *_retired_head;
+        table_type *_retired_tail;
+
+    public:
+        /* Constructors/Destructors.  */
+        explicit seqlock_unordered_map(size_type cap = 16, const hasher &hash = hasher(), const key_equal &keq = key_equal());
+        seqlock_unordered_map(const seqlock_unordered_map &other) = delete;
+        ~seqlock_unordered_map();
+        seqlock_unordered_map &operator=(const seqlock_unordered_map &rhs) = delete;
+
+        /* Capacity.  */
+        bool empty() const noexcept;
+        size_type size() const noexcept;
+
+        /* Readers, lock free.  */
+        bool find(const key_type &key, mapped_type &value) const;
+        mapped_type at(const key_type &key) const noexcept(false);
+        size_type count(const key_type &key) const;
+        bool contains(const key_type &key) const;
+
+        /* Modifiers.  */
+        bool insert(const value_type &val);
+        bool insert_or_assign(const key_type &key, const mapped_type &obj);
+        size_type erase(const key_type &key);
+        void clear();
+
+    private:
+        uint64_t _hash(const key_type &key) const;
+        bool _read(const table_type *table, const key_type &key, uint64_t hash, entry_type &entry) const;
+        bool _insert(const key_type &key, const mapped_type &obj, bool assign);
+        locate_info _locate(const key_type &key, uint64_t hash);
+        table_type *_locate_in(table_type *table, const key_type &key, uint64_t hash, locate_info &info);
+        void _place(table_type *table, const entry_type &entry);
+        void _grow(table_type *table);
+        void _make_room(table_type *table);
+        void _migrate();
+        void _migrate_group(group_type &g, table_type *next);
+        void _retire(table_type *table);
+        void _try_reclaim();
+        void _reclaim();
+    };
+
+    /* Implementation.  */
+
+    /* Public member functions.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqlock_unordered_map<K, V, Hash, Eq>::seqlock_unordered_map(size_type cap, const hasher &hash, const key_equal &keq)
+        : _hasher(hash), _keq(keq), _seed(next_seed()), _size(0), _reclaim_pending(false), _retired_head(nullptr), _retired_tail(nullptr) {
+        _table.store(new table_type(std::max(normalize_capacity(cap), group::width)));
+    }
+
+    /* No reader or writer may be left, every table goes.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqlock_unordered_map<K, V, Hash, Eq>::~seqlock_unordered_map() {
+        table_type *next;
+
+        for (table_type *table = _retired_head ; table != nullptr ; table = next) {
+            next = table->retired_next;
+            delete table;
+        }
+        for (table_type *table = _table.load() ; table != nullptr ; table = next) {
+            next = table->next.load();
+            delete table;
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::empty() const noexcept {
+        return size() == 0;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::size_type seqlock_unordered_map<K, V, Hash, Eq>::size() const noexcept {
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    /* Copies the value of key to value, returns false if there is none.
+       A key that is not in a table yet, or whose group was copied to the next one, is looked up in the next table.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::find(const key_type &key, mapped_type &value) const {
+        epoch_guard guard(&_epochs);
+        uint64_t hash = _hash(key);
+        entry_type entry;
+
+        for (auto table = _table.load() ; table ; table = table->next.load(std::memory_order_acquire)) {
+            if (_read(table, key, hash, entry)) {
+                value = entry.value;
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /* The mapped value is returned by copy, the slot may change as soon as the read ends.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::mapped_type seqlock_unordered_map<K, V, Hash, Eq>::at(const key_type &key) const noexcept(false) {
+        mapped_type value;
+
+        if (!find(key, value)) throw std::out_of_range("Key is not present on the map.");
+
+        return value;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::size_type seqlock_unordered_map<K, V, Hash, Eq>::count(const key_type &key) const {
+        mapped_type value;
+
+        return find(key, value) ? 1 : 0;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::contains(const key_type &key) const {
+        return count(key) != 0;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::insert(const value_type &val) {
+        return _insert(val.first, val.second, false);
+    }
+
+    /* Returns true if the key was inserted, false if it was assigned.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::insert_or_assign(const key_type &key, const mapped_type &obj) {
+        return _insert(key, obj, true);
+    }
+
+    /* The slot becomes a tombstone, it is dropped when the groups are copied to the next table.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::size_type seqlock_unordered_map<K, V, Hash, Eq>::erase(const key_type &key) {
+        _try_reclaim();
+
+        epoch_guard guard(&_epochs);
+        uint64_t hash = _hash(key);
+
+        {
+            std::lock_guard<std::mutex> stripe(_stripes[((hash >> 32) * seqlock_writer_stripes) >> 32].lock);
+            locate_info info = _locate(key, hash);
+
+            if (info.found) {
+                _seq_set_ctrl(*info.group, info.slot, ctrl_deleted);
+                _size.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (info.group) _seq_unlock(*info.group, info.version, info.found);
+
+            if (!info.found) return 0;
+        }
+        _migrate();
+
+        return 1;
+    }
+
+    /* Replaces the tables with an empty one while every stripe is locked, readers inside keep reading the old ones.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::clear() {
+        std::unique_lock<std::mutex> stripes[seqlock_writer_stripes];
+        table_type *next;
+
+        for (size_type i = 0 ; i < seqlock_writer_stripes ; i++) {
+            stripes[i] = std::unique_lock<std::mutex>(_stripes[i].lock);
+        }
+
+        std::lock_guard<std::mutex> lock(_resize_lock);
+        table_type *table = _table.exchange(new table_type(group::width));
+
+        for ( ; table != nullptr ; table = next) {
+            next = table->next.load();
+            _retire(table);
+        }
+        _size.store(0, std::memory_order_relaxed);
+        _reclaim();
+    }
+
+    /* Private member functions.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    uint64_t seqlock_unordered_map<K, V, Hash, Eq>::_hash(const key_type &key) const {
+        return mix(_hasher(key), _seed);
+    }
+
+    /* Optimistic lookup in one table. Returns true with the entry of key if the table holds it,
+       false if it does not or if its group was copied to the next table.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::_read(const table_type *table, const key_type &key, uint64_t hash, entry_type &entry) const {
+        probe_seq seq(h1(hash), table->capacity);
+        uint64_t version;
+        bool retry, empty;
+
+        while (1) {
+            const group_type &g = table->group_at(seq.offset());
+
+            version = _seq_read_begin(g);
+            group ctrl = _seq_load_ctrl(g);
+
+            /* Keys are compared only once their copy is known not to be torn.  */
+            retry = false;
+            for (auto match = ctrl.match(h2(hash)) ; match.any() ; match.clear_lowest()) {
+                _seq_load_entry(g, match.lowest(), entry);
+                if (!_seq_read_validate(g, version)) {
+                    retry = true;
+                    break;
+                }
+                if (_keq(entry.key, key)) return !(version & seqlock_moved);
+            }
+            if (retry) continue;
+
+            empty = ctrl.match_empty().any();
+            if (!_seq_read_validate(g, version)) continue;
+            if (empty) return false;
+
+            seq.next();
+            if (seq.index() >= table->capacity) return false;
+        }
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool seqlock_unordered_map<K, V, Hash, Eq>::_insert(const key_type &key, const mapped_type &obj, bool assign) {
+        _try_reclaim();
+
+        epoch_guard guard(&_epochs);
+        uint64_t hash = _hash(key);
+        table_type *grown = nullptr, *full;
+        size_type used;
+        bool growing;
+
+        while (1) {
+            {
+                std::lock_guard<std::mutex> stripe(_stripes[((hash >> 32) * seqlock_writer_stripes) >> 32].lock);
+                locate_info info = _locate(key, hash);
+
+                if (info.found) {
+                    if (assign) _seq_store_entry(*info.group, info.slot, entry_type{key, obj});
+                    _seq_unlock(*info.group, info.version, assign);
+
+                    return false;
+                }
+
+                full = info.table;
+                if (info.group && is_empty_slot(_seq_ctrl_at(*info.group, info.slot))) {
+                    used = info.table->used.fetch_add(1) + 1;
+
+                    /* Writers on other stripes may have filled the table before the one that crossed 3/4 grew it.
+                       A table that started growing meanwhile gets no new keys, its migration may not count them.  */
+                    growing = info.table->next.load() != nullptr;
+                    if (growing || used > seqlock_max_used(info.table->capacity)) {
+                        if (growing) full = nullptr;
+                        info.table->used.fetch_sub(1, std::memory_order_relaxed);
+                        _seq_unlock(*info.group, info.version, false);
+                        info.group = nullptr;
+                    }
+                    else if (used * 4 > info.table->capacity * 3) {
+                        grown = info.table;
+                    }
+                }
+
+                if (info.group) {
+                    _seq_store_entry(*info.group, info.slot, entry_type{key, obj});
+                    _seq_set_ctrl(*info.group, info.slot, h2(hash));
+                    _seq_unlock(*info.group, info.version, true);
+                    _size.fetch_add(1, std::memory_order_relaxed);
+                    break;
+                }
+            }
+
+            if (full) _make_room(full);
+        }
+
+        if (grown) _grow(grown);
+        _migrate();
+
+        return true;
+    }
+
+    /* Walks the tables to the one key belongs to: the first one that holds it in a group not copied yet,
+       or the last one if none does.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::locate_info seqlock_unordered_map<K, V, Hash, Eq>::_locate(const key_type &key, uint64_t hash) {
+        locate_info info;
+
+        for (auto table = _table.load() ; table ; table = _locate_in(table, key, hash, info));
+
+        return info;
+    }
+
+    /* Probes table holding one group lock at a time. Returns the table to go on with, or nullptr once info
+       holds the locked group of key, or the locked group with the free slot it goes into, or no group if
+       table is full. Tables only get new keys while they have no next table, and a group only gets copied
+       once its writer unlocked it. Like _read, the probe ends after every group was seen.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    seqmap_t::table_type *seqlock_unordered_map<K, V, Hash, Eq>::_locate_in(table_type *table, const key_type &key, uint64_t hash, locate_info &info) {
+        probe_seq seq(h1(hash), table->capacity);
+        table_type *next;
+        entry_type entry;
+
+        while (1) {
+            group_type &g = table->group_at(seq.offset());
+            uint64_t version = _seq_lock(g);
+            group ctrl = _seq_load_ctrl(g);
+
+            for (auto match = ctrl.match(h2(hash)) ; match.any() ; match.clear_lowest()) {
+                _seq_load_entry(g, match.lowest(), entry);
+                if (_keq(entry.key, key)) {
+                    if (!(version & seqlock_moved)) {
+                        info = {table, &g, match.lowest(), version, true};
+                        return nullptr;
+                    }
+                    _seq_unlock(g, version, false);
+                    return table->next.load(std::memory_order_acquire);
+                }
+            }
+
+            if (ctrl.match_empty().any()) {
+                next = table->next.load(std::memory_order_acquire);
+                if (next == nullptr) {
+                    info = {table, &g, ctrl.match_empty_or_deleted().lowest(), version, false};
+                    return nullptr;
+                }
+                _seq_unlock(g, version, false);
+                return next;
+            }
+
+            _seq_unlock(g, version, false);
+            seq.next();
+            if (seq.index() >= table->capacity) {
+                next = table->next.load(std::memory_order_acquire);
+                if (next == nullptr) info = {table, nullptr, 0, 0, false};
+                return next;
+            }
+        }
+    }
+
+    /* Inserts an entry copied from the previous table, its key is not in table yet.
+       _grow() reserved a slot in table for every slot the previous one used, so the probe finds one.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_place(table_type *table, const entry_type &entry) {
+        uint64_t hash = _hash(entry.key);
+        probe_seq seq(h1(hash), table->capacity);
+        size_type slot;
+
+        while (1) {
+            group_type &g = table->group_at(seq.offset());
+            uint64_t version = _seq_lock(g);
+            auto free = _seq_load_ctrl(g).match_empty_or_deleted();
+
+            if (free.any()) {
+                slot = free.lowest();
+                if (is_empty_slot(_seq_ctrl_at(g, slot))) table->placed.fetch_add(1, std::memory_order_relaxed);
+                _seq_store_entry(g, slot, entry);
+                _seq_set_ctrl(g, slot, h2(hash));
+                _seq_unlock(g, version, true);
+                return;
+            }
+
+            _seq_unlock(g, version, false);
+            seq.next();
+            assert(seq.index() < table->capacity && "the migration reserved a slot for every entry");
+        }
+    }
+
+    /* Starts copying table to a new one, twice as large unless most of its used slots are tombstones.
+       Only the current table grows, and only one migration runs at a time.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_grow(table_type *table) {
+        std::lock_guard<std::mutex> lock(_resize_lock);
+
+        if (table != _table.load() || table->next.load() != nullptr) return;
+
+        size_type capacity = size() * 2 >= table->capacity ? table->capacity * 2 : table->capacity;
+        table_type *next = new table_type(capacity);
+
+        /* Room for the entries to copy: as many as table may ever use until next is published, then as many
+           as it used. A writer that takes a slot of table after the load below sees next and backs off.  */
+        next->used.store(seqlock_max_used(table->capacity) + 1, std::memory_order_relaxed);
+        table->next.store(next);
+        next->reserved = table->used.load();
+        next->used.fetch_sub(seqlock_max_used(table->capacity) + 1 - next->reserved);
+    }
+
+    /* Called without locks once table had no room left for a new key: grows it if it is the current table.
+       Otherwise a migration fills it, which is helped along until it ends and table can grow.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_make_room(table_type *table) {
+        if (_table.load() == table) {
+            _grow(table);
+        }
+        else {
+            _migrate();
+            std::this_thread::yield();
+        }
+    }
+
+    /* Copies the next seqlock_migrate_groups groups of a growing table into the slots _grow() reserved for them.
+       Once the last group is copied, the slots no entry took are given back to the inserts.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_migrate() {
+        table_type *table = _table.load();
+        table_type *next = table->next.load(std::memory_order_acquire);
+        size_type first, last;
+
+        if (next == nullptr) return;
+
+        first = table->migrate_next.fetch_add(seqlock_migrate_groups, std::memory_order_relaxed);
+        if (first >= table->n_groups()) return;
+
+        last = std::min(first + seqlock_migrate_groups, table->n_groups());
+        for (size_type i = first ; i < last ; i++) _migrate_group(table->groups[i], next);
+
+        if (table->migrated.fetch_add(last - first, std::memory_order_acq_rel) + last - first == table->n_groups()) {
+            std::lock_guard<std::mutex> lock(_resize_lock);
+
+            /* clear() may have replaced both tables meanwhile.  */
+            /* seq_cst like the loads of _table after _epoch_enter(): a reader either loads next or
+               announced its epoch before the advance in _retire(), which keeps table alive for it.  */
+            if (_table.load() == table) {
+                next->used.fetch_sub(next->reserved - next->placed.load(std::memory_order_relaxed));
+                _table.store(next);
+                _retire(table);
+                _reclaim();
+            }
+        }
+    }
+
+    /* The group keeps its slots, a reader that finds a key in it is sent to the next table by the moved bit.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_migrate_group(group_type &g, table_type *next) {
+        uint64_t version = _seq_lock(g);
+        entry_type entry;
+
+        for (size_type i = 0 ; i < group::width ; i++) {
+            if (is_full_slot(_seq_ctrl_at(g, i))) {
+                _seq_load_entry(g, i, entry);
+                _place(next, entry);
+            }
+        }
+        _seq_unlock(g, version, true, true);
+    }
+
+    /* Under _resize_lock, once table is unpublished.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_retire(table_type *table) {
+        table->retired = _epoch_advance(&_epochs);
+        table->retired_next = nullptr;
+        if (_retired_tail) {
+            _retired_tail->retired_next = table;
+        }
+        else {
+            _retired_head = table;
+        }
+        _retired_tail = table;
+        _reclaim_pending.store(true, std::memory_order_relaxed);
+    }
+
+    /* Writers call this before entering the epoch, the table their last migration retired can be freed
+       as soon as the readers that were inside have left.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_try_reclaim() {
+        if (!_reclaim_pending.load(std::memory_order_relaxed)) return;
+
+        std::unique_lock<std::mutex> lock(_resize_lock, std::try_to_lock);
+
+        if (lock.owns_lock()) _reclaim();
+    }
+
+    /* Under _resize_lock. Tables are retired in epoch order, free them from the oldest while no reader or writer can hold them.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    void seqlock_unordered_map<K, V, Hash, Eq>::_reclaim() {
+        uint64_t oldest = _epoch_oldest(&_epochs);
+        table_type *table;
+
+        while (_retired_head && _retired_head->retired <= oldest) {
+            table = _retired_head;
+            _retired_head = table->retired_next;
+            delete table;
+        }
+        if (_retired_head == nullptr) {
+            _retired_tail = nullptr;
+            _reclaim_pending.store(false, std::memory_order_relaxed);
+        }
+    }
+}
@@ -8,14 +8,16 @@
 #include <iostream>
 
 #include "../internal/rbtree_internal.h"
+#include "../internal/container_tags.h"
 
-#define set_t typename set<Key, Less>
+#define set_t typename set<Key, Less, Alloc, Stats>
 
 using namespace rbtree_internal;
 
 namespace adt {
 
-    template<typename Key, class Less = std::less<Key>>
+    /* Stats selects the node layout, see rbtree_internal::no_order_statistics and rbtree_internal::order_statistics.  */
+    template<typename Key, class Less = std::less<Key>, class Alloc = std::allocator<Key>, class Stats = no_order_statistics>
     class set {
     public:
         using key_type = Key;
@@ -28,6 +30,7 @@ namespace adt {
         using const_pointer = const value_type*;
         using difference_type = std::ptrdiff_t;
         using size_type = std::size_t;
+        using allocator_type = Alloc;
         class iterator;
         using const_iterator = iterator;
         class reverse_iterator;
@@ -36,11 +39,15 @@ namespace adt {
     private:
         using node_type = value_type;
         using internal_ptr = rb_node<node_type>*;
+        using node_allocator = typename std::allocator_traits<Alloc>::template rebind_alloc<typename Stats::template node<node_type>>;
+        using sentinel_type = rb_sentinel<typename Stats::template node<node_type>, node_type>;
+        using stats_type = Stats;
 
         internal_ptr _root;
         internal_ptr _sentinel;
         size_type _size;
         key_compare _less;
+        node_allocator _node_alloc;
 
         template<typename U>
         struct handle_return_overload {
@@ -93,10 +100,10 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
+                    current = _ptr->parent();
                     while (current != nullptr && _ptr == current->right) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
@@ -123,10 +130,10 @@ namespace adt {
                     }
                 }
                 else {
-                    current = _ptr->parent;
-                    while (current->parent != nullptr && _ptr == current->left) {
+                    current = _ptr->parent();
+                    while (current->parent() != nullptr && _ptr == current->left) {
                         _ptr = current;
-                        current = current->parent;
+                        current = current->parent();
                     }
                 }
 
@@ -146,8 +153,8 @@ namespace adt {
                 std::swap(lhs, rhs);
             }
 
-            template<class Container>
-            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename K>
+            friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const K &key);
 
         private:
             internal_ptr _sentinel;
@@ -208,7 +215,11 @@ namespace adt {
         };
 
         /* Constructors/Destructors.  */
-        set(const key_compare &keq = key_compare()) noexcept;
+        set(const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type()) noexcept;
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        set(InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
+        template<class InputIt>
+        set(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq = key_compare(), const allocator_type &alloc = allocator_type());
         explicit set(const set &other) noexcept;
         set(set&& other) noexcept;
         ~set();
@@ -235,17 +246,28 @@ namespace adt {
         /* Observers.  */
         key_compare key_comp() const;
         value_compare value_comp() const;
+        allocator_type get_allocator() const noexcept;
 
         /* Modifiers.  */
         std::pair<iterator, bool> insert(const value_type &val);
         std::pair<iterator, bool> insert(value_type &&val);
+        template<class InputIt, rbtree_internal::enable_if_iterator<InputIt> = 0>
+        void insert(InputIt first, InputIt last);
+        template<class InputIt>
+        void insert(sorted_unique_t, InputIt first, InputIt last);
+        iterator insert(const_iterator hint, const value_type &val);
+        iterator insert(const_iterator hint, value_type &&val);
         template <class... Args>
         std::pair<iterator, bool> emplace(Args &&... args);
+        template<class... Args>
+        iterator emplace_hint(const_iterator hint, Args &&... args);
         iterator erase(const_iterator pos);
         size_type erase(const value_type &val);
         iterator erase(const_iterator first, const_iterator last);
         void clear() noexcept;
         void swap(set &other);
+        set split(const key_type &key);
+        void join(set &other);
 
         /* Operations.  */
         iterator find(const key_type &key);
@@ -257,18 +279,40 @@ namespace adt {
         const_iterator upper_bound(const key_type &key) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
+        size_type count_range(const key_type &lo, const key_type &hi) const;
+
+        /* Order statistics, Stats must be order_statistics.  */
+        iterator nth(size_type k);
+        const_iterator nth(size_type k) const;
+        size_type rank(const key_type &key) const;
+        difference_type distance(const_iterator first, const_iterator last) const;
+
+        /* Heterogeneous lookup, enabled when Less declares is_transparent.  */
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator lower_bound(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator lower_bound(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        iterator upper_bound(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        const_iterator upper_bound(const K &key) const;
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, rbtree_internal::enable_lookup<Less, Key, K> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const K &key) const;
 
         friend void swap(set &lhs, set &rhs) {
-            using std::swap;
-
-            swap(lhs._root, rhs._root);
-            swap(lhs._sentinel, rhs._sentinel);
-            swap(lhs._less, rhs._less);
-            swap(lhs._size, rhs._size);
+            lhs.swap(rhs);
         }
 
         template<class Container>
-        friend void rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
+        friend std::size_t rbtree_internal::_rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode);
 
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_left_of(rb_node<container::node_type> *tnode);
@@ -306,17 +350,106 @@ namespace adt {
         template<class Container, typename R, typename K, typename V, typename... Args>
         friend R rbtree_internal::_rbtree_insert(Container *cnt, const K &key, V val, Args &&... args);
 
+        template<class Container, typename R>
+        friend R rbtree_internal::_rbtree_insert_fixup(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container, typename K>
+        friend neighbor_t rbtree_internal::_rbtree_hint_position(Container *cnt, rb_node<container::node_type> *hint, const K &key, rb_node<container::node_type> **parent);
+
+        template<class Container, typename R, typename K, typename V, typename... Args>
+        friend R rbtree_internal::_rbtree_insert_hint(Container *cnt, rb_node<container::node_type> *hint, const K &key, V val, Args &&... args);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_build_balanced(rb_node<container::node_type> **head, std::size_t n, std::size_t depth, std::size_t red_depth);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_link_sorted(Container *cnt, rb_node<container::node_type> *head, std::size_t n);
+
+        template<class Container, class InputIt>
+        friend void rbtree_internal::_rbtree_insert_range(Container *cnt, InputIt first, InputIt last, bool assume_sorted);
+
         template<class Container>
         friend rb_node<container::node_type> *rbtree_internal::_rbtree_prepare_erase(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
 
+        template<class Container, typename K>
+        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_bound(Container *cnt, const K &key, bool upper);
+
+        template<class Container, typename K>
+        friend std::pair<rb_node<container::node_type>*, rb_node<container::node_type>*> rbtree_internal::_rbtree_equal_range(Container *cnt, const K &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_count(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_set_count(rb_node<container::node_type> *tnode, std::size_t count);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_weight(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_add_count(rb_node<container::node_type> *tnode, rb_node<container::node_type> *sentinel, std::size_t delta);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_rotate_count(rb_node<container::node_type> *top, rb_node<container::node_type> *new_top, rb_node<container::node_type> *moved);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_count(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_select(Container *cnt, std::size_t &k);
+
+        template<class Container, typename K>
+        friend std::size_t rbtree_internal::_rbtree_rank(Container *cnt, const K &key);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_index(Container *cnt, rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_minimum(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_maximum(rb_node<container::node_type> *tnode);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_black_height(rb_node<container::node_type> *tnode);
+
         template<class Container>
-        friend container::iterator rbtree_internal::_rbtree_find(Container *cnt, const container::key_type &key);
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_join(rb_node<container::node_type> *left, std::size_t left_height, rb_node<container::node_type> *pivot,
+                                                                            rb_node<container::node_type> *right, std::size_t right_height, std::size_t &height);
+
+        template<class Container, typename K>
+        friend void rbtree_internal::_rbtree_split(Container *cnt, rb_node<container::node_type> *tnode, std::size_t height, const K &key,
+                                                   rb_node<container::node_type> **left, std::size_t &left_height, rb_node<container::node_type> **right, std::size_t &right_height);
+
+        template<class Container>
+        friend std::size_t rbtree_internal::_rbtree_split_size(rb_node<container::node_type> *left, rb_node<container::node_type> *right, std::size_t total);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_attach(Container *cnt, rb_node<container::node_type> *root, std::size_t size);
+
+        template<class Container, typename K>
+        friend void rbtree_internal::_rbtree_split_tree(Container *cnt, Container *other, const K &key);
+
+        template<class Container>
+        friend bool rbtree_internal::_rbtree_join_appends(Container *cnt, Container *other);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_join_trees(Container *cnt, Container *other);
+
+        template<class Container>
+        friend rb_node<container::node_type> *rbtree_internal::_rbtree_concat(Container *cnt, rb_node<container::node_type> *left, rb_node<container::node_type> *right);
+
+        template<class Container>
+        friend void rbtree_internal::_rbtree_erase_range(Container *cnt, rb_node<container::node_type> *first, rb_node<container::node_type> *last);
 
         template<class Container>
-        friend bool rbtree_internal::_rbtree_is_equal_key(Container *cnt, const container::key_type &lhs_key, const container::key_type &rhs_key);
+        friend void rbtree_internal::_rbtree_append_copy(Container *cnt, rb_node<container::node_type> **head, rb_node<container::node_type> **tail, std::size_t &n, rb_node<container::node_type> *tnode);
 
         template<class Container>
-        friend rb_node<container::node_type> *rbtree_internal::_rbtree_find_bound(Container *cnt, rb_node<container::node_type> *tnode, const container::key_type &key);
+        friend void rbtree_internal::_rbtree_set_operation(Container *cnt, Container *lhs, Container *rhs, set_operation_t operation);
 
     private:
         internal_ptr _copy_tree(internal_ptr other_root);
@@ -327,345 +460,564 @@ namespace adt {
         std::pair<iterator, bool> _handle_elem_found(internal_ptr ptr, to_delete obj);
         std::pair<iterator, bool> _handle_elem_not_found(internal_ptr ptr);
         const key_type &_get_key(internal_ptr tnode);
-        void _clear_node(internal_ptr tnode);
+        size_type _clear_node(internal_ptr tnode);
         std::pair<rb_node<node_type> *, size_type> _erase(const_iterator pos);
     };
 
+    /* set that keeps subtree sizes, for nth(), rank() and distance() in O(log n).  */
+    template<typename Key, class Less = std::less<Key>, class Alloc = std::allocator<Key>>
+    using ranked_set = set<Key, Less, Alloc, order_statistics>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename Key, class Less>
-    set<Key, Less>::set(const key_compare &keq) noexcept : _root(nullptr), _size(0), _less(keq) {
-        _sentinel = new rb_node<node_type>();
-    }
-
-    template<typename Key, class Less>
-    set<Key, Less>::set(const set &other) noexcept {
-        if (this != &other) {
-            /* Create an exact copy of this set, O(n).  */
-            _root = _copy_tree(other._root);
-            _sentinel = new rb_node<node_type>();
-            _sentinel->left = _root;
-            _root->parent = _sentinel;
-            _less = other._less;
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats>::set(const key_compare &keq, const allocator_type &alloc) noexcept
+        : _root(nullptr), _size(0), _less(keq), _node_alloc(alloc) {
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
     }
 
-    template<typename Key, class Less>
-    set<Key, Less>::set(set &&other) noexcept : set() {
-        swap(*this, other);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats>::set(const set &other) noexcept
+        : _root(nullptr), _size(other._size), _less(other._less),
+          _node_alloc(std::allocator_traits<node_allocator>::select_on_container_copy_construction(other._node_alloc)) {
+        /* Create an exact copy of this set, O(n).  */
+        _root = _copy_tree(other._root);
+        _sentinel = _rbtree_new_sentinel<sentinel_type>(_node_alloc);
+        _sentinel->left = _root;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+        if (_root) _root->set_parent(_sentinel);
     }
 
-    template<typename Key, class Less>
-    set<Key, Less>::~set() {
-        if (_root != nullptr) {
-            clear();
-            delete _sentinel;
-        } else {
-            if (_sentinel) delete _sentinel;
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats>::set(set &&other) noexcept : set() {
+        swap(other);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    set<Key, Less, Alloc, Stats>::set(InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc) : set(keq, alloc) {
+        insert(first, last);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class InputIt>
+    set<Key, Less, Alloc, Stats>::set(sorted_unique_t, InputIt first, InputIt last, const key_compare &keq, const allocator_type &alloc) : set(keq, alloc) {
+        insert(sorted_unique, first, last);
     }
 
-    template<typename Key, class Less>
-    set<Key, Less>& set<Key, Less>::operator=(set rhs) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats>::~set() {
+        /* The allocator gives its blocks back on its own, no need to walk the tree.  */
+        if (_rbtree_can_drop_nodes<node_allocator, node_type>(_node_alloc)) return;
+
+        clear();
+        _rbtree_delete_sentinel<sentinel_type>(_node_alloc, _sentinel);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats>& set<Key, Less, Alloc, Stats>::operator=(set rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
 
         return *this;
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::begin() noexcept {
-        internal_ptr current = _root;
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::begin() noexcept {
+        internal_ptr current = _rbtree_first<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->left != nullptr) {
-                current = current->left;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return iterator(_sentinel, current);
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::begin() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->begin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::begin() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::end() noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::end() noexcept {
         return iterator(_sentinel, _sentinel);
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::end() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->end();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::end() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename Key, class Less>
-    set_t::reverse_iterator set<Key, Less>::rbegin() noexcept {
-        internal_ptr current = _root;
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::reverse_iterator set<Key, Less, Alloc, Stats>::rbegin() noexcept {
+        internal_ptr current = _rbtree_last<sentinel_type>(_sentinel);
 
-        if (current) {
-            while (current->right != nullptr) {
-                current = current->right;
-            }
-        } else {
-            current = _sentinel;
-        }
+        if (current == nullptr) current = _sentinel;
 
         return reverse_iterator(_sentinel, current);
     }
 
-    template<typename Key, class Less>
-    set_t::const_reverse_iterator set<Key, Less>::rbegin() const {
-        return const_cast<set<Key, Less>*>(this)->rbegin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_reverse_iterator set<Key, Less, Alloc, Stats>::rbegin() const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename Key, class Less>
-    set_t::reverse_iterator set<Key, Less>::rend() noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::reverse_iterator set<Key, Less, Alloc, Stats>::rend() noexcept {
         return reverse_iterator(_sentinel, _sentinel);
     }
 
-    template<typename Key, class Less>
-    set_t::const_reverse_iterator set<Key, Less>::rend() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->rend();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_reverse_iterator set<Key, Less, Alloc, Stats>::rend() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::cbegin() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->begin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::cbegin() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->begin();
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::cend() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->end();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::cend() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->end();
     }
 
-    template<typename Key, class Less>
-    set_t::const_reverse_iterator set<Key, Less>::crbegin() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->rbegin();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_reverse_iterator set<Key, Less, Alloc, Stats>::crbegin() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->rbegin();
     }
 
-    template<typename Key, class Less>
-    set_t::const_reverse_iterator set<Key, Less>::crend() const noexcept {
-        return const_cast<set<Key, Less>*>(this)->rend();
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_reverse_iterator set<Key, Less, Alloc, Stats>::crend() const noexcept {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->rend();
     }
 
-    template<typename Key, class Less>
-    bool set<Key, Less>::empty() const noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    bool set<Key, Less, Alloc, Stats>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename Key, class Less>
-    set_t::size_type set<Key, Less>::size() const noexcept {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::size() const noexcept {
         return _size;
     }
 
-    template<typename Key, class Less>
-    set_t::key_compare set<Key, Less>::key_comp() const {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::key_compare set<Key, Less, Alloc, Stats>::key_comp() const {
         return _less;
     }
 
-    template<typename Key, class Less>
-    set_t::value_compare set<Key, Less>::value_comp() const {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::value_compare set<Key, Less, Alloc, Stats>::value_comp() const {
         return _less;
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, bool> set<Key, Less>::insert(const value_type &val) {
-        return _rbtree_insert<set<Key, Less>, std::pair<iterator, bool>, key_type, const value_type&>(this, val, val, to_ignore());
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::allocator_type set<Key, Less, Alloc, Stats>::get_allocator() const noexcept {
+        return allocator_type(_node_alloc);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::insert(const value_type &val) {
+        return _rbtree_insert<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, const value_type&>(this, val, val, to_ignore());
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::insert(value_type &&val) {
+        return _rbtree_insert<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, value_type&&>(this, val, std::forward<value_type>(val), to_ignore());
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class InputIt, rbtree_internal::enable_if_iterator<InputIt>>
+    void set<Key, Less, Alloc, Stats>::insert(InputIt first, InputIt last) {
+        /* Sorted input into an empty set is linked into a balanced tree in O(n).  */
+        _rbtree_insert_range<set<Key, Less, Alloc, Stats>>(this, first, last, false);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class InputIt>
+    void set<Key, Less, Alloc, Stats>::insert(sorted_unique_t, InputIt first, InputIt last) {
+        _rbtree_insert_range<set<Key, Less, Alloc, Stats>>(this, first, last, true);
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, bool> set<Key, Less>::insert(value_type &&val) {
-        return _rbtree_insert<set<Key, Less>, std::pair<iterator, bool>, key_type, value_type&&>(this, val, std::forward<value_type>(val), to_ignore());
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::insert(const_iterator hint, const value_type &val) {
+        return _rbtree_insert_hint<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, const value_type&>(this, hint._ptr, val, val, to_ignore()).first;
     }
 
-    template<typename Key, class Less>
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::insert(const_iterator hint, value_type &&val) {
+        return _rbtree_insert_hint<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, value_type&&>(this, hint._ptr, val, std::forward<value_type>(val), to_ignore()).first;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
     template<class... Args>
-    std::pair<set_t::iterator, bool> set<Key, Less>::emplace(Args &&... args) {
-        internal_ptr val = new rb_node<node_type>(std::forward<Args>(args)...);
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::emplace(Args &&... args) {
+        internal_ptr val = _rbtree_new_node(_node_alloc, std::forward<Args>(args)...);
 
-        return _rbtree_insert<set<Key, Less>, std::pair<iterator, bool>, key_type, internal_ptr>(this, val->data, val, to_delete(val));
+        return _rbtree_insert<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, internal_ptr>(this, val->data, val, to_delete(val));
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::erase(const_iterator pos) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class... Args>
+    set_t::iterator set<Key, Less, Alloc, Stats>::emplace_hint(const_iterator hint, Args &&... args) {
+        internal_ptr val = _rbtree_new_node(_node_alloc, std::forward<Args>(args)...);
+
+        return _rbtree_insert_hint<set<Key, Less, Alloc, Stats>, std::pair<iterator, bool>, key_type, internal_ptr>(this, hint._ptr, val->data, val, to_delete(val)).first;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::erase(const_iterator pos) {
         return {_sentinel, _erase(pos).first};
     }
 
-    template<typename Key, class Less>
-    set_t::size_type set<Key, Less>::erase(const value_type &val) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::erase(const value_type &val) {
         return _erase(find(val)).second;
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::erase(const_iterator first, const_iterator last) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::erase(const_iterator first, const_iterator last) {
         auto it = first;
+        size_type n = 0;
+
+        /* A short range is erased one element at a time, counted beforehand since erase() may move
+           the data of the next element and invalidate last.  */
+        for (; it != last && n < _rbtree_short_range ; ++it) n++;
+        if (it == last) {
+            for (it = first ; n > 0 ; n--) it = erase(it);
+            return it;
+        }
 
-        while (it != last) it = erase(it);
+        _rbtree_erase_range<set<Key, Less, Alloc, Stats>>(this, first._ptr, last._ptr);
 
-        return it;
+        return {_sentinel, last._ptr};
     }
 
-    template<typename Key, class Less>
-    void set<Key, Less>::clear() noexcept {
-        _rbtree_destruct<set<Key, Less>>(this, _root);
+    template<typename Key, class Less, class Alloc, class Stats>
+    void set<Key, Less, Alloc, Stats>::clear() noexcept {
+        _rbtree_destruct<set<Key, Less, Alloc, Stats>>(this, _root);
         _sentinel->left = nullptr;
+        _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
         _root = nullptr;
         _size = 0;
     }
 
-    template<typename Key, class Less>
-    void set<Key, Less>::swap(set &other) {
-        swap(*this, other);
+    template<typename Key, class Less, class Alloc, class Stats>
+    void set<Key, Less, Alloc, Stats>::swap(set &other) {
+        using std::swap;
+
+        swap(_root, other._root);
+        swap(_sentinel, other._sentinel);
+        swap(_less, other._less);
+        swap(_size, other._size);
+        swap(_node_alloc, other._node_alloc);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats> set<Key, Less, Alloc, Stats>::split(const key_type &key) {
+        set other(_less, get_allocator());
+
+        /* Nodes can only change hands between allocators that compare equal.  */
+        if (!(_node_alloc == other._node_alloc)) {
+            auto first = lower_bound(key);
+
+            other.insert(sorted_unique, first, end());
+            erase(first, end());
+            return other;
+        }
+
+        _rbtree_split_tree<set<Key, Less, Alloc, Stats>>(this, &other, key);
+        return other;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    void set<Key, Less, Alloc, Stats>::join(set &other) {
+        if (this == &other || other.empty()) return;
+
+        if (!(_node_alloc == other._node_alloc)) {
+            /* Only checks that the keys do not overlap.  */
+            _rbtree_join_appends<set<Key, Less, Alloc, Stats>>(this, &other);
+            insert(other.begin(), other.end());
+            other.clear();
+            return;
+        }
+
+        _rbtree_join_trees<set<Key, Less, Alloc, Stats>>(this, &other);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::iterator set<Key, Less, Alloc, Stats>::find(const K &key) {
+        return _rbtree_find<set<Key, Less, Alloc, Stats>>(this, key);
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::find(const key_type &key) {
-        return _rbtree_find<set<Key, Less>>(this, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::find(const key_type &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->find(key);
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::find(const key_type &key) const {
-        return const_cast<set<Key, Less>*>(this)->find(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::find(const K &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->find(key);
     }
 
-    template<typename Key, class Less>
-    set_t::size_type set<Key, Less>::count(const key_type &key) const {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::count(const key_type &key) const {
         return find(key)._ptr != _sentinel ? 1 : 0;
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::lower_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<set<Key, Less>>(this, _root, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::size_type set<Key, Less, Alloc, Stats>::count(const K &key) const {
+        auto range = _rbtree_equal_range<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), key);
+        internal_ptr last = range.second ? range.second : _sentinel;
+        size_type count = 0;
+
+        /* Keys of another type may be equivalent to several elements.  */
+        for (internal_ptr current = range.first ; current && current != last ; current = _rbtree_successor<set<Key, Less, Alloc, Stats>>(current)) {
+            count++;
+        }
+
+        return count;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::lower_bound(const key_type &key) {
+        return lower_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::iterator set<Key, Less, Alloc, Stats>::lower_bound(const K &key) {
+        internal_ptr bound = _rbtree_bound<set<Key, Less, Alloc, Stats>>(this, key, false);
 
         return bound == nullptr ? end() : iterator(_sentinel, bound);
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::lower_bound(const key_type &key) const {
-        return const_cast<set<Key, Less>*>(this)->lower_bound(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::lower_bound(const key_type &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->lower_bound(key);
     }
 
-    template<typename Key, class Less>
-    set_t::iterator set<Key, Less>::upper_bound(const key_type &key) {
-        internal_ptr bound = _rbtree_find_bound<set<Key, Less>>(this, _root, key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::lower_bound(const K &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->lower_bound(key);
+    }
 
-        if (bound == nullptr) {
-            return end();
-        } else {
-            if (_rbtree_is_equal_key<set<Key, Less>>(this, bound->data, key)) {
-                return iterator(_sentinel, _rbtree_successor<set<Key, Less>>(bound));
-            } else {
-                return iterator(_sentinel, bound);
-            }
-        }
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::upper_bound(const key_type &key) {
+        return upper_bound<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::iterator set<Key, Less, Alloc, Stats>::upper_bound(const K &key) {
+        internal_ptr bound = _rbtree_bound<set<Key, Less, Alloc, Stats>>(this, key, true);
+
+        return bound == nullptr ? end() : iterator(_sentinel, bound);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::upper_bound(const key_type &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::upper_bound(const K &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->upper_bound(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, set_t::iterator> set<Key, Less, Alloc, Stats>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    std::pair<set_t::iterator, set_t::iterator> set<Key, Less, Alloc, Stats>::equal_range(const K &key) {
+        auto range = _rbtree_equal_range<set<Key, Less, Alloc, Stats>>(this, key);
+
+        return {{_sentinel, range.first ? range.first : _sentinel}, {_sentinel, range.second ? range.second : _sentinel}};
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::const_iterator, set_t::const_iterator> set<Key, Less, Alloc, Stats>::equal_range(const key_type &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    template<class K, rbtree_internal::enable_lookup<Less, Key, K>>
+    std::pair<set_t::const_iterator, set_t::const_iterator> set<Key, Less, Alloc, Stats>::equal_range(const K &key) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::count_range(const key_type &lo, const key_type &hi) const {
+        size_type count = 0;
+
+        if (!_less(lo, hi)) return 0;
+        if (Stats::value) return _rbtree_rank<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), hi) - _rbtree_rank<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), lo);
+
+        /* Without subtree sizes the elements in between are walked.  */
+        for (auto it = lower_bound(lo), last = lower_bound(hi) ; it != last ; ++it) count++;
+
+        return count;
     }
 
-    template<typename Key, class Less>
-    set_t::const_iterator set<Key, Less>::upper_bound(const key_type &key) const {
-        return const_cast<set<Key, Less>*>(this)->upper_bound(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::iterator set<Key, Less, Alloc, Stats>::nth(size_type k) {
+        static_assert(Stats::value, "nth() needs order_statistics");
+
+        if (k >= _size) return end();
+
+        return iterator(_sentinel, _rbtree_select<set<Key, Less, Alloc, Stats>>(this, k));
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, set_t::iterator> set<Key, Less>::equal_range(const key_type &key) {
-        auto first = find(key);
-        auto second(first);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::const_iterator set<Key, Less, Alloc, Stats>::nth(size_type k) const {
+        return const_cast<set<Key, Less, Alloc, Stats>*>(this)->nth(k);
+    }
 
-        return {first, ++second};
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::rank(const key_type &key) const {
+        static_assert(Stats::value, "rank() needs order_statistics");
+
+        return _rbtree_rank<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), key);
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::const_iterator, set_t::const_iterator> set<Key, Less>::equal_range(const key_type &key) const {
-        return const_cast<set<Key, Less>*>(this)->equal_range(key);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::difference_type set<Key, Less, Alloc, Stats>::distance(const_iterator first, const_iterator last) const {
+        static_assert(Stats::value, "distance() needs order_statistics");
+
+        return (difference_type) _rbtree_index<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), last._ptr) - (difference_type) _rbtree_index<set<Key, Less, Alloc, Stats>>(const_cast<set<Key, Less, Alloc, Stats>*>(this), first._ptr);
     }
 
     /* Private member functions.  */
-    template<typename Key, class Less>
-    set_t::internal_ptr set<Key, Less>::_copy_tree(internal_ptr other_root) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::internal_ptr set<Key, Less, Alloc, Stats>::_copy_tree(internal_ptr other_root) {
         internal_ptr new_node;
 
         if (other_root == nullptr) return nullptr;
 
-        new_node = new rb_node<node_type>(other_root->data);
+        new_node = _rbtree_new_node(_node_alloc, other_root->data);
+        if (Stats::value) _rbtree_set_count<set<Key, Less, Alloc, Stats>>(new_node, _rbtree_count<set<Key, Less, Alloc, Stats>>(other_root));
+        new_node->set_color(other_root->color());
 
         new_node->left = _copy_tree(other_root->left);
-        if (new_node->left) new_node->left->parent = new_node;
+        if (new_node->left) new_node->left->set_parent(new_node);
 
         new_node->right = _copy_tree(other_root->right);
-        if (new_node->right) new_node->right->parent = new_node;
+        if (new_node->right) new_node->right->set_parent(new_node);
 
         return new_node;
     }
 
-    template<typename Key, class Less>
-    set_t::internal_ptr set<Key, Less>::_construct_new_element(const value_type &val) {
-        return new rb_node<node_type>(val);
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::internal_ptr set<Key, Less, Alloc, Stats>::_construct_new_element(const value_type &val) {
+        return _rbtree_new_node(_node_alloc, val);
     }
 
-    template<typename Key, class Less>
-    set_t::internal_ptr set<Key, Less>::_construct_new_element(value_type &&val) {
-        return new rb_node<node_type>(std::forward<node_type>(val));
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::internal_ptr set<Key, Less, Alloc, Stats>::_construct_new_element(value_type &&val) {
+        return _rbtree_new_node(_node_alloc, std::forward<node_type>(val));
     }
 
-    template<typename Key, class Less>
-    set_t::internal_ptr set<Key, Less>::_construct_new_element(internal_ptr val) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::internal_ptr set<Key, Less, Alloc, Stats>::_construct_new_element(internal_ptr val) {
         return val;
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, bool> set<Key, Less>::_handle_elem_found(internal_ptr ptr, to_ignore obj) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, to_ignore obj) {
         return {{_sentinel, ptr}, false};
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, bool> set<Key, Less>::_handle_elem_found(internal_ptr ptr, to_delete obj) {
-        delete obj.ptr;
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::_handle_elem_found(internal_ptr ptr, to_delete obj) {
+        _rbtree_delete_node(_node_alloc, obj.ptr);
         return {{_sentinel, ptr}, false};
     }
 
-    template<typename Key, class Less>
-    std::pair<set_t::iterator, bool> set<Key, Less>::_handle_elem_not_found(internal_ptr ptr) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<set_t::iterator, bool> set<Key, Less, Alloc, Stats>::_handle_elem_not_found(internal_ptr ptr) {
         return {{_sentinel, ptr}, true};
     }
 
-    template<typename Key, class Less>
-    const set_t::key_type &set<Key, Less>::_get_key(rb_node<node_type> *tnode) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    const set_t::key_type &set<Key, Less, Alloc, Stats>::_get_key(rb_node<node_type> *tnode) {
         return tnode->data;
     }
 
-    template<typename Key, class Less>
-    void set<Key,Less>::_clear_node(internal_ptr tnode) {
-        delete tnode;
+    template<typename Key, class Less, class Alloc, class Stats>
+    set_t::size_type set<Key, Less, Alloc, Stats>::_clear_node(internal_ptr tnode) {
+        _rbtree_delete_node(_node_alloc, tnode);
+
+        return 1;
     }
 
-    template<typename Key, class Less>
-    std::pair<rb_node<set_t::node_type> *, set_t::size_type> set<Key, Less>::_erase(const_iterator pos) {
+    template<typename Key, class Less, class Alloc, class Stats>
+    std::pair<rb_node<set_t::node_type> *, set_t::size_type> set<Key, Less, Alloc, Stats>::_erase(const_iterator pos) {
         internal_ptr to_return, successor, erase_ptr;
 
         to_return = _sentinel;
         if (pos._ptr != _sentinel) {
-            _root->parent = nullptr;
+            _root->set_parent(nullptr);
 
-            successor = _rbtree_successor<set<Key, Less>>(pos._ptr);
-            erase_ptr = _rbtree_prepare_erase<set<Key, Less>>(this, pos._ptr, successor);
+            successor = _rbtree_successor<set<Key, Less, Alloc, Stats>>(pos._ptr);
+            erase_ptr = _rbtree_prepare_erase<set<Key, Less, Alloc, Stats>>(this, pos._ptr, successor);
             to_return = erase_ptr == successor ? pos._ptr : successor;
 
-            delete erase_ptr;
+            _rbtree_delete_node(_node_alloc, erase_ptr);
 
             --_size;
             if (_size == 0) {
                 _root = nullptr;
                 _sentinel->left = nullptr;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, nullptr);
                 to_return = _sentinel;
+            } else {
+                /* The root may have changed, hook it back under the sentinel so iteration still reaches end().  */
+                _root->set_parent(_sentinel);
+                _sentinel->left = _root;
+                _rbtree_reset_bounds<sentinel_type>(_sentinel, _root);
+                if (to_return == nullptr) to_return = _sentinel;
             }
         }
 
         return {to_return, 1};
     }
+
+    /* Set algebra, returns a new set with copies of the elements.  */
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats> set_union(const set<Key, Less, Alloc, Stats> &lhs, const set<Key, Less, Alloc, Stats> &rhs) {
+        set<Key, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<set<Key, Less, Alloc, Stats>>(&result, const_cast<set<Key, Less, Alloc, Stats>*>(&lhs), const_cast<set<Key, Less, Alloc, Stats>*>(&rhs), SET_UNION);
+        return result;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats> set_intersection(const set<Key, Less, Alloc, Stats> &lhs, const set<Key, Less, Alloc, Stats> &rhs) {
+        set<Key, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<set<Key, Less, Alloc, Stats>>(&result, const_cast<set<Key, Less, Alloc, Stats>*>(&lhs), const_cast<set<Key, Less, Alloc, Stats>*>(&rhs), SET_INTERSECTION);
+        return result;
+    }
+
+    template<typename Key, class Less, class Alloc, class Stats>
+    set<Key, Less, Alloc, Stats> set_difference(const set<Key, Less, Alloc, Stats> &lhs, const set<Key, Less, Alloc, Stats> &rhs) {
+        set<Key, Less, Alloc, Stats> result(lhs.key_comp(), lhs.get_allocator());
+
+        _rbtree_set_operation<set<Key, Less, Alloc, Stats>>(&result, const_cast<set<Key, Less, Alloc, Stats>*>(&lhs), const_cast<set<Key, Less, Alloc, Stats>*>(&rhs), SET_DIFFERENCE);
+        return result;
+    }
 }
 
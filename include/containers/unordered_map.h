@@ -3,16 +3,18 @@
 #include <cstdlib>
 #include <cassert>
 #include <functional>
+#include <tuple>
 
 #include "../internal/hash_internal.h"
 
-#define umap typename unordered_map<K, V, Hash, Eq>
+#define umap typename unordered_map<K, V, Hash, Eq, Storage>
 
 using namespace hash_internal;
 
 namespace adt {
 
-    template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+    /* Storage selects the slot layout, see hash_internal::node_slots and hash_internal::flat_slots.  */
+    template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>, typename Storage = node_slots>
     class unordered_map {
     public:
         using key_type = K;
@@ -31,15 +33,28 @@ namespace adt {
 
     private:
         using internal_ptr = value_type *;
+        using slots = slot_traits<value_type, Storage>;
+        using slot_type = typename slots::slot_type;
 
-        internal_ptr *_slots;
+        slot_type *_slots;
         ctrl_t *_ctrls;
         hasher _hasher;
         size_type _size;
         size_type _capacity;
+        size_type _n_deleted;
+        float _max_load_factor{0.75f};
+        uint64_t _seed;
         size_type _first_elem_pos;
         key_equal _keq;
 
+        /* The table an incremental rehash is moving elements out of, see rehash_step().  */
+        slot_type *_old_slots{nullptr};
+        ctrl_t *_old_ctrls{nullptr};
+        size_type _old_capacity{0};
+        size_type _migrate_pos{0};
+        size_type _old_first_pos{0};
+        size_type _rehash_step{0};
+
         struct enabler {};
 
         struct hash_info {
@@ -69,6 +84,13 @@ namespace adt {
         typedef handle_return_overload<tag_ignore> to_ignore;
         typedef handle_return_overload<tag_delete> to_delete;
 
+        /* Arguments of try_emplace, the element is built from them only if the key is absent.  */
+        template<typename KeyArgs, typename MappedArgs>
+        struct piecewise_args {
+            KeyArgs key;
+            MappedArgs mapped;
+        };
+
     public:
         class iterator {
             friend class unordered_map;
@@ -76,13 +98,14 @@ namespace adt {
             template<class Container, typename R, typename Key, typename Value, typename... Args>
             friend R hash_internal::_hash_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
-            template<class Container>
-            friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename Key>
+            friend container::iterator hash_internal::_hash_find(Container *cnt, const Key &key);
 
             template<class Container>
             friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
 
-            using internal_ptr = unordered_map::internal_ptr;
+            using slot_type = unordered_map::slot_type;
+            using slots = unordered_map::slots;
 
         public:
             using iterator_category = std::forward_iterator_tag;
@@ -93,26 +116,36 @@ namespace adt {
             using const_pointer = unordered_map::const_pointer;
             using difference_type = unordered_map::difference_type;
 
+            iterator() : iterator(nullptr) {}
             iterator(const iterator &other) = default;
             iterator(iterator &&other) = default;
 
             iterator &operator=(const iterator &rhs) = default;
-            iterator &operator=(internal_ptr *ptr) {
-                this->_ptr = ptr;
-                return *this;
-            }
 
             bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
-            bool operator==(internal_ptr *ptr) const { return this->_ptr == ptr; }
+            bool operator==(slot_type *ptr) const { return this->_ptr == ptr; }
             bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
-            bool operator!=(internal_ptr *ptr) const { return !(*this == ptr); }
+            bool operator!=(slot_type *ptr) const { return !(*this == ptr); }
 
             iterator &operator++() {
                 /* If its already end(), dont try to increment it.  */
-                if (_ptr == nullptr || *_ptr == (pointer) 0x1) return *this;
+                if (_ctrl == nullptr || *_ctrl == ctrl_sentinel) return *this;
+
+                /* Skip empty and deleted slots, ctrl_sentinel stops us at end().  */
+                do {
+                    ++_ptr;
+                    ++_ctrl;
+                } while (is_empty_or_deleted(*_ctrl));
+
+                /* The old table of an incremental rehash goes on with the new one.  */
+                if (*_ctrl == ctrl_link) {
+                    table_link link;
 
-                ++_ptr;
-                while (*_ptr == nullptr && *_ptr != (pointer) 0x1) ++_ptr;
+                    memcpy(&link, _ctrl + 1, sizeof(link));
+                    _ptr = static_cast<slot_type *>(link.slots);
+                    _ctrl = link.ctrls;
+                    if (!is_full_slot(*_ctrl)) ++(*this);
+                }
 
                 return *this;
             }
@@ -122,21 +155,22 @@ namespace adt {
                 return temp;
             }
 
-            const_reference operator*() const { return *(*this->_ptr); }
-            reference operator*() { return *(*(this->_ptr)); }
-            pointer operator->() { return *(this->_ptr); }
-            const_pointer operator->() const { return *(this->_ptr); }
+            const_reference operator*() const { return *slots::element(_ptr); }
+            reference operator*() { return *slots::element(_ptr); }
+            pointer operator->() { return slots::element(_ptr); }
+            const_pointer operator->() const { return slots::element(_ptr); }
 
         private:
-            internal_ptr *_ptr;
+            slot_type *_ptr;
+            const ctrl_t *_ctrl;
 
-            iterator(internal_ptr *ptr = nullptr) : _ptr(ptr) {}
+            iterator(slot_type *ptr, const ctrl_t *ctrl = nullptr) : _ptr(ptr), _ctrl(ctrl) {}
         };
 
         class const_iterator {
             friend class unordered_map;
             friend class iterator;
-            using internal_ptr = unordered_map::internal_ptr;
+            using slot_type = unordered_map::slot_type;
 
         public:
             using iterator_category = std::forward_iterator_tag;
@@ -149,15 +183,11 @@ namespace adt {
             const_iterator(iterator it) : _it(std::move(it)) {}
 
             const_iterator &operator=(const const_iterator &rhs) = default;
-            const_iterator &operator=(internal_ptr *ptr) {
-                this->_it = ptr;
-                return *this;
-            }
 
             bool operator==(const const_iterator &other) const { return this->_it == other._it; }
-            bool operator==(internal_ptr *ptr) const { return _it == ptr; }
+            bool operator==(slot_type *ptr) const { return _it == ptr; }
             bool operator!=(const const_iterator &other) const { return !(*this == other); }
-            bool operator!=(internal_ptr *ptr) const { return !(*this == ptr); }
+            bool operator!=(slot_type *ptr) const { return !(*this == ptr); }
 
             reference operator*() const { return *_it; }
             pointer operator->() const { return _it.operator->(); }
@@ -171,7 +201,7 @@ namespace adt {
         private:
             iterator _it;
 
-            const_iterator(internal_ptr *ptr) : _it(ptr) {}
+            const_iterator(slot_type *ptr, const ctrl_t *ctrl) : _it(ptr, ctrl) {}
         };
 
         /* Constructors/Destructors.  */
@@ -208,6 +238,14 @@ namespace adt {
         std::pair<iterator, bool> insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         template <class... Args>
         std::pair<iterator, bool> emplace(Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(const key_type &key, M &&obj);
+        template<class M>
+        std::pair<iterator, bool> insert_or_assign(key_type &&key, M &&obj);
         iterator erase(const_iterator pos);
         size_type erase(const key_type &key);
         iterator erase(const_iterator first, const_iterator last);
@@ -218,19 +256,36 @@ namespace adt {
         iterator find(const key_type &key);
         const_iterator find(const key_type &key) const;
         size_type count(const key_type &key) const;
+        void find_many(const key_type *keys, size_type n, iterator *out);
+        void contains_many(const key_type *keys, size_type n, bool *out) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
 
+        /* Heterogeneous lookup, enabled when Hash and Eq declare is_transparent.  */
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const Key &key) const;
+
+        /* Hash policy.  */
+        size_type bucket_count() const noexcept;
+        float load_factor() const noexcept;
+        float max_load_factor() const noexcept;
+        void max_load_factor(float ml);
+        void rehash(size_type count);
+        void reserve(size_type count);
+        void shrink_to_fit();
+        size_type rehash_step() const noexcept;
+        void rehash_step(size_type n_slots);
+
         friend void swap(unordered_map& lhs, unordered_map& rhs) {
-            using std::swap;
-
-            swap(lhs._slots, rhs._slots);
-            swap(lhs._ctrls, rhs._ctrls);
-            swap(lhs._size, rhs._size);
-            swap(lhs._capacity, rhs._capacity);
-            swap(lhs._first_elem_pos, rhs._first_elem_pos);
-            swap(lhs._hasher, rhs._hasher);
-            swap(lhs._keq, rhs._keq);
+            lhs.swap(rhs);
         }
 
         template<class Container>
@@ -243,19 +298,46 @@ namespace adt {
         friend R hash_internal::_hash_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
         template<class Container>
-        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::internal_ptr *ptr, bool erase_all);
+        friend void hash_internal::_hash_copy(Container *cnt, const Container &other);
+
+        template<class Container>
+        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::slot_type *ptr, bool erase_all);
 
         template<class Container>
         friend void hash_internal::_hash_clear(Container *cnt);
 
+        template<class Container, typename Key>
+        friend container::iterator hash_internal::_hash_find(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend container::iterator hash_internal::_hash_find_with_info(Container *cnt, const Key &key, const container::hash_info &info);
+
+        template<class Container, typename F>
+        friend void hash_internal::_hash_find_many(Container *cnt, const container::key_type *keys, container::size_type n, F f);
+
+        template<class Container>
+        friend void hash_internal::_hash_rehash(Container *cnt, container::size_type new_cap);
+
+        template<class Container>
+        friend void hash_internal::_hash_rehash_in_place(Container *cnt);
+
         template<class Container>
-        friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+        friend container::size_type hash_internal::_hash_capacity_for(Container *cnt, container::size_type n_slots);
 
         template<class Container>
-        friend void hash_internal::_hash_rehash(Container *cnt);
+        friend void hash_internal::_hash_resize(Container *cnt, container::size_type n_slots, container::size_type count);
 
         template<class Container>
-        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const container::key_type &key);
+        friend void hash_internal::_hash_reserve(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_max_load_factor(Container *cnt, container::size_type n_slots, float ml);
+
+        template<class Container, typename Key>
+        friend uint64_t hash_internal::_hash_key(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const Key &key);
 
         template<class Container>
         friend void hash_internal::_hash_check_load_factor(Container *cnt, container::size_type, uint64_t hash, container::size_type &pos);
@@ -263,126 +345,166 @@ namespace adt {
         template<class Container>
         friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
 
+        template<class Container>
+        friend container::size_type hash_internal::_hash_find_first_non_full(Container *cnt, uint64_t hash);
+
+        template<class Container>
+        friend void hash_internal::_hash_start_migration(Container *cnt, container::size_type new_cap);
+
+        template<class Container>
+        friend void hash_internal::_hash_migrate(Container *cnt, container::size_type n_slots);
+
+        template<class Container>
+        friend void hash_internal::_hash_finish_migration(Container *cnt);
+
+        template<class Container, typename Key>
+        friend container::size_type hash_internal::_hash_find_old(Container *cnt, const Key &key, uint64_t hash);
+
+        template<class Container>
+        friend container::size_type hash_internal::_hash_next_old(Container *cnt, container::size_type pos);
+
+        template<class Container>
+        friend void hash_internal::_hash_erase_old(Container *cnt, container::size_type pos);
+
+        template<class Container>
+        friend void hash_internal::_hash_clear_old(Container *cnt);
+
+        template<class Container>
+        friend void hash_internal::_hash_copy_old(Container *cnt, const Container &other);
+
+        template<class Container>
+        friend void hash_internal::_hash_check_load_factor_incremental(Container *cnt, container::size_type n_slots, uint64_t hash, container::size_type &pos);
+
     private:
         void _rehash();
         void _check_load_factor(uint64_t hash, size_type& pos);
+        iterator _migrate_and_find_old(const key_type &key, uint64_t hash);
+        template<class Key>
+        iterator _find_old(const Key &key);
+        iterator _old_iterator_at(size_type pos) const noexcept;
+        bool _is_old_slot(const slot_type *ptr) const noexcept;
         hash_info _get_hash_info(const key_type &key);
-        const key_type &_get_slot_key(internal_ptr slot);
+        const key_type &_get_slot_key(slot_type &slot);
         
         std::pair<iterator, bool> _handle_elem_found(const iterator &it, to_ignore obj);
         std::pair<iterator, bool> _handle_elem_found(const iterator &it, to_delete obj);
         std::pair<iterator, bool> _handle_elem_not_found(const iterator &it);
 
-        internal_ptr _construct_new_element(const value_type &val);
+        template<class... Args>
+        std::pair<iterator, bool> _emplace(node_slots, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> _emplace(flat_slots, Args &&... args);
+
+        iterator _iterator_at(size_type pos) const;
         template<class P>
-        internal_ptr _construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
-        internal_ptr _construct_new_element(internal_ptr val);
-        internal_ptr _construct_new_element(const key_type &key);
-        internal_ptr _construct_new_element(key_type &&key);
-        
+        void _construct_slot(size_type pos, P &&val);
+        template<typename KeyArgs, typename MappedArgs>
+        void _construct_slot(size_type pos, piecewise_args<KeyArgs, MappedArgs> &&args);
+        void _copy_slot(size_type pos, slot_type &other);
+        bool _is_slot_free(size_type pos);
+
         size_type _delete_all_slots(size_type pos);
         size_type _delete_slot(size_type pos);
-        std::pair<size_type, size_type> _erase(internal_ptr *ptr, bool erase_all = false);
+        std::pair<size_type, size_type> _erase(slot_type *ptr, bool erase_all = false);
     };
 
+    /* unordered_map that stores its elements inline in the slot array (no pointer stability).  */
+    template<typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+    using flat_unordered_map = unordered_map<K, V, Hash, Eq, flat_slots>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename K, typename V, typename Hash, typename Eq>
-    unordered_map<K, V, Hash, Eq>::unordered_map(unordered_map::size_type cap, const hasher &hash,
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    unordered_map<K, V, Hash, Eq, Storage>::unordered_map(unordered_map::size_type cap, const hasher &hash,
                                                  const key_equal& keq) noexcept
         : _size(0), _capacity(cap), _hasher(hash), _keq(keq) {
        _hash_construct<>(this);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    unordered_map<K, V, Hash, Eq>::unordered_map(const unordered_map &other) {
-        this->_capacity = other._capacity;
-        this->_size = other._size;
-        this->_first_elem_pos = other._first_elem_pos;
-        this->_slots = (internal_ptr *) calloc(sizeof (internal_ptr), this->_capacity + 1);
-        this->_slots[this->_capacity] = (internal_ptr) 0x1;
-        this->_ctrls = new ctrl_t[this->_capacity];
-
-        /* Deep copy of the data. Avoid this lol.  */
-        for (size_t i = 0 ; i < other._capacity ; i++) {
-            this->_ctrls[i] = other._ctrls[i];
-
-            if (is_full_slot(other._ctrls[i])) {
-                this->_slots[i] = new value_type(other._slots[i]);
-            }
-        }
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    unordered_map<K, V, Hash, Eq, Storage>::unordered_map(const unordered_map &other)
+        : _hasher(other._hasher), _keq(other._keq), _rehash_step(other._rehash_step) {
+        _hash_copy<>(this, other);
+        _hash_copy_old<>(this, other);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    unordered_map<K, V, Hash, Eq>::unordered_map(unordered_map &&other) noexcept : unordered_map() {
-        swap(*this, other);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    unordered_map<K, V, Hash, Eq, Storage>::unordered_map(unordered_map &&other) noexcept : unordered_map() {
+        swap(other);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    unordered_map<K, V, Hash, Eq>::~unordered_map() noexcept {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    unordered_map<K, V, Hash, Eq, Storage>::~unordered_map() noexcept {
+        _hash_clear_old<>(this);
         _hash_destruct<>(this);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    unordered_map<K, V, Hash, Eq> &unordered_map<K, V, Hash, Eq>::operator=(unordered_map rhs) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    unordered_map<K, V, Hash, Eq, Storage> &unordered_map<K, V, Hash, Eq, Storage>::operator=(unordered_map rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
         return *this;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    bool unordered_map<K, V, Hash, Eq>::empty() const noexcept {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool unordered_map<K, V, Hash, Eq, Storage>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::size_type unordered_map<K, V, Hash, Eq>::size() const noexcept {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::size() const noexcept {
         return _size;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::iterator unordered_map<K, V, Hash, Eq>::begin() const noexcept {
-        return iterator(&_slots[_first_elem_pos]);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::begin() const noexcept {
+        /* Elements left in the old table come first, its end links to the new one.  */
+        if (_old_ctrls != nullptr && _old_first_pos != _old_capacity) return _old_iterator_at(_old_first_pos);
+
+        return _iterator_at(_first_elem_pos);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::iterator unordered_map<K, V, Hash, Eq>::end() const noexcept {
-        return iterator(&_slots[_capacity]);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::end() const noexcept {
+        return _iterator_at(_capacity);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::const_iterator unordered_map<K, V, Hash, Eq>::cbegin() const noexcept {
-        return iterator(&_slots[_first_elem_pos]);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::const_iterator unordered_map<K, V, Hash, Eq, Storage>::cbegin() const noexcept {
+        /* Elements left in the old table come first, its end links to the new one.  */
+        if (_old_ctrls != nullptr && _old_first_pos != _old_capacity) return _old_iterator_at(_old_first_pos);
+
+        return _iterator_at(_first_elem_pos);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::const_iterator unordered_map<K, V, Hash, Eq>::cend() const noexcept {
-        return iterator(&_slots[_capacity]);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::const_iterator unordered_map<K, V, Hash, Eq, Storage>::cend() const noexcept {
+        return _iterator_at(_capacity);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::hasher unordered_map<K, V, Hash, Eq>::hash_function() const {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::hasher unordered_map<K, V, Hash, Eq, Storage>::hash_function() const {
         return _hasher;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::key_equal unordered_map<K, V, Hash, Eq>::key_eq() const {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::key_equal unordered_map<K, V, Hash, Eq, Storage>::key_eq() const {
         return _keq;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::mapped_type &unordered_map<K, V, Hash, Eq>::operator[](const key_type &key) {
-        return (*((insert(std::make_pair(key,mapped_type()))).first)).second;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::mapped_type &unordered_map<K, V, Hash, Eq, Storage>::operator[](const key_type &key) {
+        return try_emplace(key).first->second;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::mapped_type &unordered_map<K, V, Hash, Eq>::operator[](key_type &&key) {
-        return (*((insert(std::make_pair(key,mapped_type()))).first)).second;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::mapped_type &unordered_map<K, V, Hash, Eq, Storage>::operator[](key_type &&key) {
+        return try_emplace(std::move(key)).first->second;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::mapped_type &unordered_map<K, V, Hash, Eq>::at(const key_type &key) noexcept(false) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::mapped_type &unordered_map<K, V, Hash, Eq, Storage>::at(const key_type &key) noexcept(false) {
         iterator it = find(key);
 
         /* If we found it, return the mapped value.  */
@@ -391,42 +513,95 @@ namespace adt {
         throw std::out_of_range("Key is not present on the map.");
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    const umap::mapped_type &unordered_map<K, V, Hash, Eq>::at(const key_type &key) const noexcept(false) {
-        return const_cast<unordered_map<K, V, Hash, Eq>*>(this)->at(key);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    const umap::mapped_type &unordered_map<K, V, Hash, Eq, Storage>::at(const key_type &key) const noexcept(false) {
+        return const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this)->at(key);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::insert(const_reference val) {
-        return _hash_insert<unordered_map<K, V, Hash, Eq>, std::pair<iterator, bool>, key_type, const_reference>(this, val.first, val, to_ignore());
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::insert(const_reference val) {
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, const_reference>(this, val.first, val, to_ignore());
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
     template<class P>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return _hash_insert<unordered_map<K, V, Hash, Eq>, std::pair<iterator, bool>, key_type, P&&>(this, val.first, std::forward<P>(val), to_ignore());
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, P&&>(this, val.first, std::forward<P>(val), to_ignore());
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
     template<class... Args>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::emplace(Args &&... args) {
-        auto *val = new value_type(std::forward<Args>(args)...);
-        
-        return _hash_insert<unordered_map<K, V, Hash, Eq>, std::pair<iterator, bool>, key_type, value_type*>(this, val->first, val, to_delete(val));
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::emplace(Args &&... args) {
+        return _emplace(Storage(), std::forward<Args>(args)...);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::try_emplace(const key_type &key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<const key_type&>, std::tuple<Args&&...>>;
+
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::try_emplace(key_type &&key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<key_type&&>, std::tuple<Args&&...>>;
+
+        /* The key is only moved from once the probe is over and a slot has to be filled.  */
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class M>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::insert_or_assign(const key_type &key, M &&obj) {
+        auto ret = try_emplace(key, std::forward<M>(obj));
+
+        /* obj was left untouched if the key was already there.  */
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class M>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::insert_or_assign(key_type &&key, M &&obj) {
+        auto ret = try_emplace(std::move(key), std::forward<M>(obj));
+
+        if (!ret.second) ret.first->second = std::forward<M>(obj);
+
+        return ret;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::unordered_map::iterator unordered_map<K, V, Hash, Eq>::erase(const_iterator pos) {
-        return iterator(&(_slots[_erase(pos._it._ptr).first]));
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::unordered_map::iterator unordered_map<K, V, Hash, Eq, Storage>::erase(const_iterator pos) {
+        iterator next(pos._it);
+
+        if (_is_old_slot(pos._it._ptr)) {
+            _hash_erase_old<>(this, pos._it._ptr - _old_slots);
+            return ++next;
+        }
+
+        return _iterator_at(_erase(pos._it._ptr).first);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::unordered_map::size_type unordered_map<K, V, Hash, Eq>::erase(const key_type &key) {
-        return _erase(find(key)._ptr).second;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::unordered_map::size_type unordered_map<K, V, Hash, Eq, Storage>::erase(const key_type &key) {
+        iterator it;
+
+        /* Like inserts, erases by key move the next rehash_step() slots of a running migration.
+           Erases by iterator do not, so erase loops see every element once.  */
+        _hash_migrate<>(this, _rehash_step);
+        it = find(key);
+
+        if (it._ptr == &_slots[_capacity]) return 0;
+        erase(it);
+
+        return 1;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::iterator unordered_map<K, V, Hash, Eq>::erase(const_iterator first, const_iterator last) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::erase(const_iterator first, const_iterator last) {
         auto it = first._it;
 
         while (it != last._it) it = erase(it);
@@ -434,128 +609,312 @@ namespace adt {
         return it;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    void unordered_map<K, V, Hash, Eq>::clear() noexcept {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::clear() noexcept {
+        _hash_clear_old<>(this);
         _hash_clear<>(this);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    void unordered_map<K, V, Hash, Eq>::swap(unordered_map &other) {
-        this->swap(*this, other);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::swap(unordered_map &other) {
+        using std::swap;
+
+        swap(_slots, other._slots);
+        swap(_ctrls, other._ctrls);
+        swap(_size, other._size);
+        swap(_capacity, other._capacity);
+        swap(_n_deleted, other._n_deleted);
+        swap(_max_load_factor, other._max_load_factor);
+        swap(_seed, other._seed);
+        swap(_first_elem_pos, other._first_elem_pos);
+        swap(_hasher, other._hasher);
+        swap(_keq, other._keq);
+        swap(_old_slots, other._old_slots);
+        swap(_old_ctrls, other._old_ctrls);
+        swap(_old_capacity, other._old_capacity);
+        swap(_migrate_pos, other._migrate_pos);
+        swap(_old_first_pos, other._old_first_pos);
+        swap(_rehash_step, other._rehash_step);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::find(const Key &key) {
+        iterator it = _hash_find<>(this, key);
+
+        if (it._ptr == &_slots[_capacity] && _old_ctrls != nullptr) return _find_old(key);
+
+        return it;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::const_iterator unordered_map<K, V, Hash, Eq, Storage>::find(const key_type &key) const {
+        return const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this)->find(key);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::iterator unordered_map<K, V, Hash, Eq>::find(const key_type &key) {
-        return _hash_find<>(this, key);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umap::const_iterator unordered_map<K, V, Hash, Eq, Storage>::find(const Key &key) const {
+        return const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this)->find(key);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::const_iterator unordered_map<K, V, Hash, Eq>::find(const key_type &key) const {
-        return const_cast<unordered_map<K, V, Hash, Eq>*>(this)->find(key);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::count(const key_type &key) const {
+        return count<key_type>(key);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::size_type unordered_map<K, V, Hash, Eq>::count(const key_type &key) const {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::count(const Key &key) const {
         return find(key)._it._ptr != &_slots[_capacity] ? 1 : 0;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::iterator, umap::iterator> unordered_map<K, V, Hash, Eq>::equal_range(const key_type &key) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::iterator, umap::iterator> unordered_map<K, V, Hash, Eq, Storage>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    std::pair<umap::iterator, umap::iterator> unordered_map<K, V, Hash, Eq, Storage>::equal_range(const Key &key) {
         auto first = find(key);
         auto second(first);
 
         return {first, ++second};
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::const_iterator, umap::const_iterator> unordered_map<K, V, Hash, Eq>::equal_range(const key_type &key) const {
-        return const_cast<unordered_map<K, V, Hash, Eq>*>(this)->equal_range(key);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::const_iterator, umap::const_iterator> unordered_map<K, V, Hash, Eq, Storage>::equal_range(const key_type &key) const {
+        return const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    std::pair<umap::const_iterator, umap::const_iterator> unordered_map<K, V, Hash, Eq, Storage>::equal_range(const Key &key) const {
+        return const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::find_many(const key_type *keys, size_type n, iterator *out) {
+        _hash_find_many<>(this, keys, n, [this, keys, out](size_type i, const iterator &it) {
+            out[i] = (it._ptr == &_slots[_capacity] && _old_ctrls != nullptr) ? _find_old(keys[i]) : it;
+        });
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::contains_many(const key_type *keys, size_type n, bool *out) const {
+        auto cnt = const_cast<unordered_map<K, V, Hash, Eq, Storage>*>(this);
+
+        _hash_find_many<>(cnt, keys, n, [cnt, keys, out](size_type i, const iterator &it) {
+            out[i] = it != cnt->end() || (cnt->_old_ctrls != nullptr && cnt->_find_old(keys[i]) != cnt->end());
+        });
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::bucket_count() const noexcept {
+        return _capacity;
+    }
+
+    /* Ratio of elements to slots, tombstones are not included.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    float unordered_map<K, V, Hash, Eq, Storage>::load_factor() const noexcept {
+        return (float) _size / (float) _capacity;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    float unordered_map<K, V, Hash, Eq, Storage>::max_load_factor() const noexcept {
+        return _max_load_factor;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::max_load_factor(float ml) {
+        _hash_finish_migration<>(this);
+        _hash_max_load_factor<>(this, _size, ml);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::rehash(size_type count) {
+        _hash_finish_migration<>(this);
+        _hash_resize<>(this, _size, count);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::reserve(size_type count) {
+        _hash_finish_migration<>(this);
+        _hash_reserve<>(this, _size, count);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::shrink_to_fit() {
+        _hash_finish_migration<>(this);
+        _hash_resize<>(this, _size, 0);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::rehash_step() const noexcept {
+        return _rehash_step;
+    }
+
+    /* With n_slots != 0 growing the table no longer moves every element at once: the new table is
+       allocated and each following insert moves the elements of the next n_slots old slots to it,
+       lookups search both tables meanwhile. 0 (the default) finishes a running migration.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::rehash_step(size_type n_slots) {
+        _rehash_step = n_slots == 0 ? 0 : std::max<size_type>(n_slots, group::width);
+        if (_rehash_step == 0) _hash_finish_migration<>(this);
     }
 
     /* Private member functions.  */
-    template<typename K, typename V, typename Hash, typename Eq>
-    void unordered_map<K, V, Hash, Eq>::_rehash() {
-        _hash_rehash<>(this);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::_rehash() {
+        _hash_rehash<>(this, _capacity * 2);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::hash_info unordered_map<K, V, Hash, Eq>::_get_hash_info(const key_type &key) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::hash_info unordered_map<K, V, Hash, Eq, Storage>::_get_hash_info(const key_type &key) {
         return _hash_get_hash_info<>(this, key);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    const umap::key_type& unordered_map<K, V, Hash, Eq>::_get_slot_key(internal_ptr slot) {
-        return slot->first;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    const umap::key_type& unordered_map<K, V, Hash, Eq, Storage>::_get_slot_key(slot_type &slot) {
+        return slots::element(&slot)->first;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::_handle_elem_found(const iterator &it, to_ignore obj) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::_handle_elem_found(const iterator &it, to_ignore obj) {
         return {it, false};
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::_handle_elem_found(const iterator &it, to_delete obj) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::_handle_elem_found(const iterator &it, to_delete obj) {
         delete obj.ptr;
         return {it, false};
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq>::_handle_elem_not_found(const iterator &it) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::_handle_elem_not_found(const iterator &it) {
         return {it, true};
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    void unordered_map<K, V, Hash, Eq>::_check_load_factor(uint64_t hash, size_type& pos) {
-        _hash_check_load_factor<>(this, _size, hash, pos);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::_check_load_factor(uint64_t hash, size_type& pos) {
+        if (_rehash_step != 0) {
+            _hash_check_load_factor_incremental<>(this, _size, hash, pos);
+        }
+        else {
+            _hash_check_load_factor<>(this, _size, hash, pos);
+        }
+    }
+
+    /* Called by every insert before it probes the new table: moves the next rehash_step() slots
+       and returns key if it is still in the old table. Lookups never move anything.  */
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::_migrate_and_find_old(const key_type &key, uint64_t hash) {
+        size_type old_pos;
+
+        if (_old_ctrls == nullptr) return iterator(nullptr);
+
+        _hash_migrate<>(this, _rehash_step);
+        if (_old_ctrls == nullptr) return iterator(nullptr);
+
+        old_pos = _hash_find_old<>(this, key, hash);
+
+        return old_pos == _old_capacity ? iterator(nullptr) : _old_iterator_at(old_pos);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class Key>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::_find_old(const Key &key) {
+        size_type pos;
+
+        if (_old_ctrls == nullptr) return end();
+
+        pos = _hash_find_old<>(this, key, _hash_key<>(this, key));
+
+        return pos == _old_capacity ? end() : _old_iterator_at(pos);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::_old_iterator_at(size_type pos) const noexcept {
+        return iterator(&_old_slots[pos], &_old_ctrls[pos]);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool unordered_map<K, V, Hash, Eq, Storage>::_is_old_slot(const slot_type *ptr) const noexcept {
+        std::less<const slot_type *> less;
+
+        return _old_slots != nullptr && !less(ptr, _old_slots) && less(ptr, _old_slots + _old_capacity);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::_emplace(node_slots, Args &&... args) {
+        auto *val = new value_type(std::forward<Args>(args)...);
+
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, value_type*>(this, val->first, val, to_delete(val));
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<class... Args>
+    std::pair<umap::iterator, bool> unordered_map<K, V, Hash, Eq, Storage>::_emplace(flat_slots, Args &&... args) {
+        /* Build the element on the stack, it is moved into its slot only if the key is new.  */
+        value_type val(std::forward<Args>(args)...);
+
+        return _hash_insert<unordered_map<K, V, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, value_type&&>(this, val.first, std::move(val), to_ignore());
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::internal_ptr unordered_map<K, V, Hash, Eq>::_construct_new_element(const_reference val) {
-        return new value_type(val);
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::iterator unordered_map<K, V, Hash, Eq, Storage>::_iterator_at(size_type pos) const {
+        return iterator(&_slots[pos], &_ctrls[pos]);
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
     template<class P>
-    umap::internal_ptr unordered_map<K, V, Hash, Eq>::_construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type) {
-        return new value_type(std::forward<P>(val));
+    void unordered_map<K, V, Hash, Eq, Storage>::_construct_slot(size_type pos, P &&val) {
+        slots::construct(&_slots[pos], std::forward<P>(val));
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::internal_ptr unordered_map<K, V, Hash, Eq>::_construct_new_element(internal_ptr val) {
-        return val;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    template<typename KeyArgs, typename MappedArgs>
+    void unordered_map<K, V, Hash, Eq, Storage>::_construct_slot(size_type pos, piecewise_args<KeyArgs, MappedArgs> &&args) {
+        slots::construct(&_slots[pos], std::piecewise_construct, std::move(args.key), std::move(args.mapped));
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::internal_ptr unordered_map<K, V, Hash, Eq>::_construct_new_element(const key_type &key) {
-        return new value_type(key, mapped_type());
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    void unordered_map<K, V, Hash, Eq, Storage>::_copy_slot(size_type pos, slot_type &other) {
+        slots::construct(&_slots[pos], *slots::element(&other));
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::internal_ptr unordered_map<K, V, Hash, Eq>::_construct_new_element(key_type &&key) {
-        return new value_type(std::forward<key_type>(key), mapped_type());
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    bool unordered_map<K, V, Hash, Eq, Storage>::_is_slot_free(size_type) {
+        /* Keys are unique, erasing always frees the slot.  */
+        return true;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::size_type unordered_map<K, V, Hash, Eq>::_delete_all_slots(size_type pos) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::_delete_all_slots(size_type pos) {
         /* Keys are unique.  */
-        delete _slots[pos];
-        _slots[pos] = nullptr;
+        slots::destroy(&_slots[pos]);
         --_size;
 
         return 1;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    umap::size_type unordered_map<K, V, Hash, Eq>::_delete_slot(size_type pos) {
-        delete _slots[pos];
-        _slots[pos] = nullptr;
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    umap::size_type unordered_map<K, V, Hash, Eq, Storage>::_delete_slot(size_type pos) {
+        slots::destroy(&_slots[pos]);
         --_size;
 
         return 1;
     }
 
-    template<typename K, typename V, typename Hash, typename Eq>
-    std::pair<umap::size_type, umap::size_type> unordered_map<K, V, Hash, Eq>::_erase(internal_ptr *ptr, bool erase_all) {
+    template<typename K, typename V, typename Hash, typename Eq, typename Storage>
+    std::pair<umap::size_type, umap::size_type> unordered_map<K, V, Hash, Eq, Storage>::_erase(slot_type *ptr, bool erase_all) {
         return _hash_erase<>(this, ptr, erase_all);
     }
 }
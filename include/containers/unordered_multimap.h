@@ -3,6 +3,7 @@
 #include <cstdlib>
 #include <cassert>
 #include <functional>
+#include <tuple>
 
 #include "../internal/hash_internal.h"
 
@@ -58,7 +59,19 @@ namespace adt {
 
         struct enabler {};
 
+        /* Arguments of try_emplace, the node is built from them only if the key is absent.  */
+        template<typename KeyArgs, typename MappedArgs>
+        struct piecewise_args {
+            KeyArgs key;
+            MappedArgs mapped;
+        };
+
+        /* Passed to _handle_elem_found when an existing key must be left alone.  */
+        struct to_ignore {};
+
         using internal_ptr = multimap_node *;
+        using slots = slot_traits<multimap_node, node_slots>;
+        using slot_type = typename slots::slot_type;
 
         internal_ptr *_slots;
         ctrl_t *_ctrls;
@@ -66,6 +79,9 @@ namespace adt {
         size_type _size;
         size_type _n_slots;
         size_type _capacity;
+        size_type _n_deleted;
+        float _max_load_factor{0.75f};
+        uint64_t _seed;
         size_type _first_elem_pos;
         key_equal _keq;
 
@@ -76,8 +92,8 @@ namespace adt {
             template<class Container, typename R, typename Key, typename Value, typename... Args>
             friend R hash_internal::_hash_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
-            template<class Container>
-            friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename Key>
+            friend container::iterator hash_internal::_hash_find(Container *cnt, const Key &key);
 
             template<class Container>
             friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
@@ -93,6 +109,7 @@ namespace adt {
             using const_pointer = unordered_multimap::const_pointer;
             using difference_type = unordered_multimap::difference_type;
 
+            iterator() : iterator(nullptr) {}
             iterator(const iterator &other) = default;
             iterator(iterator &&other) = default;
 
@@ -140,7 +157,7 @@ namespace adt {
             internal_ptr *_ptr;
             internal_ptr _it;
 
-            iterator(internal_ptr *ptr = nullptr) : _ptr(ptr) {
+            iterator(internal_ptr *ptr) : _ptr(ptr), _it(nullptr) {
                 if (ptr != nullptr) _it = *_ptr;
             }
         };
@@ -207,6 +224,10 @@ namespace adt {
         iterator insert(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         template<class... Args>
         iterator emplace(Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(const key_type &key, Args&&... args);
+        template<class... Args>
+        std::pair<iterator, bool> try_emplace(key_type &&key, Args&&... args);
         iterator erase(const_iterator pos);
         size_type erase(const key_type &key);
         iterator erase(const_iterator first, const_iterator last);
@@ -217,19 +238,34 @@ namespace adt {
         iterator find(const key_type &key);
         const_iterator find(const key_type &key) const;
         size_type count(const key_type &key) const;
+        void find_many(const key_type *keys, size_type n, iterator *out);
+        void contains_many(const key_type *keys, size_type n, bool *out) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<iterator, const_iterator> equal_range(const key_type &key) const;
 
+        /* Heterogeneous lookup, enabled when Hash and Eq declare is_transparent.  */
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        iterator find(const Key &key);
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        const_iterator find(const Key &key) const;
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        size_type count(const Key &key) const;
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        std::pair<iterator, iterator> equal_range(const Key &key);
+        template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key> = 0>
+        std::pair<iterator, const_iterator> equal_range(const Key &key) const;
+
+        /* Hash policy.  */
+        size_type bucket_count() const noexcept;
+        float load_factor() const noexcept;
+        float max_load_factor() const noexcept;
+        void max_load_factor(float ml);
+        void rehash(size_type count);
+        void reserve(size_type count);
+        void shrink_to_fit();
+
         friend void swap(unordered_multimap &lhs, unordered_multimap &rhs) {
-            using std::swap;
-
-            swap(lhs._slots, rhs._slots);
-            swap(lhs._ctrls, rhs._ctrls);
-            swap(lhs._size, rhs._size);
-            swap(lhs._capacity, rhs._capacity);
-            swap(lhs._first_elem_pos, rhs._first_elem_pos);
-            swap(lhs._hasher, rhs._hasher);
-            swap(lhs._keq, rhs._keq);
+            lhs.swap(rhs);
         }
 
         template<class Container>
@@ -242,19 +278,43 @@ namespace adt {
         friend R hash_internal::_hash_insert(Container *cnt, const Key &key, Value val, Args &&... args);
 
         template<class Container>
-        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::internal_ptr *ptr, bool erase_all);
+        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::slot_type *ptr, bool erase_all);
 
         template<class Container>
         friend void hash_internal::_hash_clear(Container *cnt);
 
+        template<class Container, typename Key>
+        friend container::iterator hash_internal::_hash_find(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend container::iterator hash_internal::_hash_find_with_info(Container *cnt, const Key &key, const container::hash_info &info);
+
+        template<class Container, typename F>
+        friend void hash_internal::_hash_find_many(Container *cnt, const container::key_type *keys, container::size_type n, F f);
+
         template<class Container>
-        friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+        friend void hash_internal::_hash_rehash(Container *cnt, container::size_type new_cap);
 
         template<class Container>
-        friend void hash_internal::_hash_rehash(Container *cnt);
+        friend void hash_internal::_hash_rehash_in_place(Container *cnt);
 
         template<class Container>
-        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const container::key_type &key);
+        friend container::size_type hash_internal::_hash_capacity_for(Container *cnt, container::size_type n_slots);
+
+        template<class Container>
+        friend void hash_internal::_hash_resize(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_reserve(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_max_load_factor(Container *cnt, container::size_type n_slots, float ml);
+
+        template<class Container, typename Key>
+        friend uint64_t hash_internal::_hash_key(Container *cnt, const Key &key);
+
+        template<class Container, typename Key>
+        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const Key &key);
 
         template<class Container>
         friend void hash_internal::_hash_check_load_factor(Container *cnt, container::size_type, uint64_t hash, container::size_type &pos);
@@ -262,10 +322,14 @@ namespace adt {
         template<class Container>
         friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
 
+        template<class Container>
+        friend container::size_type hash_internal::_hash_find_first_non_full(Container *cnt, uint64_t hash);
+
     private:
         void _rehash();
         hash_info _get_hash_info(const key_type &key);
         void _check_load_factor(uint64_t hash, size_type &pos);
+        iterator _migrate_and_find_old(const key_type &key, uint64_t hash);
         const key_type &_get_slot_key(internal_ptr slot);
 
         iterator _add_to_list(const iterator &it, internal_ptr new_node);
@@ -273,13 +337,21 @@ namespace adt {
         template<typename P>
         internal_ptr _construct_new_element(P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         internal_ptr _construct_new_element(internal_ptr val);
+        template<typename KeyArgs, typename MappedArgs>
+        internal_ptr _construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args);
 
         iterator _handle_elem_found(const iterator &it, const value_type &val);
         template<typename P>
         iterator _handle_elem_found(const iterator &it, P &&val, typename std::enable_if<std::is_constructible<P&&, value_type>::value, enabler>::type = enabler());
         iterator _handle_elem_found(const iterator &it, internal_ptr new_node);
+        iterator _handle_elem_found(const iterator &it, to_ignore obj);
         iterator _handle_elem_not_found(const iterator &it);
 
+        iterator _iterator_at(size_type pos);
+        template<typename P>
+        void _construct_slot(size_type pos, P &&val);
+        bool _is_slot_free(size_type pos);
+
         size_type _delete_all_slots(size_type pos);
         size_type _delete_slot(size_type pos);
         std::pair<size_type, size_type> _erase(internal_ptr *ptr, bool erase_all);
@@ -302,6 +374,10 @@ namespace adt {
         this->_capacity = other._capacity;
         this->_size = other._size;
         this->_n_slots = other._n_slots;
+        this->_n_deleted = other._n_deleted;
+        this->_max_load_factor = other._max_load_factor;
+        /* Same seed, so the control bytes can be copied as they are.  */
+        this->_seed = other._seed;
         this->_first_elem_pos = other._first_elem_pos;
         this->_slots = (internal_ptr *) calloc(sizeof(internal_ptr), this->_capacity + 1);
         this->_slots[this->_capacity] = (internal_ptr) 0x1;
@@ -327,13 +403,13 @@ namespace adt {
 
     template<typename K, typename V, typename Hash, typename Eq>
     unordered_multimap<K, V, Hash, Eq>::unordered_multimap(unordered_multimap &&other) noexcept : unordered_multimap() {
-        swap(*this, other);
+        swap(other);
     }
 
     template<typename K, typename V, typename Hash, typename Eq>
     unordered_multimap<K, V, Hash, Eq> &unordered_multimap<K, V, Hash, Eq>::operator=(unordered_multimap rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
         return *this;
     }
 
@@ -401,6 +477,26 @@ namespace adt {
         return _hash_insert<unordered_multimap<K, V, Hash, Eq>, iterator, key_type, internal_ptr>(this, val->data.first, val, val);
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class... Args>
+    std::pair<umultimap_t::iterator, bool> unordered_multimap<K, V, Hash, Eq>::try_emplace(const key_type &key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<const key_type&>, std::tuple<Args&&...>>;
+        size_type old_size = _size;
+        iterator it = _hash_insert<unordered_multimap<K, V, Hash, Eq>, iterator, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+
+        return {it, _size != old_size};
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class... Args>
+    std::pair<umultimap_t::iterator, bool> unordered_multimap<K, V, Hash, Eq>::try_emplace(key_type &&key, Args &&... args) {
+        using args_type = piecewise_args<std::tuple<key_type&&>, std::tuple<Args&&...>>;
+        size_type old_size = _size;
+        iterator it = _hash_insert<unordered_multimap<K, V, Hash, Eq>, iterator, key_type, args_type&&>(this, key, args_type{std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<Args>(args)...)}, to_ignore());
+
+        return {it, _size != old_size};
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::erase(const_iterator pos) {
 
@@ -434,11 +530,28 @@ namespace adt {
 
     template<typename K, typename V, typename Hash, typename Eq>
     void unordered_multimap<K, V, Hash, Eq>::swap(unordered_multimap &other) {
-        this->swap(*this, other);
+        using std::swap;
+
+        swap(_slots, other._slots);
+        swap(_ctrls, other._ctrls);
+        swap(_size, other._size);
+        swap(_capacity, other._capacity);
+        swap(_n_deleted, other._n_deleted);
+        swap(_max_load_factor, other._max_load_factor);
+        swap(_seed, other._seed);
+        swap(_first_elem_pos, other._first_elem_pos);
+        swap(_hasher, other._hasher);
+        swap(_keq, other._keq);
     }
 
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::find(const Key &key) {
         return _hash_find<>(this, key);
     }
 
@@ -447,8 +560,20 @@ namespace adt {
         return const_cast<unordered_multimap<K, V, Hash, Eq>*>(this)->find(key);
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umultimap_t::const_iterator unordered_multimap<K, V, Hash, Eq>::find(const Key &key) const {
+        return const_cast<unordered_multimap<K, V, Hash, Eq>*>(this)->find(key);
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::size_type unordered_multimap<K, V, Hash, Eq>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    umultimap_t::size_type unordered_multimap<K, V, Hash, Eq>::count(const Key &key) const {
         multimap_node *current;
         size_t count = 0;
         multimap_node **found_ptr = const_cast<unordered_multimap<K, V, Hash, Eq>*>(this)->find(key)._ptr;
@@ -466,6 +591,12 @@ namespace adt {
 
     template<typename K, typename V, typename Hash, typename Eq>
     std::pair<umultimap_t::iterator, umultimap_t::iterator> unordered_multimap<K, V, Hash, Eq>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    std::pair<umultimap_t::iterator, umultimap_t::iterator> unordered_multimap<K, V, Hash, Eq>::equal_range(const Key &key) {
         multimap_node **first = find(key)._ptr;
         multimap_node **second = &(_slots[first - _slots]);
 
@@ -482,10 +613,64 @@ namespace adt {
         return const_cast<unordered_multimap<K, V, Hash, Eq>*>(this)->equal_range(key);
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<class Key, hash_internal::enable_lookup<Hash, Eq, K, Key>>
+    std::pair<umultimap_t::iterator, umultimap_t::const_iterator> unordered_multimap<K, V, Hash, Eq>::equal_range(const Key &key) const {
+        return const_cast<unordered_multimap<K, V, Hash, Eq>*>(this)->equal_range(key);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::find_many(const key_type *keys, size_type n, iterator *out) {
+        _hash_find_many<>(this, keys, n, [out](size_type i, const iterator &it) { out[i] = it; });
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::contains_many(const key_type *keys, size_type n, bool *out) const {
+        auto cnt = const_cast<unordered_multimap<K, V, Hash, Eq>*>(this);
+
+        _hash_find_many<>(cnt, keys, n, [cnt, out](size_type i, const iterator &it) { out[i] = it != cnt->end(); });
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    umultimap_t::size_type unordered_multimap<K, V, Hash, Eq>::bucket_count() const noexcept {
+        return _capacity;
+    }
+
+    /* Ratio of used slots (distinct keys) to slots, tombstones are not included.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    float unordered_multimap<K, V, Hash, Eq>::load_factor() const noexcept {
+        return (float) _n_slots / (float) _capacity;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    float unordered_multimap<K, V, Hash, Eq>::max_load_factor() const noexcept {
+        return _max_load_factor;
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::max_load_factor(float ml) {
+        _hash_max_load_factor<>(this, _n_slots, ml);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::rehash(size_type count) {
+        _hash_resize<>(this, _n_slots, count);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::reserve(size_type count) {
+        _hash_reserve<>(this, _n_slots, count);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    void unordered_multimap<K, V, Hash, Eq>::shrink_to_fit() {
+        _hash_resize<>(this, _n_slots, 0);
+    }
+
     /* Private member functions.  */
     template<typename K, typename V, typename Hash, typename Eq>
     void unordered_multimap<K, V, Hash, Eq>::_rehash() {
-        _hash_rehash<>(this);
+        _hash_rehash<>(this, _capacity * 2);
     }
 
     template<typename K, typename V, typename Hash, typename Eq>
@@ -498,6 +683,12 @@ namespace adt {
         return _hash_check_load_factor<>(this, _n_slots, hash, pos);
     }
 
+    /* No incremental rehash.  */
+    template<typename K, typename V, typename Hash, typename Eq>
+    umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::_migrate_and_find_old(const key_type &, uint64_t) {
+        return iterator(nullptr);
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     const umultimap_t::key_type &unordered_multimap<K, V, Hash, Eq>::_get_slot_key(internal_ptr slot) {
         return slot->data.first;
@@ -529,6 +720,12 @@ namespace adt {
         return val;
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<typename KeyArgs, typename MappedArgs>
+    umultimap_t::internal_ptr unordered_multimap<K, V, Hash, Eq>::_construct_new_element(piecewise_args<KeyArgs, MappedArgs> &&args) {
+        return new multimap_node(std::piecewise_construct, std::move(args.key), std::move(args.mapped));
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::_handle_elem_found(const iterator &it, const value_type &val) {
         return _add_to_list(it, new multimap_node(val));
@@ -545,12 +742,33 @@ namespace adt {
         return _add_to_list(it, new_node);
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::_handle_elem_found(const iterator &it, to_ignore obj) {
+        return it;
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::_handle_elem_not_found(const iterator &it) {
         _n_slots++;
         return it;
     }
 
+    template<typename K, typename V, typename Hash, typename Eq>
+    umultimap_t::iterator unordered_multimap<K, V, Hash, Eq>::_iterator_at(size_type pos) {
+        return iterator(&_slots[pos]);
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    template<typename P>
+    void unordered_multimap<K, V, Hash, Eq>::_construct_slot(size_type pos, P &&val) {
+        _slots[pos] = _construct_new_element(std::forward<P>(val));
+    }
+
+    template<typename K, typename V, typename Hash, typename Eq>
+    bool unordered_multimap<K, V, Hash, Eq>::_is_slot_free(size_type pos) {
+        return _slots[pos] == nullptr;
+    }
+
     template<typename K, typename V, typename Hash, typename Eq>
     umultimap_t::size_type unordered_multimap<K, V, Hash, Eq>::_delete_all_slots(size_type pos) {
         multimap_node *to_delete;
@@ -568,6 +786,7 @@ namespace adt {
 
         delete _slots[pos];
         _slots[pos] = nullptr;
+        _n_slots--;
         count++;
 
         _size -= count;
@@ -582,6 +801,7 @@ namespace adt {
         if (to_delete == nullptr) {
             delete _slots[pos];
             _slots[pos] = nullptr;
+            _n_slots--;
         } else {
             _slots[pos]->next = to_delete->next;
             delete to_delete;
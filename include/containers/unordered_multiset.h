@@ -56,6 +56,8 @@ namespace adt {
         };
 
         using internal_ptr = multiset_node *;
+        using slots = slot_traits<multiset_node, node_slots>;
+        using slot_type = typename slots::slot_type;
 
         internal_ptr *_slots;
         ctrl_t *_ctrls;
@@ -63,6 +65,9 @@ namespace adt {
         size_type _size;
         size_type _n_slots;
         size_type _capacity;
+        size_type _n_deleted;
+        float _max_load_factor{0.75f};
+        uint64_t _seed;
         size_type _first_elem_pos;
         key_equal _keq;
 
@@ -73,8 +78,8 @@ namespace adt {
             template<class Container, typename R, typename K, typename V, typename... Args>
             friend R hash_internal::_hash_insert(Container *cnt, const K &key, V val, Args &&... args);
 
-            template<class Container>
-            friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename K>
+            friend container::iterator hash_internal::_hash_find(Container *cnt, const K &key);
 
             template<class Container>
             friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
@@ -88,6 +93,7 @@ namespace adt {
             using pointer = unordered_multiset::const_pointer;
             using difference_type = unordered_multiset::difference_type;
 
+            iterator() : iterator(nullptr) {}
             iterator(const iterator &other) = default;
             iterator(iterator &&other) = default;
 
@@ -180,19 +186,34 @@ namespace adt {
         iterator find(const key_type &key);
         const_iterator find(const key_type &key) const;
         size_type count(const key_type &key) const;
+        void find_many(const key_type *keys, size_type n, iterator *out);
+        void contains_many(const key_type *keys, size_type n, bool *out) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<iterator, const_iterator> equal_range(const key_type &key) const;
 
+        /* Heterogeneous lookup, enabled when Hash and Eq declare is_transparent.  */
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        std::pair<iterator, const_iterator> equal_range(const K &key) const;
+
+        /* Hash policy.  */
+        size_type bucket_count() const noexcept;
+        float load_factor() const noexcept;
+        float max_load_factor() const noexcept;
+        void max_load_factor(float ml);
+        void rehash(size_type count);
+        void reserve(size_type count);
+        void shrink_to_fit();
+
         friend void swap(unordered_multiset &lhs, unordered_multiset &rhs) {
-            using std::swap;
-
-            swap(lhs._slots, rhs._slots);
-            swap(lhs._ctrls, rhs._ctrls);
-            swap(lhs._size, rhs._size);
-            swap(lhs._capacity, rhs._capacity);
-            swap(lhs._first_elem_pos, rhs._first_elem_pos);
-            swap(lhs._hasher, rhs._hasher);
-            swap(lhs._keq, rhs._keq);
+            lhs.swap(rhs);
         }
 
         template<class Container>
@@ -205,13 +226,31 @@ namespace adt {
         friend void hash_internal::_hash_clear(Container *cnt);
 
         template<class Container>
-        friend void hash_internal::_hash_rehash(Container *cnt);
+        friend void hash_internal::_hash_rehash(Container *cnt, container::size_type new_cap);
 
         template<class Container>
-        friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
+        friend void hash_internal::_hash_rehash_in_place(Container *cnt);
+
+        template<class Container>
+        friend container::size_type hash_internal::_hash_capacity_for(Container *cnt, container::size_type n_slots);
 
         template<class Container>
-        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const container::key_type &key);
+        friend void hash_internal::_hash_resize(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_reserve(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_max_load_factor(Container *cnt, container::size_type n_slots, float ml);
+
+        template<class Container>
+        friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
+
+        template<class Container, typename K>
+        friend uint64_t hash_internal::_hash_key(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const K &key);
 
         template<class Container>
         friend void hash_internal::_hash_check_load_factor(Container *cnt, container::size_type, uint64_t hash, container::size_type &pos);
@@ -219,16 +258,26 @@ namespace adt {
         template<class Container, typename R, typename K, typename V, typename... Args>
         friend R hash_internal::_hash_insert(Container *cnt, const K &key, V val, Args &&... args);
 
+        template<class Container, typename K>
+        friend container::iterator hash_internal::_hash_find(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend container::iterator hash_internal::_hash_find_with_info(Container *cnt, const K &key, const container::hash_info &info);
+
+        template<class Container, typename F>
+        friend void hash_internal::_hash_find_many(Container *cnt, const container::key_type *keys, container::size_type n, F f);
+
         template<class Container>
-        friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::slot_type *ptr, bool erase_all);
 
         template<class Container>
-        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::internal_ptr *ptr, bool erase_all);
+        friend container::size_type hash_internal::_hash_find_first_non_full(Container *cnt, uint64_t hash);
 
     private:
         void _rehash();
         hash_info _get_hash_info(const key_type &key);
         void _check_load_factor(uint64_t hash, size_type &pos);
+        iterator _migrate_and_find_old(const key_type &key, uint64_t hash);
         const key_type &_get_slot_key(internal_ptr slot);
 
         iterator _add_to_list(const iterator &it, internal_ptr new_node);
@@ -241,6 +290,11 @@ namespace adt {
         iterator _handle_elem_found(const iterator &it, internal_ptr new_node);
         iterator _handle_elem_not_found(const iterator &it);
 
+        iterator _iterator_at(size_type pos);
+        template<typename P>
+        void _construct_slot(size_type pos, P &&val);
+        bool _is_slot_free(size_type pos);
+
         size_type _delete_all_slots(size_type pos);
         size_type _delete_slot(size_type pos);
         std::pair<size_type, size_type> _erase(internal_ptr *ptr, bool erase_all);
@@ -263,6 +317,10 @@ namespace adt {
         this->_capacity = other._capacity;
         this->_size = other._size;
         this->_n_slots = other._n_slots;
+        this->_n_deleted = other._n_deleted;
+        this->_max_load_factor = other._max_load_factor;
+        /* Same seed, so the control bytes can be copied as they are.  */
+        this->_seed = other._seed;
         this->_first_elem_pos = other._first_elem_pos;
         this->_slots = (internal_ptr *) calloc(sizeof(internal_ptr), this->_capacity + 1);
         this->_slots[this->_capacity] = (internal_ptr) 0x1;
@@ -288,13 +346,13 @@ namespace adt {
 
     template<typename Key, class Hash, class Eq>
     unordered_multiset<Key, Hash, Eq>::unordered_multiset(unordered_multiset &&other) noexcept : unordered_multiset() {
-        swap(*this, other);
+        swap(other);
     }
 
     template<typename Key, class Hash, class Eq>
     unordered_multiset<Key, Hash, Eq> &unordered_multiset<Key, Hash, Eq>::operator=(unordered_multiset rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
         return *this;
     }
 
@@ -394,11 +452,28 @@ namespace adt {
 
     template<typename Key, class Hash, class Eq>
     void unordered_multiset<Key, Hash, Eq>::swap(unordered_multiset &other) {
-        this->swap(*this, other);
+        using std::swap;
+
+        swap(_slots, other._slots);
+        swap(_ctrls, other._ctrls);
+        swap(_size, other._size);
+        swap(_capacity, other._capacity);
+        swap(_n_deleted, other._n_deleted);
+        swap(_max_load_factor, other._max_load_factor);
+        swap(_seed, other._seed);
+        swap(_first_elem_pos, other._first_elem_pos);
+        swap(_hasher, other._hasher);
+        swap(_keq, other._keq);
     }
 
     template<typename Key, class Hash, class Eq>
     umultiset_t::iterator unordered_multiset<Key, Hash, Eq>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    umultiset_t::iterator unordered_multiset<Key, Hash, Eq>::find(const K &key) {
         return _hash_find<>(this, key);
     }
 
@@ -407,8 +482,20 @@ namespace adt {
         return const_cast<unordered_multiset<Key, Hash, Eq>*>(this)->find(key);
     }
 
+    template<typename Key, class Hash, class Eq>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    umultiset_t::const_iterator unordered_multiset<Key, Hash, Eq>::find(const K &key) const {
+        return const_cast<unordered_multiset<Key, Hash, Eq>*>(this)->find(key);
+    }
+
     template<typename Key, class Hash, class Eq>
     umultiset_t::size_type unordered_multiset<Key, Hash, Eq>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    umultiset_t::size_type unordered_multiset<Key, Hash, Eq>::count(const K &key) const {
         multiset_node *current;
         size_t count = 0;
         multiset_node **found_ptr = const_cast<unordered_multiset<Key, Hash, Eq>*>(this)->find(key)._ptr;
@@ -426,6 +513,12 @@ namespace adt {
 
     template<typename Key, class Hash, class Eq>
     std::pair<umultiset_t::iterator, umultiset_t::iterator> unordered_multiset<Key, Hash, Eq>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    std::pair<umultiset_t::iterator, umultiset_t::iterator> unordered_multiset<Key, Hash, Eq>::equal_range(const K &key) {
         multiset_node **first = find(key)._ptr;
         multiset_node **second = &(_slots[first - _slots]);
 
@@ -442,10 +535,64 @@ namespace adt {
         return const_cast<unordered_multiset<Key, Hash, Eq>*>(this)->equal_range(key);
     }
 
+    template<typename Key, class Hash, class Eq>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    std::pair<umultiset_t::iterator, umultiset_t::const_iterator> unordered_multiset<Key, Hash, Eq>::equal_range(const K &key) const {
+        return const_cast<unordered_multiset<Key, Hash, Eq>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::find_many(const key_type *keys, size_type n, iterator *out) {
+        _hash_find_many<>(this, keys, n, [out](size_type i, const iterator &it) { out[i] = it; });
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::contains_many(const key_type *keys, size_type n, bool *out) const {
+        auto cnt = const_cast<unordered_multiset<Key, Hash, Eq>*>(this);
+
+        _hash_find_many<>(cnt, keys, n, [cnt, out](size_type i, const iterator &it) { out[i] = it != cnt->end(); });
+    }
+
+    template<typename Key, class Hash, class Eq>
+    umultiset_t::size_type unordered_multiset<Key, Hash, Eq>::bucket_count() const noexcept {
+        return _capacity;
+    }
+
+    /* Ratio of used slots (distinct keys) to slots, tombstones are not included.  */
+    template<typename Key, class Hash, class Eq>
+    float unordered_multiset<Key, Hash, Eq>::load_factor() const noexcept {
+        return (float) _n_slots / (float) _capacity;
+    }
+
+    template<typename Key, class Hash, class Eq>
+    float unordered_multiset<Key, Hash, Eq>::max_load_factor() const noexcept {
+        return _max_load_factor;
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::max_load_factor(float ml) {
+        _hash_max_load_factor<>(this, _n_slots, ml);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::rehash(size_type count) {
+        _hash_resize<>(this, _n_slots, count);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::reserve(size_type count) {
+        _hash_reserve<>(this, _n_slots, count);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    void unordered_multiset<Key, Hash, Eq>::shrink_to_fit() {
+        _hash_resize<>(this, _n_slots, 0);
+    }
+
     /* Private member functions.  */
     template<typename Key, class Hash, class Eq>
     void unordered_multiset<Key, Hash, Eq>::_rehash() {
-        _hash_rehash<>(this);
+        _hash_rehash<>(this, _capacity * 2);
     }
 
     template<typename Key, class Hash, class Eq>
@@ -458,6 +605,12 @@ namespace adt {
         return _hash_check_load_factor<>(this, _n_slots, hash, pos);
     }
 
+    /* No incremental rehash.  */
+    template<typename Key, typename Hash, typename Eq>
+    umultiset_t::iterator unordered_multiset<Key, Hash, Eq>::_migrate_and_find_old(const key_type &, uint64_t) {
+        return iterator(nullptr);
+    }
+
     template<typename Key, class Hash, class Eq>
     umultiset_t::iterator unordered_multiset<Key, Hash, Eq>::_add_to_list(const iterator &it, internal_ptr new_node) {
         new_node->next = *(it._ptr);
@@ -509,6 +662,22 @@ namespace adt {
         return it;
     }
 
+    template<typename Key, class Hash, class Eq>
+    umultiset_t::iterator unordered_multiset<Key, Hash, Eq>::_iterator_at(size_type pos) {
+        return iterator(&_slots[pos]);
+    }
+
+    template<typename Key, class Hash, class Eq>
+    template<typename P>
+    void unordered_multiset<Key, Hash, Eq>::_construct_slot(size_type pos, P &&val) {
+        _slots[pos] = _construct_new_element(std::forward<P>(val));
+    }
+
+    template<typename Key, class Hash, class Eq>
+    bool unordered_multiset<Key, Hash, Eq>::_is_slot_free(size_type pos) {
+        return _slots[pos] == nullptr;
+    }
+
     template<typename Key, class Hash, class Eq>
     umultiset_t::size_type unordered_multiset<Key, Hash, Eq>::_delete_all_slots(size_type pos) {
         multiset_node *to_delete;
@@ -526,6 +695,7 @@ namespace adt {
 
         delete _slots[pos];
         _slots[pos] = nullptr;
+        _n_slots--;
         count++;
 
         _size -= count;
@@ -540,6 +710,7 @@ namespace adt {
         if (to_delete == nullptr) {
             delete _slots[pos];
             _slots[pos] = nullptr;
+            _n_slots--;
         } else {
             _slots[pos]->next = to_delete->next;
             delete to_delete;
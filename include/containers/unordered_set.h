@@ -6,13 +6,14 @@
 
 #include "../internal/hash_internal.h"
 
-#define uset_t typename unordered_set<Key, Hash, Eq>
+#define uset_t typename unordered_set<Key, Hash, Eq, Storage>
 
 using namespace hash_internal;
 
 namespace adt {
 
-    template<typename Key, class Hash = std::hash<Key>, class Eq = std::equal_to<Key>>
+    /* Storage selects the slot layout, see hash_internal::node_slots and hash_internal::flat_slots.  */
+    template<typename Key, class Hash = std::hash<Key>, class Eq = std::equal_to<Key>, class Storage = node_slots>
     class unordered_set {
     public:
         using key_type = Key;
@@ -30,12 +31,17 @@ namespace adt {
 
     private:
         using internal_ptr = value_type *;
+        using slots = slot_traits<value_type, Storage>;
+        using slot_type = typename slots::slot_type;
 
-        internal_ptr *_slots;
+        slot_type *_slots;
         ctrl_t *_ctrls{};
         hasher _hasher;
         size_type _size;
         size_type _capacity;
+        size_type _n_deleted;
+        float _max_load_factor{0.75f};
+        uint64_t _seed;
         size_type _first_elem_pos{};
         key_equal _keq;
 
@@ -74,13 +80,14 @@ namespace adt {
             template<class Container, typename R, typename K, typename V, typename... Args>
             friend R hash_internal::_hash_insert(Container *cnt, const K &key, V val, Args &&... args);
 
-            template<class Container>
-            friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+            template<class Container, typename K>
+            friend container::iterator hash_internal::_hash_find(Container *cnt, const K &key);
 
             template<class Container>
             friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
 
-            using internal_ptr = unordered_set::internal_ptr;
+            using slot_type = unordered_set::slot_type;
+            using slots = unordered_set::slots;
 
         public:
             using iterator_category = std::forward_iterator_tag;
@@ -89,30 +96,29 @@ namespace adt {
             using pointer = unordered_set::const_pointer;
             using difference_type = unordered_set::difference_type;
 
+            iterator() : iterator(nullptr) {}
             iterator(const iterator &other) = default;
             iterator(iterator &&other) = default;
 
             iterator &operator=(const iterator &rhs) = default;
-            iterator &operator=(internal_ptr *ptr) {
-                this->_ptr = ptr;
-                return *this;
-            }
 
             bool operator==(const iterator &rhs) const { return this->_ptr == rhs._ptr; }
-            bool operator==(internal_ptr *ptr) const { return this->_ptr == ptr; }
+            bool operator==(slot_type *ptr) const { return this->_ptr == ptr; }
             bool operator!=(const iterator &rhs) const { return !(*this == rhs); }
-            bool operator!=(internal_ptr *ptr) const { return !(*this == ptr); }
+            bool operator!=(slot_type *ptr) const { return !(*this == ptr); }
 
             iterator &operator++() {
                 /* If its already end(), dont try to increment it.  */
-                if (_ptr == nullptr || *_ptr == (internal_ptr) 0x1) {
+                if (_ctrl == nullptr || *_ctrl == ctrl_sentinel) {
                     return *this;
                 }
 
-                ++_ptr;
-                while (*_ptr == nullptr && *_ptr != (internal_ptr) 0x1) {
+                /* Skip empty and deleted slots, ctrl_sentinel stops us at end().  */
+                do {
                     ++_ptr;
-                }
+                    ++_ctrl;
+                } while (is_empty_or_deleted(*_ctrl));
+
                 return *this;
             }
             iterator operator++(int) & {
@@ -121,13 +127,14 @@ namespace adt {
                 return temp;
             }
 
-            reference operator*() const { return *(*_ptr); }
-            pointer operator->() const { return (*_ptr); }
+            reference operator*() const { return *slots::element(_ptr); }
+            pointer operator->() const { return slots::element(_ptr); }
 
         private:
-            internal_ptr *_ptr;
+            slot_type *_ptr;
+            const ctrl_t *_ctrl;
 
-            iterator(internal_ptr *ptr) : _ptr(ptr) {}
+            iterator(slot_type *ptr, const ctrl_t *ctrl = nullptr) : _ptr(ptr), _ctrl(ctrl) {}
         };
 
         /* Constructors/Destructors.  */
@@ -167,19 +174,34 @@ namespace adt {
         iterator find(const key_type &key);
         const_iterator find(const key_type &key) const;
         size_type count(const key_type &key) const;
+        void find_many(const key_type *keys, size_type n, iterator *out);
+        void contains_many(const key_type *keys, size_type n, bool *out) const;
         std::pair<iterator, iterator> equal_range(const key_type &key);
         std::pair<const_iterator, const_iterator> equal_range(const key_type &key) const;
 
+        /* Heterogeneous lookup, enabled when Hash and Eq declare is_transparent.  */
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        iterator find(const K &key);
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        const_iterator find(const K &key) const;
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        size_type count(const K &key) const;
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        std::pair<iterator, iterator> equal_range(const K &key);
+        template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K> = 0>
+        std::pair<const_iterator, const_iterator> equal_range(const K &key) const;
+
+        /* Hash policy.  */
+        size_type bucket_count() const noexcept;
+        float load_factor() const noexcept;
+        float max_load_factor() const noexcept;
+        void max_load_factor(float ml);
+        void rehash(size_type count);
+        void reserve(size_type count);
+        void shrink_to_fit();
+
         friend void swap(unordered_set &lhs, unordered_set &rhs) {
-            using std::swap;
-
-            swap(lhs._slots, rhs._slots);
-            swap(lhs._ctrls, rhs._ctrls);
-            swap(lhs._size, rhs._size);
-            swap(lhs._capacity, rhs._capacity);
-            swap(lhs._first_elem_pos, rhs._first_elem_pos);
-            swap(lhs._hasher, rhs._hasher);
-            swap(lhs._keq, rhs._keq);
+            lhs.swap(rhs);
         }
 
         template<class Container>
@@ -192,19 +214,46 @@ namespace adt {
         friend R hash_internal::_hash_insert(Container *cnt, const K &key, V val, Args &&... args);
 
         template<class Container>
-        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::internal_ptr *ptr, bool erase_all);
+        friend void hash_internal::_hash_copy(Container *cnt, const Container &other);
+
+        template<class Container>
+        friend std::pair<container::size_type, container::size_type> hash_internal::_hash_erase(Container *cnt, container::slot_type *ptr, bool erase_all);
 
         template<class Container>
         friend void hash_internal::_hash_clear(Container *cnt);
 
+        template<class Container, typename K>
+        friend container::iterator hash_internal::_hash_find(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend container::iterator hash_internal::_hash_find_with_info(Container *cnt, const K &key, const container::hash_info &info);
+
+        template<class Container, typename F>
+        friend void hash_internal::_hash_find_many(Container *cnt, const container::key_type *keys, container::size_type n, F f);
+
         template<class Container>
-        friend container::iterator hash_internal::_hash_find(Container *cnt, const container::key_type &key);
+        friend void hash_internal::_hash_rehash(Container *cnt, container::size_type new_cap);
 
         template<class Container>
-        friend void hash_internal::_hash_rehash(Container *cnt);
+        friend void hash_internal::_hash_rehash_in_place(Container *cnt);
 
         template<class Container>
-        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const container::key_type &key);
+        friend container::size_type hash_internal::_hash_capacity_for(Container *cnt, container::size_type n_slots);
+
+        template<class Container>
+        friend void hash_internal::_hash_resize(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_reserve(Container *cnt, container::size_type n_slots, container::size_type count);
+
+        template<class Container>
+        friend void hash_internal::_hash_max_load_factor(Container *cnt, container::size_type n_slots, float ml);
+
+        template<class Container, typename K>
+        friend uint64_t hash_internal::_hash_key(Container *cnt, const K &key);
+
+        template<class Container, typename K>
+        friend container::hash_info hash_internal::_hash_get_hash_info(Container *cnt, const K &key);
 
         template<class Container>
         friend void hash_internal::_hash_check_load_factor(Container *cnt, container::size_type, uint64_t hash, container::size_type &pos);
@@ -212,140 +261,140 @@ namespace adt {
         template<class Container>
         friend container::find_insert_info hash_internal::_hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash);
 
+        template<class Container>
+        friend container::size_type hash_internal::_hash_find_first_non_full(Container *cnt, uint64_t hash);
+
     private:
         void _rehash();
         hash_info _get_hash_info(const key_type &key);
         void _check_load_factor(uint64_t hash, size_type &pos);
-        const key_type &_get_slot_key(internal_ptr slot);
+        iterator _migrate_and_find_old(const key_type &key, uint64_t hash);
+        const key_type &_get_slot_key(slot_type &slot);
         
         std::pair<iterator, bool> _handle_elem_found(const iterator &it, to_ignore obj);
         std::pair<iterator, bool> _handle_elem_found(const iterator &it, to_delete obj);
         std::pair<iterator, bool> _handle_elem_not_found(const iterator &it);
         
-        internal_ptr _construct_new_element(const value_type &val);
-        internal_ptr _construct_new_element(internal_ptr val);
-        internal_ptr _construct_new_element(value_type &&val);
-        
+        template<class... Args>
+        std::pair<iterator, bool> _emplace(node_slots, Args &&... args);
+        template<class... Args>
+        std::pair<iterator, bool> _emplace(flat_slots, Args &&... args);
+
+        iterator _iterator_at(size_type pos) const;
+        template<class P>
+        void _construct_slot(size_type pos, P &&val);
+        void _copy_slot(size_type pos, slot_type &other);
+        bool _is_slot_free(size_type pos);
+
         size_type _delete_all_slots(size_type pos);
         size_type _delete_slot(size_type pos);
-        std::pair<size_type, size_type> _erase(internal_ptr *ptr, bool erase_all = false);
+        std::pair<size_type, size_type> _erase(slot_type *ptr, bool erase_all = false);
     };
 
+    /* unordered_set that stores its elements inline in the slot array (no pointer stability).  */
+    template<typename Key, class Hash = std::hash<Key>, class Eq = std::equal_to<Key>>
+    using flat_unordered_set = unordered_set<Key, Hash, Eq, flat_slots>;
+
     /* Implementation.  */
 
     /* Public member functions.  */
-    template<typename Key, class Hash, class Eq>
-    unordered_set<Key, Hash, Eq>::unordered_set(size_type cap, const hasher &hash, const key_equal& keq) noexcept
+    template<typename Key, class Hash, class Eq, class Storage>
+    unordered_set<Key, Hash, Eq, Storage>::unordered_set(size_type cap, const hasher &hash, const key_equal& keq) noexcept
         : _size(0), _capacity(cap), _hasher(hash), _keq(keq) {
         _hash_construct<>(this);
     }
 
-    template<typename Key, class Hash, class Eq>
-    unordered_set<Key, Hash, Eq>::unordered_set(const unordered_set &other) {
-        this->_capacity = other._capacity;
-        this->_size = other._size;
-        this->_first_elem_pos = other._first_elem_pos;
-        this->_slots = (internal_ptr *) calloc(sizeof (internal_ptr), this->_capacity + 1);
-        this->_slots[this->_capacity] = (internal_ptr) 0x1;
-        this->_ctrls = new ctrl_t[this->_capacity];
-
-        /* Deep copy of the data. Avoid this lol.  */
-        for (size_t i = 0 ; i < other._capacity ; i++) {
-            this->_ctrls[i] = other._ctrls[i];
-
-            if (is_full_slot(other._ctrls[i])) {
-                this->_slots[i] = new key_type(*other._slots[i]);
-            }
-        }
+    template<typename Key, class Hash, class Eq, class Storage>
+    unordered_set<Key, Hash, Eq, Storage>::unordered_set(const unordered_set &other)
+        : _hasher(other._hasher), _keq(other._keq) {
+        _hash_copy<>(this, other);
     }
 
-    template<typename Key, class Hash, class Eq>
-    unordered_set<Key, Hash, Eq>::unordered_set(unordered_set &&other) noexcept : unordered_set() {
-        swap(*this, other);
+    template<typename Key, class Hash, class Eq, class Storage>
+    unordered_set<Key, Hash, Eq, Storage>::unordered_set(unordered_set &&other) noexcept : unordered_set() {
+        swap(other);
     }
 
-    template<typename Key, class Hash, class Eq>
-    unordered_set<Key, Hash, Eq>& unordered_set<Key, Hash, Eq>::operator=(unordered_set rhs) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    unordered_set<Key, Hash, Eq, Storage>& unordered_set<Key, Hash, Eq, Storage>::operator=(unordered_set rhs) {
         /* Copy and swap idiom, let the compiler handle the copy of the argument.  */
-        swap(*this, rhs);
+        swap(rhs);
         return *this;
     }
 
-    template<typename Key, class Hash, class Eq>
-    unordered_set<Key, Hash, Eq>::~unordered_set() noexcept {
-        _hash_destruct<unordered_set<Key, Hash, Eq>>(this);
+    template<typename Key, class Hash, class Eq, class Storage>
+    unordered_set<Key, Hash, Eq, Storage>::~unordered_set() noexcept {
+        _hash_destruct<unordered_set<Key, Hash, Eq, Storage>>(this);
     }
 
-    template<typename Key, class Hash, class Eq>
-    bool unordered_set<Key, Hash, Eq>::empty() const noexcept {
+    template<typename Key, class Hash, class Eq, class Storage>
+    bool unordered_set<Key, Hash, Eq, Storage>::empty() const noexcept {
         return _size == 0;
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::size_type unordered_set<Key, Hash, Eq>::size() const noexcept {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::size() const noexcept {
         return _size;
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::iterator unordered_set<Key, Hash, Eq>::begin() const noexcept {
-        return iterator(&_slots[_first_elem_pos]);
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::begin() const noexcept {
+        return _iterator_at(_first_elem_pos);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::iterator unordered_set<Key, Hash, Eq>::end() const noexcept {
-        return iterator(&_slots[_capacity]);
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::end() const noexcept {
+        return _iterator_at(_capacity);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::const_iterator unordered_set<Key, Hash, Eq>::cbegin() const noexcept {
-        return const_iterator(&_slots[_first_elem_pos]);
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::const_iterator unordered_set<Key, Hash, Eq, Storage>::cbegin() const noexcept {
+        return _iterator_at(_first_elem_pos);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::const_iterator unordered_set<Key, Hash, Eq>::cend() const noexcept {
-        return const_iterator(&_slots[_capacity]);
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::const_iterator unordered_set<Key, Hash, Eq, Storage>::cend() const noexcept {
+        return _iterator_at(_capacity);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::hasher unordered_set<Key, Hash, Eq>::hash_function() const {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::hasher unordered_set<Key, Hash, Eq, Storage>::hash_function() const {
         return _hasher;
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::key_equal unordered_set<Key, Hash, Eq>::key_eq() const {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::key_equal unordered_set<Key, Hash, Eq, Storage>::key_eq() const {
         return _keq;
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::insert(const_reference val) {
-        return _hash_insert<unordered_set<Key, Hash, Eq>, std::pair<iterator, bool>, key_type, const_reference>(this, val, val, to_ignore());
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::insert(const_reference val) {
+        return _hash_insert<unordered_set<Key, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, const_reference>(this, val, val, to_ignore());
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::insert(value_type &&val) {
-        return _hash_insert<unordered_set<Key, Hash, Eq>, std::pair<iterator, bool>, key_type, value_type&&>(this, val, std::forward<value_type>(val), to_ignore());
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::insert(value_type &&val) {
+        return _hash_insert<unordered_set<Key, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, value_type&&>(this, val, std::forward<value_type>(val), to_ignore());
     }
 
-    template<typename Key, class Hash, class Eq>
+    template<typename Key, class Hash, class Eq, class Storage>
     template<class... Args>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::emplace(Args &&... args) {
-        value_type *val = new value_type(std::forward<Args>(args)...);
-
-        return _hash_insert<unordered_set<Key, Hash, Eq>, std::pair<iterator, bool>, key_type, value_type*>(this, *val, val, to_delete(val));
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::emplace(Args &&... args) {
+        return _emplace(Storage(), std::forward<Args>(args)...);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::iterator unordered_set<Key, Hash, Eq>::erase(const_iterator pos) {
-        return iterator(&(_slots[_erase(pos._ptr).first]));
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::erase(const_iterator pos) {
+        return _iterator_at(_erase(pos._ptr).first);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::size_type unordered_set<Key, Hash, Eq>::erase(const key_type &key) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::erase(const key_type &key) {
         return _erase(find(key)._ptr).second;
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::iterator unordered_set<Key, Hash, Eq>::erase(const_iterator first, const_iterator last) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::erase(const_iterator first, const_iterator last) {
         auto it = first;
 
         while (it != last) it = erase(it);
@@ -353,117 +402,234 @@ namespace adt {
         return it;
     }
 
-    template<typename Key, class Hash, class Eq>
-    void unordered_set<Key, Hash, Eq>::clear() noexcept {
-        _hash_clear<unordered_set<Key, Hash, Eq>>(this);
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::clear() noexcept {
+        _hash_clear<unordered_set<Key, Hash, Eq, Storage>>(this);
     }
 
-    template<typename Key, class Hash, class Eq>
-    void unordered_set<Key, Hash, Eq>::swap(unordered_set &other) {
-        this->swap(*this, other);
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::swap(unordered_set &other) {
+        using std::swap;
+
+        swap(_slots, other._slots);
+        swap(_ctrls, other._ctrls);
+        swap(_size, other._size);
+        swap(_capacity, other._capacity);
+        swap(_n_deleted, other._n_deleted);
+        swap(_max_load_factor, other._max_load_factor);
+        swap(_seed, other._seed);
+        swap(_first_elem_pos, other._first_elem_pos);
+        swap(_hasher, other._hasher);
+        swap(_keq, other._keq);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::iterator unordered_set<Key, Hash, Eq>::find(const key_type &key) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::find(const key_type &key) {
+        return find<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::find(const K &key) {
         return _hash_find<>(this, key);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::const_iterator unordered_set<Key, Hash, Eq>::find(const key_type &key) const {
-        return const_cast<unordered_set<Key, Hash, Eq>*>(this)->find(key);
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::const_iterator unordered_set<Key, Hash, Eq, Storage>::find(const key_type &key) const {
+        return const_cast<unordered_set<Key, Hash, Eq, Storage>*>(this)->find(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    uset_t::const_iterator unordered_set<Key, Hash, Eq, Storage>::find(const K &key) const {
+        return const_cast<unordered_set<Key, Hash, Eq, Storage>*>(this)->find(key);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::size_type unordered_set<Key, Hash, Eq>::count(const key_type &key) const {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::count(const key_type &key) const {
+        return count<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::count(const K &key) const {
         return find(key)._ptr != &_slots[_capacity] ? 1 : 0;
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, uset_t::iterator> unordered_set<Key, Hash, Eq>::equal_range(const key_type &key) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, uset_t::iterator> unordered_set<Key, Hash, Eq, Storage>::equal_range(const key_type &key) {
+        return equal_range<key_type>(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    std::pair<uset_t::iterator, uset_t::iterator> unordered_set<Key, Hash, Eq, Storage>::equal_range(const K &key) {
         auto first = find(key);
         auto second(first);
 
         return {first, ++second};
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::const_iterator, uset_t::const_iterator> unordered_set<Key, Hash, Eq>::equal_range(const key_type &key) const {
-        return const_cast<unordered_set<Key, Hash, Eq>*>(this)->equal_range(key);
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::const_iterator, uset_t::const_iterator> unordered_set<Key, Hash, Eq, Storage>::equal_range(const key_type &key) const {
+        return const_cast<unordered_set<Key, Hash, Eq, Storage>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class K, hash_internal::enable_lookup<Hash, Eq, Key, K>>
+    std::pair<uset_t::const_iterator, uset_t::const_iterator> unordered_set<Key, Hash, Eq, Storage>::equal_range(const K &key) const {
+        return const_cast<unordered_set<Key, Hash, Eq, Storage>*>(this)->equal_range(key);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::find_many(const key_type *keys, size_type n, iterator *out) {
+        _hash_find_many<>(this, keys, n, [out](size_type i, const iterator &it) { out[i] = it; });
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::contains_many(const key_type *keys, size_type n, bool *out) const {
+        auto cnt = const_cast<unordered_set<Key, Hash, Eq, Storage>*>(this);
+
+        _hash_find_many<>(cnt, keys, n, [cnt, out](size_type i, const iterator &it) { out[i] = it != cnt->end(); });
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::bucket_count() const noexcept {
+        return _capacity;
+    }
+
+    /* Ratio of elements to slots, tombstones are not included.  */
+    template<typename Key, class Hash, class Eq, class Storage>
+    float unordered_set<Key, Hash, Eq, Storage>::load_factor() const noexcept {
+        return (float) _size / (float) _capacity;
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    float unordered_set<Key, Hash, Eq, Storage>::max_load_factor() const noexcept {
+        return _max_load_factor;
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::max_load_factor(float ml) {
+        _hash_max_load_factor<>(this, _size, ml);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::rehash(size_type count) {
+        _hash_resize<>(this, _size, count);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::reserve(size_type count) {
+        _hash_reserve<>(this, _size, count);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::shrink_to_fit() {
+        _hash_resize<>(this, _size, 0);
     }
 
     /* Private member functions.  */
-    template<typename Key, class Hash, class Eq>
-    void unordered_set<Key, Hash, Eq>::_rehash() {
-        _hash_rehash<>(this);
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::_rehash() {
+        _hash_rehash<>(this, _capacity * 2);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::hash_info unordered_set<Key, Hash, Eq>::_get_hash_info(const key_type &key) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::hash_info unordered_set<Key, Hash, Eq, Storage>::_get_hash_info(const key_type &key) {
         return _hash_get_hash_info<>(this, key);
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::_handle_elem_found(const iterator &it, to_ignore obj) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::_handle_elem_found(const iterator &it, to_ignore obj) {
         return {it, false};
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::_handle_elem_found(const iterator &it, to_delete obj) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::_handle_elem_found(const iterator &it, to_delete obj) {
         delete obj.ptr;
         return {it, false};
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq>::_handle_elem_not_found(const iterator &it) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::_handle_elem_not_found(const iterator &it) {
         return {it, true};
     }
 
-    template<typename Key, class Hash, class Eq>
-    void unordered_set<Key, Hash, Eq>::_check_load_factor(uint64_t hash, size_type &pos) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::_check_load_factor(uint64_t hash, size_type &pos) {
         return _hash_check_load_factor<>(this, _size, hash, pos);
     }
 
-    template<typename Key, class Hash, class Eq>
-    const uset_t::key_type& unordered_set<Key, Hash, Eq>::_get_slot_key(internal_ptr slot) {
-        return *slot;
+    /* No incremental rehash.  */
+    template<typename Key, typename Hash, typename Eq, typename Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::_migrate_and_find_old(const key_type &, uint64_t) {
+        return iterator(nullptr);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    const uset_t::key_type& unordered_set<Key, Hash, Eq, Storage>::_get_slot_key(slot_type &slot) {
+        return *slots::element(&slot);
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class... Args>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::_emplace(node_slots, Args &&... args) {
+        value_type *val = new value_type(std::forward<Args>(args)...);
+
+        return _hash_insert<unordered_set<Key, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, value_type*>(this, *val, val, to_delete(val));
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class... Args>
+    std::pair<uset_t::iterator, bool> unordered_set<Key, Hash, Eq, Storage>::_emplace(flat_slots, Args &&... args) {
+        /* Build the element on the stack, it is moved into its slot only if the key is new.  */
+        value_type val(std::forward<Args>(args)...);
+
+        return _hash_insert<unordered_set<Key, Hash, Eq, Storage>, std::pair<iterator, bool>, key_type, value_type&&>(this, val, std::move(val), to_ignore());
+    }
+
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::iterator unordered_set<Key, Hash, Eq, Storage>::_iterator_at(size_type pos) const {
+        return iterator(&_slots[pos], &_ctrls[pos]);
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::internal_ptr unordered_set<Key, Hash, Eq>::_construct_new_element(const_reference val) {
-        return new value_type(val);
+    template<typename Key, class Hash, class Eq, class Storage>
+    template<class P>
+    void unordered_set<Key, Hash, Eq, Storage>::_construct_slot(size_type pos, P &&val) {
+        slots::construct(&_slots[pos], std::forward<P>(val));
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::internal_ptr unordered_set<Key, Hash, Eq>::_construct_new_element(internal_ptr val) {
-        return val;
+    template<typename Key, class Hash, class Eq, class Storage>
+    void unordered_set<Key, Hash, Eq, Storage>::_copy_slot(size_type pos, slot_type &other) {
+        slots::construct(&_slots[pos], *slots::element(&other));
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::internal_ptr unordered_set<Key, Hash, Eq>::_construct_new_element(value_type &&val) {
-        return new value_type(std::forward<value_type>(val));
+    template<typename Key, class Hash, class Eq, class Storage>
+    bool unordered_set<Key, Hash, Eq, Storage>::_is_slot_free(size_type) {
+        /* Keys are unique, erasing always frees the slot.  */
+        return true;
     }
 
-    template<typename Key, typename Hash, typename Eq>
-    uset_t::size_type unordered_set<Key, Hash, Eq>::_delete_all_slots(size_type pos) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::_delete_all_slots(size_type pos) {
         /* Keys are unique.  */
-        delete _slots[pos];
-        _slots[pos] = nullptr;
+        slots::destroy(&_slots[pos]);
         --_size;
 
         return 1;
     }
 
-    template<typename Key, class Hash, class Eq>
-    uset_t::size_type unordered_set<Key, Hash, Eq>::_delete_slot(size_type pos) {
-        delete _slots[pos];
-        _slots[pos] = nullptr;
+    template<typename Key, class Hash, class Eq, class Storage>
+    uset_t::size_type unordered_set<Key, Hash, Eq, Storage>::_delete_slot(size_type pos) {
+        slots::destroy(&_slots[pos]);
         --_size;
 
         return 1;
     }
 
-    template<typename Key, class Hash, class Eq>
-    std::pair<uset_t::size_type, uset_t::size_type> unordered_set<Key, Hash, Eq>::_erase(internal_ptr *ptr, bool erase_all) {
+    template<typename Key, class Hash, class Eq, class Storage>
+    std::pair<uset_t::size_type, uset_t::size_type> unordered_set<Key, Hash, Eq, Storage>::_erase(slot_type *ptr, bool erase_all) {
         return _hash_erase<>(this, ptr, erase_all);
     }
 }
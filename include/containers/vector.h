@@ -4,6 +4,10 @@
 #include <cassert>
 #include <cstdlib>
 #include <cstring>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 #define vector_t typename vector<T>
 
@@ -374,11 +378,7 @@ namespace adt {
         void clear() noexcept;
 
         friend void swap(vector &lhs, vector &rhs) {
-            using std::swap;
-
-            swap(lhs._data, rhs._data);
-            swap(lhs._size, rhs._size);
-            swap(lhs._capacity, rhs._capacity);
+            lhs.swap(rhs);
         }
 
     private:
@@ -390,6 +390,9 @@ namespace adt {
         void _push_back(Args&&... args);
         template<typename... Args>
         iterator _insert(const const_iterator &pos, Args&&... args);
+        void _reallocate(size_type n);
+        void _reallocate(size_type n, std::true_type);
+        void _reallocate(size_type n, std::false_type);
     };
 
     template<typename T>
@@ -420,7 +423,7 @@ namespace adt {
 
     template<typename T>
     vector<T>::vector(vector &&other) noexcept : vector() {
-        swap(*this, other);
+        swap(other);
     }
 
     template<typename T>
@@ -436,7 +439,7 @@ namespace adt {
     template<typename T>
     vector<T> &vector<T>::operator=(vector other) {
         /*Copy and swap idiom, let the compiler handle the copy of the argument*/
-        swap(*this, other);
+        swap(other);
 
         return *this;
     }
@@ -523,15 +526,7 @@ namespace adt {
 
     template<typename T>
     void vector<T>::reserve(size_type n) noexcept(false) {
-        if (n > _capacity) {
-            pointer new_data = (pointer) realloc(_data, n * sizeof(value_type));
-            if (new_data != nullptr) {
-                _data = new_data;
-                _capacity = n;
-            } else {
-                throw std::bad_alloc();
-            }
-        }
+        if (n > _capacity) _reallocate(n);
     }
 
     template<typename T>
@@ -713,7 +708,11 @@ namespace adt {
 
     template<typename T>
     void vector<T>::swap(vector &x) {
-        swap(*this, x);
+        using std::swap;
+
+        swap(_data, x._data);
+        swap(_size, x._size);
+        swap(_capacity, x._capacity);
     }
 
     template<typename T>
@@ -749,21 +748,11 @@ namespace adt {
             for (size_t i = n ; i < _size ; i++) _data[i].~value_type();
             _size = n;
         }
-        else if (n > _size && n < _capacity) {
+        else if (n > _size) {
+            if (n > _capacity) _reallocate(n);
             for (size_t i = _size ; i < n ; i++) new (&(_data[i])) value_type(std::forward<Args>(args)...);
             _size = n;
         }
-        else if (n > _size && n > _capacity) {
-            pointer new_data = (pointer) realloc(_data, n * sizeof(value_type));
-            if (new_data != nullptr) {
-                _data = new_data;
-                for (size_t i = _size ; i < n ; i++) new (&(_data[i])) value_type(std::forward<Args>(args)...);
-                _size = n;
-                _capacity = n;
-            } else {
-                throw std::bad_alloc();
-            }
-        }
     }
 
     template<typename T>
@@ -772,15 +761,8 @@ namespace adt {
         if (_size < _capacity) {
             new (&(_data[_size++])) value_type(std::forward<Args>(args)...);
         } else {
-            size_t new_cap = 1 + _capacity * 2;
-            pointer new_data = (pointer) realloc(_data, new_cap * sizeof(value_type));
-            if (new_data != nullptr) {
-                _data = new_data;
-                new (&(_data[_size++])) value_type(std::forward<Args>(args)...);
-                _capacity = new_cap;
-            } else {
-                throw std::bad_alloc();
-            }
+            _reallocate(1 + _capacity * 2);
+            new (&(_data[_size++])) value_type(std::forward<Args>(args)...);
         }
     }
 
@@ -801,4 +783,36 @@ namespace adt {
             return iterator(&(_data[idx]));
         }
     }
-}
\ No newline at end of file
+
+    template<typename T>
+    void vector<T>::_reallocate(size_type n) {
+        _reallocate(n, std::is_trivially_copyable<value_type>());
+    }
+
+    template<typename T>
+    void vector<T>::_reallocate(size_type n, std::true_type) {
+        pointer new_data = (pointer) realloc((void *) _data, n * sizeof(value_type));
+
+        if (new_data == nullptr) throw std::bad_alloc();
+
+        _data = new_data;
+        _capacity = n;
+    }
+
+    template<typename T>
+    void vector<T>::_reallocate(size_type n, std::false_type) {
+        /* Elements may point into themselves (std::string does), they have to be moved, not copied bytewise.  */
+        pointer new_data = (pointer) malloc(n * sizeof(value_type));
+
+        if (new_data == nullptr) throw std::bad_alloc();
+
+        for (size_t i = 0 ; i < _size ; i++) {
+            new (&(new_data[i])) value_type(std::move(_data[i]));
+            _data[i].~value_type();
+        }
+        free((void *) _data);
+
+        _data = new_data;
+        _capacity = n;
+    }
+}
@@ -0,0 +1,666 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* Define BTREE_INTERNAL_HAVE_SSE2 to 0 to force the portable in-node search.  */
+#ifndef BTREE_INTERNAL_HAVE_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BTREE_INTERNAL_HAVE_SSE2 1
+#else
+#define BTREE_INTERNAL_HAVE_SSE2 0
+#endif
+#endif
+
+#if BTREE_INTERNAL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace btree_internal {
+
+    /* Fixed part of every node, used to size the nodes.  */
+    struct btree_node_header {
+        void *parent;
+        uint16_t position;
+        uint16_t count;
+        bool leaf;
+    };
+
+    /* Elements per node: as many as fit in TargetNodeSize bytes next to the header, at least 3.  */
+    template<typename T, std::size_t TargetNodeSize>
+    struct btree_slots {
+        static constexpr std::size_t fit = TargetNodeSize > sizeof(btree_node_header) ? (TargetNodeSize - sizeof(btree_node_header)) / sizeof(T) : 0;
+        static constexpr std::size_t value = fit < 3 ? 3 : (fit > UINT16_MAX ? UINT16_MAX : fit);
+    };
+
+    /* Leaves are plain btree_nodes, internal nodes carry the child pointers after the slots.
+       Only slots [0, count) hold constructed elements.  */
+    template<typename T, std::size_t Slots>
+    struct btree_node {
+        static constexpr std::size_t slots = Slots;
+
+        btree_node *parent;
+        uint16_t position;
+        uint16_t count;
+        bool leaf;
+        alignas(T) unsigned char storage[Slots * sizeof(T)];
+
+        explicit btree_node(bool is_leaf) : parent(nullptr), position(0), count(0), leaf(is_leaf) {}
+
+        T &slot(std::size_t i) { return reinterpret_cast<T *>(storage)[i]; }
+        const T &slot(std::size_t i) const { return reinterpret_cast<const T *>(storage)[i]; }
+        const T *data() const { return reinterpret_cast<const T *>(storage); }
+    };
+
+    /* Child i holds the elements between slot i - 1 and slot i.  */
+    template<typename T, std::size_t Slots>
+    struct btree_inner_node : btree_node<T, Slots> {
+        btree_node<T, Slots> *children[Slots + 1];
+
+        btree_inner_node() : btree_node<T, Slots>(false) {}
+    };
+
+    /* An element of the tree, end() is (root, root->count).  */
+    template<class Node>
+    struct btree_pos {
+        Node *node;
+        std::size_t pos;
+    };
+
+    /* Search strategies inside a node.
+       Sets of arithmetic keys under std::less count the keys before the searched one with SSE2 (the keys are contiguous),
+       anything else, maps included, does a binary search.  */
+    struct btree_binary_search {};
+    struct btree_simd_search {};
+
+    #define container typename Container
+
+    template<class Less, class K>
+    struct is_std_less : std::integral_constant<bool, std::is_same<Less, std::less<K>>::value || std::is_same<Less, std::less<>>::value> {};
+
+    template<class Container, class K>
+    using btree_search_for = typename std::conditional<
+            std::is_arithmetic<K>::value && std::is_same<K, container::key_type>::value && is_std_less<container::key_compare, K>::value
+                && std::is_same<container::value_type, container::key_type>::value,
+            btree_simd_search, btree_binary_search>::type;
+
+    /* Heterogeneous lookups (find(K), lower_bound(K) ...) are only enabled when
+       the comparator declares is_transparent, or when K is the key type itself.  */
+    template<class Compare, class Key, class K, class = void>
+    struct is_lookup_key : std::is_same<K, Key> {};
+
+    template<class Compare, class Key, class K>
+    struct is_lookup_key<Compare, Key, K, typename std::conditional<true, void, typename Compare::is_transparent>::type> : std::true_type {};
+
+    template<class Compare, class Key, class K>
+    using enable_lookup = typename std::enable_if<is_lookup_key<Compare, Key, K>::value, int>::type;
+
+    /* Range constructors and inserts only take part in overload resolution for iterators.  */
+    template<class It>
+    using enable_if_iterator = typename std::enable_if<std::is_convertible<typename std::iterator_traits<It>::iterator_category, std::input_iterator_tag>::value, int>::type;
+
+    /* Node helpers.  */
+    template<typename T, std::size_t Slots>
+    btree_node<T, Slots> *_btree_child(btree_node<T, Slots> *node, std::size_t i) {
+        return static_cast<btree_inner_node<T, Slots> *>(node)->children[i];
+    }
+
+    template<typename T, std::size_t Slots>
+    void _btree_set_child(btree_node<T, Slots> *node, std::size_t i, btree_node<T, Slots> *child) {
+        static_cast<btree_inner_node<T, Slots> *>(node)->children[i] = child;
+        child->parent = node;
+        child->position = (uint16_t) i;
+    }
+
+    template<class Node>
+    Node *_btree_leftmost(Node *node) {
+        while (node != nullptr && !node->leaf) node = _btree_child(node, 0);
+        return node;
+    }
+
+    template<class Node>
+    Node *_btree_rightmost(Node *node) {
+        while (node != nullptr && !node->leaf) node = _btree_child(node, node->count);
+        return node;
+    }
+
+    template<class Node>
+    btree_pos<Node> _btree_end(Node *root) {
+        return {root, root != nullptr ? root->count : (std::size_t) 0};
+    }
+
+    template<class Node>
+    bool _btree_is_end(const btree_pos<Node> &where) {
+        return where.node == nullptr || (where.node->parent == nullptr && where.pos == where.node->count);
+    }
+
+    /* Inorder successor, climbing out of a leaf stops at the root, which is end().  */
+    template<class Node>
+    void _btree_increment(Node *&node, std::size_t &pos) {
+        if (node->leaf) {
+            if (++pos < node->count) return;
+
+            while (pos == node->count && node->parent != nullptr) {
+                pos = node->position;
+                node = node->parent;
+            }
+        } else {
+            node = _btree_leftmost(_btree_child(node, pos + 1));
+            pos = 0;
+        }
+    }
+
+    /* Inorder predecessor, returns false (and leaves node, pos alone) at the first element.  */
+    template<class Node>
+    bool _btree_decrement(Node *&node, std::size_t &pos) {
+        Node *current = node;
+        std::size_t current_pos = pos;
+
+        if (current->leaf) {
+            while (current_pos == 0 && current->parent != nullptr) {
+                current_pos = current->position;
+                current = current->parent;
+            }
+            if (current_pos == 0) return false;
+
+            node = current;
+            pos = current_pos - 1;
+        } else {
+            node = _btree_rightmost(_btree_child(current, current_pos));
+            pos = node->count - 1;
+        }
+
+        return true;
+    }
+
+    /* Slot moves, the source slot is destroyed and the destination must be raw.  */
+    template<class Node>
+    void _btree_move_slot(Node *dst, std::size_t dst_pos, Node *src, std::size_t src_pos) {
+        using T = typename std::remove_reference<decltype(src->slot(0))>::type;
+
+        ::new (&dst->slot(dst_pos)) T(std::move(src->slot(src_pos)));
+        src->slot(src_pos).~T();
+    }
+
+    /* Moves slots [first, last) k places right, [first, first + k) is left raw.  */
+    template<class Node>
+    void _btree_shift_right(Node *node, std::size_t first, std::size_t last, std::size_t k) {
+        for (std::size_t i = last ; i-- > first ;) _btree_move_slot(node, i + k, node, i);
+    }
+
+    /* Moves slots [first, last) k places left into raw slots, [last - k, last) is left raw.  */
+    template<class Node>
+    void _btree_shift_left(Node *node, std::size_t first, std::size_t last, std::size_t k) {
+        for (std::size_t i = first ; i < last ; i++) _btree_move_slot(node, i - k, node, i);
+    }
+
+    /* In node search.  */
+#if BTREE_INTERNAL_HAVE_SSE2
+    /* Keys of a node are sorted, so the lanes that compare true form a prefix of the mask.  */
+    inline std::size_t _btree_prefix_length(int mask) {
+        return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+    }
+
+    inline std::size_t _btree_simd_count(const int32_t *keys, std::size_t n, int32_t key, bool upper) {
+        __m128i needle = _mm_set1_epi32(key);
+        std::size_t i;
+        int mask;
+
+        for (i = 0 ; i + 4 <= n ; i += 4) {
+            __m128i group = _mm_loadu_si128((const __m128i *) (keys + i));
+            /* slot < key for lower bounds, !(slot > key) for upper bounds.  */
+            mask = upper ? ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(group, needle))) & 0xF
+                         : _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(group, needle)));
+            if (mask != 0xF) return i + _btree_prefix_length(mask);
+        }
+        for (; i < n && (upper ? !(key < keys[i]) : keys[i] < key) ; i++) {}
+
+        return i;
+    }
+
+    inline std::size_t _btree_simd_count(const uint32_t *keys, std::size_t n, uint32_t key, bool upper) {
+        const __m128i bias = _mm_set1_epi32(INT32_MIN);
+        __m128i needle = _mm_xor_si128(_mm_set1_epi32((int32_t) key), bias);
+        std::size_t i;
+        int mask;
+
+        /* SSE2 only compares signed lanes, flipping the sign bit keeps the unsigned order.  */
+        for (i = 0 ; i + 4 <= n ; i += 4) {
+            __m128i group = _mm_xor_si128(_mm_loadu_si128((const __m128i *) (keys + i)), bias);
+            mask = upper ? ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(group, needle))) & 0xF
+                         : _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(group, needle)));
+            if (mask != 0xF) return i + _btree_prefix_length(mask);
+        }
+        for (; i < n && (upper ? !(key < keys[i]) : keys[i] < key) ; i++) {}
+
+        return i;
+    }
+
+    inline std::size_t _btree_simd_count(const float *keys, std::size_t n, float key, bool upper) {
+        __m128 needle = _mm_set1_ps(key);
+        std::size_t i;
+        int mask;
+
+        for (i = 0 ; i + 4 <= n ; i += 4) {
+            __m128 group = _mm_loadu_ps(keys + i);
+            mask = upper ? _mm_movemask_ps(_mm_cmple_ps(group, needle)) : _mm_movemask_ps(_mm_cmplt_ps(group, needle));
+            if (mask != 0xF) return i + _btree_prefix_length(mask);
+        }
+        for (; i < n && (upper ? !(key < keys[i]) : keys[i] < key) ; i++) {}
+
+        return i;
+    }
+#endif
+
+    /* Other arithmetic keys, a branchless count the compiler can vectorize.  */
+    template<typename T>
+    std::size_t _btree_simd_count(const T *keys, std::size_t n, T key, bool upper) {
+        std::size_t count = 0;
+
+        for (std::size_t i = 0 ; i < n ; i++) count += upper ? !(key < keys[i]) : keys[i] < key;
+
+        return count;
+    }
+
+    /* Index of the first slot of node that does not go before key: the first slot not less than key
+       for lower bounds, the first slot greater than key for upper bounds.  */
+    template<class Container, typename K>
+    std::size_t _btree_search_node(Container *, container::node_type *node, const K &key, bool upper, btree_simd_search) {
+        return _btree_simd_count(node->data(), node->count, key, upper);
+    }
+
+    template<class Container, typename K>
+    std::size_t _btree_search_node(Container *cnt, container::node_type *node, const K &key, bool upper, btree_binary_search) {
+        std::size_t low = 0, high = node->count, mid;
+
+        while (low < high) {
+            mid = low + (high - low) / 2;
+            if (upper ? !cnt->_less(key, Container::_get_key(node->slot(mid))) : cnt->_less(Container::_get_key(node->slot(mid)), key)) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+
+        return low;
+    }
+
+    template<class Container, typename K>
+    std::size_t _btree_search_node(Container *cnt, container::node_type *node, const K &key, bool upper) {
+        return _btree_search_node(cnt, node, key, upper, btree_search_for<Container, K>());
+    }
+
+    /* Lookups.  */
+    template<class Container, typename K>
+    btree_pos<container::node_type> _btree_bound(Container *cnt, const K &key, bool upper) {
+        container::node_type *node = cnt->_root;
+        btree_pos<container::node_type> bound = _btree_end(cnt->_root);
+        std::size_t i;
+
+        /* The deepest slot that does not go before key is the bound.  */
+        while (node != nullptr) {
+            i = _btree_search_node(cnt, node, key, upper);
+            if (i < node->count) bound = {node, i};
+            if (node->leaf) break;
+            node = _btree_child(node, i);
+        }
+
+        return bound;
+    }
+
+    /* Stops at the first equivalent element, for containers with unique keys.  */
+    template<class Container, typename K>
+    btree_pos<container::node_type> _btree_find(Container *cnt, const K &key) {
+        container::node_type *node = cnt->_root;
+        std::size_t i;
+
+        while (node != nullptr) {
+            i = _btree_search_node(cnt, node, key, false);
+            if (i < node->count && !cnt->_less(key, Container::_get_key(node->slot(i)))) return {node, i};
+            if (node->leaf) break;
+            node = _btree_child(node, i);
+        }
+
+        return _btree_end(cnt->_root);
+    }
+
+    /* Nodes.  */
+    template<class Container>
+    container::node_type *_btree_new_node(Container *cnt, bool leaf) {
+        using Leaf = container::node_type;
+        using Inner = container::inner_node_type;
+
+        if (leaf) {
+            Leaf *node = std::allocator_traits<container::leaf_allocator>::allocate(cnt->_leaf_alloc, 1);
+            return ::new (node) Leaf(true);
+        } else {
+            Inner *node = std::allocator_traits<container::inner_allocator>::allocate(cnt->_inner_alloc, 1);
+            return ::new (node) Inner();
+        }
+    }
+
+    template<class Container>
+    void _btree_delete_node(Container *cnt, container::node_type *node) {
+        using Leaf = container::node_type;
+        using Inner = container::inner_node_type;
+
+        if (node->leaf) {
+            node->~Leaf();
+            std::allocator_traits<container::leaf_allocator>::deallocate(cnt->_leaf_alloc, node, 1);
+        } else {
+            Inner *inner = static_cast<Inner *>(node);
+            inner->~Inner();
+            std::allocator_traits<container::inner_allocator>::deallocate(cnt->_inner_alloc, inner, 1);
+        }
+    }
+
+    template<class Container>
+    void _btree_destroy(Container *cnt, container::node_type *node) {
+        using T = container::value_type;
+
+        if (!node->leaf) {
+            for (std::size_t i = 0 ; i <= node->count ; i++) _btree_destroy(cnt, _btree_child(node, i));
+        }
+        for (std::size_t i = 0 ; i < node->count ; i++) node->slot(i).~T();
+
+        _btree_delete_node(cnt, node);
+    }
+
+    template<class Container>
+    container::node_type *_btree_copy(Container *cnt, const container::node_type *other) {
+        using T = container::value_type;
+        container::node_type *node = _btree_new_node(cnt, other->leaf);
+
+        for (std::size_t i = 0 ; i < other->count ; i++) {
+            ::new (&node->slot(i)) T(other->slot(i));
+            node->count++;
+        }
+        if (!other->leaf) {
+            for (std::size_t i = 0 ; i <= other->count ; i++) {
+                _btree_set_child(node, i, _btree_copy(cnt, _btree_child(const_cast<container::node_type *>(other), i)));
+            }
+        }
+
+        return node;
+    }
+
+    /* Insertion.  */
+    template<class Container>
+    void _btree_insert_slot(Container *cnt, container::node_type *&node, std::size_t &pos, container::value_type &&val, container::node_type *right);
+
+    /* Splits the full node where pos is about to be inserted, the middle element moves up to the parent.
+       Appending at the end of a node keeps it full and starts the new one empty (and symmetrically at the front),
+       so sorted insertions leave full nodes behind instead of half empty ones.
+       node and pos are updated to where the insertion has to happen.  */
+    template<class Container>
+    void _btree_split(Container *cnt, container::node_type *&node, std::size_t &pos) {
+        using T = container::value_type;
+        const std::size_t slots = Container::node_type::slots;
+        std::size_t split = pos == slots ? slots - 1 : (pos == 0 ? 0 : slots / 2);
+        container::node_type *sibling = _btree_new_node(cnt, node->leaf), *parent, *root;
+        std::size_t parent_pos;
+
+        for (std::size_t i = split + 1 ; i < slots ; i++) _btree_move_slot(sibling, i - split - 1, node, i);
+        if (!node->leaf) {
+            for (std::size_t i = split + 1 ; i <= slots ; i++) _btree_set_child(sibling, i - split - 1, _btree_child(node, i));
+        }
+        sibling->count = (uint16_t) (slots - split - 1);
+
+        T middle(std::move(node->slot(split)));
+        node->slot(split).~T();
+        node->count = (uint16_t) split;
+
+        if (node->parent == nullptr) {
+            root = _btree_new_node(cnt, false);
+            _btree_set_child(root, 0, node);
+            cnt->_root = root;
+        }
+
+        parent = node->parent;
+        parent_pos = node->position;
+        _btree_insert_slot(cnt, parent, parent_pos, std::move(middle), sibling);
+
+        if (pos > split) {
+            node = sibling;
+            pos -= split + 1;
+        }
+    }
+
+    /* Inserts val at pos of node, right becomes the child after it when node is internal.  */
+    template<class Container>
+    void _btree_insert_slot(Container *cnt, container::node_type *&node, std::size_t &pos, container::value_type &&val, container::node_type *right) {
+        using T = container::value_type;
+
+        if (node->count == Container::node_type::slots) _btree_split(cnt, node, pos);
+
+        _btree_shift_right(node, pos, node->count, 1);
+        ::new (&node->slot(pos)) T(std::move(val));
+        if (!node->leaf) {
+            for (std::size_t i = node->count + 1 ; i > pos + 1 ; i--) _btree_set_child(node, i, _btree_child(node, i - 1));
+            _btree_set_child(node, pos + 1, right);
+        }
+        node->count++;
+    }
+
+    /* The leaf position key goes to: before the first greater element, or for unique containers
+       before the first element not less, found is then set when that element is equivalent.  */
+    template<class Container, typename K>
+    btree_pos<container::node_type> _btree_insert_position(Container *cnt, const K &key, bool unique, bool &found) {
+        container::node_type *node = cnt->_root;
+        std::size_t i;
+
+        found = false;
+        while (true) {
+            i = _btree_search_node(cnt, node, key, !unique);
+            if (unique && i < node->count && !cnt->_less(key, Container::_get_key(node->slot(i)))) {
+                found = true;
+                return {node, i};
+            }
+            if (node->leaf) return {node, i};
+            node = _btree_child(node, i);
+        }
+    }
+
+    /* Same, checking first whether key belongs right before hint, which then spares the descent.  */
+    template<class Container, typename K>
+    btree_pos<container::node_type> _btree_hint_position(Container *cnt, btree_pos<container::node_type> hint, const K &key, bool unique, bool &found) {
+        btree_pos<container::node_type> prev = hint;
+        bool after_prev, before_hint;
+
+        /* end() of a tree that was empty when the hint was taken.  */
+        if (hint.node == nullptr) prev = hint = _btree_end(cnt->_root);
+        before_hint = _btree_is_end(hint) || (unique ? cnt->_less(key, Container::_get_key(hint.node->slot(hint.pos)))
+                                                     : !cnt->_less(Container::_get_key(hint.node->slot(hint.pos)), key));
+        if (before_hint) {
+            after_prev = !_btree_decrement(prev.node, prev.pos) || (unique ? cnt->_less(Container::_get_key(prev.node->slot(prev.pos)), key)
+                                                                           : !cnt->_less(key, Container::_get_key(prev.node->slot(prev.pos))));
+            if (after_prev) {
+                found = false;
+                /* Right before an internal slot is the end of the rightmost leaf of the child on its left.  */
+                if (hint.node->leaf) return hint;
+                prev.node = _btree_rightmost(_btree_child(hint.node, hint.pos));
+                return {prev.node, prev.node->count};
+            }
+        }
+
+        return _btree_insert_position(cnt, key, unique, found);
+    }
+
+    /* Inserts val at the leaf position where, returns where it ended up.  */
+    template<class Container>
+    btree_pos<container::node_type> _btree_insert_at(Container *cnt, btree_pos<container::node_type> where, container::value_type &&val) {
+        _btree_insert_slot(cnt, where.node, where.pos, std::move(val), nullptr);
+        cnt->_size++;
+
+        return where;
+    }
+
+    /* Erasure.  */
+    template<class Node>
+    void _btree_track_merge(btree_pos<Node> &tracked, Node *parent, std::size_t i, Node *left, std::size_t left_count, Node *right) {
+        if (tracked.node == right) {
+            tracked = {left, left_count + 1 + tracked.pos};
+        } else if (tracked.node == parent && tracked.pos >= i) {
+            if (tracked.pos == i) tracked = {left, left_count};
+            else tracked.pos--;
+        }
+    }
+
+    /* Merges child i + 1 of parent and the separator i into child i.  */
+    template<class Container>
+    void _btree_merge(Container *cnt, container::node_type *parent, std::size_t i, btree_pos<container::node_type> &tracked) {
+        container::node_type *left = _btree_child(parent, i), *right = _btree_child(parent, i + 1);
+        std::size_t left_count = left->count, right_count = right->count;
+
+        _btree_move_slot(left, left_count, parent, i);
+        for (std::size_t j = 0 ; j < right_count ; j++) _btree_move_slot(left, left_count + 1 + j, right, j);
+        if (!left->leaf) {
+            for (std::size_t j = 0 ; j <= right_count ; j++) _btree_set_child(left, left_count + 1 + j, _btree_child(right, j));
+        }
+        left->count = (uint16_t) (left_count + 1 + right_count);
+
+        _btree_shift_left(parent, i + 1, parent->count, 1);
+        for (std::size_t j = i + 1 ; j < parent->count ; j++) _btree_set_child(parent, j, _btree_child(parent, j + 1));
+        parent->count--;
+
+        _btree_track_merge(tracked, parent, i, left, left_count, right);
+
+        right->count = 0;
+        _btree_delete_node(cnt, right);
+    }
+
+    /* Moves k elements from child i + 1 of parent to child i, through the separator i.  */
+    template<class Container>
+    void _btree_borrow_right(Container *, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked) {
+        container::node_type *left = _btree_child(parent, i), *right = _btree_child(parent, i + 1);
+        std::size_t left_count = left->count, right_count = right->count;
+
+        _btree_move_slot(left, left_count, parent, i);
+        for (std::size_t j = 0 ; j + 1 < k ; j++) _btree_move_slot(left, left_count + 1 + j, right, j);
+        _btree_move_slot(parent, i, right, k - 1);
+        _btree_shift_left(right, k, right_count, k);
+        if (!left->leaf) {
+            for (std::size_t j = 0 ; j < k ; j++) _btree_set_child(left, left_count + 1 + j, _btree_child(right, j));
+            for (std::size_t j = 0 ; j + k <= right_count ; j++) _btree_set_child(right, j, _btree_child(right, j + k));
+        }
+        left->count = (uint16_t) (left_count + k);
+        right->count = (uint16_t) (right_count - k);
+
+        if (tracked.node == parent && tracked.pos == i) {
+            tracked = {left, left_count};
+        } else if (tracked.node == right) {
+            if (tracked.pos + 1 < k) tracked = {left, left_count + 1 + tracked.pos};
+            else if (tracked.pos + 1 == k) tracked = {parent, i};
+            else tracked.pos -= k;
+        }
+    }
+
+    /* Moves k elements from child i of parent to child i + 1, through the separator i.  */
+    template<class Container>
+    void _btree_borrow_left(Container *, container::node_type *parent, std::size_t i, std::size_t k, btree_pos<container::node_type> &tracked) {
+        container::node_type *left = _btree_child(parent, i), *right = _btree_child(parent, i + 1);
+        std::size_t left_count = left->count, right_count = right->count;
+
+        _btree_shift_right(right, 0, right_count, k);
+        _btree_move_slot(right, k - 1, parent, i);
+        for (std::size_t j = 0 ; j + 1 < k ; j++) _btree_move_slot(right, j, left, left_count - k + 1 + j);
+        _btree_move_slot(parent, i, left, left_count - k);
+        if (!left->leaf) {
+            for (std::size_t j = right_count + 1 ; j-- > 0 ;) _btree_set_child(right, j + k, _btree_child(right, j));
+            for (std::size_t j = 0 ; j < k ; j++) _btree_set_child(right, j, _btree_child(left, left_count - k + 1 + j));
+        }
+        left->count = (uint16_t) (left_count - k);
+        right->count = (uint16_t) (right_count + k);
+
+        if (tracked.node == right) {
+            tracked.pos += k;
+        } else if (tracked.node == parent && tracked.pos == i) {
+            tracked = {right, k - 1};
+        } else if (tracked.node == left && tracked.pos >= left_count - k) {
+            if (tracked.pos == left_count - k) tracked = {parent, i};
+            else tracked = {right, tracked.pos - (left_count - k + 1)};
+        }
+    }
+
+    /* Restores the fill of node after an erasure, going up while merges empty the parents.
+       Nodes under half full are merged with a sibling when both fit in one node, otherwise they take
+       elements from the larger sibling until both hold about the same.  */
+    template<class Container>
+    void _btree_rebalance(Container *cnt, container::node_type *node, btree_pos<container::node_type> &tracked) {
+        const std::size_t slots = Container::node_type::slots;
+        container::node_type *parent, *left, *right;
+        std::size_t i;
+
+        while (node != cnt->_root) {
+            if (node->count >= slots / 2) return;
+
+            parent = node->parent;
+            i = node->position;
+            left = i > 0 ? _btree_child(parent, i - 1) : nullptr;
+            right = i < parent->count ? _btree_child(parent, i + 1) : nullptr;
+
+            if (left != nullptr && (std::size_t) left->count + node->count + 1 <= slots) {
+                _btree_merge(cnt, parent, i - 1, tracked);
+            } else if (right != nullptr && (std::size_t) node->count + right->count + 1 <= slots) {
+                _btree_merge(cnt, parent, i, tracked);
+            } else {
+                if (left != nullptr && (right == nullptr || left->count >= right->count)) {
+                    _btree_borrow_left(cnt, parent, i - 1, (left->count - node->count + 1) / 2, tracked);
+                } else {
+                    _btree_borrow_right(cnt, parent, i, (right->count - node->count + 1) / 2, tracked);
+                }
+                return;
+            }
+
+            node = parent;
+        }
+
+        /* The root may be left without elements: an empty leaf goes away, an internal node hands over to its only child.  */
+        if (node->count == 0) {
+            if (node->leaf) {
+                cnt->_root = nullptr;
+            } else {
+                cnt->_root = _btree_child(node, 0);
+                cnt->_root->parent = nullptr;
+                cnt->_root->position = 0;
+            }
+            _btree_delete_node(cnt, node);
+        }
+    }
+
+    /* Erases the element at where, returns the position of the element that followed it.  */
+    template<class Container>
+    btree_pos<container::node_type> _btree_erase(Container *cnt, btree_pos<container::node_type> where) {
+        using T = container::value_type;
+        btree_pos<container::node_type> next = where;
+        container::node_type *leaf;
+        bool last;
+
+        _btree_increment(next.node, next.pos);
+        last = _btree_is_end(next);
+
+        /* An internal element is replaced by its predecessor, which always sits at the end of a leaf.  */
+        if (!where.node->leaf) {
+            leaf = _btree_rightmost(_btree_child(where.node, where.pos));
+            where.node->slot(where.pos) = std::move(leaf->slot(leaf->count - 1));
+            where = {leaf, (std::size_t) leaf->count - 1};
+        } else if (next.node == where.node) {
+            next.pos--;
+        }
+
+        where.node->slot(where.pos).~T();
+        _btree_shift_left(where.node, where.pos + 1, where.node->count, 1);
+        where.node->count--;
+        cnt->_size--;
+
+        _btree_rebalance(cnt, where.node, next);
+
+        return last ? _btree_end(cnt->_root) : next;
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+namespace adt {
+
+    /* Tag for the constructors and insert overloads that take a range already sorted
+       by the container's comparator and free of equivalent keys, the order is not checked.  */
+    struct sorted_unique_t {
+        explicit sorted_unique_t() = default;
+    };
+
+    constexpr sorted_unique_t sorted_unique{};
+}
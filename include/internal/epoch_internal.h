@@ -0,0 +1,176 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace epoch_internal {
+
+    /* The epoch a thread entered a domain at, 0 while it is outside. Each thread that enters a domain
+       gets a record of its own with its own cache line, entering is one store and never waits for other
+       readers. depth counts the guards of the owning thread that are inside, only the owner touches it.  */
+    struct alignas(64) epoch_record {
+        std::atomic<std::uint64_t> epoch;
+        std::atomic<bool> in_use;
+        std::size_t depth;
+        epoch_record *next;
+
+        epoch_record() : epoch(0), in_use(true), depth(0), next(nullptr) {}
+    };
+
+    /* The records of a domain, a list records are pushed on and never unlinked from.
+       Shared with the threads that hold one, an exiting thread gives its record back through it.  */
+    struct epoch_records {
+        std::atomic<epoch_record*> head;
+
+        epoch_records() : head(nullptr) {}
+        epoch_records(const epoch_records &other) = delete;
+        ~epoch_records() {
+            epoch_record *next;
+
+            for (epoch_record *record = head.load() ; record != nullptr ; record = next) {
+                next = record->next;
+                delete record;
+            }
+        }
+
+        epoch_records &operator=(const epoch_records &rhs) = delete;
+    };
+
+    /* Domains are told apart by id, an address may be reused by a later domain.  */
+    inline std::uint64_t _epoch_next_id() {
+        static std::atomic<std::uint64_t> next(0);
+
+        return next.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /* Epoch based reclamation: readers announce the epoch they entered at in their record, writers advance
+       the epoch after unpublishing something and free it once no reader announces an older epoch.
+       A reader that entered at the advanced epoch or later can only have seen what replaced it.  */
+    struct epoch_domain {
+        alignas(64) std::atomic<std::uint64_t> epoch;
+        std::uint64_t id;
+        std::shared_ptr<epoch_records> records;
+
+        epoch_domain() : epoch(1), id(_epoch_next_id()), records(std::make_shared<epoch_records>()) {}
+    };
+
+    /* Takes a record nobody uses or pushes a new one, once per thread and domain.  */
+    inline epoch_record *_epoch_claim_record(epoch_domain *domain) {
+        epoch_record *record;
+        bool expected;
+
+        for (record = domain->records->head.load(std::memory_order_acquire) ; record != nullptr ; record = record->next) {
+            expected = false;
+            if (!record->in_use.load(std::memory_order_relaxed) &&
+                record->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+
+        record = new epoch_record();
+        record->next = domain->records->head.load(std::memory_order_relaxed);
+        while (!domain->records->head.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed));
+
+        return record;
+    }
+
+    /* The records a thread holds, by domain id. They are given back when the thread exits,
+       unless their domain is gone already.  */
+    class epoch_thread_records {
+    public:
+        epoch_thread_records() = default;
+        epoch_thread_records(const epoch_thread_records &other) = delete;
+        ~epoch_thread_records() {
+            for (auto &held : _held) {
+                if (auto records = held.records.lock()) held.record->in_use.store(false, std::memory_order_release);
+            }
+        }
+
+        epoch_thread_records &operator=(const epoch_thread_records &rhs) = delete;
+
+        epoch_record *get(epoch_domain *domain) {
+            epoch_record *record;
+
+            for (auto &held : _held) {
+                if (held.id == domain->id) return held.record;
+            }
+
+            /* Forget the records of destroyed domains before holding a new one.  */
+            for (std::size_t i = _held.size() ; i-- > 0 ;) {
+                if (_held[i].records.expired()) {
+                    _held[i] = _held.back();
+                    _held.pop_back();
+                }
+            }
+
+            record = _epoch_claim_record(domain);
+            _held.push_back({domain->id, domain->records, record});
+
+            return record;
+        }
+
+    private:
+        struct held_record {
+            std::uint64_t id;
+            std::weak_ptr<epoch_records> records;
+            epoch_record *record;
+        };
+
+        std::vector<held_record> _held;
+    };
+
+    inline epoch_record *_epoch_thread_record(epoch_domain *domain) {
+        thread_local epoch_thread_records records;
+
+        return records.get(domain);
+    }
+
+    /* Announces the current epoch in the record of the calling thread and returns the record.
+       The seq_cst store orders the announcement before whatever the reader loads next. A thread that is
+       inside already keeps its older epoch. The record belongs to the thread, leave from the same one.  */
+    inline epoch_record *_epoch_enter(epoch_domain *domain) {
+        epoch_record *record = _epoch_thread_record(domain);
+
+        if (record->depth++ == 0) record->epoch.store(domain->epoch.load());
+
+        return record;
+    }
+
+    /* Release: the reads of the reader happen before a writer that sees the record outside frees anything.  */
+    inline void _epoch_leave(epoch_record *record) {
+        if (--record->depth == 0) record->epoch.store(0, std::memory_order_release);
+    }
+
+    /* Called after unpublishing, what was unpublished can be freed once _epoch_oldest() reaches the returned epoch.  */
+    inline std::uint64_t _epoch_advance(epoch_domain *domain) {
+        return domain->epoch.fetch_add(1) + 1;
+    }
+
+    /* Keeps the calling thread inside domain while it lives.  */
+    class epoch_guard {
+    public:
+        explicit epoch_guard(epoch_domain *domain) : _record(_epoch_enter(domain)) {}
+        epoch_guard(const epoch_guard &other) = delete;
+        ~epoch_guard() { _epoch_leave(_record); }
+
+        epoch_guard &operator=(const epoch_guard &rhs) = delete;
+
+    private:
+        epoch_record *_record;
+    };
+
+    /* The oldest epoch a reader is inside of, UINT64_MAX without readers.  */
+    inline std::uint64_t _epoch_oldest(const epoch_domain *domain) {
+        std::uint64_t oldest = UINT64_MAX, epoch;
+
+        for (epoch_record *record = domain->records->head.load(std::memory_order_acquire) ; record != nullptr ; record = record->next) {
+            epoch = record->epoch.load();
+            if (epoch != 0 && epoch < oldest) oldest = epoch;
+        }
+
+        return oldest;
+    }
+}
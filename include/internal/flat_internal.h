@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+#include "../containers/vector.h"
+
+namespace flat_internal {
+
+    /* The Layout parameter of the flat containers.
+       The elements are always kept sorted in one array, sorted_layout searches that array directly.
+       eytzinger_layout also keeps a copy of the keys in breadth first order (the heap layout of a complete tree),
+       so the first levels of every search share a few cache lines and the next ones can be prefetched.
+       The copy is rebuilt on every modification, which makes it a layout for containers built once and read many times.  */
+    struct sorted_layout {
+        template<typename Key>
+        struct index {};
+
+        static constexpr bool value = false;
+    };
+
+    struct eytzinger_layout {
+        /* keys[k - 1] is the key of node k of the implicit tree, children of k are 2k and 2k + 1,
+           pos[k - 1] is the position of that key in the sorted array.  */
+        template<typename Key>
+        struct index {
+            adt::vector<Key> keys;
+            adt::vector<std::size_t> pos;
+        };
+
+        static constexpr bool value = true;
+    };
+
+    #define container typename Container
+
+    /* Heterogeneous lookups (find(K), lower_bound(K) ...) are only enabled when
+       the comparator declares is_transparent, or when K is the key type itself.  */
+    template<class Compare, class Key, class K, class = void>
+    struct is_lookup_key : std::is_same<K, Key> {};
+
+    template<class Compare, class Key, class K>
+    struct is_lookup_key<Compare, Key, K, typename std::conditional<true, void, typename Compare::is_transparent>::type> : std::true_type {};
+
+    template<class Compare, class Key, class K>
+    using enable_lookup = typename std::enable_if<is_lookup_key<Compare, Key, K>::value, int>::type;
+
+    /* Range constructors and inserts only take part in overload resolution for iterators.  */
+    template<class It>
+    using enable_if_iterator = typename std::enable_if<std::is_convertible<typename std::iterator_traits<It>::iterator_category, std::input_iterator_tag>::value, int>::type;
+
+    inline void prefetch(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(addr);
+#else
+        (void) addr;
+#endif
+    }
+
+    inline std::size_t count_trailing_ones(std::size_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(~(unsigned long long) v);
+#else
+        std::size_t n = 0;
+        while (v & 1) {
+            v >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    /* Position of the first element for which go_right is false, go_right must be true on a prefix of the array.
+       The loop halves the range without branching on the comparison, the compiler turns the select into a cmov,
+       so the cost no longer depends on how well the branch predictor guesses the path.  */
+    template<class Container, class Pred>
+    std::size_t _flat_partition_point(Container *cnt, Pred go_right, sorted_layout) {
+        const container::value_type *base = cnt->_data.data();
+        std::size_t len = cnt->_data.size();
+        std::size_t half;
+
+        if (len == 0) return 0;
+
+        while (len > 1) {
+            half = len / 2;
+            base = go_right(Container::_get_key(base[half])) ? base + half : base;
+            len -= half;
+        }
+
+        return (base - cnt->_data.data()) + go_right(Container::_get_key(*base));
+    }
+
+    /* Same search over the breadth first copy, the path is walked down to a leaf and the last
+       node where we went left (found from the trailing ones of k) holds the answer.
+       Returns that node, 0 when go_right holds for every key.  */
+    template<class Container, class Pred>
+    std::size_t _flat_eytzinger_search(Container *cnt, Pred go_right) {
+        const auto *keys = cnt->_index.keys.data();
+        std::size_t n = cnt->_index.keys.size();
+        std::size_t k = 1;
+
+        while (k <= n) {
+            /* Four levels down, the 16 descendants are contiguous.  */
+            prefetch(keys + std::min(16 * k, n) - 1);
+            k = 2 * k + go_right(keys[k - 1]);
+        }
+
+        return k >> (count_trailing_ones(k) + 1);
+    }
+
+    template<class Container, class Pred>
+    std::size_t _flat_partition_point(Container *cnt, Pred go_right, eytzinger_layout) {
+        std::size_t k = _flat_eytzinger_search(cnt, go_right);
+
+        return k == 0 ? cnt->_data.size() : cnt->_index.pos[k - 1];
+    }
+
+    template<class Container, typename K>
+    std::size_t _flat_lower_bound(Container *cnt, const K &key) {
+        return _flat_partition_point(cnt, [cnt, &key](const container::key_type &elem_key) {
+            return cnt->_less(elem_key, key);
+        }, container::layout_type());
+    }
+
+    template<class Container, typename K>
+    std::size_t _flat_upper_bound(Container *cnt, const K &key) {
+        return _flat_partition_point(cnt, [cnt, &key](const container::key_type &elem_key) {
+            return !cnt->_less(key, elem_key);
+        }, container::layout_type());
+    }
+
+    /* Position of key, or size() if it is not there.  */
+    template<class Container, typename K>
+    std::size_t _flat_find(Container *cnt, const K &key, sorted_layout) {
+        std::size_t pos = _flat_lower_bound(cnt, key);
+
+        if (pos != cnt->_data.size() && cnt->_less(key, Container::_get_key(cnt->_data[pos]))) return cnt->_data.size();
+
+        return pos;
+    }
+
+    /* The key found is compared in the index, where it was just read, the sorted array is only touched on a hit.  */
+    template<class Container, typename K>
+    std::size_t _flat_find(Container *cnt, const K &key, eytzinger_layout) {
+        std::size_t k = _flat_eytzinger_search(cnt, [cnt, &key](const container::key_type &elem_key) {
+            return cnt->_less(elem_key, key);
+        });
+
+        if (k == 0 || cnt->_less(key, cnt->_index.keys[k - 1])) return cnt->_data.size();
+
+        return cnt->_index.pos[k - 1];
+    }
+
+    template<class Container, typename K>
+    std::size_t _flat_find(Container *cnt, const K &key) {
+        return _flat_find(cnt, key, container::layout_type());
+    }
+
+    template<class Container>
+    std::size_t _flat_eytzinger_fill(Container *cnt, std::size_t i, std::size_t k) {
+        if (k <= cnt->_data.size()) {
+            i = _flat_eytzinger_fill(cnt, i, 2 * k);
+            cnt->_index.pos[k - 1] = i++;
+            i = _flat_eytzinger_fill(cnt, i, 2 * k + 1);
+        }
+
+        return i;
+    }
+
+    template<class Container>
+    void _flat_reindex(Container *, sorted_layout) {}
+
+    template<class Container>
+    void _flat_reindex(Container *cnt, eytzinger_layout) {
+        std::size_t n = cnt->_data.size();
+
+        /* An inorder walk of the implicit tree visits the sorted array in order, it tells where every key goes.  */
+        cnt->_index.pos.resize(n);
+        _flat_eytzinger_fill(cnt, 0, 1);
+
+        cnt->_index.keys.clear();
+        cnt->_index.keys.reserve(n);
+        for (std::size_t k = 0 ; k < n ; k++) cnt->_index.keys.push_back(Container::_get_key(cnt->_data[cnt->_index.pos[k]]));
+    }
+
+    /* Called after every modification of the sorted array.  */
+    template<class Container>
+    void _flat_reindex(Container *cnt) {
+        _flat_reindex(cnt, container::layout_type());
+    }
+
+    /* Moves the element at the back of the array to pos, shifting the tail right.  */
+    template<class Container>
+    void _flat_rotate_back(Container *cnt, std::size_t pos) {
+        container::value_type *data = cnt->_data.data();
+        std::size_t n = cnt->_data.size();
+
+        std::rotate(data + pos, data + n - 1, data + n);
+    }
+
+    /* Removes [first, last) from the array, the tail is moved down and the freed slots are popped.  */
+    template<class Container>
+    void _flat_erase(Container *cnt, std::size_t first, std::size_t last) {
+        container::value_type *data = cnt->_data.data();
+        std::size_t n = cnt->_data.size();
+
+        if (first == last) return;
+
+        std::move(data + last, data + n, data + first);
+        for (std::size_t i = first ; i < last ; i++) cnt->_data.pop_back();
+
+        _flat_reindex(cnt);
+    }
+
+    /* Inserts the elements appended after position old_size in one pass.
+       The batch is sorted (stable, so the first of equivalent keys wins) and deduplicated unless sorted_unique,
+       then merged with the old elements, which win over the batch for equivalent keys.
+       This is O(n + m log m) instead of the O(n * m) of m single insertions.  */
+    template<class Container>
+    void _flat_merge_back(Container *cnt, std::size_t old_size, bool sorted_unique) {
+        container::value_type *data = cnt->_data.data();
+        std::size_t n = cnt->_data.size();
+        container::value_type *first = data, *middle = data + old_size, *last = data + n, *new_last;
+
+        auto less = [cnt](const container::value_type &lhs, const container::value_type &rhs) {
+            return cnt->_less(Container::_get_key(lhs), Container::_get_key(rhs));
+        };
+        auto equal = [cnt](const container::value_type &lhs, const container::value_type &rhs) {
+            return !cnt->_less(Container::_get_key(lhs), Container::_get_key(rhs));
+        };
+
+        if (middle == last) return;
+
+        if (!sorted_unique) {
+            std::stable_sort(middle, last, less);
+            last = std::unique(middle, last, equal);
+        }
+
+        /* Appending past the largest element needs no merge.  */
+        if (first != middle && !less(*middle, *(middle - 1))) {
+            new_last = less(*(middle - 1), *middle) ? last : std::move(middle + 1, last, middle);
+        } else {
+            std::inplace_merge(first, middle, last, less);
+            new_last = std::unique(first, last, equal);
+        }
+
+        while (cnt->_data.size() > (std::size_t) (new_last - first)) cnt->_data.pop_back();
+
+        _flat_reindex(cnt);
+    }
+}
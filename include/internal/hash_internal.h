@@ -1,24 +1,97 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <climits>
+#include <cstdint>
 #include <cstring>
+#include <new>
+#include <random>
 #include <type_traits>
+#include <utility>
+
+/* Define HASH_INTERNAL_HAVE_SSE2 to 0 to force the portable group implementation.  */
+#ifndef HASH_INTERNAL_HAVE_SSE2
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASH_INTERNAL_HAVE_SSE2 1
+#else
+#define HASH_INTERNAL_HAVE_SSE2 0
+#endif
+#endif
+
+#if HASH_INTERNAL_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Define HASH_INTERNAL_FIXED_SEED to a constant to give every table the same seed,
+   which makes iteration order reproducible between runs (at the cost of DoS resistance).  */
 
 namespace hash_internal {
 
     using ctrl_t = int8_t;
 
+    /* ctrl_sentinel sits right after the last control byte so iteration knows where to stop.
+       Groups never reach it since they never cross the end of the table.  */
     enum ctrl_val : ctrl_t {
         ctrl_empty = -1,
-        ctrl_deleted = -2
+        ctrl_deleted = -2,
+        ctrl_sentinel = -3,
+        ctrl_link = -4
+    };
+
+    /* During an incremental rehash the old table ends with ctrl_link instead of ctrl_sentinel,
+       followed by this link, so iterators that reach its end go on with the new table.  */
+    struct table_link {
+        void *slots;
+        const ctrl_t *ctrls;
     };
 
-    size_t hash_seed(const ctrl_t* ctrl) {
-        return reinterpret_cast<uintptr_t>(ctrl) >> 12;
+    /* Control bytes of a table with capacity slots: one per slot, the sentinel and room for a link.  */
+    inline size_t ctrl_bytes(size_t capacity) {
+        return capacity + 1 + sizeof(table_link);
+    }
+
+    /* wyhash style finalizer: multiply into 128 bits and fold the halves together.
+       Every input bit affects every output bit, so weak user hashes (std::hash<int> is
+       the identity) still spread over the whole table and h2 gets 7 useful bits.  */
+    inline uint64_t mix(uint64_t hash, uint64_t seed) {
+        constexpr uint64_t k0 = 0xa0761d6478bd642full;
+        constexpr uint64_t k1 = 0xe7037ed1a0b428dbull;
+        uint64_t a = hash ^ seed ^ k0;
+#if defined(__SIZEOF_INT128__)
+        __uint128_t m = (__uint128_t) a * k1;
+
+        return (uint64_t) (m >> 64) ^ (uint64_t) m;
+#else
+        /* murmur3 fmix64.  */
+        a ^= a >> 33;
+        a *= 0xff51afd7ed558ccdull;
+        a ^= a >> 33;
+        a *= 0xc4ceb9fe1a85ec53ull;
+        a ^= a >> 33;
+
+        return a ^ k1;
+#endif
+    }
+
+    /* Returns the seed of a new table. Each table is salted differently, starting
+       from a per-process random value, unless HASH_INTERNAL_FIXED_SEED is defined.  */
+    inline uint64_t next_seed() {
+#ifdef HASH_INTERNAL_FIXED_SEED
+        return (uint64_t) (HASH_INTERNAL_FIXED_SEED);
+#else
+        static const uint64_t process_seed = ((uint64_t) std::random_device{}() << 32) ^ std::random_device{}();
+        static std::atomic<uint64_t> counter{0};
+
+        return mix(counter.fetch_add(1, std::memory_order_relaxed), process_seed);
+#endif
     }
 
-    size_t h1(size_t hash, const ctrl_t* ctrl) {
-        return (hash) ^ hash_seed(ctrl);
+    /* The low 7 bits of the hash go to h2, so leave them out of the position.
+       Otherwise every element in a group would share the same h2.  */
+    size_t h1(size_t hash) {
+        return hash >> 7;
     }
 
     ctrl_t h2(size_t hash) {
@@ -60,23 +133,271 @@ namespace hash_internal {
         return (n & (d - 1));
     }
 
+    /* Asks the cache for addr ahead of time, used to overlap the misses of batched lookups.  */
+    inline void prefetch(const void *addr) {
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_prefetch(addr);
+#elif HASH_INTERNAL_HAVE_SSE2
+        _mm_prefetch((const char *) addr, _MM_HINT_T0);
+#else
+        (void) addr;
+#endif
+    }
+
+    inline size_t count_trailing_zeros(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(v);
+#else
+        size_t n = 0;
+        while (!(v & 1)) {
+            v >>= 1;
+            n++;
+        }
+        return n;
+#endif
+    }
+
+    /* Set of matching positions inside a group.
+       Shift is log2 of the number of mask bits used per slot.  */
+    template<typename T, int Shift>
+    class bitmask {
+    public:
+        explicit bitmask(T mask) : _mask(mask) {}
+
+        bool any() const { return _mask != 0; }
+        size_t lowest() const { return count_trailing_zeros(_mask) >> Shift; }
+        void clear_lowest() { _mask &= (_mask - 1); }
+
+    private:
+        T _mask;
+    };
+
+#if HASH_INTERNAL_HAVE_SSE2
+    /* 16 control bytes matched at once with SSE2, one bit per slot in the mask.  */
+    struct group_sse2 {
+        static constexpr size_t width = 16;
+        using mask_type = bitmask<uint32_t, 0>;
+
+        explicit group_sse2(const ctrl_t *pos) : ctrl(_mm_loadu_si128(reinterpret_cast<const __m128i *>(pos))) {}
+
+        mask_type match(ctrl_t h2_hash) const {
+            return mask_type(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2_hash), ctrl))));
+        }
+
+        mask_type match_empty() const {
+            return match(ctrl_empty);
+        }
+
+        /* Empty and deleted are the only negative control bytes, so the sign bits are enough.  */
+        mask_type match_empty_or_deleted() const {
+            return mask_type(static_cast<uint32_t>(_mm_movemask_epi8(ctrl)));
+        }
+
+        __m128i ctrl;
+    };
+#endif
+
+    /* Portable fallback, 8 control bytes packed in a 64-bit word (SWAR).
+       Each matching slot sets the high bit of its byte in the mask.  */
+    struct group_portable {
+        static constexpr size_t width = 8;
+        using mask_type = bitmask<uint64_t, 3>;
+
+        static constexpr uint64_t lsbs = 0x0101010101010101ULL;
+        static constexpr uint64_t msbs = 0x8080808080808080ULL;
+
+        explicit group_portable(const ctrl_t *pos) {
+            memcpy(&ctrl, pos, sizeof(ctrl));
+        }
+
+        /* Exact zero-byte detection, no carries leak between bytes.  */
+        mask_type match(ctrl_t h2_hash) const {
+            uint64_t x = ctrl ^ (lsbs * static_cast<uint8_t>(h2_hash));
+            return mask_type(~(((x & ~msbs) + ~msbs) | x | ~msbs));
+        }
+
+        mask_type match_empty() const {
+            return match(ctrl_empty);
+        }
+
+        mask_type match_empty_or_deleted() const {
+            return mask_type(ctrl & msbs);
+        }
+
+        uint64_t ctrl;
+    };
+
+#if HASH_INTERNAL_HAVE_SSE2
+    using group = group_sse2;
+#else
+    using group = group_portable;
+#endif
+
+    /* Triangular probing over groups: starting from the group that contains pos,
+       visit groups at offsets 0, 1, 3, 6, 10, ... (in groups) from it.
+       Since the number of groups is a power of 2 this visits every group exactly once.  */
+    class probe_seq {
+    public:
+        probe_seq(size_t pos, size_t capacity) : _mask(capacity - 1), _offset(pos & (capacity - 1) & ~(group::width - 1)), _index(0) {}
+
+        size_t offset() const { return _offset; }
+        size_t offset(size_t i) const { return _offset + i; }
+        size_t index() const { return _index; }
+
+        void next() {
+            _index += group::width;
+            _offset = (_offset + _index) & _mask;
+        }
+
+    private:
+        size_t _mask;
+        size_t _offset;
+        size_t _index;
+    };
+
+    /* Storage policies for the slots array.
+       node_slots keeps a pointer to a separately allocated element in each slot,
+       so elements never move (pointer and reference stability).
+       flat_slots keeps the element itself inside the slot array: no extra allocation
+       per element and one less cache miss per lookup, but elements move on rehash.  */
+    struct node_slots {};
+    struct flat_slots {};
+
+    template<typename T, typename Storage>
+    struct slot_traits;
+
+    template<typename T>
+    struct slot_traits<T, node_slots> {
+        using slot_type = T *;
+
+        static T *element(slot_type *slot) { return *slot; }
+
+        template<typename... Args>
+        static void construct(slot_type *slot, Args &&... args) {
+            *slot = new T(std::forward<Args>(args)...);
+        }
+
+        /* Adopt an element that was already allocated (e.g. by emplace).  */
+        static void construct(slot_type *slot, T *elem) {
+            *slot = elem;
+        }
+
+        static void destroy(slot_type *slot) {
+            delete *slot;
+            *slot = nullptr;
+        }
+
+        static void transfer(slot_type *to, slot_type *from) {
+            *to = *from;
+            *from = nullptr;
+        }
+
+        /* Node containers mark the end of the slots array with a 0x1 pointer.  */
+        static void set_sentinel(slot_type *slot) {
+            *slot = (slot_type) 0x1;
+        }
+    };
+
+    template<typename T>
+    struct slot_traits<T, flat_slots> {
+        union slot_type {
+            T value;
+
+            slot_type() {}
+            ~slot_type() {}
+        };
+
+        static T *element(slot_type *slot) { return &slot->value; }
+
+        template<typename... Args>
+        static void construct(slot_type *slot, Args &&... args) {
+            new (&slot->value) T(std::forward<Args>(args)...);
+        }
+
+        static void destroy(slot_type *slot) {
+            slot->value.~T();
+        }
+
+        static void transfer(slot_type *to, slot_type *from) {
+            new (&to->value) T(std::move(from->value));
+            from->value.~T();
+        }
+
+        /* Iteration stops on ctrl_sentinel, the slot itself is never read.  */
+        static void set_sentinel(slot_type *) {}
+    };
+
     #define container typename Container
 
+    template<class Container>
+    container::size_type _hash_find_first_non_full(Container *cnt, uint64_t hash);
+
+    /* Heterogeneous lookups (find(K), count(K) ...) are only enabled when both
+       Hash and Eq declare is_transparent, or when K is the key type itself.  */
+    template<class Hash, class Eq, class Key, class K, class = void, class = void>
+    struct is_lookup_key : std::is_same<K, Key> {};
+
+    template<class Hash, class Eq, class Key, class K>
+    struct is_lookup_key<Hash, Eq, Key, K, typename std::conditional<true, void, typename Hash::is_transparent>::type,
+                         typename std::conditional<true, void, typename Eq::is_transparent>::type> : std::true_type {};
+
+    template<class Hash, class Eq, class Key, class K>
+    using enable_lookup = typename std::enable_if<is_lookup_key<Hash, Eq, Key, K>::value, int>::type;
+
+    /* The user hash of key mixed with the seed of cnt, h1 and h2 are taken from this.  */
+    template<class Container, typename K>
+    uint64_t _hash_key(Container *cnt, const K &key) {
+        return mix(cnt->_hasher(key), cnt->_seed);
+    }
+
+    template<class Container, typename K>
+    container::hash_info _hash_get_hash_info(Container *cnt, const K &key);
+
     template<class Container>
     void _hash_construct(Container *cnt) {
 
-        cnt->_capacity = normalize_capacity(cnt->_capacity);
+        /* Groups never wrap around the table, so it has to hold at least one.  */
+        cnt->_capacity = std::max(normalize_capacity(cnt->_capacity), group::width);
         cnt->_size = 0;
+        cnt->_n_deleted = 0;
+        cnt->_seed = next_seed();
 
         assert(is_valid_capacity(cnt->_capacity) &&  "capacity should always be a power of 2");
         cnt->_first_elem_pos = cnt->_capacity;
-        cnt->_ctrls = new ctrl_t[cnt->_capacity];
+        cnt->_ctrls = new ctrl_t[ctrl_bytes(cnt->_capacity)];
 
         /* Add one extra slot so we can determine when our hash table ends.  */
-        cnt->_slots = (container::internal_ptr *) calloc (sizeof(container::internal_ptr), cnt->_capacity + 1);
-        cnt->_slots[cnt->_capacity] = (container::internal_ptr) 0x1;
+        cnt->_slots = (container::slot_type *) calloc (sizeof(container::slot_type), cnt->_capacity + 1);
+        Container::slots::set_sentinel(&cnt->_slots[cnt->_capacity]);
 
         memset(cnt->_ctrls, ctrl_empty, cnt->_capacity * sizeof(ctrl_t));
+        cnt->_ctrls[cnt->_capacity] = ctrl_sentinel;
+    }
+
+    /* Copies other into the freshly zeroed cnt, other's elements are rehashed since
+       their positions depend on the seed of the table they live in.  */
+    template<class Container>
+    void _hash_copy(Container *cnt, const Container &other) {
+        uint64_t hash;
+        size_t pos;
+        auto src = const_cast<Container *>(&other);
+
+        cnt->_capacity = other._capacity;
+        cnt->_max_load_factor = other._max_load_factor;
+        _hash_construct(cnt);
+
+        for (size_t i = 0 ; i < other._capacity ; i++) {
+            if (is_full_slot(other._ctrls[i])) {
+                hash = _hash_key(cnt, src->_get_slot_key(src->_slots[i]));
+                pos = _hash_find_first_non_full(cnt, hash);
+
+                cnt->_ctrls[pos] = h2(hash);
+                cnt->_copy_slot(pos, src->_slots[i]);
+
+                if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
+            }
+        }
+        cnt->_size = other._size;
     }
 
     template<class Container>
@@ -95,28 +416,53 @@ namespace hash_internal {
     container::find_insert_info _hash_find_or_prepare_insert(Container *cnt, const container::key_type &key, container::size_type pos, ctrl_t h2_hash) {
         bool found_deleted;
         size_t empty_pos = 0, del_pos = 0;
+        probe_seq seq(pos, cnt->_capacity);
 
         found_deleted = false;
         while (1) {
-            if (is_empty_slot(cnt->_ctrls[pos])) {
-                empty_pos = pos;
-                break;
+            group g(cnt->_ctrls + seq.offset());
+
+            for (auto match = g.match(h2_hash) ; match.any() ; match.clear_lowest()) {
+                pos = seq.offset(match.lowest());
+                if (cnt->_keq(cnt->_get_slot_key(cnt->_slots[pos]), key)) {
+                    return {cnt->_iterator_at(pos), found_deleted, del_pos, empty_pos};
+                }
             }
-            else if (is_deleted_slot(cnt->_ctrls[pos]) && !found_deleted) {
+
+            auto empty = g.match_empty();
+            auto empty_or_deleted = g.match_empty_or_deleted();
+
+            /* Remember the first tombstone on the probe sequence, we prefer reusing it.  */
+            if (!found_deleted && empty_or_deleted.any() && !is_empty_slot(cnt->_ctrls[seq.offset(empty_or_deleted.lowest())])) {
                 found_deleted = true;
-                del_pos = pos;
+                del_pos = seq.offset(empty_or_deleted.lowest());
             }
-            else if (cnt->_ctrls[pos] == h2_hash) {
-                if (cnt->_keq(cnt->_get_slot_key(cnt->_slots[pos]), key)) {
-                    return {container::iterator(&cnt->_slots[pos]), found_deleted, del_pos, empty_pos};
-                }
+
+            if (empty.any()) {
+                empty_pos = seq.offset(empty.lowest());
+                break;
             }
-            pos = mod(pos + 1, cnt->_capacity);
+
+            seq.next();
         }
 
         return {container::iterator(nullptr), found_deleted, del_pos, empty_pos};
     }
 
+    /* Returns the first empty or deleted slot on the probe sequence of hash.  */
+    template<class Container>
+    container::size_type _hash_find_first_non_full(Container *cnt, uint64_t hash) {
+        probe_seq seq(mod(h1(hash), cnt->_capacity), cnt->_capacity);
+
+        while (1) {
+            auto mask = group(cnt->_ctrls + seq.offset()).match_empty_or_deleted();
+
+            if (mask.any()) return seq.offset(mask.lowest());
+
+            seq.next();
+        }
+    }
+
     template<class Container, typename R, typename K, typename V, typename... Args>
     R _hash_insert(Container *cnt, const K &key, V val, Args &&... args) {
         size_t pos;
@@ -124,73 +470,129 @@ namespace hash_internal {
 
         assert(sizeof...(Args) <= 1);
 
+        /* Containers in the middle of an incremental rehash move some elements on every insert, found or not,
+           before the probe below picks a slot. The old table may still hold key.  */
+        auto old = cnt->_migrate_and_find_old(key, info.hash);
+        if (old != nullptr) return cnt->_handle_elem_found(old, std::forward<Args>(args)...);
+
         /* Try to find the key first.  */
         auto p = _hash_find_or_prepare_insert<Container>(cnt, key, info.pos, info.h2_hash);
         /* If we found it, return early.  */
         if (p.it != nullptr) return cnt->_handle_elem_found(p.it, std::forward<Args>(args)...);
 
         pos = p.found_deleted ? p.del_pos : p.empty_pos;
+
         cnt->_check_load_factor(info.hash, pos);
 
-        while (1) {
-            if (is_empty_or_deleted(cnt->_ctrls[pos])) {
-                cnt->_ctrls[pos] = info.h2_hash;
-                cnt->_slots[pos] = cnt->_construct_new_element(std::forward<V>(val));
-                cnt->_size++;
+        assert(is_empty_or_deleted(cnt->_ctrls[pos]));
 
-                /* Update first element position.  */
-                if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
+        if (is_deleted_slot(cnt->_ctrls[pos])) cnt->_n_deleted--;
+        cnt->_ctrls[pos] = info.h2_hash;
+        cnt->_construct_slot(pos, std::forward<V>(val));
+        cnt->_size++;
+
+        /* Update first element position.  */
+        if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
+
+        return cnt->_handle_elem_not_found(cnt->_iterator_at(pos));
+    }
+
+    /* Same as _hash_find but with the hash of key already computed.  */
+    template<class Container, typename K>
+    container::iterator _hash_find_with_info(Container *cnt, const K &key, const container::hash_info &info) {
+        size_t pos;
+        probe_seq seq(info.pos, cnt->_capacity);
+
+        while (1) {
+            group g(cnt->_ctrls + seq.offset());
 
-                return cnt->_handle_elem_not_found(container::iterator(&(cnt->_slots[pos])));
+            for (auto match = g.match(info.h2_hash) ; match.any() ; match.clear_lowest()) {
+                pos = seq.offset(match.lowest());
+                if (cnt->_keq(cnt->_get_slot_key(cnt->_slots[pos]), key)) {
+                    return cnt->_iterator_at(pos);
+                }
             }
-            pos = mod(pos + 1, cnt->_capacity);
+
+            /* An empty slot ends every probe sequence that went through this group.  */
+            if (g.match_empty().any()) return cnt->end();
+
+            seq.next();
+            if (seq.index() >= cnt->_capacity) return cnt->end();
         }
     }
 
-    template<class Container>
-    container::iterator _hash_find(Container *cnt, const container::key_type &key) {
-        size_t pos;
+    template<class Container, typename K>
+    container::iterator _hash_find(Container *cnt, const K &key) {
 
         if (cnt->empty()) return cnt->end();
 
-        auto info = cnt->_get_hash_info(key);
-        pos = info.pos;
+        return _hash_find_with_info(cnt, key, _hash_get_hash_info(cnt, key));
+    }
 
-        while (1) {
-            if (is_empty_slot(cnt->_ctrls[pos])) return cnt->end();
+    /* Looks up keys[0..n) and calls f(i, it) with the result of each lookup.
+       Keys are processed in batches: all of them are hashed first and their first group
+       of ctrl bytes and slots is prefetched, then the first candidate element of each key
+       is prefetched and finally each lookup is resolved. This way the cache misses of a
+       whole batch are in flight at the same time instead of one after the other.  */
+    template<class Container, typename F>
+    void _hash_find_many(Container *cnt, const container::key_type *keys, container::size_type n, F f) {
+        constexpr size_t batch_size = 16;
+        container::hash_info infos[batch_size];
+        size_t i, j, batch;
+
+        if (cnt->empty()) {
+            for (i = 0 ; i < n ; i++) f(i, cnt->end());
+            return;
+        }
 
-            if (is_full_slot(cnt->_ctrls[pos]) && cnt->_ctrls[pos] == info.h2_hash) {
-                if (cnt->_keq(cnt->_get_slot_key(cnt->_slots[pos]), key)) {
-                    return container::iterator(&cnt->_slots[pos]);
-                }
+        for (i = 0 ; i < n ; i += batch) {
+            batch = std::min(batch_size, n - i);
+
+            for (j = 0 ; j < batch ; j++) {
+                infos[j] = cnt->_get_hash_info(keys[i + j]);
+                probe_seq seq(infos[j].pos, cnt->_capacity);
+                prefetch(cnt->_ctrls + seq.offset());
+                prefetch(cnt->_slots + seq.offset());
+            }
+
+            for (j = 0 ; j < batch ; j++) {
+                probe_seq seq(infos[j].pos, cnt->_capacity);
+                auto match = group(cnt->_ctrls + seq.offset()).match(infos[j].h2_hash);
+                if (match.any()) prefetch(Container::slots::element(&cnt->_slots[seq.offset(match.lowest())]));
+            }
+
+            for (j = 0 ; j < batch ; j++) {
+                f(i + j, _hash_find_with_info(cnt, keys[i + j], infos[j]));
             }
-            pos = mod(pos + 1, cnt->_capacity);
         }
     }
     
     template<class Container>
-    std::pair<container::size_type, container::size_type> _hash_erase(Container *cnt, container::internal_ptr *ptr, bool erase_all) {
-        container::size_type pos, prev_pos, count, to_delete;
+    std::pair<container::size_type, container::size_type> _hash_erase(Container *cnt, container::slot_type *ptr, bool erase_all) {
+        container::size_type pos, count;
 
         count = 0;
         if (ptr != &(cnt->_slots[cnt->_capacity])) {
             pos = ptr - cnt->_slots;
+
+            if (erase_all) {
+                count = cnt->_delete_all_slots(pos);
+            } else {
+                count = cnt->_delete_slot(pos);
+            }
+
+            /* Multi containers keep the slot while it still holds equivalent elements.  */
+            if (!cnt->_is_slot_free(pos)) return {pos, count};
+
             cnt->_ctrls[pos] = ctrl_deleted;
-            to_delete = pos;
+            cnt->_n_deleted++;
 
-            prev_pos = pos;
-            /* Find next non-null entry.  */
+            /* Find next full entry.  */
             pos++;
-            while (cnt->_slots[pos] == nullptr && pos != cnt->_capacity) pos++;
+            while (pos != cnt->_capacity && !is_full_slot(cnt->_ctrls[pos])) pos++;
 
             /* If the deleted entry was the first element in our container, update.  */
-            if (prev_pos == cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
-
-            if (erase_all) {
-                count = cnt->_delete_all_slots(to_delete);
-            } else {
-                count = cnt->_delete_slot(to_delete);
-            }
+            if (ptr - cnt->_slots == (std::ptrdiff_t) cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
 
             return {pos, count};
         }
@@ -203,58 +605,51 @@ namespace hash_internal {
 
         if (cnt && cnt->_ctrls && cnt->_slots) {
             for (size_t i = 0 ; i < cnt->_capacity ; i++) {
-                if (cnt->_slots[i] != nullptr) {
+                if (is_full_slot(cnt->_ctrls[i])) {
                     cnt->_delete_all_slots(i);
-                    cnt->_slots[i] = nullptr;
                 }
             }
             memset(cnt->_ctrls, ctrl_empty, cnt->_capacity * sizeof(ctrl_t));
 
             cnt->_size = 0;
-            cnt->_capacity = 16;
+            cnt->_n_deleted = 0;
             cnt->_first_elem_pos = cnt->_capacity;
         }
     }
 
+    /* Moves every element of cnt into freshly allocated arrays of new_cap slots.  */
     template<class Container>
-    void _hash_rehash(Container *cnt) {
-        uint64_t hash, h1_hash;
+    void _hash_rehash(Container *cnt, container::size_type new_cap) {
+        uint64_t hash;
         size_t pos;
         auto old_slots = cnt->_slots;
         auto old_ctrls = cnt->_ctrls;
         auto old_cap = cnt->_capacity;
-        auto new_cap = old_cap * 2;
 
-        assert (is_valid_capacity (cnt->_capacity) && "capacity should always be a power of 2");
+        assert (is_valid_capacity (new_cap) && new_cap >= group::width && "capacity should always be a power of 2");
 
-        cnt->_ctrls = new ctrl_t[new_cap];
-        cnt->_slots = (container::internal_ptr *) calloc (sizeof (container::internal_ptr), new_cap + 1);
+        cnt->_ctrls = new ctrl_t[ctrl_bytes(new_cap)];
+        cnt->_slots = (container::slot_type *) calloc (sizeof (container::slot_type), new_cap + 1);
 
         if (cnt->_ctrls == nullptr || cnt->_slots == nullptr) throw std::bad_alloc();
 
-        cnt->_slots[new_cap] = (container::internal_ptr) 0x1;
+        Container::slots::set_sentinel(&cnt->_slots[new_cap]);
         cnt->_capacity = new_cap;
+        cnt->_n_deleted = 0;
         cnt->_first_elem_pos = new_cap;
 
         memset(cnt->_ctrls, ctrl_empty, new_cap * sizeof(ctrl_t));
+        cnt->_ctrls[new_cap] = ctrl_sentinel;
 
         for (size_t i = 0 ; i < old_cap ; i++) {
             if (is_full_slot(old_ctrls[i])) {
-                hash = cnt->_hasher(cnt->_get_slot_key(old_slots[i]));
-                h1_hash = h1(hash, cnt->_ctrls);
+                hash = _hash_key(cnt, cnt->_get_slot_key(old_slots[i]));
+                pos = _hash_find_first_non_full(cnt, hash);
 
-                pos = mod(h1_hash, cnt->_capacity);
-                while (1) {
-                    if (is_empty_or_deleted(cnt->_ctrls[pos])) {
-                        cnt->_ctrls[pos] = h2(hash);
-                        cnt->_slots[pos] = old_slots[i];
+                cnt->_ctrls[pos] = h2(hash);
+                Container::slots::transfer(&cnt->_slots[pos], &old_slots[i]);
 
-                        if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
-
-                        break;
-                    }
-                    pos = mod(pos + 1, cnt->_capacity);
-                }
+                if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
             }
         }
 
@@ -262,27 +657,294 @@ namespace hash_internal {
         free(old_slots);
     }
 
+    /* Rehashes cnt at the same capacity reusing its arrays, all tombstones are dropped.
+       First every deleted slot becomes empty and every full slot becomes deleted,
+       so ctrl_deleted now means "not placed yet". Then each such element either stays
+       (its target is in the same group), moves to an empty target or swaps with
+       the not yet placed element that occupies its target, which is processed next.  */
+    template<class Container>
+    void _hash_rehash_in_place(Container *cnt) {
+        uint64_t hash;
+        size_t pos, group_mask = ~(group::width - 1);
+        container::slot_type tmp;
+
+        for (size_t i = 0 ; i < cnt->_capacity ; i++) {
+            cnt->_ctrls[i] = is_full_slot(cnt->_ctrls[i]) ? ctrl_deleted : ctrl_empty;
+        }
+
+        for (size_t i = 0 ; i < cnt->_capacity ; i++) {
+            if (!is_deleted_slot(cnt->_ctrls[i])) continue;
+
+            hash = _hash_key(cnt, cnt->_get_slot_key(cnt->_slots[i]));
+            pos = _hash_find_first_non_full(cnt, hash);
+
+            /* Probing for this element would reach i's group before pos anyway.  */
+            if ((pos & group_mask) == (i & group_mask)) {
+                cnt->_ctrls[i] = h2(hash);
+                continue;
+            }
+
+            if (is_empty_slot(cnt->_ctrls[pos])) {
+                cnt->_ctrls[pos] = h2(hash);
+                cnt->_ctrls[i] = ctrl_empty;
+                Container::slots::transfer(&cnt->_slots[pos], &cnt->_slots[i]);
+            } else {
+                /* pos holds an element that was not placed yet, swap and retry i.  */
+                cnt->_ctrls[pos] = h2(hash);
+                Container::slots::transfer(&tmp, &cnt->_slots[pos]);
+                Container::slots::transfer(&cnt->_slots[pos], &cnt->_slots[i]);
+                Container::slots::transfer(&cnt->_slots[i], &tmp);
+                i--;
+            }
+        }
+
+        cnt->_n_deleted = 0;
+        cnt->_first_elem_pos = 0;
+        while (cnt->_first_elem_pos != cnt->_capacity && !is_full_slot(cnt->_ctrls[cnt->_first_elem_pos])) cnt->_first_elem_pos++;
+    }
+
+    /* First slot of the old table from pos on that still holds an element, _old_capacity if none does.
+       The old table only loses elements, so _old_first_pos caches it and only ever moves forward.  */
+    template<class Container>
+    container::size_type _hash_next_old(Container *cnt, container::size_type pos) {
+        while (pos != cnt->_old_capacity && !is_full_slot(cnt->_old_ctrls[pos])) pos++;
+
+        return pos;
+    }
+
+    /* Incremental rehash: the elements stay in the old arrays (_old_slots, _old_ctrls, _old_capacity) and
+       are moved to the new ones _migrate_pos by _migrate_pos, a bounded number of slots at a time.
+       Moved slots become tombstones so the probe sequences of the others stay intact.  */
+    template<class Container>
+    void _hash_start_migration(Container *cnt, container::size_type new_cap) {
+        table_link link;
+        auto ctrls = new ctrl_t[ctrl_bytes(new_cap)];
+        auto slots = (container::slot_type *) calloc (sizeof (container::slot_type), new_cap + 1);
+
+        assert (is_valid_capacity (new_cap) && new_cap >= group::width && "capacity should always be a power of 2");
+        assert (cnt->_old_ctrls == nullptr && "only one migration at a time");
+
+        if (slots == nullptr) {
+            delete[] ctrls;
+            throw std::bad_alloc();
+        }
+
+        cnt->_old_slots = cnt->_slots;
+        cnt->_old_ctrls = cnt->_ctrls;
+        cnt->_old_capacity = cnt->_capacity;
+        cnt->_migrate_pos = 0;
+        cnt->_old_first_pos = _hash_next_old(cnt, 0);
+        cnt->_slots = slots;
+        cnt->_ctrls = ctrls;
+
+        Container::slots::set_sentinel(&cnt->_slots[new_cap]);
+        cnt->_capacity = new_cap;
+        cnt->_n_deleted = 0;
+        cnt->_first_elem_pos = new_cap;
+
+        memset(cnt->_ctrls, ctrl_empty, new_cap * sizeof(ctrl_t));
+        cnt->_ctrls[new_cap] = ctrl_sentinel;
+
+        link = {cnt->_slots, cnt->_ctrls};
+        cnt->_old_ctrls[cnt->_old_capacity] = ctrl_link;
+        memcpy(cnt->_old_ctrls + cnt->_old_capacity + 1, &link, sizeof(link));
+    }
+
+    /* Moves the elements of the next n_slots slots of the old table, frees it once they are all moved.  */
+    template<class Container>
+    void _hash_migrate(Container *cnt, container::size_type n_slots) {
+        uint64_t hash;
+        size_t pos, last;
+
+        if (cnt->_old_ctrls == nullptr) return;
+
+        last = std::min(cnt->_migrate_pos + n_slots, cnt->_old_capacity);
+        for (size_t i = cnt->_migrate_pos ; i < last ; i++) {
+            if (is_full_slot(cnt->_old_ctrls[i])) {
+                hash = _hash_key(cnt, cnt->_get_slot_key(cnt->_old_slots[i]));
+                pos = _hash_find_first_non_full(cnt, hash);
+
+                cnt->_ctrls[pos] = h2(hash);
+                Container::slots::transfer(&cnt->_slots[pos], &cnt->_old_slots[i]);
+                cnt->_old_ctrls[i] = ctrl_deleted;
+
+                if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
+            }
+        }
+        cnt->_migrate_pos = last;
+        if (cnt->_old_first_pos < last) cnt->_old_first_pos = _hash_next_old(cnt, last);
+
+        if (last == cnt->_old_capacity) {
+            delete[] cnt->_old_ctrls;
+            free(cnt->_old_slots);
+            cnt->_old_ctrls = nullptr;
+            cnt->_old_slots = nullptr;
+            cnt->_old_capacity = 0;
+            cnt->_old_first_pos = 0;
+        }
+    }
+
+    template<class Container>
+    void _hash_finish_migration(Container *cnt) {
+        _hash_migrate(cnt, cnt->_old_capacity);
+    }
+
+    /* Position of key in the old table, _old_capacity if it is not there.  */
+    template<class Container, typename K>
+    container::size_type _hash_find_old(Container *cnt, const K &key, uint64_t hash) {
+        size_t pos;
+        probe_seq seq(mod(h1(hash), cnt->_old_capacity), cnt->_old_capacity);
+
+        while (1) {
+            group g(cnt->_old_ctrls + seq.offset());
+
+            for (auto match = g.match(h2(hash)) ; match.any() ; match.clear_lowest()) {
+                pos = seq.offset(match.lowest());
+                if (cnt->_keq(cnt->_get_slot_key(cnt->_old_slots[pos]), key)) return pos;
+            }
+
+            if (g.match_empty().any()) return cnt->_old_capacity;
+
+            seq.next();
+            if (seq.index() >= cnt->_old_capacity) return cnt->_old_capacity;
+        }
+    }
+
+    template<class Container>
+    void _hash_erase_old(Container *cnt, container::size_type pos) {
+        Container::slots::destroy(&cnt->_old_slots[pos]);
+        cnt->_old_ctrls[pos] = ctrl_deleted;
+        cnt->_size--;
+
+        if (pos == cnt->_old_first_pos) cnt->_old_first_pos = _hash_next_old(cnt, pos + 1);
+    }
+
+    /* Destroys the elements left in the old table and frees it, the new table is left alone.  */
+    template<class Container>
+    void _hash_clear_old(Container *cnt) {
+        container::size_type n_old = 0;
+
+        if (cnt->_old_ctrls == nullptr) return;
+
+        for (size_t i = cnt->_migrate_pos ; i < cnt->_old_capacity ; i++) {
+            if (is_full_slot(cnt->_old_ctrls[i])) {
+                Container::slots::destroy(&cnt->_old_slots[i]);
+                n_old++;
+            }
+        }
+        cnt->_size -= n_old;
+
+        delete[] cnt->_old_ctrls;
+        free(cnt->_old_slots);
+        cnt->_old_ctrls = nullptr;
+        cnt->_old_slots = nullptr;
+        cnt->_old_capacity = 0;
+        cnt->_old_first_pos = 0;
+    }
+
+    /* Copies the elements other still has in its old table into cnt, after _hash_copy() copied the new one.  */
+    template<class Container>
+    void _hash_copy_old(Container *cnt, const Container &other) {
+        uint64_t hash;
+        size_t pos;
+        auto src = const_cast<Container *>(&other);
+
+        if (other._old_ctrls == nullptr) return;
+
+        for (size_t i = other._migrate_pos ; i < other._old_capacity ; i++) {
+            if (is_full_slot(other._old_ctrls[i])) {
+                hash = _hash_key(cnt, src->_get_slot_key(src->_old_slots[i]));
+                pos = _hash_find_first_non_full(cnt, hash);
+
+                cnt->_ctrls[pos] = h2(hash);
+                cnt->_copy_slot(pos, src->_old_slots[i]);
+
+                if (pos < cnt->_first_elem_pos) cnt->_first_elem_pos = pos;
+            }
+        }
+    }
+
+    /* Smallest capacity that keeps n_slots used slots below the max load factor.  */
+    template<class Container>
+    container::size_type _hash_capacity_for(Container *cnt, container::size_type n_slots) {
+        auto cap = (size_t) ((double) n_slots / cnt->_max_load_factor) + 1;
+
+        return std::max(normalize_capacity(cap), group::width);
+    }
+
+    /* Implements rehash(count): the new capacity is at least count and large enough
+       for the n_slots used slots, so it may shrink the table as well.  */
+    template<class Container>
+    void _hash_resize(Container *cnt, container::size_type n_slots, container::size_type count) {
+        auto new_cap = std::max(std::max(normalize_capacity(count), group::width), _hash_capacity_for(cnt, n_slots));
+
+        if (new_cap != cnt->_capacity) {
+            _hash_rehash(cnt, new_cap);
+        } else if (cnt->_n_deleted > 0) {
+            _hash_rehash_in_place(cnt);
+        }
+    }
+
+    /* Implements reserve(count), unlike rehash() it never shrinks the table.  */
+    template<class Container>
+    void _hash_reserve(Container *cnt, container::size_type n_slots, container::size_type count) {
+        auto new_cap = _hash_capacity_for(cnt, std::max(n_slots, count));
+
+        if (new_cap > cnt->_capacity) _hash_rehash(cnt, new_cap);
+    }
+
     template<class Container>
-    container::hash_info _hash_get_hash_info(Container *cnt, const container::key_type &key) {
+    void _hash_max_load_factor(Container *cnt, container::size_type n_slots, float ml) {
+        assert(ml > 0.0f && "max load factor should be positive");
+
+        /* ml is a hint, probing needs empty slots to terminate so the table never gets fuller than 7/8.  */
+        cnt->_max_load_factor = std::min(ml, 0.875f);
+        if ((double) (n_slots + cnt->_n_deleted) >= (double) cnt->_capacity * cnt->_max_load_factor) {
+            _hash_resize(cnt, n_slots, 0);
+        }
+    }
+
+    template<class Container, typename K>
+    container::hash_info _hash_get_hash_info(Container *cnt, const K &key) {
         uint64_t hash;
         size_t h1_hash, pos;
         ctrl_t h2_hash;
 
-        hash = cnt->_hasher(key);
-        h1_hash = h1(hash, cnt->_ctrls);
+        hash = _hash_key(cnt, key);
+        h1_hash = h1(hash);
         h2_hash = h2(hash);
         pos = mod(h1_hash, cnt->_capacity);
 
         return {pos, hash, h2_hash};
     }
 
+    /* Tombstones lengthen probe sequences just like full slots, so they count towards the load factor.
+       If most of the used slots are tombstones, purging them at the same capacity is enough.  */
     template<class Container>
     void _hash_check_load_factor(Container *cnt, container::size_type n_slots, uint64_t hash, container::size_type &pos) {
-        double load_factor = (double) n_slots / (double) cnt->_capacity;
+        double load_factor = (double) (n_slots + cnt->_n_deleted) / (double) cnt->_capacity;
+
+        if (load_factor >= cnt->_max_load_factor) {
+            if (cnt->_n_deleted > n_slots) {
+                _hash_rehash_in_place(cnt);
+            } else {
+                cnt->_rehash();
+            }
+            pos = _hash_find_first_non_full(cnt, hash);
+        }
+    }
+
+    /* Same as _hash_check_load_factor, but the elements are moved to the new table by the following inserts and erases.
+       A migration that is still running when the new table fills up is finished first, which only happens
+       if the inserts moved less than two slots each.  */
+    template<class Container>
+    void _hash_check_load_factor_incremental(Container *cnt, container::size_type n_slots, uint64_t hash, container::size_type &pos) {
+        double load_factor = (double) (n_slots + cnt->_n_deleted) / (double) cnt->_capacity;
 
-        if (load_factor >= 0.75) {
-            cnt->_rehash();
-            pos = mod(h1(hash, cnt->_ctrls), cnt->_capacity);
+        if (load_factor >= cnt->_max_load_factor) {
+            _hash_finish_migration(cnt);
+            _hash_start_migration(cnt, cnt->_n_deleted > n_slots ? cnt->_capacity : cnt->_capacity * 2);
+            pos = _hash_find_first_non_full(cnt, hash);
         }
     }
 }
@@ -0,0 +1,474 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+#include "rbtree_internal.h"
+
+namespace persistent_internal {
+
+    using rbtree_internal::color_t;
+
+    #define container typename Container
+
+    /* Node of the persistent containers. Nodes are shared between a map and its snapshots, so they have
+       no parent pointer and count the references to them: the map (or parent node) that holds a node owns one.
+       A node referenced once belongs to a single map and is changed in place, shared nodes are never changed.  */
+    template<typename T>
+    struct persistent_node {
+        T data;
+        persistent_node *left;
+        persistent_node *right;
+        std::atomic<std::size_t> refs;
+        color_t color;
+
+        template<typename... Args>
+        explicit persistent_node(Args&&... args)
+            : data(std::forward<Args>(args)...), left(nullptr), right(nullptr), refs(1), color(rbtree_internal::RED) {}
+    };
+
+    /* The nodes from the root down to a node of the tree, this is how iterators and modifications find their way
+       back up. A red black tree of n nodes is at most 2 * log2(n + 1) high, twice the bits of a size_t is enough.  */
+    template<class Node>
+    struct persistent_path {
+        static constexpr std::size_t max_height = 2 * CHAR_BIT * sizeof(std::size_t);
+
+        Node *nodes[max_height];
+        std::size_t depth;
+
+        persistent_path() : depth(0) {}
+        persistent_path(const persistent_path &other) : depth(other.depth) {
+            std::copy(other.nodes, other.nodes + other.depth, nodes);
+        }
+
+        persistent_path &operator=(const persistent_path &other) {
+            depth = other.depth;
+            std::copy(other.nodes, other.nodes + other.depth, nodes);
+            return *this;
+        }
+
+        Node *top() const { return depth ? nodes[depth - 1] : nullptr; }
+        void push(Node *node) { nodes[depth++] = node; }
+    };
+
+    template<class Node>
+    color_t _persistent_color(const Node *node) {
+        return node ? node->color : (color_t) rbtree_internal::BLACK;
+    }
+
+    /* The pointer that holds nodes[i]: the root or a child pointer of its parent.  */
+    template<class Container>
+    container::internal_ptr &_persistent_link(Container *cnt, persistent_path<container::node_type> &path, std::size_t i) {
+        if (i == 0) return cnt->_root;
+
+        return path.nodes[i - 1]->left == path.nodes[i] ? path.nodes[i - 1]->left : path.nodes[i - 1]->right;
+    }
+
+    template<class Container, typename... Args>
+    container::internal_ptr _persistent_new_node(Container *cnt, Args&&... args) {
+        using Node = container::node_type;
+        Node *node = std::allocator_traits<container::node_allocator>::allocate(cnt->_node_alloc, 1);
+
+        try {
+            ::new (node) Node(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            std::allocator_traits<container::node_allocator>::deallocate(cnt->_node_alloc, node, 1);
+            throw;
+        }
+
+        return node;
+    }
+
+    /* Drops a reference, the last one frees the node and drops the references it held to its children.  */
+    template<class Container>
+    void _persistent_release(Container *cnt, container::internal_ptr node) {
+        using Node = container::node_type;
+
+        /* Release for our reads of the node, acquire for the reads of the owners that dropped it before us.  */
+        if (node == nullptr || node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+        _persistent_release(cnt, node->left);
+        _persistent_release(cnt, node->right);
+
+        node->~Node();
+        std::allocator_traits<container::node_allocator>::deallocate(cnt->_node_alloc, node, 1);
+    }
+
+    template<class Node>
+    Node *_persistent_share(Node *node) {
+        if (node) node->refs.fetch_add(1, std::memory_order_relaxed);
+
+        return node;
+    }
+
+    /* Makes the node held by link private to this map before it is changed: a shared node is copied, the copy
+       takes references to the same children and replaces it in link. The tree holds the same elements either way,
+       so a copy that throws leaves the map as it was.  */
+    template<class Container>
+    container::internal_ptr _persistent_unshare(Container *cnt, container::internal_ptr &link) {
+        container::internal_ptr node = link, copy;
+
+        /* Acquire pairs with the snapshots that dropped the node: whatever they read happened before we write.  */
+        if (node->refs.load(std::memory_order_acquire) == 1) return node;
+
+        copy = _persistent_new_node(cnt, node->data);
+        copy->left = _persistent_share(node->left);
+        copy->right = _persistent_share(node->right);
+        copy->color = node->color;
+
+        link = copy;
+        _persistent_release(cnt, node);
+
+        return copy;
+    }
+
+    /* Copies the shared nodes of a path from the root down, the nodes of the path are replaced by their copies.  */
+    template<class Container>
+    void _persistent_unshare_path(Container *cnt, persistent_path<container::node_type> &path) {
+        for (std::size_t i = 0 ; i < path.depth ; i++) {
+            path.nodes[i] = _persistent_unshare(cnt, _persistent_link(cnt, path, i));
+        }
+    }
+
+    /* Descends from the root towards key, the path ends at the element equivalent to key (and true is returned)
+       or at the node under which key would be linked.  */
+    template<class Container, typename Key>
+    bool _persistent_search(Container *cnt, const Key &key, persistent_path<container::node_type> &path) {
+        container::internal_ptr current = cnt->_root;
+
+        path.depth = 0;
+        while (current != nullptr) {
+            path.push(current);
+            if (cnt->_less(key, cnt->_get_key(current))) {
+                current = current->left;
+            }
+            else if (cnt->_less(cnt->_get_key(current), key)) {
+                current = current->right;
+            }
+            else {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    /* The path to the first element not less than key (upper: greater than key), empty for end.  */
+    template<class Container, typename Key>
+    persistent_path<container::node_type> _persistent_bound(const Container *cnt, const Key &key, bool upper) {
+        persistent_path<container::node_type> path;
+        container::internal_ptr current = cnt->_root;
+        std::size_t found = 0;
+
+        while (current != nullptr) {
+            path.push(current);
+            if (upper ? cnt->_less(key, cnt->_get_key(current)) : !cnt->_less(cnt->_get_key(current), key)) {
+                found = path.depth;
+                current = current->left;
+            }
+            else {
+                current = current->right;
+            }
+        }
+        path.depth = found;
+
+        return path;
+    }
+
+    template<class Node>
+    void _persistent_leftmost(Node *node, persistent_path<Node> &path) {
+        for (; node != nullptr ; node = node->left) path.push(node);
+    }
+
+    template<class Node>
+    void _persistent_rightmost(Node *node, persistent_path<Node> &path) {
+        for (; node != nullptr ; node = node->right) path.push(node);
+    }
+
+    /* Inorder successor, the last element steps to the empty path (end).  */
+    template<class Node>
+    void _persistent_increment(persistent_path<Node> &path) {
+        Node *child;
+
+        if (path.depth == 0) return;
+
+        if (path.top()->right) {
+            _persistent_leftmost(path.top()->right, path);
+            return;
+        }
+
+        do {
+            child = path.nodes[--path.depth];
+        } while (path.depth != 0 && path.top()->right == child);
+    }
+
+    /* Inorder predecessor, end steps to the last element.  */
+    template<class Node>
+    void _persistent_decrement(Node *root, persistent_path<Node> &path) {
+        Node *child;
+
+        if (path.depth == 0) {
+            _persistent_rightmost(root, path);
+            return;
+        }
+
+        if (path.top()->left) {
+            _persistent_rightmost(path.top()->left, path);
+            return;
+        }
+
+        do {
+            child = path.nodes[--path.depth];
+        } while (path.depth != 0 && path.top()->left == child);
+    }
+
+    template<class Node>
+    void _persistent_rotate_left(Node *&link) {
+        Node *node = link, *right = node->right;
+
+        node->right = right->left;
+        right->left = node;
+        link = right;
+    }
+
+    template<class Node>
+    void _persistent_rotate_right(Node *&link) {
+        Node *node = link, *left = node->left;
+
+        node->left = left->right;
+        left->right = node;
+        link = left;
+    }
+
+    /* Links the red node under the last node of an unshared search path and restores the colors.
+       A red node under a red parent is rebuilt together with its parent and grandparent into a red node
+       over two black ones, so only nodes of the path are changed and nothing has to be copied here.
+       On return the path leads to the new node.  */
+    template<class Container>
+    void _persistent_insert(Container *cnt, persistent_path<container::node_type> &path, container::internal_ptr node) {
+        using Node = container::node_type;
+        Node *inserted = node, *parent, *grand, *x, *y, *z, *a, *b, *c, *d;
+        std::size_t i;
+
+        if (path.depth == 0) {
+            cnt->_root = node;
+        }
+        else if (cnt->_less(cnt->_get_key(node), cnt->_get_key(path.top()))) {
+            path.top()->left = node;
+        }
+        else {
+            path.top()->right = node;
+        }
+        path.push(node);
+
+        for (i = path.depth - 1 ; i >= 2 && path.nodes[i - 1]->color == rbtree_internal::RED ; i -= 2) {
+            node = path.nodes[i];
+            parent = path.nodes[i - 1];
+            grand = path.nodes[i - 2];
+
+            /* x < y < z, with the subtrees a < x < b < y < c < z < d.  */
+            if (parent == grand->left) {
+                if (node == parent->left) {
+                    x = node, y = parent, z = grand;
+                    a = node->left, b = node->right, c = parent->right, d = grand->right;
+                }
+                else {
+                    x = parent, y = node, z = grand;
+                    a = parent->left, b = node->left, c = node->right, d = grand->right;
+                }
+            }
+            else {
+                if (node == parent->left) {
+                    x = grand, y = node, z = parent;
+                    a = grand->left, b = node->left, c = node->right, d = parent->right;
+                }
+                else {
+                    x = grand, y = parent, z = node;
+                    a = grand->left, b = parent->left, c = node->left, d = node->right;
+                }
+            }
+
+            _persistent_link(cnt, path, i - 2) = y;
+            x->left = a, x->right = b, x->color = rbtree_internal::BLACK;
+            z->left = c, z->right = d, z->color = rbtree_internal::BLACK;
+            y->left = x, y->right = z, y->color = rbtree_internal::RED;
+            path.nodes[i - 2] = y;
+        }
+
+        cnt->_root->color = rbtree_internal::BLACK;
+
+        /* Only the nodes under the last rebuilt one moved, walk down to the new node again from there.  */
+        path.depth = i + 1;
+        for (node = path.top() ; node != inserted ; path.push(node)) {
+            node = cnt->_less(cnt->_get_key(inserted), cnt->_get_key(node)) ? node->left : node->right;
+        }
+    }
+
+    /* Copies every shared node the erase fixup below is going to change, before anything changes.
+       The path ends at the parent of the removed black node, left tells on which side it was.
+       Only siblings on the way up are recolored, the walk stops at the first level that is fixed by rotations,
+       which also change the children of the sibling and, after a red sibling, the children of the new sibling.  */
+    template<class Container>
+    void _persistent_prepare_fixup(Container *cnt, persistent_path<container::node_type> path, bool left) {
+        using Node = container::node_type;
+        Node *parent, *sibling, *nephew;
+
+        while (path.depth != 0) {
+            parent = path.top();
+            sibling = _persistent_unshare(cnt, left ? parent->right : parent->left);
+
+            if (sibling->color == rbtree_internal::RED) {
+                nephew = _persistent_unshare(cnt, left ? sibling->left : sibling->right);
+                if (nephew->left) _persistent_unshare(cnt, nephew->left);
+                if (nephew->right) _persistent_unshare(cnt, nephew->right);
+                return;
+            }
+
+            if (_persistent_color(sibling->left) == rbtree_internal::RED || _persistent_color(sibling->right) == rbtree_internal::RED) {
+                if (sibling->left) _persistent_unshare(cnt, sibling->left);
+                if (sibling->right) _persistent_unshare(cnt, sibling->right);
+                return;
+            }
+
+            /* The sibling turns red and the missing black moves up, a red parent absorbs it.  */
+            if (parent->color == rbtree_internal::RED) return;
+
+            path.depth--;
+            if (path.depth != 0) left = path.top()->left == parent;
+        }
+    }
+
+    /* Restores the black height after a black node was removed under the last node of path (on the left side
+       when left is set). Every node it changes has been unshared by _persistent_prepare_fixup.  */
+    template<class Container>
+    void _persistent_erase_fixup(Container *cnt, persistent_path<container::node_type> &path, bool left) {
+        using Node = container::node_type;
+        Node *parent, *sibling, *node = left ? path.top()->left : path.top()->right;
+
+        while (path.depth != 0 && _persistent_color(node) == rbtree_internal::BLACK) {
+            parent = path.top();
+            sibling = left ? parent->right : parent->left;
+
+            if (sibling->color == rbtree_internal::RED) {
+                /* Rotate the red sibling above the parent, the new sibling is black.  */
+                sibling->color = rbtree_internal::BLACK;
+                parent->color = rbtree_internal::RED;
+                if (left) {
+                    _persistent_rotate_left(_persistent_link(cnt, path, path.depth - 1));
+                }
+                else {
+                    _persistent_rotate_right(_persistent_link(cnt, path, path.depth - 1));
+                }
+                path.nodes[path.depth - 1] = sibling;
+                path.push(parent);
+                sibling = left ? parent->right : parent->left;
+            }
+
+            if (_persistent_color(sibling->left) == rbtree_internal::BLACK && _persistent_color(sibling->right) == rbtree_internal::BLACK) {
+                sibling->color = rbtree_internal::RED;
+                node = parent;
+                path.depth--;
+                if (path.depth != 0) left = path.top()->left == node;
+                continue;
+            }
+
+            if (left) {
+                if (_persistent_color(sibling->right) == rbtree_internal::BLACK) {
+                    sibling->left->color = rbtree_internal::BLACK;
+                    sibling->color = rbtree_internal::RED;
+                    _persistent_rotate_right(parent->right);
+                    sibling = parent->right;
+                }
+                sibling->color = parent->color;
+                parent->color = rbtree_internal::BLACK;
+                sibling->right->color = rbtree_internal::BLACK;
+                _persistent_rotate_left(_persistent_link(cnt, path, path.depth - 1));
+            }
+            else {
+                if (_persistent_color(sibling->left) == rbtree_internal::BLACK) {
+                    sibling->right->color = rbtree_internal::BLACK;
+                    sibling->color = rbtree_internal::RED;
+                    _persistent_rotate_left(parent->left);
+                    sibling = parent->left;
+                }
+                sibling->color = parent->color;
+                parent->color = rbtree_internal::BLACK;
+                sibling->left->color = rbtree_internal::BLACK;
+                _persistent_rotate_right(_persistent_link(cnt, path, path.depth - 1));
+            }
+            return;
+        }
+
+        if (node) node->color = rbtree_internal::BLACK;
+    }
+
+    /* Erases the element at the end of the search path. Everything that can throw (the copies of shared nodes)
+       is done before the tree changes shape.  */
+    template<class Container>
+    void _persistent_erase(Container *cnt, persistent_path<container::node_type> &path) {
+        using Node = container::node_type;
+        Node *erased, *removed, *child;
+        std::size_t at = path.depth - 1;
+        color_t removed_color;
+        bool left;
+
+        /* An element with two children is replaced by its successor, which is unlinked instead.  */
+        if (path.top()->left && path.top()->right) _persistent_leftmost(path.top()->right, path);
+
+        _persistent_unshare_path(cnt, path);
+        erased = path.nodes[at];
+        removed = path.top();
+        removed_color = removed->color;
+        left = path.depth >= 2 && path.nodes[path.depth - 2]->left == removed;
+        path.depth--;
+
+        /* The only child of a black node is red and turns black, a black leaf leaves a black height to restore.  */
+        if (removed_color == rbtree_internal::BLACK) {
+            if (removed->left || removed->right) {
+                _persistent_unshare(cnt, removed->left ? removed->left : removed->right);
+            }
+            else {
+                _persistent_prepare_fixup(cnt, path, left);
+            }
+        }
+
+        /* Unlink the removed node, its child takes its place.  */
+        child = removed->left ? removed->left : removed->right;
+        if (path.depth == 0) {
+            cnt->_root = child;
+        }
+        else if (left) {
+            path.top()->left = child;
+        }
+        else {
+            path.top()->right = child;
+        }
+
+        /* The successor takes the place, children and color of the erased element.  */
+        if (removed != erased) {
+            removed->left = erased->left;
+            removed->right = erased->right;
+            removed->color = erased->color;
+            _persistent_link(cnt, path, at) = removed;
+            path.nodes[at] = removed;
+        }
+
+        erased->left = erased->right = nullptr;
+        _persistent_release(cnt, erased);
+
+        if (removed_color == rbtree_internal::BLACK) {
+            if (child) {
+                child->color = rbtree_internal::BLACK;
+            }
+            else if (path.depth != 0) {
+                _persistent_erase_fixup(cnt, path, left);
+            }
+        }
+    }
+}
@@ -1,11 +1,20 @@
 #pragma once
 
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
 
 namespace rbtree_internal {
 
     using color_t = int8_t;
     using balance_t = int8_t;
+    using neighbor_t = int8_t;
+    using set_operation_t = int8_t;
 
     enum color : color_t {
         RED,
@@ -17,35 +26,214 @@ namespace rbtree_internal {
         INSERTION
     };
 
+    /* Where a hinted insertion links the new node relative to the neighbor it found.  */
+    enum neighbor_type : neighbor_t {
+        NEIGHBOR_NONE,
+        NEIGHBOR_EQUAL,
+        NEIGHBOR_LEFT,
+        NEIGHBOR_RIGHT
+    };
+
+    /* The result of set_union, set_intersection and set_difference.  */
+    enum set_operation : set_operation_t {
+        SET_UNION,
+        SET_INTERSECTION,
+        SET_DIFFERENCE
+    };
+
     #define container typename Container
 
+    /* Heterogeneous lookups (find(K), lower_bound(K) ...) are only enabled when
+       the comparator declares is_transparent, or when K is the key type itself.  */
+    template<class Compare, class Key, class K, class = void>
+    struct is_lookup_key : std::is_same<K, Key> {};
+
+    template<class Compare, class Key, class K>
+    struct is_lookup_key<Compare, Key, K, typename std::conditional<true, void, typename Compare::is_transparent>::type> : std::true_type {};
+
+    template<class Compare, class Key, class K>
+    using enable_lookup = typename std::enable_if<is_lookup_key<Compare, Key, K>::value, int>::type;
+
+    /* Range constructors and inserts only take part in overload resolution for iterators.  */
+    template<class It>
+    using enable_if_iterator = typename std::enable_if<std::is_convertible<typename std::iterator_traits<It>::iterator_category, std::input_iterator_tag>::value, int>::type;
+
+    /* The color is kept in the lowest bit of the parent pointer, always clear since nodes hold pointers
+       and are aligned to them. Three words of links per node instead of three and a padded color byte.  */
     template<typename T>
     struct rb_node {
         T data;
         rb_node *left;
         rb_node *right;
-        rb_node *parent;
-        color_t color;
+        std::uintptr_t parent_color;
 
-        rb_node() : data(), left(nullptr), right(nullptr), parent(nullptr), color(RED) {}
-        explicit rb_node(const T &val) : data(val), left(nullptr), right(nullptr), parent(nullptr), color(RED) {}
-        explicit rb_node(T &&val) : data(std::forward<T>(val)), left(nullptr), right(nullptr), parent(nullptr), color(RED) {}
+        rb_node() : data(), left(nullptr), right(nullptr), parent_color(RED) {}
+        explicit rb_node(const T &val) : data(val), left(nullptr), right(nullptr), parent_color(RED) {}
+        explicit rb_node(T &&val) : data(std::forward<T>(val)), left(nullptr), right(nullptr), parent_color(RED) {}
         template<typename... Args>
-        rb_node(Args&&... args) : data(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent(nullptr), color(RED) {}
+        rb_node(Args&&... args) : data(std::forward<Args>(args)...), left(nullptr), right(nullptr), parent_color(RED) {}
         explicit rb_node(const rb_node &node) = default;
         explicit rb_node(rb_node &&node) = default;
 
         rb_node &operator=(const rb_node &node) = default;
+
+        rb_node *parent() const {
+            return reinterpret_cast<rb_node*>(parent_color & ~(std::uintptr_t) 1);
+        }
+
+        void set_parent(rb_node *tnode) {
+            parent_color = reinterpret_cast<std::uintptr_t>(tnode) | (parent_color & 1);
+        }
+
+        color_t color() const {
+            return (color_t) (parent_color & 1);
+        }
+
+        void set_color(color_t color) {
+            parent_color = (parent_color & ~(std::uintptr_t) 1) | (std::uintptr_t) color;
+        }
+    };
+
+    static_assert(alignof(rb_node<char>) > 1, "The color needs the lowest bit of aligned node pointers.");
+
+    /* Node of the containers with order statistics, count is the number of elements in its subtree.  */
+    template<typename T>
+    struct rb_counted_node : rb_node<T> {
+        std::size_t count;
+
+        template<typename... Args>
+        rb_counted_node(Args&&... args) : rb_node<T>(std::forward<Args>(args)...), count(1) {}
+    };
+
+    /* The sentinel of a tree container, the end() node. Its left child is the root, it also caches the
+       first and the last node (nullptr when empty) so begin(), rbegin() and hints at either end need no descent.  */
+    template<typename Node, typename T>
+    struct rb_sentinel : Node {
+        rb_node<T> *first;
+        rb_node<T> *last;
+
+        rb_sentinel() : Node(), first(nullptr), last(nullptr) {}
+    };
+
+    /* The Stats parameter of the tree containers.
+       order_statistics keeps subtree sizes in every node for nth(), rank() and distance() in O(log n),
+       at the cost of a counter per node and a walk up to the root on every insertion and erasure.  */
+    struct no_order_statistics {
+        template<typename T>
+        using node = rb_node<T>;
+
+        static constexpr bool value = false;
+    };
+
+    struct order_statistics {
+        template<typename T>
+        using node = rb_counted_node<T>;
+
+        static constexpr bool value = true;
     };
 
+    /* Allocators that declare releases_on_destruction give every node back when their last owner is destroyed
+       and tell their owners with use_count(). A tree of trivially destructible elements whose allocators are
+       the last owners can then be dropped without visiting its nodes.  */
+    template<class Alloc, class = void>
+    struct releases_on_destruction : std::false_type {};
+
+    template<class Alloc>
+    struct releases_on_destruction<Alloc, typename std::conditional<true, void, typename Alloc::releases_on_destruction>::type> : Alloc::releases_on_destruction {};
+
+    template<class Alloc>
+    bool _rbtree_last_owners(const Alloc &alloc, std::size_t owners, std::true_type) {
+        return alloc.use_count() == owners;
+    }
+
+    template<class Alloc>
+    bool _rbtree_last_owners(const Alloc &, std::size_t, std::false_type) {
+        return false;
+    }
+
+    /* owners is the number of allocators of the container sharing alloc's pool.  */
+    template<class Alloc, class T>
+    bool _rbtree_can_drop_nodes(const Alloc &alloc, std::size_t owners = 1) {
+        return _rbtree_last_owners(alloc, owners, std::integral_constant<bool, releases_on_destruction<Alloc>::value &&
+                                                                              std::is_trivially_destructible<T>::value>());
+    }
+
+    /* Nodes are allocated through the container's (rebound) allocator, its pointer type must be a plain pointer.  */
+    template<class Alloc, typename... Args>
+    typename std::allocator_traits<Alloc>::value_type *_rbtree_new_node(Alloc &alloc, Args &&... args) {
+        using traits = std::allocator_traits<Alloc>;
+        typename traits::value_type *tnode = traits::allocate(alloc, 1);
+
+        try {
+            traits::construct(alloc, tnode, std::forward<Args>(args)...);
+        } catch (...) {
+            traits::deallocate(alloc, tnode, 1);
+            throw;
+        }
+
+        return tnode;
+    }
+
+    /* The sentinel is allocated through the node allocator rebound to Sentinel.  */
+    template<class Sentinel, class Alloc>
+    Sentinel *_rbtree_new_sentinel(const Alloc &alloc) {
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Sentinel> sentinel_alloc(alloc);
+
+        return _rbtree_new_node(sentinel_alloc);
+    }
+
+    template<class Sentinel, class Alloc, typename T>
+    void _rbtree_delete_sentinel(const Alloc &alloc, rb_node<T> *sentinel) {
+        typename std::allocator_traits<Alloc>::template rebind_alloc<Sentinel> sentinel_alloc(alloc);
+
+        _rbtree_delete_node(sentinel_alloc, sentinel);
+    }
+
+    template<class Sentinel, typename T>
+    rb_node<T> *_rbtree_first(rb_node<T> *sentinel) {
+        return static_cast<Sentinel*>(sentinel)->first;
+    }
+
+    template<class Sentinel, typename T>
+    rb_node<T> *_rbtree_last(rb_node<T> *sentinel) {
+        return static_cast<Sentinel*>(sentinel)->last;
+    }
+
+    /* Caches the first and the last node of the tree rooted at root again, after changes that may have removed them.  */
+    template<class Sentinel, typename T>
+    void _rbtree_reset_bounds(rb_node<T> *sentinel, decltype(sentinel) root) {
+        auto header = static_cast<Sentinel*>(sentinel);
+
+        header->first = header->last = root;
+        if (root == nullptr) return;
+
+        while (header->first->left) header->first = header->first->left;
+        while (header->last->right) header->last = header->last->right;
+    }
+
+    /* tnode may point to the base rb_node of the allocator's node type.  */
+    template<class Alloc, typename Node>
+    void _rbtree_delete_node(Alloc &alloc, Node *tnode) {
+        using traits = std::allocator_traits<Alloc>;
+        auto *node = static_cast<typename traits::value_type*>(tnode);
+
+        traits::destroy(alloc, node);
+        traits::deallocate(alloc, node, 1);
+    }
+
+    /* Frees the nodes of the subtree rooted at tnode, returns the number of elements they held.  */
     template<class Container>
-    void _rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode) {
+    std::size_t _rbtree_destruct(Container *cnt, rb_node<container::node_type> *tnode) {
+        std::size_t size = 0;
+
         if (tnode) {
-            _rbtree_destruct(cnt, tnode->left);
-            _rbtree_destruct(cnt, tnode->right);
+            size += _rbtree_destruct(cnt, tnode->left);
+            size += _rbtree_destruct(cnt, tnode->right);
 
-            cnt->_clear_node(tnode);
+            size += cnt->_clear_node(tnode);
         }
+
+        return size;
     }
 
     template<class Container>
@@ -60,14 +248,14 @@ namespace rbtree_internal {
 
     template<class Container>
     rb_node<container::node_type> *_rbtree_parent_of(rb_node<container::node_type> *tnode) {
-        return tnode ? tnode->parent : nullptr;
+        return tnode ? tnode->parent() : nullptr;
     }
 
     template<class Container>
     rb_node<container::node_type> *_rbtree_grandparent_of(rb_node<container::node_type> *tnode) {
         if (tnode) {
-            if (tnode->parent) {
-                return tnode->parent->parent;
+            if (tnode->parent()) {
+                return tnode->parent()->parent();
             }
         }
         return nullptr;
@@ -75,12 +263,51 @@ namespace rbtree_internal {
 
     template<class Container>
     void _rbtree_set_color(rb_node<container::node_type> *tnode, color_t color) {
-        if (tnode) tnode->color = color;
+        if (tnode) tnode->set_color(color);
     }
 
     template<class Container>
     color_t _rbtree_get_color(rb_node<container::node_type> *tnode) {
-        return tnode ? tnode->color : BLACK;
+        return tnode ? tnode->color() : (color_t) BLACK;
+    }
+
+    /* Subtree sizes, only touched when the container keeps order statistics.  */
+    template<class Container>
+    std::size_t _rbtree_count(rb_node<container::node_type> *tnode) {
+        return tnode ? static_cast<rb_counted_node<container::node_type>*>(tnode)->count : 0;
+    }
+
+    template<class Container>
+    void _rbtree_set_count(rb_node<container::node_type> *tnode, std::size_t count) {
+        static_cast<rb_counted_node<container::node_type>*>(tnode)->count = count;
+    }
+
+    /* Elements held by tnode itself, more than one for the lists of multiset and multimap.  */
+    template<class Container>
+    std::size_t _rbtree_weight(rb_node<container::node_type> *tnode) {
+        return _rbtree_count<Container>(tnode) - _rbtree_count<Container>(tnode->left) - _rbtree_count<Container>(tnode->right);
+    }
+
+    /* Adds delta (which may wrap around, to subtract) to tnode and every ancestor up to the root.  */
+    template<class Container>
+    void _rbtree_add_count(rb_node<container::node_type> *tnode, rb_node<container::node_type> *sentinel, std::size_t delta) {
+        if (!Container::stats_type::value) return;
+
+        for (; tnode != nullptr && tnode != sentinel ; tnode = tnode->parent()) {
+            _rbtree_set_count<Container>(tnode, _rbtree_count<Container>(tnode) + delta);
+        }
+    }
+
+    /* top was rotated below new_top, which now roots the same elements, moved changed sides from new_top to top.  */
+    template<class Container>
+    void _rbtree_rotate_count(rb_node<container::node_type> *top, rb_node<container::node_type> *new_top, rb_node<container::node_type> *moved) {
+        std::size_t total;
+
+        if (!Container::stats_type::value) return;
+
+        total = _rbtree_count<Container>(top);
+        _rbtree_set_count<Container>(top, total - _rbtree_count<Container>(new_top) + _rbtree_count<Container>(moved));
+        _rbtree_set_count<Container>(new_top, total);
     }
 
     template<class Container>
@@ -92,10 +319,10 @@ namespace rbtree_internal {
             left_right_child = left_child->right;
 
             tnode->left = left_right_child;
-            if (left_right_child) left_right_child->parent = tnode;
+            if (left_right_child) left_right_child->set_parent(tnode);
 
-            p_node = tnode->parent;
-            left_child->parent = p_node;
+            p_node = tnode->parent();
+            left_child->set_parent(p_node);
 
             if (p_node == nullptr) {
                 *root = left_child;
@@ -105,8 +332,10 @@ namespace rbtree_internal {
                 p_node->left = left_child;
             }
 
+            _rbtree_rotate_count<Container>(tnode, left_child, left_right_child);
+
             left_child->right = tnode;
-            tnode->parent = left_child;
+            tnode->set_parent(left_child);
         }
     }
 
@@ -119,10 +348,10 @@ namespace rbtree_internal {
             right_left_child = right_child->left;
 
             tnode->right = right_left_child;
-            if (right_left_child) right_left_child->parent = tnode;
+            if (right_left_child) right_left_child->set_parent(tnode);
 
-            p_node = tnode->parent;
-            right_child->parent = p_node;
+            p_node = tnode->parent();
+            right_child->set_parent(p_node);
 
             if (p_node == nullptr) {
                 *root = right_child;
@@ -132,8 +361,10 @@ namespace rbtree_internal {
                 p_node->right = right_child;
             }
 
+            _rbtree_rotate_count<Container>(tnode, right_child, right_left_child);
+
             right_child->left = tnode;
-            tnode->parent = right_child;
+            tnode->set_parent(right_child);
         }
     }
 
@@ -207,11 +438,11 @@ namespace rbtree_internal {
             }
         }
         else if (btype == INSERTION) {
-            tnode->color = RED;
-            (*root)->parent = nullptr;
+            tnode->set_color(RED);
+            (*root)->set_parent(nullptr);
 
             while (tnode != sentinel && tnode != *root) {
-                if (tnode->parent->color != RED) {
+                if (tnode->parent()->color() != RED) {
                     break;
                 }
 
@@ -274,10 +505,10 @@ namespace rbtree_internal {
                     current = current->left;
                 }
             } else {
-                current = tnode->parent;
+                current = tnode->parent();
                 while (current != nullptr && tnode == current->right) {
                     tnode = current;
-                    current = current->parent;
+                    current = current->parent();
                 }
             }
         }
@@ -293,7 +524,7 @@ namespace rbtree_internal {
             added_new = true;
             cnt->_root = cnt->_construct_new_element(std::forward<V>(val));
             cnt->_sentinel->left = cnt->_root;
-            cnt->_root->parent = cnt->_sentinel;
+            cnt->_root->set_parent(cnt->_sentinel);
             return cnt->_root;
         }
 
@@ -307,7 +538,7 @@ namespace rbtree_internal {
                     added_new = true;
                     new_node = cnt->_construct_new_element(std::forward<V>(val));
                     current->left = new_node;
-                    new_node->parent = current;
+                    new_node->set_parent(current);
 
                     return new_node;
                 }
@@ -319,7 +550,7 @@ namespace rbtree_internal {
                     added_new = true;
                     new_node = cnt->_construct_new_element(std::forward<V>(val));
                     current->right = new_node;
-                    new_node->parent = current;
+                    new_node->set_parent(current);
 
                     return new_node;
                 }
@@ -331,6 +562,31 @@ namespace rbtree_internal {
         }
     }
 
+    /* Rebalances after tnode was linked as a new leaf and counts it.  */
+    template<class Container, typename R>
+    R _rbtree_insert_fixup(Container *cnt, rb_node<container::node_type> *tnode) {
+        auto header = static_cast<container::sentinel_type*>(cnt->_sentinel);
+
+        /* Rotations keep the order, only a new leaf left of the first or right of the last node moves the bounds.  */
+        if (cnt->_size == 0) {
+            header->first = header->last = tnode;
+        } else {
+            if (tnode->parent() == header->first && tnode == header->first->left) header->first = tnode;
+            if (tnode->parent() == header->last && tnode == header->last->right) header->last = tnode;
+        }
+
+        /* The new node already counts itself.  */
+        _rbtree_add_count<Container>(tnode->parent(), cnt->_sentinel, 1);
+        _rbtree_restore_balance<Container>(&(cnt->_root), cnt->_sentinel, tnode, INSERTION);
+
+        cnt->_root->set_color(BLACK);
+        cnt->_sentinel->left = cnt->_root;
+        cnt->_root->set_parent(cnt->_sentinel);
+        cnt->_size++;
+
+        return cnt->_handle_elem_not_found(tnode);
+    }
+
     /* Container functions.  */
     template<class Container, typename R, typename K, typename V, typename... Args>
     R _rbtree_insert(Container *cnt, const K &key, V val, Args &&... args) {
@@ -343,24 +599,289 @@ namespace rbtree_internal {
 
         if (!added_new) return cnt->_handle_elem_found(current, std::forward<Args>(args)...);
 
-        _rbtree_restore_balance<Container>(&(cnt->_root), cnt->_sentinel, current, INSERTION);
+        return _rbtree_insert_fixup<Container, R>(cnt, current);
+    }
+
+    /* Finds where key goes next to hint, the element the new one should precede.
+       Only the neighbors of hint are compared, with a wrong hint NEIGHBOR_NONE is returned.  */
+    template<class Container, typename K>
+    neighbor_t _rbtree_hint_position(Container *cnt, rb_node<container::node_type> *hint, const K &key, rb_node<container::node_type> **parent) {
+        rb_node<container::node_type> *sentinel, *prev, *next;
+
+        sentinel = cnt->_sentinel;
+        if (hint == sentinel || cnt->_less(key, cnt->_get_key(hint))) {
+            /* key goes right before hint, check the predecessor.  */
+            if (hint == sentinel) {
+                prev = _rbtree_last<container::sentinel_type>(sentinel);
+            } else if (hint == _rbtree_first<container::sentinel_type>(sentinel)) {
+                prev = sentinel;
+            } else if (hint->left) {
+                prev = hint->left;
+                while (prev->right) prev = prev->right;
+            } else {
+                next = hint;
+                prev = hint->parent();
+                while (prev != sentinel && next == prev->left) {
+                    next = prev;
+                    prev = prev->parent();
+                }
+            }
+
+            if (prev == sentinel || cnt->_less(cnt->_get_key(prev), key)) {
+                /* Either hint has no left child or its predecessor has no right child.  */
+                if (hint != sentinel && hint->left == nullptr) {
+                    *parent = hint;
+                    return NEIGHBOR_LEFT;
+                }
+                *parent = prev;
+                return NEIGHBOR_RIGHT;
+            }
+
+            *parent = prev;
+            return cnt->_less(key, cnt->_get_key(prev)) ? NEIGHBOR_NONE : NEIGHBOR_EQUAL;
+        }
+
+        if (cnt->_less(cnt->_get_key(hint), key)) {
+            /* key goes right after hint, check the successor.  */
+            if (hint == _rbtree_last<container::sentinel_type>(sentinel)) {
+                next = sentinel;
+            } else if (hint->right) {
+                next = hint->right;
+                while (next->left) next = next->left;
+            } else {
+                prev = hint;
+                next = hint->parent();
+                while (next != sentinel && prev == next->right) {
+                    prev = next;
+                    next = next->parent();
+                }
+            }
+
+            if (next == sentinel || cnt->_less(key, cnt->_get_key(next))) {
+                if (hint->right == nullptr) {
+                    *parent = hint;
+                    return NEIGHBOR_RIGHT;
+                }
+                *parent = next;
+                return NEIGHBOR_LEFT;
+            }
+
+            *parent = next;
+            return cnt->_less(cnt->_get_key(next), key) ? NEIGHBOR_NONE : NEIGHBOR_EQUAL;
+        }
+
+        *parent = hint;
+        return NEIGHBOR_EQUAL;
+    }
+
+    /* Insertion next to a hint, a right hint costs at most two comparisons instead of a descent from the root.  */
+    template<class Container, typename R, typename K, typename V, typename... Args>
+    R _rbtree_insert_hint(Container *cnt, rb_node<container::node_type> *hint, const K &key, V val, Args &&... args) {
+        rb_node<container::node_type> *parent, *new_node;
+        neighbor_t side;
+
+        side = cnt->empty() ? (neighbor_t) NEIGHBOR_NONE : _rbtree_hint_position<Container, K>(cnt, hint, key, &parent);
+
+        if (side == NEIGHBOR_NONE) return _rbtree_insert<Container, R, K, V>(cnt, key, std::forward<V>(val), std::forward<Args>(args)...);
+        if (side == NEIGHBOR_EQUAL) return cnt->_handle_elem_found(parent, std::forward<Args>(args)...);
+
+        new_node = cnt->_construct_new_element(std::forward<V>(val));
+        if (side == NEIGHBOR_LEFT) parent->left = new_node;
+        else parent->right = new_node;
+        new_node->set_parent(parent);
+
+        return _rbtree_insert_fixup<Container, R>(cnt, new_node);
+    }
+
+    /* Links the first n nodes of a list chained through right into a balanced tree, O(n).
+       The levels above red_depth are full, coloring the nodes on red_depth red keeps the black height equal.  */
+    template<class Container>
+    rb_node<container::node_type> *_rbtree_build_balanced(rb_node<container::node_type> **head, std::size_t n, std::size_t depth, std::size_t red_depth) {
+        rb_node<container::node_type> *left, *tnode;
+
+        if (n == 0) return nullptr;
+
+        left = _rbtree_build_balanced<Container>(head, n / 2, depth + 1, red_depth);
+
+        tnode = *head;
+        *head = tnode->right;
+
+        tnode->left = left;
+        if (left) left->set_parent(tnode);
+
+        tnode->right = _rbtree_build_balanced<Container>(head, n - n / 2 - 1, depth + 1, red_depth);
+        if (tnode->right) tnode->right->set_parent(tnode);
+
+        tnode->set_color(depth == red_depth ? RED : BLACK);
+        if (Container::stats_type::value) _rbtree_set_count<Container>(tnode, n);
+
+        return tnode;
+    }
+
+    template<class Container>
+    void _rbtree_link_sorted(Container *cnt, rb_node<container::node_type> *head, std::size_t n) {
+        std::size_t red_depth = 0;
+
+        if (n == 0) return;
+
+        /* The deepest level that is full is the one above floor(log2(n + 1)).  */
+        while (((std::size_t) 2 << red_depth) - 1 <= n) red_depth++;
 
-        cnt->_root->color = BLACK;
+        cnt->_root = _rbtree_build_balanced<Container>(&head, n, 0, red_depth);
+        cnt->_root->set_parent(cnt->_sentinel);
         cnt->_sentinel->left = cnt->_root;
-        cnt->_root->parent = cnt->_sentinel;
-        cnt->_size++;
+        cnt->_size = n;
+        _rbtree_reset_bounds<container::sentinel_type>(cnt->_sentinel, cnt->_root);
+    }
 
-        return cnt->_handle_elem_not_found(current);
+    /* Inserts [first, last), loading an empty tree in O(n) as long as the input is sorted.
+       Nodes are allocated in key order and collected into a list, equivalent keys after the first are dropped.
+       Once an element is out of order the list so far becomes the tree and the rest is inserted one by one.  */
+    template<class Container, class InputIt>
+    void _rbtree_insert_range(Container *cnt, InputIt first, InputIt last, bool assume_sorted) {
+        rb_node<container::node_type> *head, *tail, *tnode;
+        std::size_t n;
+        bool unsorted;
+
+        if (!cnt->empty()) {
+            for (; first != last; ++first) cnt->insert(*first);
+            return;
+        }
+
+        head = tail = tnode = nullptr;
+        n = 0;
+        unsorted = false;
+        try {
+            for (; first != last; ++first) {
+                tnode = _rbtree_new_node(cnt->_node_alloc, *first);
+
+                if (tail && !assume_sorted && !cnt->_less(cnt->_get_key(tail), cnt->_get_key(tnode))) {
+                    if (cnt->_less(cnt->_get_key(tnode), cnt->_get_key(tail))) {
+                        unsorted = true;
+                        break;
+                    }
+
+                    _rbtree_delete_node(cnt->_node_alloc, tnode);
+                    continue;
+                }
+
+                if (tail) tail->right = tnode;
+                else head = tnode;
+                tail = tnode;
+                n++;
+            }
+        } catch (...) {
+            while (head) {
+                tnode = head;
+                head = head->right;
+                _rbtree_delete_node(cnt->_node_alloc, tnode);
+            }
+            throw;
+        }
+
+        _rbtree_link_sorted<Container>(cnt, head, n);
+
+        if (unsorted) {
+            _rbtree_insert<Container, std::pair<container::iterator, bool>, container::key_type, rb_node<container::node_type>*>(cnt, cnt->_get_key(tnode), tnode, container::to_delete(tnode));
+            for (++first; first != last; ++first) cnt->insert(*first);
+        }
+    }
+
+    /* Takes the elements of current out of the counts before _rbtree_prepare_erase unlinks a node.
+       With two children the successor's elements move up into current, so the nodes between them lose those too.
+       The node that gets unlinked is left counting only its remaining child, rotations stay consistent meanwhile.  */
+    template<class Container>
+    void _rbtree_erase_count(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor) {
+        rb_node<container::node_type> *tnode;
+        std::size_t erased, moved;
+
+        if (!Container::stats_type::value) return;
+
+        erased = _rbtree_weight<Container>(current);
+        if (current->left != nullptr && current->right != nullptr) {
+            moved = _rbtree_weight<Container>(successor);
+            for (tnode = successor ; tnode != current ; tnode = tnode->parent()) {
+                _rbtree_set_count<Container>(tnode, _rbtree_count<Container>(tnode) - moved);
+            }
+        }
+
+        _rbtree_add_count<Container>(current, cnt->_sentinel, (std::size_t) 0 - erased);
+    }
+
+    /* Order statistics.  */
+    template<class Container>
+    rb_node<container::node_type> *_rbtree_select(Container *cnt, std::size_t &k) {
+        rb_node<container::node_type> *current;
+        std::size_t left, weight;
+
+        current = cnt->_root;
+        while (current) {
+            left = _rbtree_count<Container>(current->left);
+            weight = _rbtree_weight<Container>(current);
+
+            if (k < left) {
+                current = current->left;
+            } else if (k < left + weight) {
+                /* k is now the position inside the node.  */
+                k -= left;
+                return current;
+            } else {
+                k -= left + weight;
+                current = current->right;
+            }
+        }
+
+        return cnt->_sentinel;
+    }
+
+    /* Number of elements whose key is less than key.  */
+    template<class Container, typename K>
+    std::size_t _rbtree_rank(Container *cnt, const K &key) {
+        rb_node<container::node_type> *current;
+        std::size_t rank = 0;
+
+        current = cnt->_root;
+        while (current) {
+            if (cnt->_less(cnt->_get_key(current), key)) {
+                rank += _rbtree_count<Container>(current) - _rbtree_count<Container>(current->right);
+                current = current->right;
+            } else {
+                current = current->left;
+            }
+        }
+
+        return rank;
+    }
+
+    /* Position of the first element held by tnode, size() for the sentinel.  */
+    template<class Container>
+    std::size_t _rbtree_index(Container *cnt, rb_node<container::node_type> *tnode) {
+        std::size_t index;
+
+        if (tnode == cnt->_sentinel) return cnt->_size;
+
+        index = _rbtree_count<Container>(tnode->left);
+        for (; tnode != cnt->_root ; tnode = tnode->parent()) {
+            if (tnode == tnode->parent()->right) {
+                index += _rbtree_count<Container>(tnode->parent()) - _rbtree_count<Container>(tnode);
+            }
+        }
+
+        return index;
     }
 
     template<class Container>
     rb_node<container::node_type> * _rbtree_prepare_erase(Container *cnt, rb_node<container::node_type> *current, rb_node<container::node_type> *successor) {
         rb_node<container::node_type> *r_node, *parent_node;
 
+        _rbtree_erase_count<Container>(cnt, current, successor);
+
         /* If this node is not a leaf and has both children.  */
         if (current->left != nullptr && current->right != nullptr) {
-            /* Get the minimum value of the right subtree.  */
-            current->data = std::move(successor->data);
+            /* Get the minimum value of the right subtree, the erased data goes to the node that is unlinked.
+               Swapping matters for multiset and multimap, whose data is the list the caller frees afterwards.  */
+            using std::swap;
+            swap(current->data, successor->data);
             current = successor;
         }
 
@@ -368,8 +889,8 @@ namespace rbtree_internal {
 
         /* If node has one child.  */
         if (r_node != nullptr) {
-            r_node->parent = current->parent;
-            parent_node = current->parent;
+            r_node->set_parent(current->parent());
+            parent_node = current->parent();
             
             if (parent_node == nullptr) {
                 cnt->_root =  r_node;
@@ -383,14 +904,14 @@ namespace rbtree_internal {
 
             current->right = nullptr;
             current->left = nullptr;
-            current->parent = nullptr;
+            current->set_parent(nullptr);
 
             if (_rbtree_get_color<Container>(current) == BLACK) {
                 /* Balance only if its a black node.  */
                 _rbtree_restore_balance<Container>(&(cnt->_root), cnt->_sentinel, r_node, DELETION);
             }
         }
-        else if (current->parent == nullptr) {
+        else if (current->parent() == nullptr) {
             return cnt->_root;
         }
         else {
@@ -400,7 +921,7 @@ namespace rbtree_internal {
                 _rbtree_restore_balance<Container>(&(cnt->_root), cnt->_sentinel, current, DELETION);
             }
 
-            parent_node = current->parent;
+            parent_node = current->parent();
             if (parent_node != nullptr) {
                 if (current == parent_node->left) {
                     parent_node->left = nullptr;
@@ -408,15 +929,15 @@ namespace rbtree_internal {
                 else if (current == parent_node->right) {
                     parent_node->right = nullptr;
                 }
-                current->parent = nullptr;
+                current->set_parent(nullptr);
             }
         }
 
         return current;        
     }
 
-    template<class Container>
-    container::iterator _rbtree_find(Container *cnt, const container::key_type &key) {
+    template<class Container, typename K>
+    container::iterator _rbtree_find(Container *cnt, const K &key) {
         container::internal_ptr current;
         
         current = cnt->_root;        
@@ -436,19 +957,417 @@ namespace rbtree_internal {
     }
 
     template<class Container>
-    bool _rbtree_is_equal_key(Container *cnt, const container::key_type &lhs_key, const container::key_type &rhs_key) {
-        return !cnt->_less(lhs_key, rhs_key) && !cnt->_less(rhs_key, lhs_key);
+    rb_node<container::node_type> *_rbtree_minimum(rb_node<container::node_type> *tnode) {
+        while (tnode->left) tnode = tnode->left;
+        return tnode;
+    }
+
+    template<class Container>
+    rb_node<container::node_type> *_rbtree_maximum(rb_node<container::node_type> *tnode) {
+        while (tnode->right) tnode = tnode->right;
+        return tnode;
+    }
+
+    /* First node whose key is not less than key, or greater than key when upper is set, nullptr if there is none.
+       A single descent that remembers the last node where it turned left.  */
+    template<class Container, typename K>
+    rb_node<container::node_type> *_rbtree_bound(Container *cnt, const K &key, bool upper) {
+        rb_node<container::node_type> *current, *bound;
+
+        current = cnt->_root;
+        bound = nullptr;
+        while (current) {
+            if (upper ? cnt->_less(key, cnt->_get_key(current)) : !cnt->_less(cnt->_get_key(current), key)) {
+                bound = current;
+                current = current->left;
+            } else {
+                current = current->right;
+            }
+        }
+
+        return bound;
+    }
+
+    /* Lower and upper bound of key in one descent, nullptr standing for the end. Both follow the same path down
+       to the first node equivalent to key, the lower bound then lies in its left subtree and the upper bound in
+       its right one. With K the key type no other node is equivalent and both are found without comparisons.  */
+    template<class Container, typename K>
+    std::pair<rb_node<container::node_type>*, rb_node<container::node_type>*> _rbtree_equal_range(Container *cnt, const K &key) {
+        rb_node<container::node_type> *current, *lower, *upper, *tnode;
+
+        current = cnt->_root;
+        upper = nullptr;
+        while (current) {
+            if (cnt->_less(cnt->_get_key(current), key)) {
+                current = current->right;
+            } else if (cnt->_less(key, cnt->_get_key(current))) {
+                upper = current;
+                current = current->left;
+            } else {
+                break;
+            }
+        }
+
+        if (current == nullptr) return {upper, upper};
+
+        lower = current;
+        if (std::is_same<K, container::key_type>::value) {
+            if (current->right) upper = _rbtree_minimum<Container>(current->right);
+            return {lower, upper};
+        }
+
+        for (tnode = current->left ; tnode ; ) {
+            if (cnt->_less(cnt->_get_key(tnode), key)) {
+                tnode = tnode->right;
+            } else {
+                lower = tnode;
+                tnode = tnode->left;
+            }
+        }
+
+        for (tnode = current->right ; tnode ; ) {
+            if (cnt->_less(key, cnt->_get_key(tnode))) {
+                upper = tnode;
+                tnode = tnode->left;
+            } else {
+                tnode = tnode->right;
+            }
+        }
+
+        return {lower, upper};
+    }
+
+    /* Split and join.
+       Black nodes on a path from tnode down to a leaf, tnode included.  */
+    template<class Container>
+    std::size_t _rbtree_black_height(rb_node<container::node_type> *tnode) {
+        std::size_t height = 0;
+
+        for (; tnode ; tnode = tnode->left) {
+            if (tnode->color() == BLACK) height++;
+        }
+
+        return height;
+    }
+
+    /* Links pivot between two detached trees whose black heights are known, every key of left goes before pivot
+       and every key of right after it. The red pivot replaces the black node of the other tree's black height on the
+       inner spine of the taller tree and the insertion fixup repairs a red parent, O(|left_height - right_height| + 1).
+       With order statistics pivot counts only its own elements. Returns the new root, black, and its black height in height.  */
+    template<class Container>
+    rb_node<container::node_type> *_rbtree_join(rb_node<container::node_type> *left, std::size_t left_height, rb_node<container::node_type> *pivot,
+                                                rb_node<container::node_type> *right, std::size_t right_height, std::size_t &height) {
+        rb_node<container::node_type> *root, *parent, *current;
+        std::size_t weight;
+
+        weight = Container::stats_type::value ? _rbtree_count<Container>(pivot) : 1;
+
+        /* A red root can be turned black on its own, the tree just gets one black level taller.  */
+        if (left && left->color() == RED) {
+            left->set_color(BLACK);
+            left_height++;
+        }
+        if (right && right->color() == RED) {
+            right->set_color(BLACK);
+            right_height++;
+        }
+
+        pivot->set_parent(nullptr);
+        if (left_height == right_height) {
+            pivot->left = left;
+            pivot->right = right;
+            if (left) left->set_parent(pivot);
+            if (right) right->set_parent(pivot);
+            pivot->set_color(BLACK);
+            if (Container::stats_type::value) _rbtree_set_count<Container>(pivot, _rbtree_count<Container>(left) + _rbtree_count<Container>(right) + weight);
+
+            height = left_height + 1;
+            return pivot;
+        }
+
+        parent = nullptr;
+        if (left_height > right_height) {
+            root = left;
+            height = left_height;
+            current = left;
+            while (current != nullptr && (current->color() != BLACK || left_height != right_height)) {
+                if (current->color() == BLACK) left_height--;
+                parent = current;
+                current = current->right;
+            }
+
+            pivot->left = current;
+            pivot->right = right;
+            parent->right = pivot;
+            if (Container::stats_type::value) _rbtree_add_count<Container>(parent, nullptr, _rbtree_count<Container>(right) + weight);
+        } else {
+            root = right;
+            height = right_height;
+            current = right;
+            while (current != nullptr && (current->color() != BLACK || right_height != left_height)) {
+                if (current->color() == BLACK) right_height--;
+                parent = current;
+                current = current->left;
+            }
+
+            pivot->left = left;
+            pivot->right = current;
+            parent->left = pivot;
+            if (Container::stats_type::value) _rbtree_add_count<Container>(parent, nullptr, _rbtree_count<Container>(left) + weight);
+        }
+
+        if (pivot->left) pivot->left->set_parent(pivot);
+        if (pivot->right) pivot->right->set_parent(pivot);
+        pivot->set_parent(parent);
+        if (Container::stats_type::value) _rbtree_set_count<Container>(pivot, _rbtree_count<Container>(pivot->left) + _rbtree_count<Container>(pivot->right) + weight);
+
+        _rbtree_restore_balance<Container>(&root, nullptr, pivot, INSERTION);
+        if (root->color() == RED) {
+            root->set_color(BLACK);
+            height++;
+        }
+
+        return root;
+    }
+
+    /* Splits the detached tree rooted at tnode, of black height height, into the keys less than key (left)
+       and the rest (right). Each level joins its node and untouched subtree to one side, the joins cost
+       telescopes to O(log n) overall.  */
+    template<class Container, typename K>
+    void _rbtree_split(Container *cnt, rb_node<container::node_type> *tnode, std::size_t height, const K &key,
+                       rb_node<container::node_type> **left, std::size_t &left_height, rb_node<container::node_type> **right, std::size_t &right_height) {
+        rb_node<container::node_type> *left_child, *right_child, *rest;
+        std::size_t child_height, rest_height;
+
+        if (tnode == nullptr) {
+            *left = *right = nullptr;
+            left_height = right_height = 0;
+            return;
+        }
+
+        child_height = height - (tnode->color() == BLACK ? 1 : 0);
+        if (Container::stats_type::value) _rbtree_set_count<Container>(tnode, _rbtree_weight<Container>(tnode));
+        left_child = tnode->left;
+        right_child = tnode->right;
+        if (left_child) left_child->set_parent(nullptr);
+        if (right_child) right_child->set_parent(nullptr);
+        tnode->left = tnode->right = nullptr;
+
+        if (cnt->_less(cnt->_get_key(tnode), key)) {
+            _rbtree_split<Container, K>(cnt, right_child, child_height, key, &rest, rest_height, right, right_height);
+            *left = _rbtree_join<Container>(left_child, child_height, tnode, rest, rest_height, left_height);
+        } else {
+            _rbtree_split<Container, K>(cnt, left_child, child_height, key, left, left_height, &rest, rest_height);
+            *right = _rbtree_join<Container>(rest, rest_height, tnode, right_child, child_height, right_height);
+        }
+    }
+
+    /* Number of elements of the detached tree left, total being the elements of both trees.
+       Walks both in step and stops at the end of the smaller one, O(min(|left|, |right|)).  */
+    template<class Container>
+    std::size_t _rbtree_split_size(rb_node<container::node_type> *left, rb_node<container::node_type> *right, std::size_t total) {
+        std::size_t n = 0;
+
+        if (Container::stats_type::value) return _rbtree_count<Container>(left);
+
+        if (left) left = _rbtree_minimum<Container>(left);
+        if (right) right = _rbtree_minimum<Container>(right);
+        while (left && right) {
+            left = _rbtree_successor<Container>(left);
+            right = _rbtree_successor<Container>(right);
+            n++;
+        }
+
+        return left == nullptr ? n : total - n;
+    }
+
+    /* Hangs a detached tree of size elements under the sentinel of cnt.  */
+    template<class Container>
+    void _rbtree_attach(Container *cnt, rb_node<container::node_type> *root, std::size_t size) {
+        cnt->_root = root;
+        cnt->_sentinel->left = root;
+        if (root) root->set_parent(cnt->_sentinel);
+        cnt->_size = size;
+        _rbtree_reset_bounds<container::sentinel_type>(cnt->_sentinel, root);
+    }
+
+    /* Moves the elements of cnt not less than key into the empty container other, both share their allocator.  */
+    template<class Container, typename K>
+    void _rbtree_split_tree(Container *cnt, Container *other, const K &key) {
+        rb_node<container::node_type> *left, *right;
+        std::size_t left_height, right_height, left_size;
+
+        if (cnt->empty()) return;
+
+        cnt->_root->set_parent(nullptr);
+        _rbtree_split<Container, K>(cnt, cnt->_root, _rbtree_black_height<Container>(cnt->_root), key, &left, left_height, &right, right_height);
+
+        left_size = _rbtree_split_size<Container>(left, right, cnt->_size);
+        _rbtree_attach<Container>(other, right, cnt->_size - left_size);
+        _rbtree_attach<Container>(cnt, left, left_size);
+    }
+
+    /* Whether the keys of other all go after the keys of cnt rather than before them, other is not empty.
+       Keys of the two that interleave cannot be joined.  */
+    template<class Container>
+    bool _rbtree_join_appends(Container *cnt, Container *other) {
+        if (cnt->empty()) return true;
+
+        if (cnt->_less(cnt->_get_key(_rbtree_last<container::sentinel_type>(cnt->_sentinel)), cnt->_get_key(_rbtree_first<container::sentinel_type>(other->_sentinel)))) return true;
+        if (cnt->_less(cnt->_get_key(_rbtree_last<container::sentinel_type>(other->_sentinel)), cnt->_get_key(_rbtree_first<container::sentinel_type>(cnt->_sentinel)))) return false;
+
+        throw std::invalid_argument("The keys of the joined containers overlap.");
+    }
+
+    /* Joins the detached trees left and right, every key of left goes before every key of right.
+       The first element of right is unlinked to become the pivot, through cnt whose root is borrowed meanwhile.
+       The element has at most one child, no data is swapped, O(log n + log m).  */
+    template<class Container>
+    rb_node<container::node_type> *_rbtree_concat(Container *cnt, rb_node<container::node_type> *left, rb_node<container::node_type> *right) {
+        rb_node<container::node_type> *root, *pivot;
+        std::size_t weight, height;
+
+        if (left == nullptr) return right;
+        if (right == nullptr) return left;
+
+        left->set_parent(nullptr);
+        right->set_parent(nullptr);
+        pivot = _rbtree_minimum<Container>(right);
+        if (pivot == right && right->right == nullptr) {
+            right = nullptr;
+        } else {
+            weight = Container::stats_type::value ? _rbtree_weight<Container>(pivot) : 1;
+
+            root = cnt->_root;
+            cnt->_root = right;
+            pivot = _rbtree_prepare_erase<Container>(cnt, pivot, nullptr);
+            right = cnt->_root;
+            cnt->_root = root;
+
+            if (Container::stats_type::value) _rbtree_set_count<Container>(pivot, weight);
+        }
+
+        return _rbtree_join<Container>(left, _rbtree_black_height<Container>(left), pivot, right, _rbtree_black_height<Container>(right), height);
+    }
+
+    /* Moves every element of the non empty other into cnt, both share their allocator.  */
+    template<class Container>
+    void _rbtree_join_trees(Container *cnt, Container *other) {
+        rb_node<container::node_type> *root;
+        std::size_t size;
+
+        size = cnt->_size + other->_size;
+        if (_rbtree_join_appends<Container>(cnt, other)) {
+            root = _rbtree_concat<Container>(cnt, cnt->_root, other->_root);
+        } else {
+            root = _rbtree_concat<Container>(cnt, other->_root, cnt->_root);
+        }
+
+        _rbtree_attach<Container>(cnt, root, size);
+        _rbtree_attach<Container>(other, nullptr, 0);
     }
 
+    /* Ranges of up to this many elements are erased one at a time, the splits and the join cost more below it.  */
+    constexpr std::size_t _rbtree_short_range = 32;
+
+    /* Erases the elements of the nodes from first up to last, excluded (the sentinel for the end).
+       Two splits cut the range out, its nodes are freed without any rebalancing and the rest is joined
+       back, O(log n + k) instead of a rebalancing erasure per element.  */
     template<class Container>
-    rb_node<container::node_type> *_rbtree_find_bound(Container *cnt, rb_node<container::node_type> *tnode, const container::key_type &key) {
-        if (tnode == nullptr) return nullptr;
+    void _rbtree_erase_range(Container *cnt, rb_node<container::node_type> *first, rb_node<container::node_type> *last) {
+        rb_node<container::node_type> *left, *middle, *rest, *right;
+        std::size_t left_height, middle_height, rest_height, right_height, size;
+
+        cnt->_root->set_parent(nullptr);
+        _rbtree_split<Container, container::key_type>(cnt, cnt->_root, _rbtree_black_height<Container>(cnt->_root), cnt->_get_key(first),
+                                                      &left, left_height, &rest, rest_height);
+        if (last != cnt->_sentinel) {
+            _rbtree_split<Container, container::key_type>(cnt, rest, rest_height, cnt->_get_key(last), &middle, middle_height, &right, right_height);
+        } else {
+            middle = rest;
+            right = nullptr;
+        }
 
-        if (_rbtree_is_equal_key<Container>(cnt, cnt->_get_key(tnode), key)) return tnode;
+        size = cnt->_size - _rbtree_destruct<Container>(cnt, middle);
+        _rbtree_attach<Container>(cnt, _rbtree_concat<Container>(cnt, left, right), size);
+    }
 
-        if (cnt->_less(cnt->_get_key(tnode), key)) return _rbtree_find_bound(cnt, tnode->right, key);
+    /* Set algebra.  */
+    template<class Container>
+    void _rbtree_append_copy(Container *cnt, rb_node<container::node_type> **head, rb_node<container::node_type> **tail, std::size_t &n, rb_node<container::node_type> *tnode) {
+        tnode = _rbtree_new_node(cnt->_node_alloc, tnode->data);
+
+        if (*tail) (*tail)->right = tnode;
+        else *head = tnode;
+        *tail = tnode;
+        n++;
+    }
+
+    /* Whether probing each of small elements in a tree of large elements beats a merge of both.  */
+    inline bool _rbtree_probe_cheaper(std::size_t small, std::size_t large) {
+        std::size_t depth = 0;
+
+        while ((large >> depth) != 0) depth++;
+
+        return small * depth < large;
+    }
+
+    /* Fills the empty cnt with copies of the elements of lhs and rhs that operation keeps, lhs supplying the
+       element when both hold the key. The copies are collected in order and linked into a balanced tree,
+       O(n + m) with a merge of the two traversals. When one side is much smaller its elements are looked up
+       in the other instead, O(m log n), as long as the result cannot be larger than that side.  */
+    template<class Container>
+    void _rbtree_set_operation(Container *cnt, Container *lhs, Container *rhs, set_operation_t operation) {
+        rb_node<container::node_type> *head, *tail, *lnode, *rnode, *lend, *rend, *tnode;
+        std::size_t n;
+
+        lend = lhs->_sentinel;
+        rend = rhs->_sentinel;
+        lnode = lhs->_root ? _rbtree_minimum<Container>(lhs->_root) : lend;
+        rnode = rhs->_root ? _rbtree_minimum<Container>(rhs->_root) : rend;
+
+        head = tail = nullptr;
+        n = 0;
+        try {
+            if (operation != SET_UNION && _rbtree_probe_cheaper(lhs->_size, rhs->_size)) {
+                for (; lnode != lend ; lnode = _rbtree_successor<Container>(lnode)) {
+                    tnode = _rbtree_bound<Container>(rhs, cnt->_get_key(lnode), false);
+                    if ((tnode == nullptr || cnt->_less(cnt->_get_key(lnode), cnt->_get_key(tnode))) == (operation == SET_DIFFERENCE)) {
+                        _rbtree_append_copy<Container>(cnt, &head, &tail, n, lnode);
+                    }
+                }
+            } else if (operation == SET_INTERSECTION && _rbtree_probe_cheaper(rhs->_size, lhs->_size)) {
+                for (; rnode != rend ; rnode = _rbtree_successor<Container>(rnode)) {
+                    tnode = _rbtree_bound<Container>(lhs, cnt->_get_key(rnode), false);
+                    if (tnode && !cnt->_less(cnt->_get_key(rnode), cnt->_get_key(tnode))) _rbtree_append_copy<Container>(cnt, &head, &tail, n, tnode);
+                }
+            } else {
+                while (lnode != lend || rnode != rend) {
+                    /* Nothing past the end of lhs is kept, or past the end of rhs for an intersection.  */
+                    if (operation != SET_UNION && (lnode == lend || (operation == SET_INTERSECTION && rnode == rend))) break;
+
+                    if (rnode == rend || (lnode != lend && cnt->_less(cnt->_get_key(lnode), cnt->_get_key(rnode)))) {
+                        if (operation != SET_INTERSECTION) _rbtree_append_copy<Container>(cnt, &head, &tail, n, lnode);
+                        lnode = _rbtree_successor<Container>(lnode);
+                    } else if (lnode == lend || cnt->_less(cnt->_get_key(rnode), cnt->_get_key(lnode))) {
+                        if (operation == SET_UNION) _rbtree_append_copy<Container>(cnt, &head, &tail, n, rnode);
+                        rnode = _rbtree_successor<Container>(rnode);
+                    } else {
+                        if (operation != SET_DIFFERENCE) _rbtree_append_copy<Container>(cnt, &head, &tail, n, lnode);
+                        lnode = _rbtree_successor<Container>(lnode);
+                        rnode = _rbtree_successor<Container>(rnode);
+                    }
+                }
+            }
+        } catch (...) {
+            while (head) {
+                tnode = head;
+                head = head->right;
+                _rbtree_delete_node(cnt->_node_alloc, tnode);
+            }
+            throw;
+        }
 
-        auto rnode = _rbtree_find_bound(cnt, tnode->left, key);
-        return rnode == nullptr ? tnode : rnode;
+        _rbtree_link_sorted<Container>(cnt, head, n);
     }
 }
\ No newline at end of file
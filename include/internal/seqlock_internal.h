@@ -0,0 +1,184 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <type_traits>
+
+#include "hash_internal.h"
+
+namespace seqlock_internal {
+
+    using hash_internal::ctrl_t;
+    using hash_internal::group;
+
+    /* Writers of keys in different stripes never wait for each other unless they change the same group.  */
+    constexpr std::size_t seqlock_writer_stripes = 64;
+
+    /* Groups a writer migrates to the new table on each change while the table grows.  */
+    constexpr std::size_t seqlock_migrate_groups = 2;
+
+    /* Low bit of a group version: a writer is changing the group.  */
+    constexpr std::uint64_t seqlock_locked = 1;
+
+    /* High bit of a group version: the group was copied to the next table, which is authoritative for its keys.  */
+    constexpr std::uint64_t seqlock_moved = 1ull << 63;
+
+    /* Slots a table may use. Writers grow a table before a new key would take more, probes need empty slots
+       to end early and a table that is filled by a migration needs room for the keys still to come.  */
+    constexpr std::size_t seqlock_max_used(std::size_t capacity) {
+        return capacity - capacity / 8;
+    }
+
+    /* The element of a slot, trivially copyable so that a torn copy can be thrown away.  */
+    template<typename K, typename V>
+    struct seq_entry {
+        K key;
+        V value;
+    };
+
+    /* One Swiss table group: its version, its control bytes and its slots, on adjacent cache lines.
+       Everything readers load is atomic (relaxed), so a reader racing a writer reads stale words, never
+       undefined ones, and the version tells it to retry. Words are only stored under the group lock.  */
+    template<typename Entry>
+    struct alignas(64) seq_group {
+        static constexpr std::size_t ctrl_words = group::width / sizeof(std::uint64_t);
+        static constexpr std::size_t slot_words = (sizeof(Entry) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+        std::atomic<std::uint64_t> version;
+        std::atomic<std::uint64_t> ctrl[ctrl_words];
+        std::atomic<std::uint64_t> slots[group::width * slot_words];
+
+        seq_group() : version(0) {
+            for (std::size_t i = 0 ; i < ctrl_words ; i++) ctrl[i].store(~0ull, std::memory_order_relaxed);
+            for (std::size_t i = 0 ; i < group::width * slot_words ; i++) slots[i].store(0, std::memory_order_relaxed);
+        }
+    };
+
+    /* A table and, while it grows, the table its groups are copied to. Groups are handed out to the migrating
+       writers by migrate_next, the writer that migrates the last one replaces the table with next.
+       used counts the slots that are not empty, plus the ones reserved for a migration into the table:
+       reserved of them, of which the copied entries took placed.  */
+    template<typename Entry>
+    struct seq_table {
+        seq_group<Entry> *groups;
+        std::size_t capacity;
+        std::atomic<seq_table*> next;
+        std::atomic<std::size_t> used;
+        std::atomic<std::size_t> placed;
+        std::size_t reserved;
+        std::atomic<std::size_t> migrate_next;
+        std::atomic<std::size_t> migrated;
+        std::uint64_t retired;
+        seq_table *retired_next;
+
+        explicit seq_table(std::size_t cap) : groups(new seq_group<Entry>[cap / group::width]), capacity(cap), next(nullptr),
+                                              used(0), placed(0), reserved(0), migrate_next(0), migrated(0), retired(0),
+                                              retired_next(nullptr) {}
+        ~seq_table() { delete[] groups; }
+
+        std::size_t n_groups() const { return capacity / group::width; }
+        seq_group<Entry> &group_at(std::size_t offset) const { return groups[offset / group::width]; }
+    };
+
+    struct alignas(64) seq_stripe {
+        std::mutex lock;
+    };
+
+    /* Control bytes of g, read with relaxed loads into a buffer the existing group matching works on.  */
+    template<typename Entry>
+    group _seq_load_ctrl(const seq_group<Entry> &g) {
+        std::uint64_t words[seq_group<Entry>::ctrl_words];
+
+        for (std::size_t i = 0 ; i < seq_group<Entry>::ctrl_words ; i++) words[i] = g.ctrl[i].load(std::memory_order_relaxed);
+
+        return group(reinterpret_cast<const ctrl_t *>(words));
+    }
+
+    template<typename Entry>
+    ctrl_t _seq_ctrl_at(const seq_group<Entry> &g, std::size_t i) {
+        std::uint64_t word = g.ctrl[i / sizeof(std::uint64_t)].load(std::memory_order_relaxed);
+        ctrl_t bytes[sizeof(std::uint64_t)];
+
+        memcpy(bytes, &word, sizeof(word));
+        return bytes[i % sizeof(std::uint64_t)];
+    }
+
+    /* Under the group lock.  */
+    template<typename Entry>
+    void _seq_set_ctrl(seq_group<Entry> &g, std::size_t i, ctrl_t ctrl) {
+        std::uint64_t word = g.ctrl[i / sizeof(std::uint64_t)].load(std::memory_order_relaxed);
+        ctrl_t bytes[sizeof(std::uint64_t)];
+
+        memcpy(bytes, &word, sizeof(word));
+        bytes[i % sizeof(std::uint64_t)] = ctrl;
+        memcpy(&word, bytes, sizeof(word));
+        g.ctrl[i / sizeof(std::uint64_t)].store(word, std::memory_order_relaxed);
+    }
+
+    template<typename Entry>
+    void _seq_load_entry(const seq_group<Entry> &g, std::size_t i, Entry &entry) {
+        std::uint64_t words[seq_group<Entry>::slot_words];
+        const std::atomic<std::uint64_t> *slot = &g.slots[i * seq_group<Entry>::slot_words];
+
+        for (std::size_t w = 0 ; w < seq_group<Entry>::slot_words ; w++) words[w] = slot[w].load(std::memory_order_relaxed);
+        memcpy(static_cast<void *>(&entry), words, sizeof(Entry));
+    }
+
+    /* Under the group lock.  */
+    template<typename Entry>
+    void _seq_store_entry(seq_group<Entry> &g, std::size_t i, const Entry &entry) {
+        std::uint64_t words[seq_group<Entry>::slot_words] = {};
+        std::atomic<std::uint64_t> *slot = &g.slots[i * seq_group<Entry>::slot_words];
+
+        memcpy(words, static_cast<const void *>(&entry), sizeof(Entry));
+        for (std::size_t w = 0 ; w < seq_group<Entry>::slot_words ; w++) slot[w].store(words[w], std::memory_order_relaxed);
+    }
+
+    /* Returns the version g had before it was locked. The release fence keeps the stores of the writer
+       after the locked version: a reader that loads one of them sees the version changed afterwards.  */
+    template<typename Entry>
+    std::uint64_t _seq_lock(seq_group<Entry> &g) {
+        std::uint64_t version;
+
+        for (;;) {
+            version = g.version.load(std::memory_order_relaxed);
+            if (!(version & seqlock_locked) &&
+                g.version.compare_exchange_weak(version, version | seqlock_locked, std::memory_order_acquire)) {
+                break;
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+
+        return version;
+    }
+
+    /* Publishes the changes made under the lock with the next version, moved marks the group as migrated.  */
+    template<typename Entry>
+    void _seq_unlock(seq_group<Entry> &g, std::uint64_t version, bool changed, bool moved = false) {
+        if (changed) version += 2;
+        if (moved) version |= seqlock_moved;
+        g.version.store(version, std::memory_order_release);
+    }
+
+    /* Begins an optimistic read of g, waiting out a writer that holds it.  */
+    template<typename Entry>
+    std::uint64_t _seq_read_begin(const seq_group<Entry> &g) {
+        std::uint64_t version;
+
+        do {
+            version = g.version.load(std::memory_order_acquire);
+        } while (version & seqlock_locked);
+
+        return version;
+    }
+
+    /* True if nothing the reader loaded since _seq_read_begin() returned version was changed.  */
+    template<typename Entry>
+    bool _seq_read_validate(const seq_group<Entry> &g, std::uint64_t version) {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return g.version.load(std::memory_order_relaxed) == version;
+    }
+}
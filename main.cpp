@@ -1,7 +1,10 @@
 #include <algorithm>
 #include <set>
 #include <map>
+#include <iterator>
 #include <utility>
+#include <thread>
+#include <atomic>
 
 #include "include/containers/list.h"
 #include "include/containers/vector.h"
@@ -9,11 +12,22 @@
 #include "include/containers/multiset.h"
 #include "include/containers/map.h"
 #include "include/containers/multimap.h"
+#include "include/containers/flat_set.h"
+#include "include/containers/flat_map.h"
+#include "include/containers/btree_set.h"
+#include "include/containers/btree_multiset.h"
+#include "include/containers/btree_map.h"
+#include "include/containers/btree_multimap.h"
+#include "include/containers/persistent_map.h"
+#include "include/containers/concurrent_map.h"
 #include "include/containers/unordered_set.h"
 #include "include/containers/unordered_multiset.h"
 #include "include/containers/unordered_map.h"
 #include "include/containers/unordered_multimap.h"
+#include "include/containers/concurrent_unordered_map.h"
+#include "include/containers/seqlock_unordered_map.h"
 #include "include/containers/pqueue.h"
+#include "include/containers/pool_allocator.h"
 
 #define CONTAINERS_ASSERT(cond)                                            \
     do {                                                                         \
@@ -366,13 +380,45 @@ void run_vector_test() {
 
 struct ReverseSorted {
     bool operator()(const int& lhs, const int& rhs) {
-        return lhs >= rhs;
+        return lhs > rhs;
     }
     bool operator()(const std::pair<int, std::string> &lhs, const std::pair<int, std::string> &rhs) {
-        return lhs.first >= rhs.first;
+        return lhs.first > rhs.first;
     }
 };
 
+/* Transparent functors, they let string keyed containers be searched with a const char * directly.  */
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(const char *s) const {
+        size_t hash = 14695981039346656037ULL;
+        while (*s) hash = (hash ^ (unsigned char) *s++) * 1099511628211ULL;
+        return hash;
+    }
+    size_t operator()(const std::string &s) const { return (*this)(s.c_str()); }
+};
+
+struct StringEqual {
+    using is_transparent = void;
+
+    bool operator()(const std::string &lhs, const std::string &rhs) const { return lhs == rhs; }
+    bool operator()(const std::string &lhs, const char *rhs) const { return lhs == rhs; }
+    bool operator()(const char *lhs, const std::string &rhs) const { return rhs == lhs; }
+};
+
+/* Counts its constructions, used to check that try_emplace leaves existing keys alone.  */
+struct Counted {
+    static size_t constructions;
+    int value;
+
+    explicit Counted(int _value = 0) : value(_value) { constructions++; }
+    Counted(const Counted &other) : value(other.value) { constructions++; }
+    Counted &operator=(const Counted &other) = default;
+};
+
+size_t Counted::constructions = 0;
+
 void run_set_test() {
     adt::set<std::string> set_str_test;
     adt::set<int> set_test;
@@ -468,7 +514,18 @@ void run_set_test() {
         }
     }
 
-    /* erase(range) test.  */
+    /* erase(range) test, a long range is cut out of the tree.  */
+    size_t before = set_test.size(), quarter = before / 4;
+    auto erase_from = std::next(set_test.begin(), quarter);
+    auto erase_to = std::next(erase_from, quarter);
+    int erase_next = *erase_to;
+    CONTAINERS_ASSERT(set_test.count_range(*erase_from, erase_next) == quarter);
+    CONTAINERS_ASSERT(*set_test.erase(erase_from, erase_to) == erase_next);
+    CONTAINERS_ASSERT(set_test.size() == before - quarter);
+    CONTAINERS_ASSERT(set_test.count_range(*set_test.begin(), erase_next) == quarter);
+    CONTAINERS_ASSERT((size_t) std::distance(set_test.begin(), set_test.end()) == set_test.size());
+    CONTAINERS_ASSERT(std::is_sorted(set_test.begin(), set_test.end()));
+
     set_test.erase(set_test.begin(), set_test.end());
     CONTAINERS_ASSERT(set_test.empty());
     CONTAINERS_ASSERT(set_test.begin() == set_test.end());
@@ -511,8 +568,8 @@ void run_set_test() {
     }
 
     auto myrange = set_test.equal_range(-15);
-    CONTAINERS_ASSERT(myrange.first == set_test.end());
-    CONTAINERS_ASSERT(myrange.second == set_test.end());
+    CONTAINERS_ASSERT(myrange.first == set_test.lower_bound(-15));
+    CONTAINERS_ASSERT(myrange.second == myrange.first);
 
     /* count() test.  */
     for (size_t i = 0 ; i < ELEMENTS ; i++) {
@@ -524,6 +581,210 @@ void run_set_test() {
     /* sets are sorted, this also asserts compatibility with STL iterators.  */
     CONTAINERS_ASSERT(std::is_sorted(set_test.begin(), set_test.end()));
     CONTAINERS_ASSERT(std::is_sorted(set_test.rbegin(), set_test.rend(), ReverseSorted()));
+
+    /* pool_allocator test.  */
+    adt::set<int, std::less<int>, adt::pool_allocator<int>> pool_set_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(pool_set_test.insert((int) i).second);
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        pool_set_test.erase((int) i);
+    }
+    /* Freed nodes are reused.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        pool_set_test.insert((int) i);
+    }
+    adt::set<int, std::less<int>, adt::pool_allocator<int>> pool_set_copy(pool_set_test);
+    pool_set_test.clear();
+    CONTAINERS_ASSERT(pool_set_copy.size() == ELEMENTS);
+    CONTAINERS_ASSERT(std::is_sorted(pool_set_copy.begin(), pool_set_copy.end()));
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(pool_set_copy.count((int) i) == 1);
+    }
+
+    /* Copies and rebinds share the pool, split() and join() then hand the nodes over.  */
+    adt::pool_allocator<int> pool_alloc;
+    adt::pool_allocator<int> pool_alloc_copy(pool_alloc);
+    adt::pool_allocator<double> pool_alloc_rebind(pool_alloc);
+    CONTAINERS_ASSERT(pool_alloc_copy == pool_alloc && pool_alloc_rebind == pool_alloc);
+    CONTAINERS_ASSERT(pool_alloc != adt::pool_allocator<int>());
+    CONTAINERS_ASSERT(pool_alloc.use_count() == 3);
+
+    auto pool_middle = pool_set_copy.find(ELEMENTS / 2);
+    auto pool_set_upper = pool_set_copy.split(ELEMENTS / 2);
+    CONTAINERS_ASSERT(pool_set_upper.begin() == pool_middle && *pool_middle == ELEMENTS / 2);
+    CONTAINERS_ASSERT(pool_set_copy.size() == ELEMENTS / 2 && pool_set_upper.size() == ELEMENTS - ELEMENTS / 2);
+    pool_set_copy.join(pool_set_upper);
+    CONTAINERS_ASSERT(pool_set_upper.empty() && pool_set_copy.size() == ELEMENTS);
+    CONTAINERS_ASSERT(pool_set_copy.find(ELEMENTS / 2) == pool_middle);
+
+    /* Range construction test.  */
+    std::vector<int> sorted_input;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        sorted_input.push_back((int) i / 2);
+    }
+    adt::set<int> range_set(sorted_input.begin(), sorted_input.end());
+    CONTAINERS_ASSERT(range_set.size() == ELEMENTS / 2);
+    CONTAINERS_ASSERT(std::equal(range_set.begin(), range_set.end(), std::set<int>(sorted_input.begin(), sorted_input.end()).begin()));
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        range_set.erase((int) i / 2);
+    }
+    CONTAINERS_ASSERT(range_set.empty());
+
+    std::vector<int> unsorted_input(sorted_input.begin(), sorted_input.end());
+    std::reverse(unsorted_input.begin() + ELEMENTS / 2, unsorted_input.end());
+    range_set.insert(unsorted_input.begin(), unsorted_input.end());
+    CONTAINERS_ASSERT(range_set.size() == ELEMENTS / 2);
+    CONTAINERS_ASSERT(std::is_sorted(range_set.begin(), range_set.end()));
+    range_set.insert(unsorted_input.begin(), unsorted_input.end());
+    CONTAINERS_ASSERT(range_set.size() == ELEMENTS / 2);
+
+    sorted_input.erase(std::unique(sorted_input.begin(), sorted_input.end()), sorted_input.end());
+    adt::set<int> sorted_set(adt::sorted_unique, sorted_input.begin(), sorted_input.end());
+    CONTAINERS_ASSERT(sorted_set.size() == sorted_input.size());
+    for (size_t i = 0 ; i < sorted_input.size() ; i++) {
+        CONTAINERS_ASSERT(sorted_set.count((int) i) == 1);
+    }
+    CONTAINERS_ASSERT(sorted_set.insert(-1).second);
+    CONTAINERS_ASSERT(*sorted_set.begin() == -1);
+
+    /* Hinted insertion test.  */
+    adt::set<int> hint_set;
+    auto hint = hint_set.end();
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        hint = hint_set.insert(hint, (int) i);
+        CONTAINERS_ASSERT(*hint == (int) i);
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        /* Right, wrong and equal hints.  */
+        CONTAINERS_ASSERT(*hint_set.emplace_hint(hint_set.find((int) i), (int) i) == (int) i);
+        CONTAINERS_ASSERT(*hint_set.insert(hint_set.begin(), -(int) i) == -(int) i);
+        CONTAINERS_ASSERT(*hint_set.insert(hint_set.end(), (int) (ELEMENTS + i)) == (int) (ELEMENTS + i));
+    }
+    CONTAINERS_ASSERT(hint_set.size() == 3 * ELEMENTS - 1);
+    CONTAINERS_ASSERT(std::is_sorted(hint_set.begin(), hint_set.end()));
+
+    /* Copies keep the colors, the copy stays balanced through further erasures.  */
+    adt::set<int> hint_copy(hint_set);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        hint_copy.erase((int) i);
+    }
+    CONTAINERS_ASSERT(hint_copy.size() == 2 * ELEMENTS - 1 && std::is_sorted(hint_copy.begin(), hint_copy.end()));
+
+    /* The sentinel caches the first and the last node through erasures, splits and joins.  */
+    CONTAINERS_ASSERT(*hint_copy.begin() == -(int) ELEMENTS + 1 && *hint_copy.rbegin() == 2 * (int) ELEMENTS - 1);
+    hint_copy.erase(hint_copy.begin());
+    hint_copy.erase(--hint_copy.end());
+    CONTAINERS_ASSERT(*hint_copy.begin() == -(int) ELEMENTS + 2 && *hint_copy.rbegin() == 2 * (int) ELEMENTS - 2);
+    auto hint_upper = hint_copy.split(0);
+    CONTAINERS_ASSERT(*hint_copy.rbegin() == -1 && *hint_upper.begin() == (int) ELEMENTS);
+    hint_upper.join(hint_copy);
+    CONTAINERS_ASSERT(hint_copy.begin() == hint_copy.end() && *hint_upper.begin() == -(int) ELEMENTS + 2);
+    hint_upper.erase(hint_upper.begin(), hint_upper.lower_bound(0));
+    CONTAINERS_ASSERT(*hint_upper.begin() == (int) ELEMENTS && *hint_upper.rbegin() == 2 * (int) ELEMENTS - 2);
+
+    /* The color is packed into the parent pointer, a node of int is four words.  */
+    CONTAINERS_ASSERT(sizeof(rbtree_internal::rb_node<int>) == 4 * sizeof(void *));
+
+    /* Order statistics test.  */
+    adt::ranked_set<int> ranked_set_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        ranked_set_test.insert((int) (2 * i));
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i += 3) {
+        ranked_set_test.erase((int) (2 * i));
+    }
+    index = 0;
+    for (auto it = ranked_set_test.begin() ; it != ranked_set_test.end() ; it++, index++) {
+        CONTAINERS_ASSERT(ranked_set_test.nth(index) == it);
+        CONTAINERS_ASSERT(ranked_set_test.rank(*it) == index);
+        CONTAINERS_ASSERT(ranked_set_test.rank(*it + 1) == index + 1);
+        CONTAINERS_ASSERT(ranked_set_test.distance(ranked_set_test.begin(), it) == (long) index);
+    }
+    CONTAINERS_ASSERT(index == ranked_set_test.size());
+    CONTAINERS_ASSERT(ranked_set_test.nth(index) == ranked_set_test.end());
+    CONTAINERS_ASSERT(ranked_set_test.distance(ranked_set_test.end(), ranked_set_test.begin()) == -(long) index);
+
+    /* count_range() is two ranks and a range erase keeps the subtree sizes.  */
+    size_t ranked_size = ranked_set_test.size();
+    size_t ranked_middle = ranked_set_test.count_range((int) ELEMENTS / 2, (int) ELEMENTS * 3 / 2);
+    CONTAINERS_ASSERT(ranked_set_test.count_range(0, 2 * (int) ELEMENTS) == ranked_size);
+    CONTAINERS_ASSERT(ranked_set_test.count_range((int) ELEMENTS, 0) == 0);
+    ranked_set_test.erase(ranked_set_test.lower_bound((int) ELEMENTS / 2), ranked_set_test.lower_bound((int) ELEMENTS * 3 / 2));
+    CONTAINERS_ASSERT(ranked_set_test.size() == ranked_size - ranked_middle);
+    index = 0;
+    for (auto it = ranked_set_test.begin() ; it != ranked_set_test.end() ; it++, index++) {
+        CONTAINERS_ASSERT(ranked_set_test.nth(index) == it);
+        CONTAINERS_ASSERT(ranked_set_test.rank(*it) == index);
+    }
+
+    /* A short range is erased element by element, the successor moving into an erased node must not end it early.  */
+    adt::set<int> short_range;
+    for (int i = 0 ; i < 15 ; i++) {
+        short_range.insert(i);
+    }
+    CONTAINERS_ASSERT(*short_range.erase(short_range.find(7), short_range.find(9)) == 9);
+    CONTAINERS_ASSERT(short_range.size() == 13 && short_range.count(8) == 0);
+
+    /* Split and join test.  */
+    adt::set<int> upper_set = hint_set.split((int) ELEMENTS);
+    CONTAINERS_ASSERT(hint_set.size() == 2 * ELEMENTS - 1 && upper_set.size() == ELEMENTS);
+    CONTAINERS_ASSERT(*hint_set.rbegin() == (int) ELEMENTS - 1 && *upper_set.begin() == (int) ELEMENTS);
+    CONTAINERS_ASSERT(std::is_sorted(upper_set.begin(), upper_set.end()));
+    hint_set.erase(0);
+    CONTAINERS_ASSERT(hint_set.split(-(int) ELEMENTS).size() == 2 * ELEMENTS - 2 && hint_set.empty());
+    upper_set.join(hint_set);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        hint_set.insert(-(int) i - 1);
+    }
+    upper_set.join(hint_set);
+    CONTAINERS_ASSERT(hint_set.empty() && upper_set.size() == 2 * ELEMENTS);
+    CONTAINERS_ASSERT(*upper_set.begin() == -(int) ELEMENTS && std::is_sorted(upper_set.begin(), upper_set.end()));
+    hint_set.insert(0);
+    try {
+        upper_set.join(hint_set);
+        CONTAINERS_ASSERT(false);
+    } catch (std::invalid_argument &) {
+        CONTAINERS_ASSERT(hint_set.size() == 1);
+    }
+
+    adt::ranked_set<int> ranked_upper = ranked_set_test.split((int) ELEMENTS);
+    CONTAINERS_ASSERT(ranked_set_test.size() + ranked_upper.size() == index);
+    CONTAINERS_ASSERT(*ranked_upper.nth(0) >= (int) ELEMENTS && ranked_upper.rank(*ranked_upper.nth(10)) == 10);
+    ranked_set_test.join(ranked_upper);
+    CONTAINERS_ASSERT(ranked_set_test.size() == index && ranked_upper.empty());
+    for (size_t i = 0 ; i < index ; i++) {
+        CONTAINERS_ASSERT(ranked_set_test.rank(*ranked_set_test.nth(i)) == i);
+    }
+
+    /* Set algebra test, multiples of 2 and 3 and a small set.  */
+    adt::set<int> evens, thirds, few;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        evens.insert((int) i * 2);
+        thirds.insert((int) i * 3);
+    }
+    few.insert(6);
+    few.insert(7);
+    std::set<int> std_evens(evens.begin(), evens.end()), std_thirds(thirds.begin(), thirds.end());
+    std::vector<int> expected;
+    std::set_union(std_evens.begin(), std_evens.end(), std_thirds.begin(), std_thirds.end(), std::back_inserter(expected));
+    adt::set<int> algebra_set = adt::set_union(evens, thirds);
+    CONTAINERS_ASSERT(std::equal(algebra_set.begin(), algebra_set.end(), expected.begin(), expected.end()));
+    expected.clear();
+    std::set_intersection(std_evens.begin(), std_evens.end(), std_thirds.begin(), std_thirds.end(), std::back_inserter(expected));
+    algebra_set = adt::set_intersection(evens, thirds);
+    CONTAINERS_ASSERT(std::equal(algebra_set.begin(), algebra_set.end(), expected.begin(), expected.end()));
+    expected.clear();
+    std::set_difference(std_evens.begin(), std_evens.end(), std_thirds.begin(), std_thirds.end(), std::back_inserter(expected));
+    algebra_set = adt::set_difference(evens, thirds);
+    CONTAINERS_ASSERT(std::equal(algebra_set.begin(), algebra_set.end(), expected.begin(), expected.end()));
+    algebra_set = adt::set_intersection(few, evens);
+    CONTAINERS_ASSERT(algebra_set.size() == 1 && *algebra_set.begin() == 6);
+    algebra_set = adt::set_intersection(evens, few);
+    CONTAINERS_ASSERT(algebra_set.size() == 1 && *algebra_set.begin() == 6);
+    algebra_set = adt::set_difference(few, evens);
+    CONTAINERS_ASSERT(algebra_set.size() == 1 && *algebra_set.begin() == 7);
+    CONTAINERS_ASSERT(adt::set_union(few, adt::set<int>()).size() == 2 && adt::set_intersection(few, adt::set<int>()).empty());
 }
 
 void run_multiset_test() {
@@ -663,8 +924,8 @@ void run_multiset_test() {
     }
 
     auto myrange = multiset_test.equal_range(-15);
-    CONTAINERS_ASSERT(myrange.first == multiset_test.end());
-    CONTAINERS_ASSERT(myrange.second == multiset_test.end());
+    CONTAINERS_ASSERT(myrange.first == multiset_test.lower_bound(-15));
+    CONTAINERS_ASSERT(myrange.second == myrange.first);
 
     /* count() test.  */
     for (size_t i = 0 ; i < ELEMENTS ; i++) {
@@ -673,9 +934,49 @@ void run_multiset_test() {
 
     CONTAINERS_ASSERT(multiset_test.count(-15) == 0);
 
+    /* erase(range) and count_range() test, both ends of the range fall among equivalent elements.  */
+    size_t multiset_size = multiset_test.size();
+    CONTAINERS_ASSERT(multiset_test.count_range(100, 200) == 100 * EXTRA_ELEMENTS);
+    CONTAINERS_ASSERT(*multiset_test.erase(std::next(multiset_test.lower_bound(100)), std::next(multiset_test.lower_bound(200))) == 200);
+    CONTAINERS_ASSERT(multiset_test.size() == multiset_size - 100 * EXTRA_ELEMENTS);
+    CONTAINERS_ASSERT(multiset_test.count(100) == 1 && multiset_test.count(200) == EXTRA_ELEMENTS - 1);
+    CONTAINERS_ASSERT(multiset_test.count_range(101, 200) == 0);
+
     /* multisets are sorted, this also asserts compatibility with STL iterators.  */
     CONTAINERS_ASSERT(std::is_sorted(multiset_test.begin(), multiset_test.end()));
     CONTAINERS_ASSERT(std::is_sorted(multiset_test.rbegin(), multiset_test.rend(), ReverseSorted()));
+
+    /* Hinted insertion test.  */
+    adt::multiset<int> hint_multiset;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(*hint_multiset.insert(hint_multiset.end(), (int) i) == (int) i);
+        CONTAINERS_ASSERT(*hint_multiset.emplace_hint(hint_multiset.begin(), (int) i) == (int) i);
+    }
+    CONTAINERS_ASSERT(hint_multiset.size() == 2 * ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(hint_multiset.count((int) i) == 2);
+    }
+    CONTAINERS_ASSERT(std::is_sorted(hint_multiset.begin(), hint_multiset.end()));
+
+    /* Order statistics test, equivalent elements are counted one by one.  */
+    adt::ranked_multiset<int> ranked_multiset_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        for (size_t j = 0 ; j < EXTRA_ELEMENTS ; j++) {
+            ranked_multiset_test.insert((int) i);
+        }
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        ranked_multiset_test.erase((int) i);
+    }
+    index = 0;
+    for (auto it = ranked_multiset_test.begin() ; it != ranked_multiset_test.end() ; it++, index++) {
+        CONTAINERS_ASSERT(*ranked_multiset_test.nth(index) == *it);
+        CONTAINERS_ASSERT(ranked_multiset_test.distance(ranked_multiset_test.begin(), it) == (long) index);
+    }
+    CONTAINERS_ASSERT(index == ranked_multiset_test.size());
+    for (size_t i = 1 ; i < ELEMENTS ; i += 2) {
+        CONTAINERS_ASSERT(ranked_multiset_test.rank((int) i) == i / 2 * EXTRA_ELEMENTS);
+    }
 }
 
 void run_map_test() {
@@ -834,8 +1135,8 @@ void run_map_test() {
     }
 
     auto myrange = map_test.equal_range(-15);
-    CONTAINERS_ASSERT(myrange.first == map_test.end());
-    CONTAINERS_ASSERT(myrange.second == map_test.end());
+    CONTAINERS_ASSERT(myrange.first == map_test.lower_bound(-15));
+    CONTAINERS_ASSERT(myrange.second == myrange.first);
 
     /* count() test.  */
     for (size_t i = 0 ; i < ELEMENTS ; i++) {
@@ -844,9 +1145,119 @@ void run_map_test() {
 
     CONTAINERS_ASSERT(map_test.count(-15) == 0);
 
+    /* erase(range) and count_range() test.  */
+    CONTAINERS_ASSERT(map_test.count_range(1000, 2000) == 1000);
+    CONTAINERS_ASSERT(map_test.erase(map_test.find(1000), map_test.find(2000))->first == 2000);
+    CONTAINERS_ASSERT(map_test.size() == ELEMENTS - 1000 && map_test.count_range(0, ELEMENTS) == ELEMENTS - 1000);
+    CONTAINERS_ASSERT(map_test.count(999) == 1 && map_test.count(1000) == 0 && map_test.count(1999) == 0);
+    for (size_t i = 1000 ; i < 2000 ; i++) {
+        map_test.insert({i, std::to_string(i)});
+    }
+
     /* maps are sorted, this also asserts compatibility with STL iterators.  */
     CONTAINERS_ASSERT(std::is_sorted(map_test.begin(), map_test.end()));
     CONTAINERS_ASSERT(std::is_sorted(map_test.rbegin(), map_test.rend(), ReverseSorted()));
+
+    /* Heterogeneous lookup test.  */
+    adt::map<std::string, int, std::less<>> strmap_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        strmap_test[std::to_string(2 * i)] = (int) i;
+    }
+    CONTAINERS_ASSERT(strmap_test.find("10")->second == 5);
+    CONTAINERS_ASSERT(strmap_test.find("11") == strmap_test.end());
+    CONTAINERS_ASSERT(strmap_test.count("12") == 1);
+    CONTAINERS_ASSERT(strmap_test.lower_bound("11")->first == "110");
+    CONTAINERS_ASSERT(strmap_test.upper_bound("12")->first == "120");
+    CONTAINERS_ASSERT(strmap_test.equal_range("14").first->second == 7);
+
+    /* try_emplace(), insert_or_assign() test.  */
+    adt::map<int, Counted> counted_map;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(counted_map.try_emplace((int) i, (int) i).second);
+    }
+    Counted::constructions = 0;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = counted_map.try_emplace((int) i, -1);
+        CONTAINERS_ASSERT(!p.second);
+        CONTAINERS_ASSERT(p.first->second.value == (int) i);
+    }
+    CONTAINERS_ASSERT(Counted::constructions == 0);
+
+    CONTAINERS_ASSERT(!counted_map.insert_or_assign(0, Counted(-1)).second);
+    CONTAINERS_ASSERT(counted_map.at(0).value == -1);
+    CONTAINERS_ASSERT(counted_map.insert_or_assign(-1, Counted(1)).second);
+    CONTAINERS_ASSERT(counted_map.size() == ELEMENTS + 1);
+
+    std::string key = "10";
+    CONTAINERS_ASSERT(!strmap_test.try_emplace(std::move(key), 0).second);
+    CONTAINERS_ASSERT(key == "10");
+
+    /* Range construction test.  */
+    std::vector<std::pair<int, int>> sorted_pairs;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        sorted_pairs.emplace_back((int) i, (int) i * 2);
+    }
+    adt::map<int, int> range_map(sorted_pairs.begin(), sorted_pairs.end());
+    CONTAINERS_ASSERT(range_map.size() == ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(range_map.at((int) i) == (int) i * 2);
+    }
+    adt::map<int, int> sorted_map(adt::sorted_unique, sorted_pairs.begin(), sorted_pairs.end());
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        sorted_map.erase((int) i);
+    }
+    CONTAINERS_ASSERT(sorted_map.size() == ELEMENTS / 2);
+    CONTAINERS_ASSERT(std::is_sorted(sorted_map.begin(), sorted_map.end()));
+
+    /* Hinted insertion test, monotonically increasing keys appended at end().  */
+    adt::map<int, int> hint_map;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(hint_map.emplace_hint(hint_map.end(), (int) i, (int) i)->first == (int) i);
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto it = hint_map.insert(hint_map.begin(), std::make_pair((int) i, -1));
+        CONTAINERS_ASSERT(it->second == (int) i);
+    }
+    CONTAINERS_ASSERT(hint_map.size() == ELEMENTS);
+    CONTAINERS_ASSERT(std::is_sorted(hint_map.begin(), hint_map.end()));
+
+    /* Order statistics test, percentiles of the values.  */
+    adt::ranked_map<int, int> ranked_map_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        ranked_map_test.emplace((int) (ELEMENTS - i), (int) i);
+    }
+    CONTAINERS_ASSERT(ranked_map_test.nth(0)->first == 1);
+    CONTAINERS_ASSERT(ranked_map_test.nth(ELEMENTS / 2)->first == ELEMENTS / 2 + 1);
+    CONTAINERS_ASSERT(ranked_map_test.nth(ELEMENTS - 1)->first == ELEMENTS);
+    CONTAINERS_ASSERT(ranked_map_test.rank(ELEMENTS / 4) == ELEMENTS / 4 - 1);
+    CONTAINERS_ASSERT(ranked_map_test.distance(ranked_map_test.find(10), ranked_map_test.find(20)) == 10);
+    ranked_map_test.erase(15);
+    CONTAINERS_ASSERT(ranked_map_test.distance(ranked_map_test.find(10), ranked_map_test.find(20)) == 9);
+    CONTAINERS_ASSERT(ranked_map_test.nth(14)->first == 16);
+
+    /* Split and join test.  */
+    adt::map<int, int> upper_map = hint_map.split((int) ELEMENTS / 2);
+    CONTAINERS_ASSERT(hint_map.size() == ELEMENTS / 2 && upper_map.size() == ELEMENTS - ELEMENTS / 2);
+    CONTAINERS_ASSERT(upper_map.begin()->first == (int) ELEMENTS / 2 && upper_map.at((int) ELEMENTS - 1) == (int) ELEMENTS - 1);
+    CONTAINERS_ASSERT(hint_map.find((int) ELEMENTS / 2) == hint_map.end());
+    upper_map.join(hint_map);
+    CONTAINERS_ASSERT(hint_map.empty() && upper_map.size() == ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(upper_map[(int) i] == (int) i);
+    }
+
+    /* Set algebra test, the values come from the left map.  */
+    adt::map<int, int> lower_half, upper_half;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        if (i < 2 * ELEMENTS / 3) lower_half.emplace((int) i, 0);
+        if (i >= ELEMENTS / 3) upper_half.emplace((int) i, 1);
+    }
+    adt::map<int, int> algebra_map = adt::set_union(lower_half, upper_half);
+    CONTAINERS_ASSERT(algebra_map.size() == ELEMENTS && algebra_map.at((int) ELEMENTS / 2) == 0 && algebra_map.at((int) ELEMENTS - 1) == 1);
+    algebra_map = adt::set_intersection(upper_half, lower_half);
+    CONTAINERS_ASSERT(algebra_map.size() == 2 * ELEMENTS / 3 - ELEMENTS / 3 && algebra_map.at((int) ELEMENTS / 2) == 1);
+    algebra_map = adt::set_difference(lower_half, upper_half);
+    CONTAINERS_ASSERT(algebra_map.size() == ELEMENTS / 3 && algebra_map.rbegin()->first == (int) ELEMENTS / 3 - 1);
 }
 
 void run_multimap_test() {
@@ -997,8 +1408,8 @@ void run_multimap_test() {
     }
 
     auto myrange = multimap_test.equal_range(-15);
-    CONTAINERS_ASSERT(myrange.first == multimap_test.end());
-    CONTAINERS_ASSERT(myrange.second == multimap_test.end());
+    CONTAINERS_ASSERT(myrange.first == multimap_test.lower_bound(-15));
+    CONTAINERS_ASSERT(myrange.second == myrange.first);
 
     /* count() test.  */
     for (size_t i = 0 ; i < ELEMENTS ; i++) {
@@ -1007,9 +1418,677 @@ void run_multimap_test() {
 
     CONTAINERS_ASSERT(multimap_test.count(-15) == 0);
 
+    /* erase(range) and count_range() test, erasing inside the elements of a key keeps the others in order.  */
+    adt::ranked_multimap<int, int> range_multimap;
+    std::multimap<int, int> std_range_multimap;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        /* Equivalent elements are listed newest first.  */
+        range_multimap.insert({(int) i / EXTRA_ELEMENTS, (int) i});
+        std_range_multimap.emplace_hint(std_range_multimap.lower_bound((int) i / EXTRA_ELEMENTS), (int) i / EXTRA_ELEMENTS, (int) i);
+    }
+    auto range_first = std::next(range_multimap.begin(), 102);
+    auto range_last = std::next(range_multimap.begin(), 2 * ELEMENTS / 3 + 1);
+    auto std_range_first = std::next(std_range_multimap.begin(), 102);
+    auto std_range_last = std::next(std_range_multimap.begin(), 2 * ELEMENTS / 3 + 1);
+    CONTAINERS_ASSERT(range_multimap.erase(range_first, range_last)->second == std_range_multimap.erase(std_range_first, std_range_last)->second);
+    CONTAINERS_ASSERT(range_multimap.size() == std_range_multimap.size());
+    CONTAINERS_ASSERT(std::equal(range_multimap.begin(), range_multimap.end(), std_range_multimap.begin(), std_range_multimap.end()));
+    CONTAINERS_ASSERT(std::equal(range_multimap.rbegin(), range_multimap.rend(), std_range_multimap.rbegin(), std_range_multimap.rend()));
+    for (int i = 0 ; i < (int) (ELEMENTS / EXTRA_ELEMENTS) ; i += 7) {
+        CONTAINERS_ASSERT(range_multimap.count_range(i, i + 50) == (size_t) std::distance(std_range_multimap.lower_bound(i), std_range_multimap.lower_bound(i + 50)));
+    }
+
     /* multimaps are sorted, this also asserts compatibility with STL iterators.  */
     CONTAINERS_ASSERT(std::is_sorted(multimap_test.begin(), multimap_test.end()));
     CONTAINERS_ASSERT(std::is_sorted(multimap_test.rbegin(), multimap_test.rend(), ReverseSorted()));
+
+    /* try_emplace() test.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = multimap_test.try_emplace((int) i, "new");
+        CONTAINERS_ASSERT(!p.second);
+        CONTAINERS_ASSERT(p.first->first == (int) i);
+        CONTAINERS_ASSERT(multimap_test.count((int) i) == EXTRA_ELEMENTS);
+    }
+    auto p = multimap_test.try_emplace(-15, "new");
+    CONTAINERS_ASSERT(p.second);
+    CONTAINERS_ASSERT(p.first->second == "new");
+    CONTAINERS_ASSERT(multimap_test.count(-15) == 1);
+
+    /* pool_allocator test, both the tree nodes and the lists come from pools.  */
+    adt::multimap<int, std::string, std::less<int>, adt::pool_allocator<std::pair<const int, std::string>>> pool_multimap_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        for (size_t j = 0 ; j < EXTRA_ELEMENTS ; j++) {
+            pool_multimap_test.emplace((int) i, std::to_string(j));
+        }
+    }
+    adt::multimap<int, std::string, std::less<int>, adt::pool_allocator<std::pair<const int, std::string>>> pool_multimap_copy(pool_multimap_test);
+    pool_multimap_test.clear();
+    CONTAINERS_ASSERT(pool_multimap_copy.size() == ELEMENTS * EXTRA_ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(pool_multimap_copy.count((int) i) == EXTRA_ELEMENTS);
+    }
+
+    /* Hinted insertion test.  */
+    adt::multimap<int, int> hint_multimap;
+    auto hint = hint_multimap.end();
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        hint = hint_multimap.emplace_hint(hint, (int) i, 0);
+        hint = hint_multimap.insert(hint, std::make_pair((int) i, 1));
+        CONTAINERS_ASSERT(hint->first == (int) i);
+    }
+    CONTAINERS_ASSERT(hint_multimap.size() == 2 * ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(hint_multimap.count((int) i) == 2);
+    }
+
+    /* Order statistics test.  */
+    adt::ranked_multimap<int, int> ranked_multimap_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        ranked_multimap_test.emplace((int) (i % 10), (int) i);
+    }
+    for (size_t i = 0 ; i < 10 ; i++) {
+        CONTAINERS_ASSERT(ranked_multimap_test.rank((int) i) == i * (ELEMENTS / 10));
+        CONTAINERS_ASSERT(ranked_multimap_test.nth(i * (ELEMENTS / 10))->first == (int) i);
+    }
+    auto range = ranked_multimap_test.equal_range(3);
+    CONTAINERS_ASSERT(ranked_multimap_test.distance(range.first, range.second) == ELEMENTS / 10);
+}
+
+void run_flat_set_test() {
+    adt::flat_set<std::string> set_str_test;
+    adt::flat_set<int> set_test;
+    adt::eytzinger_set<int> eytz_test;
+    std::set<int> std_set_test;
+    std::vector<int> batch;
+    size_t sum, test_sum;
+
+    srand((unsigned int) time(nullptr));
+
+    /* insert(), find() test.  */
+    sum = 0;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = set_str_test.insert(std::to_string(i));
+        CONTAINERS_ASSERT(*(p.first) == std::to_string(i));
+        CONTAINERS_ASSERT(p.second);
+        CONTAINERS_ASSERT(!set_str_test.insert(std::to_string(i)).second);
+        sum += i;
+    }
+    CONTAINERS_ASSERT(set_str_test.size() == ELEMENTS);
+
+    /* iterators test, elements come out sorted.  */
+    test_sum = 0;
+    for (auto it = set_str_test.begin() ; it != set_str_test.end() ; it++) {
+        if (it != set_str_test.begin()) CONTAINERS_ASSERT(*(it - 1) < *it);
+        test_sum += stoi(*it);
+    }
+    CONTAINERS_ASSERT(test_sum == sum);
+    CONTAINERS_ASSERT(*set_str_test.rbegin() == "999");
+
+    /* erase elements until 150.  */
+    CONTAINERS_ASSERT(*(set_str_test.erase(set_str_test.begin(), set_str_test.find("150"))) == "150");
+    CONTAINERS_ASSERT(*set_str_test.begin() == "150");
+
+    /* clear() test.  */
+    set_str_test.clear();
+    CONTAINERS_ASSERT(set_str_test.empty());
+    CONTAINERS_ASSERT(set_str_test.begin() == set_str_test.end());
+    CONTAINERS_ASSERT(set_str_test.rbegin() == set_str_test.rend());
+
+    /* insert(), emplace(), erase() against std::set.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        int val = rand() % (ELEMENTS * 4);
+        auto p = (i % 2) ? set_test.insert(val) : set_test.emplace(val);
+        CONTAINERS_ASSERT(*(p.first) == val);
+        CONTAINERS_ASSERT(p.second == std_set_test.insert(val).second);
+    }
+    for (size_t i = 0 ; i < ELEMENTS / 2 ; i++) {
+        int val = rand() % (ELEMENTS * 4);
+        CONTAINERS_ASSERT(set_test.erase(val) == std_set_test.erase(val));
+    }
+    CONTAINERS_ASSERT(set_test.size() == std_set_test.size());
+    CONTAINERS_ASSERT(std::equal(set_test.begin(), set_test.end(), std_set_test.begin()));
+
+    /* insert(range) test, the batch is merged with the elements already there.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) batch.push_back(rand() % (ELEMENTS * 8));
+    set_test.insert(batch.begin(), batch.end());
+    std_set_test.insert(batch.begin(), batch.end());
+    CONTAINERS_ASSERT(set_test.size() == std_set_test.size());
+    CONTAINERS_ASSERT(std::equal(set_test.begin(), set_test.end(), std_set_test.begin()));
+
+    /* lower(), upper() bound and rank check.  */
+    for (int key = -1 ; key <= ELEMENTS * 8 ; key++) {
+        auto lower = set_test.lower_bound(key);
+        auto upper = set_test.upper_bound(key);
+        auto std_lower = std_set_test.lower_bound(key);
+        auto std_upper = std_set_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(lower == set_test.end() ? std_lower == std_set_test.end() : *lower == *std_lower);
+        CONTAINERS_ASSERT(upper == set_test.end() ? std_upper == std_set_test.end() : *upper == *std_upper);
+        CONTAINERS_ASSERT(set_test.rank(key) == (size_t) std::distance(std_set_test.begin(), std_lower));
+        CONTAINERS_ASSERT(set_test.count(key) == std_set_test.count(key));
+    }
+    CONTAINERS_ASSERT(*set_test.nth(10) == *std::next(std_set_test.begin(), 10));
+    CONTAINERS_ASSERT(set_test.nth(set_test.size()) == set_test.end());
+
+    /* hinted insertion test.  */
+    set_test.clear();
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        auto it = set_test.insert(set_test.end(), i);
+        CONTAINERS_ASSERT(*it == i);
+        CONTAINERS_ASSERT(set_test.emplace_hint(set_test.begin(), i) == it);
+    }
+    CONTAINERS_ASSERT(set_test.size() == ELEMENTS);
+
+    /* the Eytzinger layout answers like the sorted one.  */
+    eytz_test.insert(batch.begin(), batch.end());
+    std_set_test = std::set<int>(batch.begin(), batch.end());
+    CONTAINERS_ASSERT(eytz_test.size() == std_set_test.size());
+    CONTAINERS_ASSERT(std::equal(eytz_test.begin(), eytz_test.end(), std_set_test.begin()));
+    for (int key = -1 ; key <= ELEMENTS * 8 ; key++) {
+        auto lower = eytz_test.lower_bound(key);
+        auto upper = eytz_test.upper_bound(key);
+        auto std_lower = std_set_test.lower_bound(key);
+        auto std_upper = std_set_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(lower == eytz_test.end() ? std_lower == std_set_test.end() : *lower == *std_lower);
+        CONTAINERS_ASSERT(upper == eytz_test.end() ? std_upper == std_set_test.end() : *upper == *std_upper);
+        CONTAINERS_ASSERT((eytz_test.find(key) != eytz_test.end()) == (std_set_test.count(key) == 1));
+    }
+    for (int val : batch) {
+        if (val % 3 == 0) CONTAINERS_ASSERT(eytz_test.erase(val) == std_set_test.erase(val));
+    }
+    for (int val : batch) CONTAINERS_ASSERT(eytz_test.count(val) == std_set_test.count(val));
+}
+
+void run_flat_map_test() {
+    adt::flat_map<int, std::string> map_test;
+    adt::eytzinger_map<int, std::string> eytz_test;
+    std::map<int, std::string> std_map_test;
+    std::vector<std::pair<int, std::string>> batch;
+    auto same_pair = [](const std::pair<int, std::string> &lhs, const std::pair<const int, std::string> &rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+    };
+
+    srand((unsigned int) time(nullptr));
+
+    /* operator[](), insert(), emplace(), try_emplace() test.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        int key = rand() % (ELEMENTS * 4);
+        std::string val = std::to_string(key);
+
+        switch (i % 4) {
+            case 0:
+                map_test[key] = val;
+                std_map_test[key] = val;
+                break;
+            case 1:
+                CONTAINERS_ASSERT(map_test.insert(std::make_pair(key, val)).second == std_map_test.insert(std::make_pair(key, val)).second);
+                break;
+            case 2:
+                CONTAINERS_ASSERT(map_test.emplace(key, val).second == std_map_test.emplace(key, val).second);
+                break;
+            default:
+                CONTAINERS_ASSERT(map_test.try_emplace(key, val).second == std_map_test.try_emplace(key, val).second);
+                break;
+        }
+        CONTAINERS_ASSERT(map_test.at(key) == val);
+    }
+    CONTAINERS_ASSERT(map_test.size() == std_map_test.size());
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), same_pair));
+
+    /* insert_or_assign() and mutation through iterators.  */
+    CONTAINERS_ASSERT(!map_test.insert_or_assign(map_test.begin()->first, "first").second);
+    CONTAINERS_ASSERT(map_test.begin()->second == "first");
+    for (auto it = map_test.begin() ; it != map_test.end() ; ++it) it->second += "!";
+    for (auto it = map_test.cbegin() ; it != map_test.cend() ; ++it) CONTAINERS_ASSERT(it->second.back() == '!');
+
+    /* at() throws for missing keys.  */
+    try {
+        map_test.at(-1);
+        CONTAINERS_ASSERT(false);
+    } catch (std::out_of_range &e) {}
+
+    /* insert(range) test, keys already there keep their value.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        int key = rand() % (ELEMENTS * 8);
+        batch.emplace_back(key, "batch" + std::to_string(i));
+    }
+    map_test.clear();
+    for (auto &p : std_map_test) map_test.emplace(p);
+    map_test.insert(batch.begin(), batch.end());
+    std_map_test.insert(batch.begin(), batch.end());
+    CONTAINERS_ASSERT(map_test.size() == std_map_test.size());
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), same_pair));
+
+    /* erase() test.  */
+    for (auto it = map_test.begin() ; it != map_test.end() ;) {
+        if (it->first % 2) {
+            std_map_test.erase(it->first);
+            it = map_test.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), same_pair));
+
+    /* the Eytzinger layout answers like the sorted one.  */
+    eytz_test = adt::eytzinger_map<int, std::string>(adt::sorted_unique, map_test.begin(), map_test.end());
+    CONTAINERS_ASSERT(std::equal(eytz_test.begin(), eytz_test.end(), std_map_test.begin(), same_pair));
+    for (int key = -1 ; key <= ELEMENTS * 8 ; key++) {
+        auto it = eytz_test.find(key);
+        auto std_it = std_map_test.find(key);
+        auto upper = eytz_test.upper_bound(key);
+        auto std_upper = std_map_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(it == eytz_test.end() ? std_it == std_map_test.end() : it->second == std_it->second);
+        CONTAINERS_ASSERT(upper == eytz_test.end() ? std_upper == std_map_test.end() : upper->first == std_upper->first);
+    }
+    eytz_test[-1] = "front";
+    CONTAINERS_ASSERT(eytz_test.begin()->second == "front");
+    CONTAINERS_ASSERT(eytz_test.find(-1) == eytz_test.begin());
+    eytz_test.erase(eytz_test.begin(), eytz_test.nth(eytz_test.size() / 2));
+    CONTAINERS_ASSERT(eytz_test.find(-1) == eytz_test.end());
+    CONTAINERS_ASSERT(eytz_test.find(eytz_test.nth(3)->first) == eytz_test.nth(3));
+}
+
+void run_btree_set_test() {
+    adt::btree_set<std::string> set_str_test;
+    adt::btree_set<int> set_test;
+    adt::btree_set<int, std::less<int>, std::allocator<int>, 32> small_test;
+    std::set<int> std_set_test;
+    std::vector<int> batch;
+    size_t sum, test_sum;
+
+    srand((unsigned int) time(nullptr));
+
+    /* insert(), find() test.  */
+    sum = 0;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = set_str_test.insert(std::to_string(i));
+        CONTAINERS_ASSERT(*(p.first) == std::to_string(i));
+        CONTAINERS_ASSERT(p.second);
+        CONTAINERS_ASSERT(!set_str_test.insert(std::to_string(i)).second);
+        sum += i;
+    }
+    CONTAINERS_ASSERT(set_str_test.size() == ELEMENTS);
+
+    /* iterators test, elements come out sorted both ways.  */
+    test_sum = 0;
+    for (auto it = set_str_test.begin() ; it != set_str_test.end() ; it++) {
+        if (it != set_str_test.begin()) CONTAINERS_ASSERT(*std::prev(it) < *it);
+        test_sum += stoi(*it);
+    }
+    CONTAINERS_ASSERT(test_sum == sum);
+    CONTAINERS_ASSERT(*set_str_test.rbegin() == "999");
+    CONTAINERS_ASSERT(std::equal(set_str_test.rbegin(), set_str_test.rend(), std::set<std::string>(set_str_test.begin(), set_str_test.end()).rbegin()));
+
+    /* erase elements until 150.  */
+    CONTAINERS_ASSERT(*(set_str_test.erase(set_str_test.begin(), set_str_test.find("150"))) == "150");
+    CONTAINERS_ASSERT(*set_str_test.begin() == "150");
+
+    /* clear() test.  */
+    set_str_test.clear();
+    CONTAINERS_ASSERT(set_str_test.empty());
+    CONTAINERS_ASSERT(set_str_test.begin() == set_str_test.end());
+    CONTAINERS_ASSERT(set_str_test.rbegin() == set_str_test.rend());
+
+    /* insert(), emplace(), erase() against std::set, the small nodes split and merge all the time.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        int val = rand() % (ELEMENTS * 4);
+        auto p = (i % 2) ? set_test.insert(val) : set_test.emplace(val);
+        CONTAINERS_ASSERT(*(p.first) == val);
+        CONTAINERS_ASSERT(p.second == std_set_test.insert(val).second);
+        CONTAINERS_ASSERT(small_test.insert(val).second == p.second);
+    }
+    for (size_t i = 0 ; i < ELEMENTS / 2 ; i++) {
+        int val = rand() % (ELEMENTS * 4);
+        size_t erased = std_set_test.erase(val);
+        CONTAINERS_ASSERT(set_test.erase(val) == erased);
+        CONTAINERS_ASSERT(small_test.erase(val) == erased);
+    }
+    CONTAINERS_ASSERT(set_test.size() == std_set_test.size());
+    CONTAINERS_ASSERT(std::equal(set_test.begin(), set_test.end(), std_set_test.begin()));
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_set_test.begin(), std_set_test.end()));
+
+    /* erase() returns the next element.  */
+    for (auto it = small_test.begin() ; it != small_test.end() ;) {
+        if (*it % 3 == 0) {
+            auto next = std::next(std_set_test.find(*it));
+            it = small_test.erase(it);
+            CONTAINERS_ASSERT(it == small_test.end() ? next == std_set_test.end() : *it == *next);
+        } else {
+            ++it;
+        }
+    }
+
+    /* insert(range), lower() and upper() bound check.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) batch.push_back(rand() % (ELEMENTS * 8));
+    set_test.insert(batch.begin(), batch.end());
+    std_set_test.insert(batch.begin(), batch.end());
+    CONTAINERS_ASSERT(std::equal(set_test.begin(), set_test.end(), std_set_test.begin(), std_set_test.end()));
+    for (int key = -1 ; key <= ELEMENTS * 8 ; key++) {
+        auto lower = set_test.lower_bound(key);
+        auto upper = set_test.upper_bound(key);
+        auto std_lower = std_set_test.lower_bound(key);
+        auto std_upper = std_set_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(lower == set_test.end() ? std_lower == std_set_test.end() : *lower == *std_lower);
+        CONTAINERS_ASSERT(upper == set_test.end() ? std_upper == std_set_test.end() : *upper == *std_upper);
+        CONTAINERS_ASSERT(set_test.count(key) == std_set_test.count(key));
+    }
+
+    /* hinted insertion test.  */
+    set_test.clear();
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        auto it = set_test.insert(set_test.end(), i);
+        CONTAINERS_ASSERT(*it == i);
+        CONTAINERS_ASSERT(set_test.emplace_hint(set_test.begin(), i) == it);
+    }
+    CONTAINERS_ASSERT(set_test.size() == ELEMENTS);
+    CONTAINERS_ASSERT(*set_test.rbegin() == ELEMENTS - 1);
+}
+
+void run_btree_multiset_test() {
+    adt::btree_multiset<int> set_test;
+    adt::btree_multiset<int, std::less<int>, std::allocator<int>, 32> small_test;
+    std::multiset<int> std_set_test;
+
+    srand((unsigned int) time(nullptr));
+
+    /* insert() test, equivalent elements keep their insertion order.  */
+    for (size_t i = 0 ; i < ELEMENTS + EXTRA_ELEMENTS ; i++) {
+        int val = rand() % (ELEMENTS / 4);
+        CONTAINERS_ASSERT(*set_test.insert(val) == val);
+        CONTAINERS_ASSERT(*small_test.emplace(val) == val);
+        std_set_test.insert(val);
+    }
+    CONTAINERS_ASSERT(set_test.size() == std_set_test.size());
+    CONTAINERS_ASSERT(std::equal(set_test.begin(), set_test.end(), std_set_test.begin()));
+    CONTAINERS_ASSERT(std::equal(small_test.rbegin(), small_test.rend(), std_set_test.rbegin()));
+
+    /* count(), equal_range(), find() check.  */
+    for (int key = -1 ; key <= ELEMENTS / 4 ; key++) {
+        auto range = small_test.equal_range(key);
+
+        CONTAINERS_ASSERT(set_test.count(key) == std_set_test.count(key));
+        CONTAINERS_ASSERT((size_t) std::distance(range.first, range.second) == std_set_test.count(key));
+        CONTAINERS_ASSERT(small_test.find(key) == (range.first == range.second ? small_test.end() : range.first));
+    }
+
+    /* erase() test, erasing a key removes all its copies.  */
+    for (int key = 0 ; key < ELEMENTS / 4 ; key += 3) {
+        size_t erased = std_set_test.erase(key);
+        CONTAINERS_ASSERT(set_test.erase(key) == erased);
+        CONTAINERS_ASSERT(small_test.erase(key) == erased);
+    }
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_set_test.begin(), std_set_test.end()));
+    small_test.erase(small_test.begin(), small_test.lower_bound(ELEMENTS / 8));
+    std_set_test.erase(std_set_test.begin(), std_set_test.lower_bound(ELEMENTS / 8));
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_set_test.begin(), std_set_test.end()));
+}
+
+void run_btree_map_test() {
+    adt::btree_map<int, std::string> map_test;
+    adt::btree_map<int, std::string, std::less<int>, std::allocator<std::pair<int, std::string>>, 64> small_test;
+    std::map<int, std::string> std_map_test;
+    auto same_pair = [](const std::pair<int, std::string> &lhs, const std::pair<const int, std::string> &rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+    };
+
+    srand((unsigned int) time(nullptr));
+
+    /* operator[](), insert(), emplace(), try_emplace() test.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        int key = rand() % (ELEMENTS * 4);
+        std::string val = std::to_string(key);
+
+        switch (i % 4) {
+            case 0:
+                map_test[key] = val;
+                std_map_test[key] = val;
+                break;
+            case 1:
+                CONTAINERS_ASSERT(map_test.insert(std::make_pair(key, val)).second == std_map_test.insert(std::make_pair(key, val)).second);
+                break;
+            case 2:
+                CONTAINERS_ASSERT(map_test.emplace(key, val).second == std_map_test.emplace(key, val).second);
+                break;
+            default:
+                CONTAINERS_ASSERT(map_test.try_emplace(key, val).second == std_map_test.try_emplace(key, val).second);
+                break;
+        }
+        CONTAINERS_ASSERT(map_test.at(key) == val);
+        small_test.insert_or_assign(key, val);
+    }
+    CONTAINERS_ASSERT(map_test.size() == std_map_test.size());
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), same_pair));
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_map_test.begin(), same_pair));
+
+    /* insert_or_assign() and mutation through iterators.  */
+    CONTAINERS_ASSERT(!map_test.insert_or_assign(map_test.begin()->first, "first").second);
+    CONTAINERS_ASSERT(map_test.begin()->second == "first");
+    for (auto it = map_test.begin() ; it != map_test.end() ; ++it) it->second += "!";
+    for (auto it = map_test.cbegin() ; it != map_test.cend() ; ++it) CONTAINERS_ASSERT(it->second.back() == '!');
+
+    /* at() throws for missing keys.  */
+    try {
+        map_test.at(-1);
+        CONTAINERS_ASSERT(false);
+    } catch (std::out_of_range &e) {}
+
+    /* erase() test.  */
+    for (auto it = small_test.begin() ; it != small_test.end() ;) {
+        if (it->first % 2) {
+            std_map_test.erase(it->first);
+            it = small_test.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    CONTAINERS_ASSERT(small_test.size() == std_map_test.size());
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_map_test.begin(), same_pair));
+
+    /* lower() and upper() bound check.  */
+    for (int key = -1 ; key <= ELEMENTS * 4 ; key++) {
+        auto lower = small_test.lower_bound(key);
+        auto upper = small_test.upper_bound(key);
+        auto std_lower = std_map_test.lower_bound(key);
+        auto std_upper = std_map_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(lower == small_test.end() ? std_lower == std_map_test.end() : lower->first == std_lower->first);
+        CONTAINERS_ASSERT(upper == small_test.end() ? std_upper == std_map_test.end() : upper->first == std_upper->first);
+    }
+
+    /* copies are independent.  */
+    adt::btree_map<int, std::string> copy_test(map_test);
+    copy_test.clear();
+    CONTAINERS_ASSERT(copy_test.empty() && !map_test.empty());
+}
+
+void run_btree_multimap_test() {
+    adt::btree_multimap<int, std::string> map_test;
+    adt::btree_multimap<int, std::string, std::less<int>, std::allocator<std::pair<int, std::string>>, 64> small_test;
+    std::multimap<int, std::string> std_map_test;
+    auto same_pair = [](const std::pair<int, std::string> &lhs, const std::pair<const int, std::string> &rhs) {
+        return lhs.first == rhs.first && lhs.second == rhs.second;
+    };
+
+    srand((unsigned int) time(nullptr));
+
+    /* insert(), emplace() test, values of a key keep their insertion order.  */
+    for (int i = 0 ; i < ELEMENTS + EXTRA_ELEMENTS ; i++) {
+        int key = rand() % (ELEMENTS / 4);
+        std::string val = std::to_string(i);
+
+        CONTAINERS_ASSERT(map_test.insert(std::make_pair(key, val))->second == val);
+        CONTAINERS_ASSERT(small_test.emplace(key, val)->second == val);
+        std_map_test.emplace(key, val);
+    }
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), same_pair));
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_map_test.begin(), same_pair));
+
+    /* count() and equal_range() check.  */
+    for (int key = -1 ; key <= ELEMENTS / 4 ; key++) {
+        auto range = small_test.equal_range(key);
+        auto std_range = std_map_test.equal_range(key);
+
+        CONTAINERS_ASSERT(map_test.count(key) == std_map_test.count(key));
+        CONTAINERS_ASSERT(std::equal(range.first, range.second, std_range.first, std_range.second, same_pair));
+    }
+
+    /* erase() test.  */
+    for (int key = 0 ; key < ELEMENTS / 4 ; key += 2) {
+        size_t erased = std_map_test.erase(key);
+        CONTAINERS_ASSERT(map_test.erase(key) == erased);
+        CONTAINERS_ASSERT(small_test.erase(key) == erased);
+    }
+    CONTAINERS_ASSERT(std::equal(small_test.begin(), small_test.end(), std_map_test.begin(), std_map_test.end(), same_pair));
+    CONTAINERS_ASSERT(std::equal(map_test.rbegin(), map_test.rend(), std_map_test.rbegin(), same_pair));
+}
+
+void run_persistent_map_test() {
+    adt::persistent_map<int, std::string> map_test;
+    std::map<int, std::string> std_map_test;
+    std::vector<std::pair<adt::persistent_map<int, std::string>, std::map<int, std::string>>> snapshots;
+
+    srand((unsigned int) time(nullptr));
+
+    /* insert(), emplace(), try_emplace(), insert_or_assign() and erase() test, snapshots taken along the way
+       must keep the contents they had when they were taken.  */
+    for (int i = 0 ; i < 4 * ELEMENTS ; i++) {
+        int key = rand() % ELEMENTS;
+        std::string val = std::to_string(i);
+
+        switch (i % 5) {
+            case 0:
+                CONTAINERS_ASSERT(map_test.insert(std::make_pair(key, val)).second == std_map_test.insert(std::make_pair(key, val)).second);
+                break;
+            case 1:
+                CONTAINERS_ASSERT(map_test.emplace(key, val).first->first == key);
+                std_map_test.emplace(key, val);
+                break;
+            case 2:
+                CONTAINERS_ASSERT(map_test.try_emplace(key, val).second == std_map_test.try_emplace(key, val).second);
+                break;
+            case 3:
+                CONTAINERS_ASSERT(map_test.insert_or_assign(key, val).first->second == val);
+                std_map_test[key] = val;
+                break;
+            default:
+                CONTAINERS_ASSERT(map_test.erase(key) == std_map_test.erase(key));
+                break;
+        }
+        if (i % (ELEMENTS / 4) == 0) snapshots.emplace_back(map_test.snapshot(), std_map_test);
+    }
+    CONTAINERS_ASSERT(map_test.size() == std_map_test.size());
+    CONTAINERS_ASSERT(std::equal(map_test.begin(), map_test.end(), std_map_test.begin(), std_map_test.end()));
+    CONTAINERS_ASSERT(std::equal(map_test.rbegin(), map_test.rend(), std_map_test.rbegin(), std_map_test.rend()));
+    for (auto &snapshot : snapshots) {
+        CONTAINERS_ASSERT(snapshot.first.size() == snapshot.second.size());
+        CONTAINERS_ASSERT(std::equal(snapshot.first.begin(), snapshot.first.end(), snapshot.second.begin(), snapshot.second.end()));
+    }
+
+    /* at(), find(), lower() and upper() bound check.  */
+    for (int key = -1 ; key <= ELEMENTS ; key++) {
+        auto lower = map_test.lower_bound(key);
+        auto upper = map_test.upper_bound(key);
+        auto std_lower = std_map_test.lower_bound(key);
+        auto std_upper = std_map_test.upper_bound(key);
+
+        CONTAINERS_ASSERT(lower == map_test.end() ? std_lower == std_map_test.end() : lower->first == std_lower->first);
+        CONTAINERS_ASSERT(upper == map_test.end() ? std_upper == std_map_test.end() : upper->first == std_upper->first);
+        CONTAINERS_ASSERT(map_test.count(key) == std_map_test.count(key));
+        if (std_map_test.count(key)) CONTAINERS_ASSERT(map_test.at(key) == std_map_test.at(key) && map_test.find(key)->second == map_test.at(key));
+    }
+    try {
+        map_test.at(-1);
+        CONTAINERS_ASSERT(false);
+    } catch (std::out_of_range &e) {}
+
+    /* Erasing through iterators empties the map, the snapshots are left alone.  */
+    for (auto it = map_test.begin() ; it != map_test.end() ;) it = map_test.erase(it);
+    CONTAINERS_ASSERT(map_test.empty() && map_test.begin() == map_test.end());
+    CONTAINERS_ASSERT(std::equal(snapshots.back().first.begin(), snapshots.back().first.end(), snapshots.back().second.begin(), snapshots.back().second.end()));
+
+    /* A copy is a snapshot too, and changing it leaves the original alone.  */
+    adt::persistent_map<int, std::string> copy_test(snapshots.back().first);
+    copy_test.clear();
+    CONTAINERS_ASSERT(copy_test.empty() && snapshots.back().first.size() == snapshots.back().second.size());
+}
+
+void run_concurrent_map_test() {
+    adt::concurrent_map<int, std::string> map_test;
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+
+    /* insert(), try_emplace(), insert_or_assign(), erase() and at() test.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(map_test.insert(std::make_pair(i, std::to_string(i))));
+        CONTAINERS_ASSERT(!map_test.try_emplace(i, "duplicate"));
+    }
+    CONTAINERS_ASSERT(!map_test.insert_or_assign(0, "zero") && map_test.at(0) == "zero");
+    CONTAINERS_ASSERT(map_test.erase(0) == 1 && map_test.erase(0) == 0 && map_test.count(0) == 0);
+    CONTAINERS_ASSERT(map_test.size() == ELEMENTS - 1);
+
+    /* Snapshots outlive the changes after them.  */
+    auto snapshot = map_test.snapshot();
+    map_test.clear();
+    CONTAINERS_ASSERT(map_test.empty() && snapshot.size() == ELEMENTS - 1 && snapshot.at(1) == "1");
+
+    /* Readers must always find 100 consecutive keys, the writer moves the window with update().  */
+    map_test.update([](adt::persistent_map<int, std::string> &latest) {
+        for (int i = 0 ; i < 100 ; i++) latest.insert(std::make_pair(i, std::to_string(i)));
+    });
+    for (int t = 0 ; t < 4 ; t++) {
+        readers.emplace_back([&map_test, &done, &errors]() {
+            do {
+                auto view = map_test.read();
+                int expected = view->begin()->first;
+
+                for (auto &kv : *view) {
+                    if (kv.first != expected++ || kv.second != std::to_string(kv.first)) errors++;
+                }
+                if (view->size() != 100 || expected != view->begin()->first + 100) errors++;
+            } while (!done);
+        });
+    }
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        map_test.update([i](adt::persistent_map<int, std::string> &latest) {
+            latest.erase(i);
+            latest.insert(std::make_pair(i + 100, std::to_string(i + 100)));
+        });
+    }
+    done = true;
+    for (auto &reader : readers) reader.join();
+    CONTAINERS_ASSERT(errors == 0);
+    CONTAINERS_ASSERT(map_test.size() == 100 && map_test.read()->begin()->first == ELEMENTS);
+
+    /* Readers of a thread share its record: nested and moved guards, and more readers inside than any fixed slot count.  */
+    {
+        auto outer = map_test.read();
+        auto inner = map_test.read();
+        auto moved = std::move(outer);
+
+        map_test.clear();
+        CONTAINERS_ASSERT(moved->size() == 100 && inner->size() == 100 && map_test.read()->empty());
+    }
+    std::atomic<int> inside(0);
+    done = false;
+    readers.clear();
+    for (int t = 0 ; t < 200 ; t++) {
+        readers.emplace_back([&map_test, &done, &inside]() {
+            auto view = map_test.read();
+
+            inside++;
+            while (!done) std::this_thread::yield();
+        });
+    }
+    while (inside != 200) std::this_thread::yield();
+    map_test.insert(std::make_pair(1, "1"));
+    done = true;
+    for (auto &reader : readers) reader.join();
+    CONTAINERS_ASSERT(map_test.size() == 1);
 }
 
 void run_unordered_set_test() {
@@ -1124,6 +2203,35 @@ void run_unordered_set_test() {
     }
 
     CONTAINERS_ASSERT(uset_test.count(-15) == 0);
+
+    /* flat storage test.  */
+    adt::flat_unordered_set<std::string> flat_uset_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = flat_uset_test.insert(std::to_string(i));
+        CONTAINERS_ASSERT(*(p.first) == std::to_string(i));
+        CONTAINERS_ASSERT(p.second);
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        CONTAINERS_ASSERT(flat_uset_test.erase(std::to_string(i)) == 1);
+    }
+    CONTAINERS_ASSERT(flat_uset_test.size() == ELEMENTS / 2);
+
+    index = 0;
+    for (auto it = flat_uset_test.begin() ; it != flat_uset_test.end() ; it++, index++) {
+        CONTAINERS_ASSERT(std::stoul(*it) % 2 == 1);
+    }
+    CONTAINERS_ASSERT(index == ELEMENTS / 2);
+
+    /* insert()/erase() churn test, tombstones get purged without losing elements.  */
+    uset_test.clear();
+    for (size_t i = 0 ; i < 50 * ELEMENTS ; i++) {
+        uset_test.insert((int) i);
+        if (i >= ELEMENTS) CONTAINERS_ASSERT(uset_test.erase((int) (i - ELEMENTS)) == 1);
+    }
+    CONTAINERS_ASSERT(uset_test.size() == ELEMENTS);
+    for (size_t i = 49 * ELEMENTS ; i < 50 * ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(uset_test.count((int) i) == 1);
+    }
 }
 
 void run_unordered_multiset_test() {
@@ -1377,6 +2485,172 @@ void run_unordered_map_test() {
     }
 
     CONTAINERS_ASSERT(umap_test.count(-15) == 0);
+
+    /* Heterogeneous lookup test.  */
+    adt::unordered_map<std::string, int, StringHash, StringEqual> strmap_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        strmap_test[std::to_string(i)] = (int) i;
+    }
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto it = strmap_test.find(std::to_string(i).c_str());
+        CONTAINERS_ASSERT(it != strmap_test.end() && it->second == (int) i);
+    }
+    CONTAINERS_ASSERT(strmap_test.count("-15") == 0);
+    CONTAINERS_ASSERT(strmap_test.equal_range("15").first->second == 15);
+
+    /* find_many(), contains_many() test.  */
+    adt::vector<int> keys;
+    adt::vector<bool> contained(ELEMENTS);
+    adt::vector<adt::unordered_map<int, std::string>::iterator> found(ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        keys.push_back((int) (2 * i));
+    }
+    umap_test.find_many(keys.data(), keys.size(), found.data());
+    umap_test.contains_many(keys.data(), keys.size(), contained.data());
+    for (size_t i = 0 ; i < keys.size() ; i++) {
+        CONTAINERS_ASSERT(contained[i] == (keys[i] < ELEMENTS));
+        CONTAINERS_ASSERT(found[i] == umap_test.find(keys[i]));
+    }
+
+    /* flat storage test.  */
+    adt::flat_unordered_map<int, std::string> flat_umap_test;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = flat_umap_test.emplace((int) i, std::to_string(i));
+        CONTAINERS_ASSERT(p.second);
+        CONTAINERS_ASSERT(p.first->second == std::to_string(i));
+    }
+    CONTAINERS_ASSERT(!flat_umap_test.emplace(0, "duplicate").second);
+
+    adt::flat_unordered_map<int, std::string> flat_umap_copy(flat_umap_test);
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        CONTAINERS_ASSERT(flat_umap_test.erase((int) i) == 1);
+    }
+    CONTAINERS_ASSERT(flat_umap_test.size() == ELEMENTS / 2);
+    CONTAINERS_ASSERT(flat_umap_copy.size() == ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(flat_umap_test.count((int) i) == i % 2);
+        CONTAINERS_ASSERT(flat_umap_copy.at((int) i) == std::to_string(i));
+    }
+
+    /* reserve(), rehash(), shrink_to_fit(), max_load_factor() test.  */
+    umap_test.clear();
+    umap_test.reserve(ELEMENTS);
+    auto reserved = umap_test.bucket_count();
+    CONTAINERS_ASSERT(reserved >= ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        umap_test.emplace((int) i, std::to_string(i));
+    }
+    CONTAINERS_ASSERT(umap_test.bucket_count() == reserved);
+    CONTAINERS_ASSERT(umap_test.load_factor() < umap_test.max_load_factor());
+
+    umap_test.max_load_factor(0.25f);
+    CONTAINERS_ASSERT(umap_test.load_factor() < 0.25f);
+    CONTAINERS_ASSERT(umap_test.bucket_count() > reserved);
+
+    for (size_t i = 0 ; i < ELEMENTS - 10 ; i++) {
+        umap_test.erase((int) i);
+    }
+    umap_test.shrink_to_fit();
+    CONTAINERS_ASSERT(umap_test.bucket_count() < reserved);
+    umap_test.rehash(4 * ELEMENTS);
+    CONTAINERS_ASSERT(umap_test.bucket_count() >= 4 * ELEMENTS);
+    CONTAINERS_ASSERT(umap_test.size() == 10);
+    for (size_t i = ELEMENTS - 10 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(umap_test.at((int) i) == std::to_string(i));
+    }
+
+    /* try_emplace(), insert_or_assign() test.  */
+    adt::unordered_map<int, Counted> counted_umap;
+    adt::flat_unordered_map<int, Counted> counted_flat_umap;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(counted_umap.try_emplace((int) i, (int) i).second);
+        CONTAINERS_ASSERT(counted_flat_umap.try_emplace((int) i, (int) i).second);
+    }
+    Counted::constructions = 0;
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = counted_umap.try_emplace((int) i, -1);
+        CONTAINERS_ASSERT(!p.second);
+        CONTAINERS_ASSERT(p.first->second.value == (int) i);
+        CONTAINERS_ASSERT(!counted_flat_umap.try_emplace((int) i, -1).second);
+    }
+    CONTAINERS_ASSERT(Counted::constructions == 0);
+
+    CONTAINERS_ASSERT(!counted_umap.insert_or_assign(0, Counted(-1)).second);
+    CONTAINERS_ASSERT(counted_umap.at(0).value == -1);
+    CONTAINERS_ASSERT(counted_flat_umap.insert_or_assign(-1, Counted(1)).second);
+    CONTAINERS_ASSERT(counted_flat_umap.at(-1).value == 1);
+    CONTAINERS_ASSERT(counted_flat_umap.size() == ELEMENTS + 1);
+
+    /* rehash_step() test, checked after every insert so some checks run in the middle of a migration.  */
+    adt::flat_unordered_map<int, std::string> step_umap;
+    step_umap.rehash_step(1);
+    CONTAINERS_ASSERT(step_umap.rehash_step() >= 1);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(step_umap.emplace((int) i, std::to_string(i)).second);
+        CONTAINERS_ASSERT(!step_umap.emplace((int) i / 2, "duplicate").second);
+
+        if (i % 64 == 0) {
+            n_elems_test = 0;
+            for (auto it = step_umap.begin() ; it != step_umap.end() ; ++it) n_elems_test++;
+            CONTAINERS_ASSERT(n_elems_test == i + 1);
+            CONTAINERS_ASSERT(step_umap.at((int) (i / 3)) == std::to_string(i / 3));
+        }
+    }
+
+    adt::flat_unordered_map<int, std::string> step_copy(step_umap);
+    for (size_t i = 0 ; i < ELEMENTS ; i += 2) {
+        CONTAINERS_ASSERT(step_umap.erase((int) i) == 1);
+    }
+    CONTAINERS_ASSERT(step_umap.size() == ELEMENTS / 2);
+    CONTAINERS_ASSERT(step_copy.size() == ELEMENTS);
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(step_umap.count((int) i) == i % 2);
+        CONTAINERS_ASSERT(step_copy.at((int) i) == std::to_string(i));
+    }
+
+    adt::vector<adt::flat_unordered_map<int, std::string>::iterator> step_found(ELEMENTS);
+    step_copy.find_many(keys.data(), keys.size(), step_found.data());
+    step_copy.contains_many(keys.data(), keys.size(), contained.data());
+    for (size_t i = 0 ; i < keys.size() ; i++) {
+        CONTAINERS_ASSERT(contained[i] == (keys[i] < ELEMENTS));
+        CONTAINERS_ASSERT(step_found[i] == step_copy.find(keys[i]));
+    }
+
+    for (auto it = step_copy.begin() ; it != step_copy.end() ; ) {
+        it = it->first % 3 == 0 ? step_copy.erase(it) : ++it;
+    }
+    n_elems_test = 0;
+    for (auto it = step_copy.begin() ; it != step_copy.end() ; ++it) n_elems_test++;
+    CONTAINERS_ASSERT(n_elems_test == step_copy.size() && step_copy.size() == ELEMENTS - (ELEMENTS + 2) / 3);
+
+    step_copy.rehash_step(0);
+    CONTAINERS_ASSERT(step_copy.rehash_step() == 0 && step_copy.count(1) == 1 && step_copy.count(3) == 0);
+    step_umap.clear();
+    CONTAINERS_ASSERT(step_umap.empty() && step_umap.begin() == step_umap.end());
+
+    /* Lookups leave a running migration alone, inserts that find their key move it on as well.  */
+    index = 0;
+    for (size_t cap = step_umap.bucket_count() ; step_umap.bucket_count() == cap ; index++) {
+        step_umap.insert_or_assign((int) index, std::to_string(index));
+    }
+    auto step_first = step_umap.begin();
+    int step_key = step_first->first;
+    for (size_t i = 0 ; i < index ; i++) {
+        CONTAINERS_ASSERT(step_umap.find((int) i) != step_umap.end() && step_umap.count((int) i) == 1);
+    }
+    CONTAINERS_ASSERT(step_umap.find(step_key) == step_first && step_umap.begin() == step_first);
+    for (size_t i = 0 ; i < step_umap.bucket_count() ; i++) {
+        CONTAINERS_ASSERT(!step_umap.insert_or_assign(step_key == 0 ? 1 : 0, "hit").second);
+    }
+    CONTAINERS_ASSERT(step_umap.find(step_key) != step_first && step_umap.at(step_key) == std::to_string(step_key));
+    CONTAINERS_ASSERT(step_umap.size() == index);
+
+    /* Erasing begin() until empty, in the middle of a migration.  */
+    for (size_t cap = step_umap.bucket_count() ; step_umap.bucket_count() == cap ; index++) {
+        step_umap.insert_or_assign((int) index, std::to_string(index));
+    }
+    for (n_elems_test = 0 ; !step_umap.empty() ; n_elems_test++) step_umap.erase(step_umap.begin());
+    CONTAINERS_ASSERT(n_elems_test == index && step_umap.begin() == step_umap.end());
 }
 
 void run_unordered_multimap_test() {
@@ -1503,6 +2777,120 @@ void run_unordered_multimap_test() {
     }
 
     CONTAINERS_ASSERT(umultimap_test.count(-15) == 0);
+
+    /* try_emplace() test.  */
+    for (size_t i = 0 ; i < ELEMENTS ; i++) {
+        auto p = umultimap_test.try_emplace((int) i, "new");
+        CONTAINERS_ASSERT(!p.second);
+        CONTAINERS_ASSERT(p.first->first == (int) i);
+        CONTAINERS_ASSERT(umultimap_test.count((int) i) == EXTRA_ELEMENTS);
+    }
+    auto p = umultimap_test.try_emplace(-15, "new");
+    CONTAINERS_ASSERT(p.second);
+    CONTAINERS_ASSERT(p.first->second == "new");
+    CONTAINERS_ASSERT(umultimap_test.count(-15) == 1);
+}
+
+void run_concurrent_unordered_map_test() {
+    adt::concurrent_unordered_map<int, int> map_test(8);
+    std::vector<std::thread> writers;
+    std::atomic<int> sum(0);
+    int value = -1;
+
+    /* insert(), insert_or_visit(), visit() and erase() test.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(map_test.insert(std::make_pair(i, i)));
+        CONTAINERS_ASSERT(!map_test.insert_or_visit(std::make_pair(i, 0), [](std::pair<const int, int> &kv) { kv.second++; }));
+    }
+    CONTAINERS_ASSERT(map_test.shard_count() == 8 && map_test.size() == ELEMENTS);
+    CONTAINERS_ASSERT(map_test.visit(5, [&value](const std::pair<const int, int> &kv) { value = kv.second; }) && value == 6);
+    CONTAINERS_ASSERT(!map_test.visit(ELEMENTS, [&value](const std::pair<const int, int> &kv) { value = kv.second; }));
+    CONTAINERS_ASSERT(!map_test.try_emplace(5, 0) && !map_test.insert_or_assign(5, 0) && map_test.erase(5) == 1);
+    CONTAINERS_ASSERT(map_test.erase(5) == 0 && !map_test.contains(5) && map_test.emplace(5, 6));
+
+    /* erase_if() test, every odd key goes.  */
+    CONTAINERS_ASSERT(map_test.erase_if([](const std::pair<const int, int> &kv) { return kv.first % 2; }) == ELEMENTS / 2);
+    map_test.for_each([](const std::pair<const int, int> &kv) { CONTAINERS_ASSERT(kv.first % 2 == 0 && kv.second == kv.first + 1); });
+
+    /* Writers count the same keys concurrently, no increment may be lost.  */
+    map_test.clear();
+    for (int t = 0 ; t < 4 ; t++) {
+        writers.emplace_back([&map_test]() {
+            for (int i = 0 ; i < ELEMENTS ; i++) {
+                map_test.insert_or_visit(std::make_pair(i % 100, 1), [](std::pair<const int, int> &kv) { kv.second++; });
+            }
+        });
+    }
+    for (auto &writer : writers) writer.join();
+    CONTAINERS_ASSERT(map_test.size() == 100);
+
+    /* parallel_for_each() test.  */
+    map_test.parallel_for_each([&sum](std::pair<const int, int> &kv) { sum += kv.second; }, 4);
+    CONTAINERS_ASSERT(sum == 4 * ELEMENTS);
+    CONTAINERS_ASSERT(map_test.erase_if([](const std::pair<const int, int> &) { return true; }) == 100 && map_test.empty());
+}
+
+void run_seqlock_unordered_map_test() {
+    adt::seqlock_unordered_map<int, long> map_test;
+    std::atomic<bool> done(false);
+    std::atomic<int> errors(0);
+    std::vector<std::thread> readers;
+    long value = 0;
+
+    /* insert(), insert_or_assign(), find() and erase() test, the table grows several times.  */
+    for (int i = 0 ; i < ELEMENTS ; i++) {
+        CONTAINERS_ASSERT(map_test.insert(std::make_pair(i, 2L * i)));
+        CONTAINERS_ASSERT(!map_test.insert(std::make_pair(i, 0L)));
+    }
+    CONTAINERS_ASSERT(map_test.size() == ELEMENTS && map_test.find(7, value) && value == 14);
+    CONTAINERS_ASSERT(!map_test.insert_or_assign(7, 70L) && map_test.at(7) == 70 && map_test.insert_or_assign(ELEMENTS, 0L));
+    for (int i = 0 ; i <= ELEMENTS ; i += 2) CONTAINERS_ASSERT(map_test.erase(i) == 1 && map_test.erase(i) == 0);
+    for (int i = 0 ; i < ELEMENTS ; i++) CONTAINERS_ASSERT(map_test.contains(i) == (i % 2 == 1));
+    CONTAINERS_ASSERT(map_test.size() == ELEMENTS / 2);
+    map_test.clear();
+    CONTAINERS_ASSERT(map_test.empty() && !map_test.contains(1));
+
+    /* Readers must always find the first 100 keys with a consistent value while the writer grows the table.  */
+    for (int i = 0 ; i < 100 ; i++) map_test.insert(std::make_pair(i, 2L * i));
+    for (int t = 0 ; t < 4 ; t++) {
+        readers.emplace_back([&map_test, &done, &errors]() {
+            long value;
+
+            do {
+                for (int i = 0 ; i < 100 ; i++) {
+                    if (!map_test.find(i, value) || (value != 2L * i && value != -2L * i)) errors++;
+                }
+            } while (!done);
+        });
+    }
+    for (int i = 100 ; i < 100 + 10 * ELEMENTS ; i++) {
+        map_test.insert(std::make_pair(i, 2L * i));
+        map_test.insert_or_assign(i % 100, (i % 2 ? -2L : 2L) * (i % 100));
+    }
+    done = true;
+    for (auto &reader : readers) reader.join();
+    CONTAINERS_ASSERT(errors == 0 && map_test.size() == 100 + 10 * ELEMENTS);
+
+    /* Writers on every stripe fill a small table together, erasing absent keys on the way.  */
+    for (int round = 0 ; round < 50 ; round++) {
+        adt::seqlock_unordered_map<int, long> small_map(16);
+        std::vector<std::thread> writers;
+
+        for (int t = 0 ; t < 8 ; t++) {
+            writers.emplace_back([&small_map, &errors, t]() {
+                for (int i = 0 ; i < 300 ; i++) {
+                    if (!small_map.insert(std::make_pair(t * 1000 + i, (long) i)) || small_map.erase(-1 - i) != 0) errors++;
+                    if (i % 3 == 0 && small_map.erase(t * 1000 + i) != 1) errors++;
+                }
+            });
+        }
+        for (auto &writer : writers) writer.join();
+
+        CONTAINERS_ASSERT(errors == 0 && small_map.size() == 8 * 200);
+        for (int t = 0 ; t < 8 ; t++) {
+            for (int i = 0 ; i < 300 ; i++) CONTAINERS_ASSERT(small_map.contains(t * 1000 + i) == (i % 3 != 0));
+        }
+    }
 }
 
 void run_pqueue_test() {
@@ -1537,10 +2925,20 @@ int main() {
     run_multiset_test();
     run_map_test();
     run_multimap_test();
+    run_flat_set_test();
+    run_flat_map_test();
+    run_btree_set_test();
+    run_btree_multiset_test();
+    run_btree_map_test();
+    run_btree_multimap_test();
+    run_persistent_map_test();
+    run_concurrent_map_test();
     run_unordered_set_test();
     run_unordered_multiset_test();
     run_unordered_map_test();
     run_unordered_multimap_test();
+    run_concurrent_unordered_map_test();
+    run_seqlock_unordered_map_test();
     run_pqueue_test();
 
     return 0;    